@@ -10,10 +10,17 @@
 #include <MazeLib/RobotBase.h>
 #include <esp_timer.h>
 
+#include <algorithm>  //< for std::reverse
+#include <bitset>
+
 #include "agents/move_action.h"
 #include "config/model.h"
 #include "hardware/hardware.h"
+#include "peripheral/partition.h"
 #include "supporters/supporters.h"
+#include "utils/flash_writer.hpp"
+#include "utils/path_candidates.hpp"
+#include "utils/run_strategy.hpp"
 
 using namespace MazeLib;
 
@@ -68,8 +75,15 @@ class MazeRobot : public RobotBase {
  private:
   static constexpr int MAZE_ROBOT_TASK_PRIORITY = 2;
   static constexpr int MAZE_ROBOT_STACK_SIZE = 8192;
+  /* SPIFFS の旧形式 (records パーティションになければ移行する) */
   static constexpr auto MAZE_SAVE_PATH = "/spiffs/maze_backup.bin";
   static constexpr auto STATE_SAVE_PATH = "/spiffs/maze_state.bin";
+  /* 書き込み要求の種類 (同じ種類の待機中の要求は新しい方で置き換える) */
+  enum FlashKey : uint8_t {
+    FlashKeyWalls,
+    FlashKeyState,
+    FlashKeyStrategy,
+  };
 
  private:
   struct State {
@@ -96,46 +110,115 @@ class MazeRobot : public RobotBase {
           break;
       }
     }
-    bool save(const char* filepath = STATE_SAVE_PATH) {
-      backup_time_s = get_elapsed_time_s();
-      std::ofstream of(filepath, std::ios::binary);
-      if (of.fail()) {
-        APP_LOGE("failed to open file: %s", filepath);
-        return false;
+    /**
+     * @brief 保存形式
+     *
+     * 項目を変えたら版数を上げ，restore() に旧版からの変換を加える．
+     * パディングを含まないように並べる (CRC と比較の対象になるため)．
+     */
+    struct Record {
+      static constexpr uint8_t kVersion = 1;
+      int32_t competition_limit_time_s;
+      int32_t expected_fast_run_time_s;
+      int32_t backup_time_s;
+      int32_t try_count;
+      int32_t succeeded_parameter;
+      uint8_t has_reached_goal;
+      uint8_t is_fast_run;
+      uint8_t reserved[2];
+    };
+    static_assert(sizeof(Record) == 24, "Record must not have padding");
+    /**
+     * @brief 旧形式 (版数なしで構造体をそのまま書いていた頃) の配置
+     */
+    struct LegacyRecord {
+      int32_t running_parameter;
+      int32_t competition_limit_time_s;
+      int32_t expected_fast_run_time_s;
+      int32_t backup_time_s;
+      int32_t offset_time_s;
+      int32_t try_count;
+      int32_t succeeded_parameter;
+      uint8_t has_reached_goal;
+      uint8_t is_fast_run;
+    };
+    static_assert(sizeof(LegacyRecord) == 32, "unexpected legacy layout");
+    Record to_record() const {
+      Record r{};
+      r.competition_limit_time_s = competition_limit_time_s;
+      r.expected_fast_run_time_s = expected_fast_run_time_s;
+      r.backup_time_s = backup_time_s;
+      r.try_count = try_count;
+      r.succeeded_parameter = succeeded_parameter;
+      r.has_reached_goal = has_reached_goal;
+      r.is_fast_run = is_fast_run;
+      return r;
+    }
+    /**
+     * @brief 保存形式から復元する
+     *
+     * @param version 保存形式の版数
+     */
+    bool restore(const uint8_t version, const uint8_t* data,
+                 const size_t size) {
+      switch (version) {
+        case Record::kVersion: {
+          Record r;
+          if (size != sizeof(r)) return false;
+          std::memcpy(&r, data, sizeof(r));
+          competition_limit_time_s = r.competition_limit_time_s;
+          expected_fast_run_time_s = r.expected_fast_run_time_s;
+          backup_time_s = r.backup_time_s;
+          try_count = r.try_count;
+          succeeded_parameter = r.succeeded_parameter;
+          has_reached_goal = r.has_reached_goal;
+          is_fast_run = r.is_fast_run;
+          break;
+        }
+        default:
+          return false;
       }
-      of.write((const char*)this, sizeof(*this));
+      on_restored();
       return true;
     }
-    bool restore(const char* filepath = STATE_SAVE_PATH) {
-      std::ifstream f(filepath, std::ios::binary);
-      if (f.fail()) {
-        APP_LOGE("failed to open file: %s", filepath);
-        return false;
-      }
-      f.read((char*)this, sizeof(*this));
-      offset_time_s = backup_time_s;
-      running_parameter = 0;
+    bool restore_legacy(const uint8_t* data, const size_t size) {
+      LegacyRecord r;
+      if (size != sizeof(r)) return false;
+      std::memcpy(&r, data, sizeof(r));
+      competition_limit_time_s = r.competition_limit_time_s;
+      expected_fast_run_time_s = r.expected_fast_run_time_s;
+      backup_time_s = r.backup_time_s;
+      try_count = r.try_count;
+      succeeded_parameter = r.succeeded_parameter;
+      has_reached_goal = r.has_reached_goal;
+      is_fast_run = r.is_fast_run;
+      on_restored();
       return true;
     }
+    void stamp() { backup_time_s = get_elapsed_time_s(); }
+    int get_backup_time_s() const { return backup_time_s; }
+    /* 時刻以外に違いがあるか */
+    bool differs_from(const State& other) const {
+      Record a = to_record(), b = other.to_record();
+      b.backup_time_s = a.backup_time_s;
+      return std::memcmp(&a, &b, sizeof(a)) != 0;
+    }
     /* updaters */
     void start_search_run() {
       try_count++;
       has_reached_goal = false;
       is_fast_run = false;
-      save();
     }
     void start_fast_run() {
       try_count++;
       has_reached_goal = false;
       is_fast_run = true;
-      save();
     }
     void end_fast_run(bool result) {
       if (result) {
         is_fast_run = false;
         succeeded_parameter = running_parameter;
       }
-      save();
     }
     void set_reached_goal() { has_reached_goal = true; }
     /* checkers */
@@ -151,6 +234,15 @@ class MazeRobot : public RobotBase {
     }
     int get_try_count_remain() const { return max_try_count - try_count; }
     int get_try_count() const { return try_count; }
+    int get_remaining_time_s() const {
+      return competition_limit_time_s - get_elapsed_time_s();
+    }
+    int get_competition_limit_time_s() const {
+      return competition_limit_time_s;
+    }
+    int get_expected_fast_run_time_s() const {
+      return expected_fast_run_time_s;
+    }
     int running_parameter = 0; /**< 走行パラメータ */
 
    private:
@@ -166,7 +258,101 @@ class MazeRobot : public RobotBase {
     int get_elapsed_time_s() const {
       return offset_time_s + esp_timer_get_time() / 1000000;
     }
+    void on_restored() {
+      offset_time_s = backup_time_s;
+      running_parameter = 0;
+    }
   };
+  /**
+   * @brief 壁の保存形式 (区画ごとに東と北の壁が既知か・あるか)
+   *
+   * 大きさが一定なので records パーティションに収まる．
+   * 壁を見つけた順番は直近の kRecentMax 個だけ保存する (resetLastWalls() で
+   * 消すのは直近の壁なので)．外周の西と南の壁は常に既知なので省く．
+   */
+  struct WallMap {
+    static constexpr uint8_t kVersion = 1;
+    static constexpr int kWallCount = MAZE_SIZE * MAZE_SIZE * 2;
+    static constexpr int kRecentMax = 64;
+    uint8_t known[kWallCount / 8];
+    uint8_t wall[kWallCount / 8];
+    uint16_t recent_count;
+    uint16_t recent[kRecentMax];  //< 古い順．index_of() と壁の有無 (最上位)
+
+    /**
+     * @param unordered records の先頭の，見つけた順番のわからない壁の数
+     */
+    explicit WallMap(const WallRecords& records = {},
+                     const int unordered = 0) {
+      std::memset(known, 0, sizeof(known));
+      std::memset(wall, 0, sizeof(wall));
+      std::memset(recent, 0, sizeof(recent));
+      recent_count = 0;
+      for (const auto& wr : records) {
+        const int i = index_of(wr.getPosition(), wr.getDirection());
+        if (i < 0) continue;
+        known[i / 8] |= 1 << (i % 8);
+        wall[i / 8] = (wall[i / 8] & ~(1 << (i % 8))) | (wr.b << (i % 8));
+      }
+      /* 直近の壁を後ろから集める */
+      const auto first =
+          records.rend() - std::min<size_t>(unordered, records.size());
+      for (auto it = records.rbegin();
+           it != first && recent_count < kRecentMax; ++it) {
+        const int i = index_of(it->getPosition(), it->getDirection());
+        if (i >= 0) recent[recent_count++] = i | it->b << 15;
+      }
+      std::reverse(recent, recent + recent_count);
+    }
+    /**
+     * @brief 既知の壁を迷路に反映する
+     *
+     * 直近の壁は最後に見つけた順に反映する．
+     * @return 見つけた順番のわからない壁の記録の数
+     */
+    int apply(Maze& maze) const {
+      const int count = std::min<int>(recent_count, kRecentMax);
+      std::bitset<kWallCount> later;
+      for (int k = 0; k < count; ++k) later.set(recent[k] & 0x7FFF);
+      for (int i = 0; i < kWallCount; ++i)
+        if ((known[i / 8] >> (i % 8) & 1) && !later[i])
+          update(maze, i, wall[i / 8] >> (i % 8) & 1);
+      const int unordered = maze.getWallRecords().size();
+      for (int k = 0; k < count; ++k)
+        update(maze, recent[k] & 0x7FFF, recent[k] >> 15);
+      return unordered;
+    }
+    static int index_of(Position p, Direction d) {
+      /* 西と南の壁は隣の区画の東と北の壁として扱う */
+      if (d == Direction::West) {
+        p = Position(p.x - 1, p.y);
+        d = Direction::East;
+      } else if (d == Direction::South) {
+        p = Position(p.x, p.y - 1);
+        d = Direction::North;
+      } else if (d != Direction::East && d != Direction::North) {
+        return -1;
+      }
+      if (p.x < 0 || p.y < 0 || p.x >= MAZE_SIZE || p.y >= MAZE_SIZE)
+        return -1;
+      return (p.y * MAZE_SIZE + p.x) * 2 + (d == Direction::North);
+    }
+    static void update(Maze& maze, const int i, const bool b) {
+      if (i >= kWallCount) return;
+      const auto p = Position(i / 2 % MAZE_SIZE, i / 2 / MAZE_SIZE);
+      maze.updateWall(p, i % 2 ? Direction::North : Direction::East, b);
+    }
+  };
+  /* records パーティションの全ての記録 (と書き換え中の最大の記録) の合計 */
+  static_assert(utils::RecordStore::record_bytes(sizeof(WallMap)) * 2 +
+                        utils::RecordStore::record_bytes(
+                            sizeof(State::Record)) +
+                        utils::RecordStore::record_bytes(
+                            sizeof(utils::RunStrategy::Record)) +
+                        utils::RecordStore::record_bytes(
+                            sizeof(WallDetector::WallCurves)) <=
+                    utils::RecordStore::kLiveBytesMax,
+                "records must fit in RecordStore::kLiveBytesMax");
 
  private:
   hardware::Hardware* hw;
@@ -176,23 +362,78 @@ class MazeRobot : public RobotBase {
  public:
   MazeRobot(hardware::Hardware* hw, supporters::Supporters* sp, MoveAction* ma)
       : hw(hw), sp(sp), ma(ma) {
-    replaceGoals(MAZE_GOAL);
+    setGoals(MAZE_GOAL);
+    xTaskCreatePinnedToCore(
+        [](void* arg) { static_cast<utils::FlashWriter*>(arg)->task(); },
+        "FlashWriter", 4096, &flash_writer, TASK_PRIORITY_FLASH_WRITER, NULL,
+        TASK_CORE_ID_FLASH_WRITER);
   }
   void reset() {
+    flash_writer.flush();
     RobotBase::reset();
-    maze.backupWallRecordsToFile(MAZE_SAVE_PATH, true);
+    unordered_walls = 0;
     state = State();
-    state.save();
+    strategy.reset();
+    write_walls(maze.getWallRecords(), unordered_walls, true);
+    write_state(state);
+    write_strategy(strategy.to_record());
   }
+  /**
+   * @brief 現在の迷路と State の書き込みを要求する
+   *
+   * 探索中に呼ばれるので，スナップショットを取って書き込みは
+   * FlashWriter のタスクに任せる．
+   */
   bool backup() {
-    state.save();
-    return maze.backupWallRecordsToFile(MAZE_SAVE_PATH);
+    const auto& walls = maze.getWallRecords();
+    const int unordered = unordered_walls;
+    const State s = state;
+    return flash_writer.post(FlashKeyWalls, sizeof(WallMap) + sizeof(Record),
+                             [this, walls, unordered, s] {
+                               bool result = write_walls(walls, unordered);
+                               if (s.differs_from(written_state))
+                                 result = write_state(s) && result;
+                               return result;
+                             });
   }
+  /**
+   * @brief records パーティションから迷路と State を復元する
+   *
+   * なければ SPIFFS の旧形式から移行する．
+   */
   bool restore() {
-    state.restore();
-    return maze.restoreWallRecordsFromFile(MAZE_SAVE_PATH);
+    flash_writer.flush();
+    restore_state();
+    restore_strategy();
+    uint8_t version;
+    WallMap map;
+    size_t size;
+    if (!peripheral::record_store().load(peripheral::RecordKeyMazeWalls,
+                                         version, &map, size, sizeof(map)))
+      return migrate_walls();
+    if (version != WallMap::kVersion || size != sizeof(map)) {
+      MR_LOGE("unsupported wall map version: %d size: %d", version,
+              int(size));
+      return false;
+    }
+    RobotBase::reset();
+    unordered_walls = map.apply(maze);
+    written_walls = WallMap(maze.getWallRecords(), unordered_walls);
+    return true;
   }
   void setTimeout(int timeout_select) { state.set_timeout(timeout_select); }
+  /**
+   * @brief 直近に見つけた壁を n 個まで消す
+   *
+   * 見つけた順番のわからない壁 (WallMap から復元した古い壁) は消さない．
+   * @return 消した壁の数
+   */
+  int resetRecentWalls(const int n) {
+    const int recent = int(maze.getWallRecords().size()) - unordered_walls;
+    const int count = std::max(0, std::min(n, recent));
+    if (count > 0) maze.resetLastWalls(count);
+    return count;
+  }
   bool autoRun(const bool isAutoParamSelect = false,
                const bool isPositionIdentificationAtFirst = false) {
     /* 自己位置復帰走行: 任意 -> 復帰 -> ゴール -> スタート */
@@ -211,6 +452,7 @@ class MazeRobot : public RobotBase {
       }
     }
     /* 最短走行ループ: スタート -> ゴール -> スタート */
+    is_auto_param_select = isAutoParamSelect;
     while (1) {
       /* 5走終了 */
       MR_LOGD("");
@@ -241,12 +483,159 @@ class MazeRobot : public RobotBase {
     for (const auto& wl : maze.getWallRecords()) std::cout << wl << std::endl;
     maze.print();
   }
-  void setGoals(const Positions& goal) { replaceGoals(goal); }
+  void setGoals(const Positions& goal) {
+    replaceGoals(goal);
+    goal_positions = goal;
+  }
   const State& getState() const { return state; }
+  void printStrategy() const {
+    strategy.print(std::cout, state.get_expected_fast_run_time_s());
+  }
+  void printFlashWriter() const { flash_writer.print(std::cout); }
+  /**
+   * @brief utils::PathCandidates の移動の可否を迷路から答える関数
+   *
+   * 壁の記録ではなく迷路そのものを見る．Maze::reset() で決まる
+   * スタート区画の壁などは記録に残らないため．
+   */
+  static utils::PathCandidates::CanGo path_can_go(const Maze& maze) {
+    return [&maze](const int x, const int y,
+                   const utils::PathCandidates::Direction d) {
+      static const Direction dirs[] = {Direction::East, Direction::North,
+                                       Direction::West, Direction::South};
+      const auto p = Position(x, y);
+      return maze.isKnown(p, dirs[d]) && !maze.isWall(p, dirs[d]);
+    };
+  }
 
  private:
   State state;
+  using Record = State::Record;
   bool prevIsForceGoingToGoal = false; /*< ゴール判定用 */
+  Positions goal_positions;            /*< 最短走行の経路の候補用 */
+  utils::FlashWriter flash_writer;
+  WallMap written_walls;             /*< 最後に書き込んだ壁 */
+  int unordered_walls = 0;           /*< 見つけた順番のわからない壁の記録の数 */
+  State written_state;               /*< 最後に書き込んだ State */
+  utils::RunStrategy strategy;       /*< 最短走行のパラメータの選択 */
+  bool is_auto_param_select = false; /*< strategy で選んで走っているか */
+
+  /**
+   * @brief State の書き込みを要求する
+   *
+   * @param durable 書き終えるまで待つ (電源断でも失われてはならない場合)
+   */
+  bool save_state(const bool durable) {
+    const State s = state;
+    if (!flash_writer.post(FlashKeyState, sizeof(Record),
+                           [this, s] { return write_state(s); }))
+      return false;
+    return !durable || flash_writer.flush();
+  }
+  bool write_state(State s) {
+    s.stamp();
+    const auto r = s.to_record();
+    if (!peripheral::record_store().save(peripheral::RecordKeyMazeState,
+                                         Record::kVersion, &r, sizeof(r))) {
+      MR_LOGE("failed to save state");
+      return false;
+    }
+    written_state = s;
+    return true;
+  }
+  /**
+   * @brief 最短走行の統計の書き込みを要求する
+   */
+  bool save_strategy() {
+    const auto r = strategy.to_record();
+    return flash_writer.post(FlashKeyStrategy, sizeof(r),
+                             [this, r] { return write_strategy(r); });
+  }
+  bool write_strategy(const utils::RunStrategy::Record& r) {
+    if (!peripheral::record_store().save(peripheral::RecordKeyRunStrategy,
+                                         r.kVersion, &r, sizeof(r))) {
+      MR_LOGE("failed to save strategy");
+      return false;
+    }
+    return true;
+  }
+  bool restore_strategy() {
+    uint8_t version;
+    utils::RunStrategy::Record r;
+    size_t size;
+    if (!peripheral::record_store().load(peripheral::RecordKeyRunStrategy,
+                                         version, &r, size, sizeof(r))) {
+      MR_LOGW("strategy not found");
+      strategy.reset();
+      return false;
+    }
+    if (!strategy.restore(version, &r, size)) {
+      MR_LOGE("unsupported strategy version: %d size: %d", version,
+              int(size));
+      strategy.reset();
+      return false;
+    }
+    return true;
+  }
+  /**
+   * @param unordered walls の先頭の，見つけた順番のわからない壁の数
+   * @param force 前回と同じでも書き込む
+   */
+  bool write_walls(const WallRecords& walls, const int unordered,
+                   const bool force = false) {
+    const WallMap map(walls, unordered);
+    if (!force && std::memcmp(&map, &written_walls, sizeof(map)) == 0)
+      return true;
+    if (!peripheral::record_store().save(peripheral::RecordKeyMazeWalls,
+                                         WallMap::kVersion, &map,
+                                         sizeof(map))) {
+      MR_LOGE("failed to save walls");
+      return false;
+    }
+    written_walls = map;
+    return true;
+  }
+  /**
+   * @brief State を復元する
+   *
+   * records パーティションになければ SPIFFS の旧形式から移行する．
+   */
+  bool restore_state() {
+    uint8_t version;
+    uint8_t data[sizeof(Record)];
+    size_t size;
+    if (peripheral::record_store().load(peripheral::RecordKeyMazeState,
+                                        version, data, size, sizeof(data))) {
+      if (state.restore(version, data, size)) {
+        written_state = state;
+        return true;
+      }
+      MR_LOGE("unsupported state version: %d size: %d", version, int(size));
+      return false;
+    }
+    if (!migrate_state()) return false;
+    MR_LOGI("migrated state from SPIFFS");
+    return write_state(state);
+  }
+  bool migrate_state() {
+    uint8_t data[sizeof(State::LegacyRecord) + 1];  //< 大きすぎる記録を検出
+    std::ifstream f(STATE_SAVE_PATH, std::ios::binary);
+    if (f.fail()) {
+      MR_LOGW("state not found");
+      return false;
+    }
+    f.read(reinterpret_cast<char*>(data), sizeof(data));
+    return state.restore_legacy(data, f.gcount());
+  }
+  /**
+   * @brief SPIFFS の旧形式 (maze_backup.bin) から壁を移行する
+   */
+  bool migrate_walls() {
+    if (!maze.restoreWallRecordsFromFile(MAZE_SAVE_PATH)) return false;
+    unordered_walls = 0;  //< 見つけた順に並んでいる
+    MR_LOGI("migrated walls from SPIFFS");
+    return write_walls(maze.getWallRecords(), unordered_walls);
+  }
 
  protected:
   /* override virtual functions */
@@ -256,6 +645,8 @@ class MazeRobot : public RobotBase {
     if (hw->mt->is_emergency()) setBreakFlag();
   }
   void queueAction(const RobotBase::SearchAction action) override {
+    ma->search_tracer.mark(utils::DecisionTracer::Enqueue,
+                           esp_timer_get_time());
     ma->enqueue_action(action);
   }
   void calibration() override { ma->calibration(); }
@@ -267,11 +658,24 @@ class MazeRobot : public RobotBase {
     MR_LOGW("discrepancy! pose: %s", getCurrentPose().toString());
   }
   void senseWalls(bool& left, bool& front, bool& right) override {
-    left = ma->getSensedWalls().left;
-    right = ma->getSensedWalls().right;
-    front = ma->getSensedWalls().front;
+    const auto& walls = ma->getSensedWalls();
+    left = walls.left;
+    right = walls.right;
+    front = walls.front;
+    /* 確からしさの低い判定を記録する (既知の壁との食い違いの調査用) */
+    const float confidence =
+        std::min({walls.side_confidence[0], walls.front_confidence,
+                  walls.side_confidence[1]});
+    if (confidence < WallDetector::wall_confidence_low)
+      MR_LOGW("uncertain wall: %s L%.2f F%.2f R%.2f",
+              getCurrentPose().toString(),
+              (double)walls.side_confidence[0],
+              (double)walls.front_confidence,
+              (double)walls.side_confidence[1]);
   }
   void calcNextDirectionsPreCallback() override {
+    ma->search_tracer.mark(utils::DecisionTracer::PreCallback,
+                           esp_timer_get_time());
     /* ゴール判定用フラグ */
     prevIsForceGoingToGoal = calcData.isForceGoingToGoal;
     /* ウルトラマンタイマー */
@@ -284,6 +688,8 @@ class MazeRobot : public RobotBase {
   void calcNextDirectionsPostCallback(
       SearchAlgorithm::State oldState,
       SearchAlgorithm::State newState) override {
+    ma->search_tracer.mark(utils::DecisionTracer::PostCallback,
+                           esp_timer_get_time());
     MR_LOGI("%s %s --> %s", getCurrentPose().toString(),
             SearchAlgorithm::getStateString(oldState),
             SearchAlgorithm::getStateString(newState));
@@ -315,8 +721,8 @@ class MazeRobot : public RobotBase {
       MR_LOGE("");
     }
     while (!isSolvable()) {
-      maze.resetLastWalls(6);  //< 探索可能になるまで壁を消す
-      if (getMaze().getWallRecords().empty()) {
+      /* 探索可能になるまで壁を消す (消せる壁がなければ初期化) */
+      if (resetRecentWalls(6) == 0) {
         hw->bz->play(hardware::Buzzer::ERROR);
         MR_LOGE("");
         reset(); /*< reset maze and save */
@@ -330,6 +736,7 @@ class MazeRobot : public RobotBase {
     if (!auto_maze_check()) return false;
     /* 探索走行: スタート -> ゴール -> スタート */
     state.start_search_run();  //< 0 -> 1
+    save_state(true);
     if (searchRun()) {
       hw->bz->play(hardware::Buzzer::COMPLETE);
       MR_LOGD("");
@@ -349,7 +756,7 @@ class MazeRobot : public RobotBase {
       ma->emergency_release();
       /* 探索中だった場合はクラッシュ後を想定して直近の壁を削除 */
       hw->bz->play(hardware::Buzzer::MAZE_BACKUP);
-      maze.resetLastWalls(6);
+      resetRecentWalls(6);
       MR_LOGW("");
       /* 自動復帰走行 */
       return auto_pi_run();
@@ -362,34 +769,88 @@ class MazeRobot : public RobotBase {
     MR_LOGD("");
     if (!auto_maze_check()) return false;
     /* 最短経路の作成 */
-    if (!calcShortestDirections(ma->rp_fast.diag_enabled)) {
+    std::string search_path;
+    if (!calc_fast_search_path(search_path)) {
       hw->bz->play(hardware::Buzzer::ERROR);
       MR_LOGE("");
       return false;
     }
-    const auto search_path =
-        convertDirectionsToSearchPath(getShortestDirections());
     /* 走行回数インクリメント */
     state.start_fast_run();
+    save_state(true);
     //> FastRun Start
     ma->set_fast_path(search_path);
     ma->enable(MoveAction::TaskActionFastRun);
     ma->waitForEndAction();
     ma->disable();
     //< FastRun End
-    if (hw->mt->is_emergency()) {
+    const float t_run_s = ma->get_fast_run_time();  //< 経路の開始から
+    const bool success = !hw->mt->is_emergency();
+    if (is_auto_param_select) {
+      strategy.record({state.running_parameter, ma->rp_fast.diag_enabled},
+                      success, t_run_s);
+      save_strategy();
+    }
+    if (!success) {
       state.end_fast_run(false);
+      save_state(false);
       MR_LOGW("");
       return false;  //< クラッシュした
     }
     /* 最短成功 */
     state.end_fast_run(true);
+    save_state(false);
     /* ゴールで回収されるか待つ */
     if (sp->ui->waitForPickup()) return false;  //< 回収された
     /* 帰る */
     MR_LOGD("");
     return endFastRunBackingToStartRun();
   }
+  /**
+   * @brief 最短走行の経路を走行時間が最小になるように選ぶ
+   *
+   * MazeLib の最短経路と，既知の壁から作った utils::PathCandidates の候補の
+   * うち，MoveAction::estimate_fast_run_time() が最小のものを選ぶ．
+   * 帰りの走行は MazeLib の最短経路の終点から始まるので，候補は
+   * 同じ区画に同じ向きで着くものに限る．
+   */
+  bool calc_fast_search_path(std::string& search_path) {
+    const auto& rp = ma->rp_fast;
+    if (!calcShortestDirections(rp.diag_enabled)) return false;
+    const auto& shortest = getShortestDirections();
+    search_path = convertDirectionsToSearchPath(shortest);
+    if (shortest.empty()) return true;
+    const auto t_start_us = esp_timer_get_time();
+    /* MazeLib の最短経路の終点 */
+    using PC = utils::PathCandidates;
+    const Direction dirs[] = {Direction::East, Direction::North,
+                              Direction::West, Direction::South};
+    static constexpr int dx[] = {1, 0, -1, 0};
+    static constexpr int dy[] = {0, 1, 0, -1};
+    int gx = 0, gy = 0, last = -1;
+    for (const auto d : shortest) {
+      last = std::find(dirs, dirs + 4, d) - dirs;
+      if (last == 4) return true;  //< 区画の境界を通らない向き
+      gx += dx[last], gy += dy[last];
+    }
+    /* 候補の生成と評価 */
+    const PC pc(MAZE_SIZE, path_can_go(maze));
+    const float t_shortest = ma->estimate_fast_run_time(search_path, rp);
+    float t_best = t_shortest;
+    int best = -1, count = 0;
+    for (const auto& c : pc.search({{gx, gy}}, last)) {
+      Directions ds;
+      for (const auto d : c) ds.push_back(dirs[d]);
+      const auto path = convertDirectionsToSearchPath(ds);
+      const float t = ma->estimate_fast_run_time(path, rp);
+      if (t < t_best) t_best = t, best = count, search_path = path;
+      count++;
+    }
+    MR_LOGI("candidates: %d best: %d time: %d -> %d [ms] (%d [us])", count,
+            best, int(1000 * t_shortest), int(1000 * t_best),
+            int(esp_timer_get_time() - t_start_us));
+    return true;
+  }
   bool auto_pi_run() {
     /* 迷路のチェック */
     MR_LOGD("");
@@ -443,41 +904,40 @@ class MazeRobot : public RobotBase {
     MR_LOGD("");
     return true;
   }
+  /**
+   * @brief 次の最短走行のパラメータを選ぶ
+   *
+   * 残りの走行回数と残り時間のうちに得られる最短時間の期待値が
+   * 最小になるように，RunStrategy でパラメータの段階と斜めの有無を選ぶ．
+   */
   bool auto_parameter_select() {
-    /* 現在の状態に応じたパラメータ選択 */
+    /* 残りの走行回数 (残り時間で走れる回数を超えない) */
+    const int runs = std::max(
+        1, std::min(state.get_try_count_remain(),
+                    state.get_remaining_time_s() /
+                        std::max(1, state.get_expected_fast_run_time_s())));
+    float value;
+    const auto arm =
+        strategy.choose(runs, state.get_competition_limit_time_s(),
+                        state.get_expected_fast_run_time_s(), &value);
+    /* パラメータの適用 (差分ではなく段階を直接設定する) */
+    const int diff = arm.level - state.running_parameter;
+    ma->rp_fast.set_level(arm.level);
+    state.running_parameter = arm.level;
+    ma->rp_fast.diag_enabled = arm.diag;
+    MR_LOGI("runs: %d level: %d diag: %d p: %.3f expected: %.3f [s]", runs,
+            arm.level, arm.diag, strategy.get_success_probability(arm),
+            value);
     if (state.no_more_time()) {
-      MR_LOGD("");
       /* 残り時間が足りない場合 */
-      ma->rp_fast.down(state.running_parameter), state.running_parameter = 0;
-      ma->rp_fast.up(1), state.running_parameter += 1;
       ma->rp_search.diag_enabled = false;  //< 既知区間斜めは無効化
-      /* 最短初回なら斜め有効、それ以外は無効 */
-      ma->rp_fast.diag_enabled = (state.get_try_count() == 1);
       hw->bz->play(hardware::Buzzer::TIMEOUT);
-    } else if (state.get_fast_run_failed()) {
-      MR_LOGD("");
-      /* 最短走行中のクラッシュ後の場合 */
-      if (state.get_at_least_fast_run_succeeded()) {
-        /* 少なくとも1回は最短が成功している: パラメータを1落として再チャレ */
-        ma->rp_fast.down(1), state.running_parameter -= 1;
-        ma->rp_fast.diag_enabled = true;  //< 斜めあり
-      } else {
-        /* 最短未成功の状態: パラメータ0の斜めありなしを交互に試す */
-        ma->rp_fast.diag_enabled = !ma->rp_fast.diag_enabled;  //< 斜めを交互に
-        ma->rp_fast.down(state.running_parameter), state.running_parameter = 0;
-      }
+    } else if (diff < 0) {
       hw->bz->play(hardware::Buzzer::DOWN);
-    } else {
-      MR_LOGD("");
-      /* 初回 or 完走した場合 */
-      if (state.get_try_count() == 1)  //< 最短初回だけ特別にパラメータを上げる
-        ma->rp_fast.up(3), state.running_parameter += 3;
-      if (ma->rp_fast.diag_enabled)  //< 既に斜めあり -> 単にパラメータを上げる
-        ma->rp_fast.up(2), state.running_parameter += 2;
-      else  //< 斜めなしで成功 -> 同じパラメータで斜めありにする
-        ma->rp_fast.diag_enabled = true;
-      // ma->rp_search.diag_enabled = true; //< 既知区間斜めを有効化
+    } else if (diff > 0) {
       hw->bz->play(hardware::Buzzer::UP);
+    } else {
+      hw->bz->play(hardware::Buzzer::CONFIRM);
     }
     return true;
   }
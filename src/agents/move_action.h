@@ -12,9 +12,11 @@
 #include <ctrl/slalom/trajectory.h>
 #include <ctrl/straight/trajectory.h>
 #include <ctrl/trajectory_tracker.h>
+#include <esp_timer.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 
+#include <atomic>
 #include <cmath>
 #include <condition_variable>
 #include <mutex>
@@ -22,14 +24,23 @@
 #include <utils/math_utils.hpp>  //< for round2, saturate
 
 #include "config/model.h"
+#include "config/parameters.h"
 #include "config/slalom_shapes.h"
 #include "hardware/hardware.h"
 #include "supporters/supporters.h"
+#include "utils/decision_tracer.hpp"
+#include "utils/slalom_table.hpp"
+#include "utils/turn_speed_solver.hpp"
+#include "utils/velocity_planner.hpp"
+#include "utils/wall_edge_detector.hpp"
 
 /* 設定 */
-#define MOVE_ACTION_WALL_FIX_COMB_ENABLED 0  //< 櫛の壁制御
-#define MOVE_ACTION_WALL_FIX_DIAG_ENABLED 0  //< 斜めの壁制御
-#define MOVE_ACTION_WALL_CUT_ENABLED 0       //< 壁切れ補正
+#define MOVE_ACTION_WALL_FIX_COMB_ENABLED 0     //< 櫛の壁制御
+#define MOVE_ACTION_WALL_FIX_DIAG_ENABLED 0     //< 斜めの壁制御
+#define MOVE_ACTION_WALL_CUT_ENABLED 0          //< 壁切れ補正 (offset 未計測)
+#define MOVE_ACTION_SLALOM_TABLE_ENABLED 1      //< スラローム軌道の事前計算
+#define MOVE_ACTION_VELOCITY_PLANNER_ENABLED 1  //< 経路全体の速度計画
+#define MOVE_ACTION_SEARCH_PREFETCH_ENABLED 1   //< 探索の次の行動の先読み
 
 /* ログマクロの定義 (MA_LOG_LEVEL は config.h で定義) */
 #if MA_LOG_LEVEL >= 1
@@ -100,6 +111,11 @@ class MoveAction {
     float a_max = 3600;
     float j_max = 240'000;
     std::array<float, field::ShapeIndexMax> v_slalom;
+    /* 段階 0 の値 (set_level() の基準．手動の調整もここに掛ける) */
+    float v_max_ref = v_max;
+    float a_max_ref = a_max;
+    std::array<float, field::ShapeIndexMax> v_slalom_ref;
+    int level = 0;  //< 速度の段階 (set_level() で設定)
     /* search run */
     float v_search = 330;
     float v_unknown_accel = 600;
@@ -118,7 +134,21 @@ class MoveAction {
     RunParameter() {
       for (int i = 0; i < field::ShapeIndexMax; ++i)
         // v_slalom[i] = field::shapes[i].v_ref;
-        v_slalom[i] = v_search;
+        v_slalom[i] = v_slalom_ref[i] = v_search;
+    }
+    /**
+     * @brief 速度の段階を設定する
+     *
+     * up() と down() の繰り返しと違い，誤差がたまらず，今の段階にも
+     * よらない．v_max，a_max，v_slalom はそれぞれ v_max_ref，a_max_ref，
+     * v_slalom_ref から計算し直す．
+     */
+    void set_level(const int level) {
+      this->level = level;
+      for (int i = 0; i < field::ShapeIndexMax; ++i)
+        v_slalom[i] = v_slalom_ref[i] * std::pow(vs_factor, float(level));
+      v_max = v_max_ref * std::pow(vm_factor, float(level));
+      a_max = a_max_ref * std::pow(am_factor, float(level));
     }
     void up(const int cnt = 1) {
       for (int i = 0; i < cnt; ++i) {
@@ -137,15 +167,25 @@ class MoveAction {
  public:
   RunParameter rp_search;
   RunParameter rp_fast;
+  /* 探索の判断の遅延 (壁の読み取りから次の行動の取り出しまで) */
+  utils::DecisionTracer search_tracer;
 
  private:
   hardware::Hardware* hw;
   supporters::Supporters* sp;
 
  public:
-  MoveAction(hardware::Hardware* hw, supporters::Supporters* sp,
-             const ctrl::TrajectoryTracker::Gain& gain)
-      : hw(hw), sp(sp), tt_gain(gain) {
+  MoveAction(hardware::Hardware* hw, supporters::Supporters* sp)
+      : hw(hw), sp(sp) {
+#if MOVE_ACTION_SLALOM_TABLE_ENABLED
+    /* スラローム軌道を事前に計算 */
+    for (const auto& shape : field::shapes) slalom_tables.emplace_back(shape);
+#endif
+    for (const auto& shape : field::shapes)
+      turn_speed_solvers.emplace_back(shape, model::RotationRadius);
+    /* 経路の評価のためにスラロームの所要時間を事前に計算 */
+    for (int i = 0; i < field::ShapeIndexMax; ++i)
+      slalom_k_times[i] = calc_slalom_k_time(field::ShapeIndex(i));
     /* set default parameters */
     for (auto& vs : rp_search.v_slalom) vs = rp_search.v_search;
     for (auto& vs : rp_fast.v_slalom) vs = rp_search.v_search;
@@ -175,6 +215,7 @@ class MoveAction {
   }
   void enqueue_action(const MazeLib::RobotBase::SearchAction action) {
     MA_LOGI("%s", MazeLib::RobotBase::getSearchActionName(action));
+    search_notified = false;  //< 次の待機の通知で壁の読み取りを記録
     sa_queue.push(action);
     if (state == STATE_WAITING) state_update(State::STATE_RUNNING);
   }
@@ -185,6 +226,28 @@ class MoveAction {
   void set_fast_path(const std::string& fast_path) {
     this->fast_path = fast_path;
   }
+  /**
+   * @brief 最短走行の所要時間を見積もる
+   *
+   * 走行と同じ直線とターンの列の速度計画から求める．
+   * ターンの所要時間は事前に計算してあるので，経路の比較に使える．
+   * @param search_path 探索の行動の列 (set_fast_path() に渡すもの)
+   * @return 所要時間 [s]
+   */
+  float estimate_fast_run_time(const std::string& search_path,
+                               const RunParameter& rp) const {
+    const auto path = MazeLib::RobotBase::convertSearchPathToFastPath(
+        search_path, rp.diag_enabled);
+    const float straight = field::kCellLengthFull / 2 - model::TailLength -
+                           field::kWallThickness / 2;
+    utils::VelocityPlanner planner({rp.j_max, rp.a_max, rp.v_max});
+    fast_run_plan(path, straight, rp, planner);
+#if MOVE_ACTION_VELOCITY_PLANNER_ENABLED
+    return planner.get_total_time();
+#else
+    return planner.estimate_sequential_time();
+#endif
+  }
   void emergency_release() {
     if (hw->mt->is_emergency()) {
       MA_LOGW("");
@@ -207,15 +270,42 @@ class MoveAction {
   void set_unknown_accel_flag(const bool flag) {
     continue_straight_if_no_front_wall = flag;
   }
+  /**
+   * @brief 摩擦円に収まる最大の速度から，各ターンの速度を設定する
+   *
+   * 合成加速度は速度の 2 乗に比例するので，ターンの速度は
+   * sqrt(aggression) 倍になる．求めた速度は段階 0 の値とし，今の段階を
+   * かけて適用する．
+   * @param aggression 使う摩擦円の割合 (0, 1]
+   */
+  void set_turn_aggression(RunParameter& rp, const float aggression) const {
+    const float a_grip = aggression * config::parameters().grip_acceleration;
+    for (int i = 0; i < field::ShapeIndexMax; ++i)
+      rp.v_slalom_ref[i] = turn_speed_solvers[i].getMaxVelocity(a_grip);
+    rp.set_level(rp.level);
+    for (int i = 0; i < field::ShapeIndexMax; ++i)
+      MA_LOGI("v_slalom[%d]: %d [mm/s]", i, int(rp.v_slalom[i]));
+  }
+  /**
+   * @brief 直前の最短走行の経路の走行時間 [s]
+   *
+   * 最初の軌道の開始から最後の軌道の終了まで．キャリブレーションや
+   * ファンの始動，停止の待ちは含まない．走り切れなかった場合は
+   * 止まるまで．
+   */
+  float get_fast_run_time() const { return fast_run_time_us / 1e6f; }
 
  private:
-  ctrl::TrajectoryTracker::Gain tt_gain;
   ctrl::Pose offset;
   WallDetector::Walls walls;
   bool continue_straight_if_no_front_wall = false;
+#if MOVE_ACTION_SLALOM_TABLE_ENABLED
+  std::vector<utils::SlalomTable> slalom_tables;
+#endif
+  std::vector<utils::TurnSpeedSolver> turn_speed_solvers;
+  std::array<float, field::ShapeIndexMax> slalom_k_times;
   typedef struct {
-    bool prev_wall[2];
-    float prev_x[2];
+    std::array<utils::WallEdgeDetector, 2> detectors;  //< [左, 右]
   } wall_cut_data_t;
 
   /* TaskAction */
@@ -293,11 +383,11 @@ class MoveAction {
       WheelPosition wp;
       for (int j = 0; j < 2; ++j) {
         wp[j] = sp->wd->getWallDistanceFrontAveraged(j) *
-                model::wall_front_attach_gain;
+                config::parameters().wall_front_attach_gain;
       }
       const ctrl::Polar p = wp.toPolar(model::RotationRadius);
       /* 終了条件 */
-      const float end = model::wall_front_attach_end;
+      const float end = config::parameters().wall_front_attach_end;
       if (math_utils::sum_of_square(wp[0], wp[1]) < end) {
         result = true;  //< 補正成功
         break;
@@ -333,7 +423,8 @@ class MoveAction {
     constexpr float theta_threshold = PI * 0.5f / 180;
     if (std::abs(th_g - th_g_w) > theta_threshold) return;
     /* 壁との距離を取得 */
-    constexpr float wall_fix_offset = model::wall_fix_offset;  //< 大: 壁に近く
+    const float wall_fix_offset =
+        config::parameters().wall_fix_offset;  //< 大: 壁に近く
     const float d_tof =
         wall_fix_offset + tof_mm - passed_ms * 1e-3f * sp->sc->ref_v.tra;
     /* グローバル位置に変換 */
@@ -403,7 +494,8 @@ class MoveAction {
     uint8_t led_flags = hw->led->get();
     /* 壁と平行 */
     if (isAlong()) {
-      const float alpha = model::wall_avoid_alpha;  //< 補正割合 (0: 補正なし)
+      const float alpha =
+          config::parameters().wall_avoid_alpha;  //< 補正割合 (0: 補正なし)
       const float wall_dist_thr = 10;  //< 遠方の閾値（近接は閾値なし）
       float y_error = 0;               //< 姿勢の補正用変数
       if (sp->wd->getWallDistanceSide(0) < wall_dist_thr) {
@@ -420,11 +512,12 @@ class MoveAction {
       }
       /* 機体姿勢の補正 (壁に寄り続けている→姿勢を補正) */
       if (rp.side_wall_fix_theta_enabled)
-        sp->sc->fix_pose({0, 0, y_error * model::wall_fix_theta_gain});
+        sp->sc->fix_pose(
+            {0, 0, y_error * config::parameters().wall_fix_theta_gain});
 #if MOVE_ACTION_WALL_FIX_COMB_ENABLED
       /* 櫛の壁制御 (KERISE v5) */
       if (hw->tof->getDistance() > field::kCellLengthFull * 3 / 2) {
-        const float comb_threshold = model::wall_comb_threshold;
+        const float comb_threshold = config::parameters().wall_comb_threshold;
         const float comb_shift = 0.1f;
         if (sp->wd->getWallDistanceFront(0) < comb_threshold) {
           sp->sc->est_p.y += comb_shift;
@@ -458,40 +551,39 @@ class MoveAction {
 #endif
     hw->led->set(led_flags);
   }
+  /**
+   * @brief 横壁の切れ目で前後方向の位置を補正する
+   *
+   * 切れ目は柱の奥側の端にあり，区画の境界から一定の位置で見つかる．
+   * その位置 (wall_cut_offset) との差を補正する．
+   */
   void side_wall_cut(const RunParameter& rp, wall_cut_data_t& wall_cut_data) {
 #if MOVE_ACTION_WALL_CUT_ENABLED
-    if (!rp.side_wall_cut_enabled || isDiag()) return;
+    /* 区画に沿って姿勢が整っているときのみ */
+    constexpr float theta_threshold = PI * 2 / 180;
+    if (!rp.side_wall_cut_enabled || !isAlong() ||
+        std::abs(sp->sc->est_p.th) > theta_threshold) {
+      for (auto& d : wall_cut_data.detectors) d.reset();
+      return;
+    }
+    const float x = sp->sc->est_p.x;
+    /* 局所座標系の原点の進行方向の位置 (グローバル) */
+    const float s0 =
+        offset.x * std::cos(offset.th) + offset.y * std::sin(offset.th);
     /* 左右それぞれ */
     for (int i = 0; i < 2; i++) {
-      bool wall = sp->wd->getWallSide(i);
-      const float x = sp->sc->est_p.x;
-      /* 壁の変化 */
-      if (wall_cut_data.prev_wall[i] != wall) {
-        if (wall) {
-          wall_cut_data.prev_x[i] = x;
-        } else {
-          // float wall_width = x - wall_cut_data.prev_x[i];
-          // if (15 < wall_width && wall_width < 60) {
-          //   const float comb_shift = (wall_width - 15) * 0.5f;
-          //   sp->sc->fix_pose({0, i == 0 ? comb_shift : -comb_shift});
-          //   hw->bz->play(hardware::Buzzer::SHORT7);
-          // }
-        }
-        // /* 姿勢が整っているときのみ */
-        // constexpr float theta_threshold = PI * 0.5f / 180;
-        // if (std::abs(sp->sc->est_p.th) < theta_threshold) {
-        // const float wall_cut_offset = -15; /*< 大きいほど前へ */
-        // const float x_abs = offset.rotate(offset.th).x + sp->sc->est_p.x;
-        // const float x_abs_cut =
-        //     math_utils::round2(x_abs, field::kCellLengthFull);
-        // const float fixed_x = x_abs_cut - x_abs + wall_cut_offset;
-        // const float fixed_x_abs = std::abs(fixed_x);
-        // const float alpha = 0.1f;
-        // sp->sc->fix_pose(ctrl::Pose(alpha * fixed_x, 0, 0));
-        // hw->bz->play(hardware::Buzzer::CANCEL);
-        // }
-      }
-      wall_cut_data.prev_wall[i] = wall;
+      auto& detector = wall_cut_data.detectors[i];
+      if (!detector.push(sp->wd->getWallDistanceSide(i), x)) continue;
+      const float x_fix = utils::WallEdgeDetector::cell_error(
+          s0 + detector.edge(), config::parameters().wall_cut_offset,
+          field::kCellLengthFull);
+      MA_LOGD("wall cut: %c x: %d fix: %d", i ? 'R' : 'L', int(x),
+              int(x_fix));
+      /* 大きくずれていれば見誤りとみなす */
+      const float tolerance = 15;  //< [mm]
+      if (std::abs(x_fix) > tolerance) continue;
+      const float alpha = 0.5f;  //< 補正割合 (0: 補正なし)
+      sp->sc->fix_pose({alpha * x_fix, 0, 0});
     }
 #endif
   }
@@ -502,16 +594,13 @@ class MoveAction {
     v_end = unknown_accel ? rp.v_unknown_accel : v_end;
     v_max = unknown_accel ? rp.v_unknown_accel : v_max;
     /* 壁切れ用 */
-    wall_cut_data_t wall_cut_data = {
-        .prev_wall = {sp->wd->getWallSide(0), sp->wd->getWallSide(1)},
-        .prev_x = {sp->sc->est_p.x, sp->sc->est_p.x},
-    };
+    wall_cut_data_t wall_cut_data;
     /* 前壁補正 */
     front_wall_fix(rp, true);  //< ステップ変化を許容
     /* 移動分が存在する場合 */
     if (distance - sp->sc->est_p.x > 0) {
       const float v_start = sp->sc->ref_v.tra;
-      ctrl::TrajectoryTracker tt{tt_gain};
+      ctrl::TrajectoryTracker tt{config::parameters().TrajectoryTrackerGain};
       ctrl::State ref_s;
       ctrl::straight::Trajectory trajectory;
       /* start */
@@ -542,6 +631,8 @@ class MoveAction {
             hw->bz->play(hardware::Buzzer::MAZE_BACKUP);
           }
         }
+        /* 区画の境界の手前で探索器に次の行動を求める */
+        if (v_end > 1) search_prefetch(remain);
         /* 情報の更新 */
         sp->sc->sampling_wait();
         /* 壁補正 */
@@ -560,6 +651,7 @@ class MoveAction {
       sp->sc->set_target(0, 0);
       vTaskDelay(pdMS_TO_TICKS(200));
     }
+    search_prefetch_armed = false;
     /* 移動した量だけ位置を更新 */
     sp->sc->fix_pose({-distance, 0, 0}, true);
     offset += ctrl::Pose(distance, 0, 0).rotate(offset.th);
@@ -569,7 +661,7 @@ class MoveAction {
     const float dddth_max = 2400 * PI;
     const float ddth_max = 54 * PI;
     const float dth_max = 4 * PI;
-    constexpr float back_gain = model::turn_back_gain;
+    const float back_gain = config::parameters().turn_back_gain;
     ctrl::AccelDesigner ad(dddth_max, ddth_max, dth_max, 0, 0, angle);
     for (float t = 0; t < ad.t_end(); t += sp->sc->Ts) {
       if (is_break_state()) break;
@@ -597,22 +689,32 @@ class MoveAction {
     sp->sc->update_pose((sp->sc->est_p - net).rotate(-net.th));
     offset += net.rotate(offset.th);
   }
-  void trace(ctrl::slalom::Trajectory& trajectory, const RunParameter& rp) {
+  void trace(const field::ShapeIndex si, const bool mirror_x,
+             const RunParameter& rp) {
     if (is_break_state()) return;
     /* 前壁補正 */
     front_wall_fix(rp, true);  //< ステップ変化を許容
     /* prepare */
     const float Ts = sp->sc->Ts;
     const float velocity = sp->sc->ref_v.tra;
-    ctrl::TrajectoryTracker tt(tt_gain);
+    const auto& shape = field::shapes[si];
+    ctrl::TrajectoryTracker tt(config::parameters().TrajectoryTrackerGain);
     ctrl::State s;
+#if MOVE_ACTION_SLALOM_TABLE_ENABLED
+    const auto& table = slalom_tables[si];
+    const float t_curve = table.getTimeCurve(velocity);
+#else
+    ctrl::slalom::Trajectory trajectory(shape, mirror_x);
+    trajectory.reset(velocity);
+    const float t_curve = trajectory.getTimeCurve();
+#endif
     /* start */
     tt.reset(velocity);
-    trajectory.reset(velocity);
-    s.q.x = sp->sc->est_p.x; /*< 既に移動した分を反映 */
-    if (std::abs(sp->sc->est_p.x) > 1)
+    const float x_start = sp->sc->est_p.x; /*< 既に移動した分を反映 */
+    s.q.x = x_start;
+    if (std::abs(x_start) > 1)
       hw->bz->play(hardware::Buzzer::MAZE_BACKUP);  //< 現在位置が進みすぎ警告
-    for (float t = 0; t < trajectory.getTimeCurve(); t += Ts) {
+    for (float t = 0; t < t_curve; t += Ts) {
       if (is_break_state()) break;
       /* データの更新 */
       sp->sc->sampling_wait();
@@ -620,11 +722,14 @@ class MoveAction {
       hw->led->set(0);
       front_wall_fix(rp);
       side_wall_avoid(rp, 0);
-      if (std::abs(trajectory.getShape().v_ref -
-                   field::shapes[field::ShapeIndex::FV90].v_ref) < 0.01f)
+      if (si == field::ShapeIndex::FV90)
         side_wall_fix_v90(rp); /*< V90の横壁補正 */
       /* 軌道を更新 */
+#if MOVE_ACTION_SLALOM_TABLE_ENABLED
+      table.update(s, velocity, t, Ts, mirror_x, x_start);
+#else
       trajectory.update(s, t, Ts);
+#endif
       const auto ref =
           tt.update(sp->sc->est_p, sp->sc->est_v, sp->sc->est_a, s);
       sp->sc->set_target(ref.v, ref.w, ref.dv, ref.dw);
@@ -632,7 +737,9 @@ class MoveAction {
     }
     sp->sc->set_target(velocity, 0);
     /* 移動した量だけ位置を更新 */
-    const auto& net = trajectory.getShape().curve;
+    const auto net = mirror_x ? ctrl::Pose(shape.curve.x, -shape.curve.y,
+                                           -shape.curve.th)
+                              : shape.curve;
     sp->sc->update_pose((sp->sc->est_p - net).rotate(-net.th));
     offset += net.rotate(offset.th);
   }
@@ -641,7 +748,6 @@ class MoveAction {
                      const RunParameter& rp) {
     if (is_break_state()) return;
     const auto& shape = field::shapes[si];
-    ctrl::slalom::Trajectory st(shape, mirror_x);
     const auto straight_prev = shape.straight_prev;
     const auto straight_post = shape.straight_post;
     const float velocity = rp.v_slalom[si];
@@ -653,7 +759,7 @@ class MoveAction {
       straight = 0;
     }
     /* スラローム */
-    trace(st, rp);
+    trace(si, mirror_x, rp);
     straight += reverse ? straight_prev : straight_post;
   }
   void u_turn() {
@@ -680,7 +786,8 @@ class MoveAction {
     if (is_break_state()) return;
     hw->bz->play(hardware::Buzzer::AEBS);
     // ToDo: compiler bug avoidance!
-    for (float v = sp->sc->ref_v.tra; v > 0; v -= 12) {
+    const float a_aebs = 12'000;  //< 減速度 [mm/s/s]
+    for (float v = sp->sc->ref_v.tra; v > 0; v -= a_aebs * sp->sc->Ts) {
       sp->sc->sampling_wait();
       sp->sc->set_target(v, 0);
     }
@@ -733,25 +840,45 @@ class MoveAction {
  private:
   utils::concurrent_queue<MazeLib::RobotBase::SearchAction> sa_queue;
   static constexpr float PI = 3.14159265358979323846f;
+  /* 探索の先読み */
+  static constexpr float search_prefetch_distance = 5.0f;  //< [mm]
+  bool search_prefetch_armed = false;  //< 探索の行動の最後の直線
+  bool search_prefetched = false;      //< 境界の手前で壁を読んだ
+  std::atomic<bool> search_notified{false};  //< 待機を通知した
+  struct SearchPipelineStats {
+    int handoffs = 0;         //< 区画の境界の数
+    int prefetched = 0;       //< 先読みした数
+    int stalls = 0;           //< キューが空で減速を始めた数
+    int stall_ticks = 0;      //< 減速しながら待った周期の合計
+    int stall_ticks_max = 0;  //< 減速しながら待った周期の最大
+  } search_pipeline_stats;
 
   void search_run_task() {
     const auto& rp = rp_search;
     /* スタート */
     sp->sc->enable();
     MA_LOG_POSE();
+    search_pipeline_stats = {};
+    search_prefetched = false;
+    search_notified = false;
+    search_tracer.reset();
     /* とりあえず区画の中心に配置 */
     offset = ctrl::Pose(field::kCellLengthFull / 2, field::kCellLengthFull / 2);
     while (1) {
       /* 離脱確認 */
       if (is_break_state()) break;
       /* 壁を確認 (区画の切り替わり位置にいるはず) */
-      walls = sp->wd->getWalls();
+      /* 先読み済みの場合は探索器が読んでいる最中なので上書きしない */
+      if (!search_prefetched) walls = sp->wd->getWalls();
+      search_prefetched = search_prefetch_armed = false;
       MA_LOG_POSE();
       MA_LOGD("wall: %s", sp->wd->get_info());
       /* 探索器に終了を通知 */
-      if (sa_queue.empty()) state_update(State::STATE_WAITING);
+      if (sa_queue.empty()) search_notify_waiting();
       /* Actionがキューされるまで直進で待つ */
+      search_pipeline_stats.handoffs++;
       if (sa_queue.empty()) search_run_queue_wait_decel(rp);
+      search_tracer.mark(utils::DecisionTracer::Dequeue, esp_timer_get_time());
       /* 既知区間走行 */
       if (sa_queue.size() >= 2) search_run_known(rp);
       MA_LOG_POSE();
@@ -764,19 +891,61 @@ class MoveAction {
     }
     MA_LOG_POSE();
     flush_action();
+    const auto& st = search_pipeline_stats;
+    MA_LOGI("handoffs: %d prefetched: %d stalls: %d stall_ticks: %d (max %d)",
+            st.handoffs, st.prefetched, st.stalls, st.stall_ticks,
+            st.stall_ticks_max);
+  }
+  /**
+   * @brief 探索器に待機状態を通知する
+   *
+   * 区画ごとに最初の通知で壁を読んだ時刻を記録する．
+   */
+  void search_notify_waiting() {
+    bool expected = false;
+    if (search_notified.compare_exchange_strong(expected, true))
+      search_tracer.mark(utils::DecisionTracer::WallCapture,
+                         esp_timer_get_time());
+    state_update(State::STATE_WAITING);
+  }
+  /**
+   * @brief 区画の境界の手前で壁を読み，探索器に次の行動を求める
+   *
+   * 探索器は境界での壁を読んでから次の行動を計算するので，その間は
+   * キューが空になり減速が始まる．そこで，探索の各行動の最後の直線で
+   * 残り距離が search_prefetch_distance を切ったら壁を読んで待機状態を
+   * 通知し，計算を走行と並行させる．停止する直線では行わない．
+   * それより手前では横壁センサが前の区画の壁を見ているので，
+   * WallDetector::side_read_lead_max() で制限する．
+   */
+  void search_prefetch(const float remain) {
+#if MOVE_ACTION_SEARCH_PREFETCH_ENABLED
+    const float lead =
+        std::min(search_prefetch_distance,
+                 WallDetector::side_read_lead_max(sp->sc->ref_v.tra));
+    if (!search_prefetch_armed || remain > lead) return;
+    search_prefetch_armed = false;
+    if (!sa_queue.empty()) return;
+    walls = sp->wd->getWalls();
+    search_prefetched = true;
+    search_pipeline_stats.prefetched++;
+    search_notify_waiting();
+#endif
   }
   void search_run_queue_wait_decel(const RunParameter& rp) {
     /* Actionがキューされるまで減速しながら待つ */
-    ctrl::TrajectoryTracker tt(tt_gain);
+    ctrl::TrajectoryTracker tt(config::parameters().TrajectoryTrackerGain);
     ctrl::State ref_s;
     const auto v_start = sp->sc->ref_v.tra;
     const float x_start = sp->sc->est_p.x;
     ctrl::AccelCurve ac(rp.j_max, rp.a_max, v_start, 0);  //< なめらかに減速
     /* start */
     tt.reset(v_start);
+    int ticks = 0;
     for (float t = 0; sa_queue.empty(); t += sp->sc->Ts) {
       if (is_break_state()) break;
       sp->sc->sampling_wait();
+      ticks++;
       /* 壁補正 */
       hw->led->set(0);
       front_wall_fix(rp);
@@ -787,6 +956,10 @@ class MoveAction {
                     ctrl::Pose(ac.a(t)), ctrl::Pose(ac.j(t)));
       sp->sc->set_target(ref.v, ref.w, ref.dv, ref.dw);
     }
+    auto& st = search_pipeline_stats;
+    if (ticks > 0) st.stalls++;
+    st.stall_ticks += ticks;
+    st.stall_ticks_max = std::max(st.stall_ticks_max, ticks);
     /* 注意: 現在位置はやや前に進んだ状態 */
   }
   void search_run_known(const RunParameter& rp) {
@@ -821,6 +994,7 @@ class MoveAction {
       }
       /* 最後の直線を消化 */
       if (straight > 0.1f) {
+        search_prefetch_armed = true;
         straight_x(straight, rp.v_max, rp.v_search, rp);
         straight = 0;
       }
@@ -848,9 +1022,11 @@ class MoveAction {
       case MazeLib::RobotBase::SearchAction::ST_FULL:
         if (hw->tof->getDistance() < field::kCellLengthFull)
           return wall_stop_aebs();
+        search_prefetch_armed = true;
         straight_x(field::kCellLengthFull, v_s, v_s, rp, unknown_accel);
         break;
       case MazeLib::RobotBase::SearchAction::ST_HALF:
+        search_prefetch_armed = true;
         straight_x(field::kCellLengthFull / 2, v_s, v_s, rp);
         break;
       case MazeLib::RobotBase::SearchAction::TURN_L:
@@ -861,14 +1037,15 @@ class MoveAction {
           straight_x(field::kCellLengthFull / 2, v_s, 0, rp);
           front_wall_attach();
           turn(PI / 2);
+          search_prefetch_armed = true;
           straight_x(field::kCellLengthFull / 2, v_s, v_s, rp);
         } else {
-          static ctrl::slalom::Trajectory st(
-              field::shapes[field::ShapeIndex::S90], 0);
-          straight_x(st.getShape().straight_prev, v_s, v_s, rp);
+          const auto& shape = field::shapes[field::ShapeIndex::S90];
+          straight_x(shape.straight_prev, v_s, v_s, rp);
           if (sp->wd->getWallSide(0)) return wall_stop_aebs();
-          trace(st, rp);
-          straight_x(st.getShape().straight_post, v_s, v_s, rp);
+          trace(field::ShapeIndex::S90, false, rp);
+          search_prefetch_armed = true;
+          straight_x(shape.straight_post, v_s, v_s, rp);
         }
         break;
       case MazeLib::RobotBase::SearchAction::TURN_R:
@@ -879,14 +1056,15 @@ class MoveAction {
           straight_x(field::kCellLengthFull / 2, v_s, 0, rp);
           front_wall_attach();
           turn(-PI / 2);
+          search_prefetch_armed = true;
           straight_x(field::kCellLengthFull / 2, v_s, v_s, rp);
         } else {
-          static ctrl::slalom::Trajectory st(
-              field::shapes[field::ShapeIndex::S90], 1);
-          straight_x(st.getShape().straight_prev, v_s, v_s, rp);
+          const auto& shape = field::shapes[field::ShapeIndex::S90];
+          straight_x(shape.straight_prev, v_s, v_s, rp);
           if (sp->wd->getWallSide(1)) return wall_stop_aebs();
-          trace(st, rp);
-          straight_x(st.getShape().straight_post, v_s, v_s, rp);
+          trace(field::ShapeIndex::S90, true, rp);
+          search_prefetch_armed = true;
+          straight_x(shape.straight_post, v_s, v_s, rp);
         }
         break;
       case MazeLib::RobotBase::SearchAction::ROTATE_180:
@@ -900,6 +1078,7 @@ class MoveAction {
 
  private:
   std::string fast_path;
+  std::atomic<int64_t> fast_run_time_us{0};  //< 直前の最短走行の経路の時間
 
   bool fast_run_task(const std::string& search_actions) {
     /* 走行パラメータを取得 */
@@ -926,6 +1105,28 @@ class MoveAction {
     /* 最初の直線を追加 */
     float straight = field::kCellLengthFull / 2 - model::TailLength -
                      field::kWallThickness / 2;
+#if MOVE_ACTION_VELOCITY_PLANNER_ENABLED
+    /* 速度計画 */
+    utils::VelocityPlanner planner({rp.j_max, rp.a_max, rp.v_max});
+    fast_run_plan(path, straight, rp, planner);
+    int overspeed = 0;
+    const float t_sequential = planner.estimate_sequential_time(&overspeed);
+    MA_LOGI("planned: %d [ms], sequential: %d [ms], overspeed: %d",
+            int(1000 * planner.get_total_time()), int(1000 * t_sequential),
+            overspeed);
+#endif
+    /* 経路の開始 */
+    const int64_t t_start_us = esp_timer_get_time();
+#if MOVE_ACTION_VELOCITY_PLANNER_ENABLED
+    /* 走行 */
+    for (const auto& seg : planner.get_segments()) {
+      if (is_break_state()) break;
+      if (seg.type == utils::VelocityPlanner::Segment::Straight)
+        straight_x(seg.distance, rp.v_max, seg.v_end, rp);
+      else
+        trace(field::ShapeIndex(seg.shape), seg.mirror_x, rp);
+    }
+#else
     /* 走行 */
     for (int path_index = 0; path_index < path.length(); path_index++) {
       if (is_break_state()) break;
@@ -938,6 +1139,9 @@ class MoveAction {
       straight_x(straight, rp.v_max, 0, rp);
       straight = 0;
     }
+#endif
+    /* 経路の終了 */
+    fast_run_time_us = esp_timer_get_time() - t_start_us;
     /* 停止処理 */
     sp->sc->set_target(0, 0);
     hw->fan->drive(0);
@@ -949,71 +1153,133 @@ class MoveAction {
     sp->sc->disable();
     return true;
   }
-  void fast_run_switch(const MazeLib::RobotBase::FastAction action,
-                       float& straight, const RunParameter& rp) {
-    MA_LOGD("FastAction: %s", MazeLib::RobotBase::getFastActionName(action));
+  struct FastSlalom {
+    field::ShapeIndex si;
+    bool mirror_x;
+    bool reverse;
+  };
+  /**
+   * @brief 最短走行のターンの種類を取得する
+   * @return false ターンでない
+   */
+  static bool get_fast_slalom(const MazeLib::RobotBase::FastAction action,
+                              FastSlalom& fs) {
     switch (action) {
       case MazeLib::RobotBase::FastAction::F45_L:
-        SlalomProcess(field::ShapeIndex::F45, 0, 0, straight, rp);
-        break;
+        fs = {field::ShapeIndex::F45, 0, 0};
+        return true;
       case MazeLib::RobotBase::FastAction::F45_R:
-        SlalomProcess(field::ShapeIndex::F45, 1, 0, straight, rp);
-        break;
+        fs = {field::ShapeIndex::F45, 1, 0};
+        return true;
       case MazeLib::RobotBase::FastAction::F45_LP:
-        SlalomProcess(field::ShapeIndex::F45, 0, 1, straight, rp);
-        break;
+        fs = {field::ShapeIndex::F45, 0, 1};
+        return true;
       case MazeLib::RobotBase::FastAction::F45_RP:
-        SlalomProcess(field::ShapeIndex::F45, 1, 1, straight, rp);
-        break;
+        fs = {field::ShapeIndex::F45, 1, 1};
+        return true;
       case MazeLib::RobotBase::FastAction::FV90_L:
-        SlalomProcess(field::ShapeIndex::FV90, 0, 0, straight, rp);
-        break;
+        fs = {field::ShapeIndex::FV90, 0, 0};
+        return true;
       case MazeLib::RobotBase::FastAction::FV90_R:
-        SlalomProcess(field::ShapeIndex::FV90, 1, 0, straight, rp);
-        break;
+        fs = {field::ShapeIndex::FV90, 1, 0};
+        return true;
       case MazeLib::RobotBase::FastAction::FS90_L:
-        SlalomProcess(field::ShapeIndex::FS90, 0, 0, straight, rp);
-        break;
+        fs = {field::ShapeIndex::FS90, 0, 0};
+        return true;
       case MazeLib::RobotBase::FastAction::FS90_R:
-        SlalomProcess(field::ShapeIndex::FS90, 1, 0, straight, rp);
-        break;
+        fs = {field::ShapeIndex::FS90, 1, 0};
+        return true;
       case MazeLib::RobotBase::FastAction::F90_L:
-        SlalomProcess(field::ShapeIndex::F90, 0, 0, straight, rp);
-        break;
+        fs = {field::ShapeIndex::F90, 0, 0};
+        return true;
       case MazeLib::RobotBase::FastAction::F90_R:
-        SlalomProcess(field::ShapeIndex::F90, 1, 0, straight, rp);
-        break;
+        fs = {field::ShapeIndex::F90, 1, 0};
+        return true;
       case MazeLib::RobotBase::FastAction::F135_L:
-        SlalomProcess(field::ShapeIndex::F135, 0, 0, straight, rp);
-        break;
+        fs = {field::ShapeIndex::F135, 0, 0};
+        return true;
       case MazeLib::RobotBase::FastAction::F135_R:
-        SlalomProcess(field::ShapeIndex::F135, 1, 0, straight, rp);
-        break;
+        fs = {field::ShapeIndex::F135, 1, 0};
+        return true;
       case MazeLib::RobotBase::FastAction::F135_LP:
-        SlalomProcess(field::ShapeIndex::F135, 0, 1, straight, rp);
-        break;
+        fs = {field::ShapeIndex::F135, 0, 1};
+        return true;
       case MazeLib::RobotBase::FastAction::F135_RP:
-        SlalomProcess(field::ShapeIndex::F135, 1, 1, straight, rp);
-        break;
+        fs = {field::ShapeIndex::F135, 1, 1};
+        return true;
       case MazeLib::RobotBase::FastAction::F180_L:
-        SlalomProcess(field::ShapeIndex::F180, 0, 0, straight, rp);
-        break;
+        fs = {field::ShapeIndex::F180, 0, 0};
+        return true;
       case MazeLib::RobotBase::FastAction::F180_R:
-        SlalomProcess(field::ShapeIndex::F180, 1, 0, straight, rp);
-        break;
+        fs = {field::ShapeIndex::F180, 1, 0};
+        return true;
+      default:
+        return false;
+    }
+  }
+  /**
+   * @brief 最短走行の直線の長さを取得する (直線でなければ 0)
+   */
+  static float get_fast_straight(const MazeLib::RobotBase::FastAction action) {
+    switch (action) {
       case MazeLib::RobotBase::FastAction::F_ST_FULL:
-        straight += field::kCellLengthFull;
-        break;
+        return field::kCellLengthFull;
       case MazeLib::RobotBase::FastAction::F_ST_HALF:
-        straight += field::kCellLengthFull / 2;
-        break;
+        return field::kCellLengthFull / 2;
       case MazeLib::RobotBase::FastAction::F_ST_DIAG:
-        straight += field::kCellLengthDiag / 2;
-        break;
+        return field::kCellLengthDiag / 2;
       default:
-        break;
+        return 0;
     }
   }
+  void fast_run_switch(const MazeLib::RobotBase::FastAction action,
+                       float& straight, const RunParameter& rp) {
+    MA_LOGD("FastAction: %s", MazeLib::RobotBase::getFastActionName(action));
+    FastSlalom fs;
+    if (get_fast_slalom(action, fs))
+      SlalomProcess(fs.si, fs.mirror_x, fs.reverse, straight, rp);
+    else
+      straight += get_fast_straight(action);
+  }
+  /**
+   * @brief 最短経路を直線とターンの列に変換し，速度計画を行う
+   *
+   * 直線の連結は fast_run_switch() と SlalomProcess() と同じ．
+   */
+  void fast_run_plan(const std::string& path, float straight,
+                     const RunParameter& rp,
+                     utils::VelocityPlanner& planner) const {
+    planner.clear();
+    for (const char c : path) {
+      const auto action = static_cast<MazeLib::RobotBase::FastAction>(c);
+      FastSlalom fs;
+      if (!get_fast_slalom(action, fs)) {
+        straight += get_fast_straight(action);
+        continue;
+      }
+      const auto& shape = field::shapes[fs.si];
+      straight += fs.reverse ? shape.straight_post : shape.straight_prev;
+      planner.add_straight(straight);
+      planner.add_turn(fs.si, fs.mirror_x, rp.v_slalom[fs.si],
+                       slalom_k_times[fs.si]);
+      straight = fs.reverse ? shape.straight_prev : shape.straight_post;
+    }
+    planner.add_straight(straight);
+    planner.plan();
+  }
+  /**
+   * @brief スラロームの所要時間と速度の積 (速度によらず一定) [mm]
+   */
+  float calc_slalom_k_time(const field::ShapeIndex si) const {
+    const auto& shape = field::shapes[si];
+#if MOVE_ACTION_SLALOM_TABLE_ENABLED
+    return slalom_tables[si].getTimeCurve(shape.v_ref) * shape.v_ref;
+#else
+    ctrl::slalom::Trajectory trajectory(shape, false);
+    trajectory.reset(shape.v_ref);
+    return trajectory.getTimeCurve() * shape.v_ref;
+#endif
+  }
 
  private:
   bool position_recovery() {
@@ -1036,7 +1302,7 @@ class MoveAction {
       sp->sc->sampling_wait();
       const float delta = sp->sc->est_p.x * std::cos(-sp->sc->est_p.th) -
                           sp->sc->est_p.y * std::sin(-sp->sc->est_p.th);
-      constexpr float back_gain = model::turn_back_gain;
+      const float back_gain = config::parameters().turn_back_gain;
       sp->sc->set_target(-delta * back_gain, ad.v(t), 0, ad.a(t));
       if (ad.x(t) > 2 * PI * index / table_size) {
         index++;
@@ -15,6 +15,25 @@
 /* Drive Mode */
 #define MACHINE_DRIVE_AUTO_ENABLED 0
 
+/* Control Loop Period */
+/* 内側の速度制御ループ周期 [us] (1000: 1 kHz, 500: 2 kHz, 250: 4 kHz) */
+/* 500, 250 の処理時間は実機で未計測．下の PROFILER で確かめてから使う */
+#ifndef SPEED_CONTROLLER_SAMPLING_PERIOD_US
+#define SPEED_CONTROLLER_SAMPLING_PERIOD_US 1000
+#endif
+/* 軌道生成ループ周期 [us] (速度制御ループ周期の整数倍) */
+#ifndef SPEED_CONTROLLER_CONTROL_PERIOD_US
+#define SPEED_CONTROLLER_CONTROL_PERIOD_US 1000
+#endif
+/* 速度制御ループの処理時間の計測 */
+#define SPEED_CONTROLLER_PROFILER_ENABLED 0
+
+/* Reflector */
+/* 250 の約数で，250 / 回数 [us] に ADC の 2 回の変換が収まること (5 まで) */
+/* 250 の約数で，250 / 回数 [us] に ADC の 2 回の変換が収まること (5 以下) */
+/* 点灯の間隔で LED の光量が変わるので，変えたら壁センサを較正し直す */
+#define REFLECTOR_DEMODULATION_PAIRS 1
+
 /* Log Target */
 #define APP_LOG_MEM_MODE_ENABLED 0
 
@@ -38,10 +57,12 @@
 #define TASK_PRIORITY_BUZZER 1
 #define TASK_PRIORITY_DRIVE 2
 #define TASK_PRIORITY_PRINT 1
+#define TASK_PRIORITY_FLASH_WRITER 1
 
 /* Core ID */
 /* Application CPU */
 #define TASK_CORE_ID_REFLECTOR APP_CPU_NUM
+#define TASK_CORE_ID_FLASH_WRITER APP_CPU_NUM
 /* Processor CPU */
 #define TASK_CORE_ID_ENCODER PRO_CPU_NUM
 #define TASK_CORE_ID_IMU PRO_CPU_NUM
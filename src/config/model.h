@@ -42,6 +42,7 @@ static constexpr float wall_front_attach_end = 0.4f;
 static constexpr float wall_avoid_alpha = 0.05f;
 static constexpr float wall_fix_theta_gain = 1e-8f;
 static constexpr float wall_comb_threshold = 54;
+static constexpr float wall_cut_offset = -10;   //< 大きく: 前へ補正
 static constexpr float ref_max_length_mm = 45;  //< リフレクタの最大計測距離
 static constexpr float ref_saturation_value = 3100;  //< リフレクタの飽和値
 /* Model */
@@ -57,8 +58,12 @@ static constexpr ctrl::FeedbackController<ctrl::Polar>::Gain
         .Kd = ctrl::Polar(0.0, 0.0),
 };
 static constexpr float turn_back_gain = 10.0f;
-/* Velocity Estimation IIR Filter gain */
+/* Velocity Estimation IIR Filter gain (1 ms あたり) */
 static constexpr ctrl::Polar velocity_filter_alpha = ctrl::Polar(1.0f, 1.0f);
+/* Odometry Slip Angle Gain: beta = k v w [s/mm] (0: 横滑りなし) */
+static constexpr float slip_angle_gain = 0.0f;
+/* Grip: タイヤの摩擦円の半径 (横と前後の合成加速度の上限) [mm/s/s] */
+static constexpr float grip_acceleration = 6000.0f;
 /* Trajectory Tracking Gain */
 static constexpr ctrl::TrajectoryTracker::Gain TrajectoryTrackerGain = {
     .zeta = 0.8f,
@@ -90,6 +95,7 @@ static constexpr float wall_front_attach_end = 0.4f;
 static constexpr float wall_avoid_alpha = 0.05f;
 static constexpr float wall_fix_theta_gain = 1e-8f;
 static constexpr float wall_comb_threshold = 54;
+static constexpr float wall_cut_offset = -10;   //< 大きく: 前へ補正
 static constexpr float ref_max_length_mm = 90;  //< リフレクタの最大計測距離
 static constexpr float ref_saturation_value = 3600;  //< リフレクタの飽和値
 /* Model */
@@ -105,8 +111,12 @@ static constexpr ctrl::FeedbackController<ctrl::Polar>::Gain
         .Kd = ctrl::Polar(0.0, 0.0),
 };
 static constexpr float turn_back_gain = 10.0f;
-/* Velocity Estimation IIR Filter gain */
+/* Velocity Estimation IIR Filter gain (1 ms あたり) */
 static constexpr ctrl::Polar velocity_filter_alpha = ctrl::Polar(1.0f, 1.0f);
+/* Odometry Slip Angle Gain: beta = k v w [s/mm] (0: 横滑りなし) */
+static constexpr float slip_angle_gain = 0.0f;
+/* Grip: タイヤの摩擦円の半径 (横と前後の合成加速度の上限) [mm/s/s] */
+static constexpr float grip_acceleration = 6000.0f;
 /* Trajectory Tracking Gain */
 static constexpr ctrl::TrajectoryTracker::Gain TrajectoryTrackerGain = {
     .zeta = 0.8f,
@@ -138,6 +148,7 @@ static constexpr float wall_front_attach_end = 0.1f;
 static constexpr float wall_avoid_alpha = 0.05f;
 static constexpr float wall_fix_theta_gain = 1e-7f;
 static constexpr float wall_comb_threshold = 54;
+static constexpr float wall_cut_offset = -10;   //< 大きく: 前へ補正
 static constexpr float ref_max_length_mm = 90;  //< リフレクタの最大計測距離
 static constexpr float ref_saturation_value = 3600;  //< リフレクタの飽和値
 /* Model */
@@ -153,8 +164,12 @@ static constexpr ctrl::FeedbackController<ctrl::Polar>::Gain
         .Kd = ctrl::Polar(0, 0),
 };
 static constexpr float turn_back_gain = 10.0f;
-/* Velocity Estimation IIR Filter gain */
+/* Velocity Estimation IIR Filter gain (1 ms あたり) */
 static constexpr ctrl::Polar velocity_filter_alpha = ctrl::Polar(0.2f, 1.0f);
+/* Odometry Slip Angle Gain: beta = k v w [s/mm] (0: 横滑りなし) */
+static constexpr float slip_angle_gain = 0.0f;
+/* Grip: タイヤの摩擦円の半径 (横と前後の合成加速度の上限) [mm/s/s] */
+static constexpr float grip_acceleration = 6000.0f;
 /* Trajectory Tracking Gain */
 static constexpr ctrl::TrajectoryTracker::Gain TrajectoryTrackerGain = {
     .zeta = 0.8f,
@@ -186,6 +201,7 @@ static constexpr float wall_front_attach_end = 0.1f;
 static constexpr float wall_avoid_alpha = 0.05f;
 static constexpr float wall_fix_theta_gain = 1e-7f;
 static constexpr float wall_comb_threshold = 80;
+static constexpr float wall_cut_offset = -10;   //< 大きく: 前へ補正
 static constexpr float ref_max_length_mm = 90;  //< リフレクタの最大計測距離
 static constexpr float ref_saturation_value = 3600;  //< リフレクタの飽和値
 /* Model */
@@ -201,8 +217,12 @@ static constexpr ctrl::FeedbackController<ctrl::Polar>::Gain
         .Kd = ctrl::Polar(0, 0),
 };
 static constexpr float turn_back_gain = 10.0f;
-/* Velocity Estimation IIR Filter gain */
+/* Velocity Estimation IIR Filter gain (1 ms あたり) */
 static constexpr ctrl::Polar velocity_filter_alpha = ctrl::Polar(0.2f, 1.0f);
+/* Odometry Slip Angle Gain: beta = k v w [s/mm] (0: 横滑りなし) */
+static constexpr float slip_angle_gain = 0.0f;
+/* Grip: タイヤの摩擦円の半径 (横と前後の合成加速度の上限) [mm/s/s] */
+static constexpr float grip_acceleration = 6000.0f;
 /* Trajectory Tracking Gain */
 static constexpr ctrl::TrajectoryTracker::Gain TrajectoryTrackerGain = {
 #if 1
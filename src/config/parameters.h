@@ -0,0 +1,108 @@
+/**
+ * @file parameters.h
+ * @brief 実行時に変更できるパラメータ
+ * @author Ryotaro Onuki <kerikun11+github@gmail.com>
+ * @date 2024-02-04
+ * @copyright Copyright 2024 Ryotaro Onuki <kerikun11+github@gmail.com>
+ */
+#pragma once
+
+#include <cstddef>  //< for offsetof
+
+#include "config/model.h"
+#include "utils/parameter_store.hpp"
+
+namespace config {
+
+/**
+ * @brief 実行時パラメータ
+ *
+ * 既定値は model.h の値．メンバは float, int32_t またはそれらの集まりに限る．
+ */
+struct Parameters {
+  /* ToF */
+  float tof_raw_range_90 = model::tof_raw_range_90;
+  float tof_raw_range_180 = model::tof_raw_range_180;
+  float wall_fix_offset = model::wall_fix_offset;
+  /* Reflector */
+  int32_t ui_thr_ref_front = model::ui_thr_ref_front;
+  int32_t ui_thr_ref_side = model::ui_thr_ref_side;
+  float wall_front_attach_gain = model::wall_front_attach_gain;
+  float wall_front_attach_end = model::wall_front_attach_end;
+  float wall_avoid_alpha = model::wall_avoid_alpha;
+  float wall_fix_theta_gain = model::wall_fix_theta_gain;
+  float wall_comb_threshold = model::wall_comb_threshold;
+  float wall_cut_offset = model::wall_cut_offset;
+  float ref_max_length_mm = model::ref_max_length_mm;
+  float ref_saturation_value = model::ref_saturation_value;
+  /* Speed Controller */
+  ctrl::FeedbackController<ctrl::Polar>::Gain SpeedControllerGain =
+      model::SpeedControllerGain;
+  float turn_back_gain = model::turn_back_gain;
+  ctrl::Polar velocity_filter_alpha = model::velocity_filter_alpha;
+  float slip_angle_gain = model::slip_angle_gain;
+  float grip_acceleration = model::grip_acceleration;
+  /* Trajectory Tracker */
+  ctrl::TrajectoryTracker::Gain TrajectoryTrackerGain =
+      model::TrajectoryTrackerGain;
+};
+
+using ParameterStore = utils::ParameterStore<Parameters>;
+
+#define PARAMETER_ENTRY(type, member) \
+  { #member, ParameterStore::Type::type, offsetof(Parameters, member) }
+
+/**
+ * @brief 名前と型の表 (シリアルでの読み書きと保存に使う)
+ */
+inline const std::vector<ParameterStore::Entry>& parameter_entries() {
+  static const std::vector<ParameterStore::Entry> entries = {
+      PARAMETER_ENTRY(Float, tof_raw_range_90),
+      PARAMETER_ENTRY(Float, tof_raw_range_180),
+      PARAMETER_ENTRY(Float, wall_fix_offset),
+      PARAMETER_ENTRY(Int, ui_thr_ref_front),
+      PARAMETER_ENTRY(Int, ui_thr_ref_side),
+      PARAMETER_ENTRY(Float, wall_front_attach_gain),
+      PARAMETER_ENTRY(Float, wall_front_attach_end),
+      PARAMETER_ENTRY(Float, wall_avoid_alpha),
+      PARAMETER_ENTRY(Float, wall_fix_theta_gain),
+      PARAMETER_ENTRY(Float, wall_comb_threshold),
+      PARAMETER_ENTRY(Float, wall_cut_offset),
+      PARAMETER_ENTRY(Float, ref_max_length_mm),
+      PARAMETER_ENTRY(Float, ref_saturation_value),
+      PARAMETER_ENTRY(Float, SpeedControllerGain.Kp.tra),
+      PARAMETER_ENTRY(Float, SpeedControllerGain.Kp.rot),
+      PARAMETER_ENTRY(Float, SpeedControllerGain.Ki.tra),
+      PARAMETER_ENTRY(Float, SpeedControllerGain.Ki.rot),
+      PARAMETER_ENTRY(Float, SpeedControllerGain.Kd.tra),
+      PARAMETER_ENTRY(Float, SpeedControllerGain.Kd.rot),
+      PARAMETER_ENTRY(Float, turn_back_gain),
+      PARAMETER_ENTRY(Float, velocity_filter_alpha.tra),
+      PARAMETER_ENTRY(Float, velocity_filter_alpha.rot),
+      PARAMETER_ENTRY(Float, slip_angle_gain),
+      PARAMETER_ENTRY(Float, grip_acceleration),
+      PARAMETER_ENTRY(Float, TrajectoryTrackerGain.zeta),
+      PARAMETER_ENTRY(Float, TrajectoryTrackerGain.omega_n),
+      PARAMETER_ENTRY(Float, TrajectoryTrackerGain.low_zeta),
+      PARAMETER_ENTRY(Float, TrajectoryTrackerGain.low_b),
+  };
+  return entries;
+}
+
+#undef PARAMETER_ENTRY
+
+static constexpr auto PARAMETERS_PATH = "/spiffs/parameters.bin";
+
+/**
+ * @brief 実行時パラメータの保存先 (起動時に model.h の値で初期化)
+ */
+inline ParameterStore& parameter_store() {
+  static ParameterStore store(Parameters(), parameter_entries());
+  return store;
+}
+/**
+ * @brief 現在の実行時パラメータのコピー (ロックフリー)
+ */
+inline Parameters parameters() { return parameter_store().get(); }
+
+}  // namespace config
@@ -11,11 +11,17 @@
 #include <drivers/ma730/ma730.h>
 #include <freertospp/semphr.h>
 
+#include <atomic>
 #include <cmath>  //< for std::sin
+#include <condition_variable>
+#include <cstddef>  //< for offsetof
+#include <fstream>  //< for std::ifstream, std::ofstream
 #include <mutex>
 #include <vector>
 
 #include "app_log.h"
+#include "utils/crc32.hpp"
+#include "utils/encoder_calibrator.hpp"
 #include "utils/wheel_position.h"
 
 namespace hardware {
@@ -36,6 +42,25 @@ class Encoder {
     std::array<float, 2> ec_gain = {0, 0};
     std::array<float, 2> ec_phase = {0, 0};
   };
+  /**
+   * @brief フラッシュに保存する偏心補正値のレコード
+   */
+  struct CalibrationRecord {
+    static constexpr uint32_t kMagic = 0x4B454E43;  //< "KENC"
+    static constexpr uint16_t kVersion = 1;
+    uint32_t magic = kMagic;
+    uint16_t version = kVersion;
+    uint16_t size = sizeof(CalibrationRecord);
+    std::array<float, 2> ec_gain = {0, 0};
+    std::array<float, 2> ec_phase = {0, 0};
+    uint32_t crc = 0;  //< crc より前の CRC-32
+
+    uint32_t calc_crc() const {
+      return utils::crc32(this, offsetof(CalibrationRecord, crc));
+    }
+  };
+  static constexpr auto ENCODER_CALIBRATION_PATH =
+      "/spiffs/encoder_calibration.bin";
 
  private:
   static constexpr float PI = 3.14159265358979323846f;
@@ -44,6 +69,8 @@ class Encoder {
   Encoder() {}
   bool init(const Parameter& param) {
     param_ = param;
+    /* 保存済みの偏心補正値があれば model.h の値より優先する */
+    restore();
     switch (param_.sensor_type) {
       case SensorType::AS5048A:
         as_ = new drivers::AS5048A_DUAL();
@@ -103,6 +130,78 @@ class Encoder {
   void sampling_wait(TickType_t xBlockTime = portMAX_DELAY) const {
     sampling_end_semaphore_.take(xBlockTime);
   }
+  /**
+   * @brief 偏心補正値の同定．両輪を一定速度で空転させた状態で呼ぶこと．
+   *
+   * @param num_samples 同定に使うサンプル数
+   * @return true 同定に成功し，補正値を更新した
+   */
+  bool calibration(const int num_samples = 1000) {
+    calibration_num_samples_ = num_samples;
+    calibrators_.assign(2, utils::EncoderCalibrator(pulses_size_));
+    calibration_req_ = true;
+    /* wait for calibration finished */
+    std::unique_lock<std::mutex> unique_lock(calibration_mutex_);
+    calibration_cv_.wait(unique_lock, [&] { return !calibration_req_; });
+    /* check result */
+    std::array<utils::EncoderCalibrator::Result, 2> results;
+    for (int i = 0; i < 2; ++i) {
+      results[i] = calibrators_[i].getResult();
+      const float pps = calibrators_[i].getPulsesPerSample();
+      APP_LOGI("Encoder[%d] gain: %f phase: %f (%f pulses/sample)", i,
+               (double)results[i].gain, (double)results[i].phase, (double)pps);
+      /* 回転していない or 1周期内で折り返すほど速い場合は同定できない */
+      if (std::abs(pps) < 1 || std::abs(pps) > pulses_size_ / 4) {
+        APP_LOGE("Encoder[%d] is not spinning properly.", i);
+        return false;
+      }
+    }
+    std::lock_guard<std::mutex> lock_guard(mutex_);
+    for (int i = 0; i < 2; ++i) {
+      param_.ec_gain[i] = results[i].gain;
+      param_.ec_phase[i] = results[i].phase;
+    }
+    return true;
+  }
+  bool backup(const char* filepath = ENCODER_CALIBRATION_PATH) const {
+    CalibrationRecord record;
+    {
+      std::lock_guard<std::mutex> lock_guard(mutex_);
+      record.ec_gain = param_.ec_gain;
+      record.ec_phase = param_.ec_phase;
+    }
+    record.crc = record.calc_crc();
+    std::ofstream of(filepath, std::ios::binary);
+    if (of.fail()) {
+      APP_LOGE("Can't open file. filepath: %s", filepath);
+      return false;
+    }
+    of.write((const char*)&record, sizeof(record));
+    return true;
+  }
+  bool restore(const char* filepath = ENCODER_CALIBRATION_PATH) {
+    std::ifstream f(filepath, std::ios::binary);
+    if (f.fail()) {
+      APP_LOGW("Can't open file. filepath: %s", filepath);
+      return false;
+    }
+    CalibrationRecord record;
+    f.read((char*)&record, sizeof(record));
+    if (f.gcount() != sizeof(record) ||
+        record.magic != CalibrationRecord::kMagic ||
+        record.version != CalibrationRecord::kVersion ||
+        record.size != sizeof(record) || record.crc != record.calc_crc()) {
+      APP_LOGE("invalid calibration record. filepath: %s", filepath);
+      return false;
+    }
+    std::lock_guard<std::mutex> lock_guard(mutex_);
+    param_.ec_gain = record.ec_gain;
+    param_.ec_phase = record.ec_phase;
+    APP_LOGI("Encoder Calibration Restored: %f %f %f %f",
+             (double)param_.ec_gain[0], (double)param_.ec_phase[0],
+             (double)param_.ec_gain[1], (double)param_.ec_phase[1]);
+    return true;
+  }
 
  private:
   TaskHandle_t handle_ = NULL;
@@ -119,6 +218,12 @@ class Encoder {
   int pulses_prev_[2] = {};
   int pulses_ovf_[2] = {};
 
+  int calibration_num_samples_ = 0;
+  std::vector<utils::EncoderCalibrator> calibrators_;
+  std::atomic<bool> calibration_req_{false};  //< UI タスク → エンコーダタスク
+  std::mutex calibration_mutex_;
+  std::condition_variable calibration_cv_;
+
   void task() {
     while (1) {
       /* sync */
@@ -127,8 +232,17 @@ class Encoder {
       update();
       /* notify */
       sampling_end_semaphore_.give();
+      /* calibration */
+      if (calibration_req_) task_calibration();
     }
   }
+  void task_calibration() {
+    for (int i = 0; i < 2; ++i) calibrators_[i].push(pulses_[i]);
+    if (calibrators_[0].size() < calibration_num_samples_) return;
+    std::lock_guard<std::mutex> lock_guard(calibration_mutex_);
+    calibration_req_ = false;
+    calibration_cv_.notify_all();
+  }
   void update() {
     /* fetch data from encoder */
     switch (param_.sensor_type) {
@@ -13,6 +13,7 @@
 #include "hardware/tof.h"
 /* Config */
 #include "config/io_mapping.h"
+#include "config/parameters.h"
 
 namespace hardware {
 
@@ -32,6 +33,9 @@ class Hardware {
 
  private:
   static constexpr float thr_battery = 3.8f;
+  static constexpr float thr_wheel_stationary = 0.5f;  //< [mm]
+  static constexpr float thr_bias_confidence = 0.9f;
+  WheelPosition wp_rest_;
 
  public:
   Hardware() {}
@@ -94,10 +98,13 @@ class Hardware {
     ToF::Parameter tof_param = {
         .i2c_port = I2C_PORT_NUM_TOF,
         .max_convergence_time_ms = model::vl6180x_max_convergence_time,
-        .reference_range_90mm = model::tof_raw_range_90,
-        .reference_range_180mm = model::tof_raw_range_180,
+        .reference_range_90mm = config::parameters().tof_raw_range_90,
+        .reference_range_180mm = config::parameters().tof_raw_range_180,
     };
     if (!tof->init(tof_param)) bz->play(hardware::Buzzer::ERROR);
+    config::parameter_store().add_listener([this](const auto& p) {
+      tof->set_reference_range(p.tof_raw_range_90, p.tof_raw_range_180);
+    });
     /* Motor */
     mt = new Motor(MOTOR_MCPWM_GROUP_ID, MOTOR_L_CTRL1_PIN, MOTOR_L_CTRL2_PIN,
                    MOTOR_R_CTRL1_PIN, MOTOR_R_CTRL2_PIN);
@@ -114,11 +121,31 @@ class Hardware {
   void sampling_wait() {
     imu->sampling_wait();
     enc->sampling_wait();
+    /* IMU のオフセット逐次推定のため車輪の静止を判定 */
+    const auto wp = enc->get_wheel_position();
+    bool stationary = true;
+    for (int i = 0; i < 2; ++i) {
+      if (std::abs(wp[i] - wp_rest_[i]) > thr_wheel_stationary) {
+        stationary = false;
+        wp_rest_ = wp;
+        break;
+      }
+    }
+    imu->set_wheel_stationary(stationary);
   }
-  void calibration() {
+  /**
+   * @brief 走行前のキャリブレーション
+   *
+   * 静止中の逐次推定で IMU のオフセットが十分に確からしい場合は待たずに終了する．
+   * @return float IMU のオフセットの信頼度 [0, 1]
+   */
+  float calibration() {
+    enc->clear_offset();
+    if (imu->get_bias_confidence() >= thr_bias_confidence)
+      return imu->get_bias_confidence();
     bz->play(hardware::Buzzer::CALIBRATION);
     imu->calibration();
-    enc->clear_offset();
+    return imu->get_bias_confidence();
   }
 
   /**
@@ -11,12 +11,14 @@
 #include <drivers/icm20602/icm20602.h>
 #include <freertospp/semphr.h>
 
+#include <atomic>
 #include <condition_variable>
 #include <iostream>  //< for std::cout
 #include <mutex>
 #include <vector>
 
 #include "app_log.h"
+#include "utils/bias_tracker.hpp"
 
 namespace hardware {
 
@@ -65,6 +67,19 @@ class IMU {
     std::unique_lock<std::mutex> unique_lock(calibration_mutex_);
     calibration_cv_.wait(unique_lock, [&] { return !calibration_req_; });
   }
+  /**
+   * @brief 静止中に逐次推定しているオフセットの信頼度 [0, 1]
+   */
+  float get_bias_confidence() const {
+    std::lock_guard<std::mutex> lock_guard(mutex_);
+    return bias_tracker_.get_confidence();
+  }
+  /**
+   * @brief 車輪が静止しているかを通知する (オフセットの逐次推定用)
+   */
+  void set_wheel_stationary(const bool stationary) {
+    wheel_stationary_ = stationary;
+  }
   void sampling_request() {
     xTaskNotifyGive(handle_);  //
   }
@@ -127,8 +142,10 @@ class IMU {
 
   freertospp::Semaphore sampling_end_semaphore_;
   MotionParameter gyro_offset_, accel_offset_;
+  utils::BiasTracker bias_tracker_;
+  std::atomic<bool> wheel_stationary_{false};  //< 制御タスク → IMU タスク
 
-  bool calibration_req_ = false;
+  std::atomic<bool> calibration_req_{false};  //< UI タスク → IMU タスク
   std::mutex calibration_mutex_;
   std::condition_variable calibration_cv_;
 
@@ -165,6 +182,9 @@ class IMU {
       accel_offset_ += accel_sum / ave_count;
       gyro_offset_ += gyro_sum / ave_count;
     }
+    /* 逐次推定をキャリブレーション結果から再開 */
+    std::lock_guard<std::mutex> lock_guard(mutex_);
+    bias_tracker_.reset(gyro_offset_, accel_offset_, true);
   }
   void update() {
     /* sampling */
@@ -181,6 +201,7 @@ class IMU {
 
     if (icm_.size() == 1) {
       const auto prev_gyro_z = gyro_.z;
+      update_offset(raw_gyro_[0], raw_accel_[0]);
       gyro_ = raw_gyro_[0] - gyro_offset_;
       accel_ = raw_accel_[0] - accel_offset_;
       /* calculate angular accel */
@@ -197,8 +218,11 @@ class IMU {
       raw_accel_[0].x = -raw_accel_[0].x;
       raw_accel_[0].y = -raw_accel_[0].y;
       /* average multiple sensor value */
-      gyro_ = (raw_gyro_[0] + raw_gyro_[1]) / 2 - gyro_offset_;
-      accel_ = (raw_accel_[0] + raw_accel_[1]) / 2 - accel_offset_;
+      const auto gyro_raw = (raw_gyro_[0] + raw_gyro_[1]) / 2;
+      const auto accel_raw = (raw_accel_[0] + raw_accel_[1]) / 2;
+      update_offset(gyro_raw, accel_raw);
+      gyro_ = gyro_raw - gyro_offset_;
+      accel_ = accel_raw - accel_offset_;
       /* calculate angular accel */
       angular_accel_ =
           (raw_accel_[0].y + raw_accel_[1].y) / 2 / rotation_radius_;
@@ -206,6 +230,16 @@ class IMU {
       APP_LOGE("IMU size error. icm_.size(): %d", icm_.size());
     }
   }
+  void update_offset(const MotionParameter& gyro_raw,
+                     const MotionParameter& accel_raw) {
+    /* 静止キャリブレーション中は逐次推定しない */
+    if (calibration_req_) return;
+    /* 静止中はオフセットを逐次更新 (zero velocity update) */
+    if (bias_tracker_.update(gyro_raw, accel_raw, wheel_stationary_)) {
+      gyro_offset_ = bias_tracker_.get_gyro_bias();
+      accel_offset_ = bias_tracker_.get_accel_bias();
+    }
+  }
 };
 
 };  // namespace hardware
@@ -16,6 +16,7 @@
 #include "app_log.h"
 #include "config/config.h"
 #include "peripheral/adc.h"
+#include "utils/lock_in_demodulator.hpp"
 #include "utils/timer_semaphore.h"
 
 namespace hardware {
@@ -24,9 +25,17 @@ class Reflector {
  public:
   static constexpr int kNumChannels = 4;  //< SL SR FL FR
   static constexpr int kSamplingPeriodMicroSeconds = 250;
+  static constexpr int kDemodulationPairs = REFLECTOR_DEMODULATION_PAIRS;
+  /* 1 回の点灯に要る区間 [us] (ADC の 2 回の変換を 20 us ずつと見積もる) */
+  static constexpr int kSlotMinMicroSeconds = 50;
+  static_assert(kSamplingPeriodMicroSeconds % kDemodulationPairs == 0,
+                "REFLECTOR_DEMODULATION_PAIRS must divide the period");
+  static_assert(kSamplingPeriodMicroSeconds / kDemodulationPairs >=
+                    kSlotMinMicroSeconds,
+                "REFLECTOR_DEMODULATION_PAIRS is too large for the ADC");
 
  public:
-  Reflector() {}
+  Reflector() : demodulator_(kDemodulationPairs) {}
   bool init(const std::array<gpio_num_t, kNumChannels>& gpio_nums_tx,
             const std::array<adc_channel_t, kNumChannels>& rx_channels) {
     gpio_nums_tx_ = gpio_nums_tx;
@@ -74,24 +83,36 @@ class Reflector {
 
   mutable std::mutex mutex_;                 //< value用のMutex
   std::array<int16_t, kNumChannels> value_;  //< リフレクタの測定値 SL SR FL FR
+  /* 点灯と消灯の組の平均 (task() の中だけで使う) */
+  utils::LockInDemodulator<kNumChannels> demodulator_;
 
+  /**
+   * @brief 1 ms の周期で各チャンネルを kDemodulationPairs 回ずつ点灯する
+   *
+   * 区間を組の数で分け，チャンネルを同じ順に繰り返す．各チャンネルの組は
+   * 周期の中で等間隔になる．LED が点灯してから次に点灯するまでの時間
+   * (充電の時間) は 1 ms / kDemodulationPairs に縮むので，光量も変わる．
+   * 最後の組で平均を値とするので，出力は 1 kHz のまま．
+   */
   void task() {
-    timer_semaphore_.startPeriodic(kSamplingPeriodMicroSeconds);
+    timer_semaphore_.startPeriodic(kSamplingPeriodMicroSeconds /
+                                   kDemodulationPairs);
     while (1) {
-      for (int i : {2, 1, 0, 3}) {  //< FL SR SL FR
-        // Sync
-        timer_semaphore_.take();  //< 干渉防止のウエイト
-        // Sampling
-        int offset = peripheral::ADC::read_raw(rx_channels_[i]);  //< ADC取得
-        gpio_set_level(gpio_nums_tx_[i], 1);                    //< 放電開始
-        int peak = peripheral::ADC::read_raw(rx_channels_[i]);  //< ADC取得
-        gpio_set_level(gpio_nums_tx_[i], 0);                    //< 充電開始
-        // Calculation
-        int diff = peak - offset;  //< オフセットとの差をとる
-        if (diff < 1) diff = 1;    //< 0以下にならないように1で飽和
-        // Result
-        std::lock_guard<std::mutex> lock_guard(mutex_);  //< lock value
-        value_[i] = diff;
+      for (int k = 0; k < kDemodulationPairs; k++) {
+        for (int i : {2, 1, 0, 3}) {  //< FL SR SL FR
+          // Sync
+          timer_semaphore_.take();  //< 干渉防止のウエイト
+          // Sampling
+          int offset = peripheral::ADC::read_raw(rx_channels_[i]);  //< ADC取得
+          gpio_set_level(gpio_nums_tx_[i], 1);                      //< 放電開始
+          int peak = peripheral::ADC::read_raw(rx_channels_[i]);    //< ADC取得
+          gpio_set_level(gpio_nums_tx_[i], 0);                      //< 充電開始
+          // Calculation (組がそろったら平均し，0以下にならないように1で飽和)
+          if (!demodulator_.push(i, offset, peak)) continue;
+          // Result
+          std::lock_guard<std::mutex> lock_guard(mutex_);  //< lock value
+          value_[i] = demodulator_.value(i);
+        }
       }
     }
   }
@@ -29,6 +29,14 @@ class ToF {
 
  public:
   ToF() {}
+  /**
+   * @brief 距離換算の基準値を変更する
+   */
+  void set_reference_range(const float range_90mm, const float range_180mm) {
+    std::lock_guard<std::mutex> lock_guard(mutex_);
+    param_.reference_range_90mm = range_90mm;
+    param_.reference_range_180mm = range_180mm;
+  }
   bool init(const Parameter& param) {
     param_ = param;
     vl6180x_ = new VL6180X(param_.i2c_port);
@@ -7,11 +7,16 @@
  */
 #pragma once
 
+#include <functional>
+#include <vector>
+
 #include "agents/maze_robot.h"
 #include "config/config.h"
+#include "config/parameters.h"
 #include "freertospp/task.h"
 #include "peripheral/esp.h"
 #include "peripheral/spiffs.h"
+#include "utils/step_response_fitter.hpp"
 
 namespace machine {
 
@@ -44,8 +49,14 @@ class Machine {
         return esp_restart();
       case 11: /* システム同定 */
         return Machine::sysid();
-      case 12:
-        return Machine::encoder_test();
+      case 12: /* エンコーダ */
+        switch (sp->ui->waitForSelect(2)) {
+          case 0: /* 偏心補正の同定と保存 */
+            return Machine::encoder_calibration();
+          case 1: /* 空転のログ (tools/encoder) */
+            return Machine::encoder_test();
+        }
+        return;
       case 13:
         return Machine::slalom_test();
       case 14:
@@ -58,6 +69,12 @@ class Machine {
       case 15: /* ログの表示 */
         lgr->print();
         APP_LOG_DUMP();
+#if SPEED_CONTROLLER_PROFILER_ENABLED
+        sp->sc->print_profile();
+#endif
+        ma->search_tracer.print(std::cout);
+        mr->printFlashWriter();
+        mr->printStrategy();
         return;
     }
   }
@@ -82,7 +99,7 @@ class Machine {
     /* 異常検出 */
     if (!mr->isSolvable()) {
       hw->bz->play(hardware::Buzzer::ERROR);
-      mr->resetLastWalls(3);
+      mr->resetRecentWalls(3);
       return;
     }
     /* 走行オプション */
@@ -108,21 +125,24 @@ class Machine {
     value = sp->ui->waitForSelect(16);
     if (value < 0) return;
     if (value > 7) value -= 16;
-    for (auto& vs : ma->rp_fast.v_slalom)
+    for (auto& vs : ma->rp_fast.v_slalom_ref)
       // cppcheck-suppress useStlAlgorithm
       vs *= std::pow(ma->rp_fast.vs_factor, float(value));
+    ma->rp_fast.set_level(ma->rp_fast.level);
     /* 最大速度 */
     for (int i = 0; i < 2; i++) hw->bz->play(hardware::Buzzer::SHORT7);
     value = sp->ui->waitForSelect(16);
     if (value < 0) return;
     if (value > 7) value -= 16;
-    ma->rp_fast.v_max *= std::pow(ma->rp_fast.vm_factor, float(value));
+    ma->rp_fast.v_max_ref *= std::pow(ma->rp_fast.vm_factor, float(value));
+    ma->rp_fast.set_level(ma->rp_fast.level);
     /* 加速度 */
     for (int i = 0; i < 3; i++) hw->bz->play(hardware::Buzzer::SHORT7);
     value = sp->ui->waitForSelect(16);
     if (value < 0) return;
     if (value > 7) value -= 16;
-    ma->rp_fast.a_max *= std::pow(ma->rp_fast.vm_factor, float(value));
+    ma->rp_fast.a_max_ref *= std::pow(ma->rp_fast.vm_factor, float(value));
+    ma->rp_fast.set_level(ma->rp_fast.level);
     /* 成功 */
     hw->bz->play(hardware::Buzzer::SUCCESSFUL);
   }
@@ -130,15 +150,14 @@ class Machine {
     int value = sp->ui->waitForSelect(16);
     if (value < 0) return;
     ma->rp_fast = MoveAction::RunParameter();
-    if (value <= 7)
-      ma->rp_fast.up(value);
-    else
-      ma->rp_fast.down(16 - value);
+    ma->rp_fast.set_level(value <= 7 ? value : value - 16);
     hw->bz->play(hardware::Buzzer::SUCCESSFUL);
   }
   void selectRunConfig() {
     int mode = sp->ui->waitForSelect(16);
     if (mode < 0) return;
+    if (mode == 15) /* 実行時パラメータのシリアル設定 */
+      return Machine::parameterConsole();
     int value = sp->ui->waitForSelect(4);
     if (value < 0) return;
     switch (mode) {
@@ -174,6 +193,37 @@ class Machine {
         value = (value < 3) ? 12 : value;
         ma->rp_search.v_search = ma->rp_fast.v_search = 30 * value;
         break;
+      case 8: /* オドメトリの積分方法 (0: Euler, 1: Midpoint, 2: ExactArc) */
+        sp->sc->odometry_method =
+            static_cast<utils::OdometryMethod>(std::min(value, 2));
+        break;
+      case 9: /* 摩擦円からのターン速度 (使う割合: 40, 55, 70, 85 %) */
+        ma->set_turn_aggression(ma->rp_fast, 0.40f + 0.15f * value);
+        break;
+    }
+    hw->bz->play(hardware::Buzzer::SUCCESSFUL);
+  }
+  void parameterConsole() {
+    auto& store = config::parameter_store();
+    std::cout << "parameter console (type 'exit' to quit)" << std::endl;
+    store.execute("help", std::cout, config::PARAMETERS_PATH);
+    std::string line;
+    while (1) {
+      /* UART */
+      int c = getchar();
+      if (c == EOF) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+        continue;
+      }
+      if (c != '\n') {
+        line += char(c);
+        continue;
+      }
+      if (!line.empty() && line.back() == '\r') line.pop_back();
+      const bool keep =
+          store.execute(line, std::cout, config::PARAMETERS_PATH);
+      line.clear();
+      if (!keep) break;
     }
     hw->bz->play(hardware::Buzzer::SUCCESSFUL);
   }
@@ -239,7 +289,7 @@ class Machine {
     hw->bz->play(hardware::Buzzer::CANCEL);
   }
   void wallCalibration() {
-    int mode = sp->ui->waitForSelect(4);
+    int mode = sp->ui->waitForSelect(6);
     switch (mode) {
       case 0: /* 前壁補正データの保存 */
         hw->led->set(15);
@@ -269,7 +319,102 @@ class Machine {
       case 3: /* 壁センサのリアルタイム表示 */
         Machine::print_wall_detector();
         break;
+      case 4: /* 横壁の掃引による較正 */
+        return Machine::wall_sweep_calibration(false);
+#if WALL_DETECTOR_FRONT_SWEEP_ENABLED
+      case 5: /* 前壁の掃引による較正 */
+        return Machine::wall_sweep_calibration(true);
+#endif
+    }
+  }
+  /**
+   * @brief 距離を変えながらリフレクタの値を集め，チャンネルごとに曲線を当てる
+   *
+   * 真の距離はエンコーダとジャイロの自己位置から求める．
+   * 保存は wallCalibration() の 0 で行う．
+   * - 横壁: 1 点の較正と同じく区画の中央に置く．前後の区画も両側が壁の
+   *   通路にする．角度 alpha の斜めに進んでは向きを戻す階段状の動きで
+   *   横位置を変え，正面を向いて止まっている間だけ標本をとる
+   *   (斜めのまま測ると壁への入射角が変わり，値が横位置だけで決まらない)．
+   * - 前壁: 1 点の較正と同じ位置に置き，前後にゆっくり動く．
+   */
+  void wall_sweep_calibration(const bool front) {
+    hw->led->set(front ? 6 : 9);
+    if (!sp->ui->waitForCover(front)) return;
+    vTaskDelay(pdMS_TO_TICKS(1000));
+    hw->bz->play(hardware::Buzzer::CONFIRM);
+    hw->calibration();
+    sp->wd->calibration_sweep_begin();
+    sp->sc->enable();  //< includes position reset
+    const uint8_t channels =
+        front ? WallDetector::SWEEP_FRONT : WallDetector::SWEEP_SIDE;
+    auto sample = [&] {
+      WallDetector::WallValue truth;
+      truth.side = {-sp->sc->est_p.y, sp->sc->est_p.y};
+      truth.front = {-sp->sc->est_p.x, -sp->sc->est_p.x};
+      sp->wd->calibration_sweep_push(truth, channels);
+    };
+    bool result = true;
+    if (front) {
+      /* 10 mm 近づき，40 mm 離れてから元の位置に戻る */
+      for (const float dist : {10.0f, -50.0f, 40.0f})
+        result = result && wall_sweep_move(false, dist, sample);
+    } else {
+      const float alpha = PI / 6;
+      const float y_step = 2.5f;
+      const float y_max = 15.0f;
+      std::vector<float> ys = {-y_max};
+      while (ys.back() < y_max) ys.push_back(ys.back() + y_step);
+      ys.push_back(0);  //< 元の位置に戻る
+      float y = 0;
+      for (const float y_target : ys) {
+        const float dist = (y_target - y) / std::sin(alpha);
+        result = result && wall_sweep_move(true, alpha, nullptr) &&
+                 wall_sweep_move(false, dist, nullptr) &&
+                 wall_sweep_move(true, -alpha, nullptr);
+        if (!result) break;
+        /* 止まって標本をとる */
+        sp->sc->set_target(0, 0);
+        for (int i = 0; i < 200; ++i) {
+          sp->sc->sampling_wait();
+          sample();
+        }
+        y = sp->sc->est_p.y;
+      }
+    }
+    sp->sc->set_target(0, 0);
+    vTaskDelay(pdMS_TO_TICKS(100));
+    sp->sc->disable();
+    result = sp->wd->calibration_sweep_end(channels) && result;
+    if (hw->mt->is_emergency())
+      hw->mt->emergency_release(), hw->bz->play(hardware::Buzzer::EMERGENCY);
+    hw->bz->play(result ? hardware::Buzzer::SUCCESSFUL
+                        : hardware::Buzzer::ERROR);
+  }
+  /**
+   * @brief 掃引のためにゆっくり直進 [mm] または その場で回転 [rad] する
+   *
+   * @param sample 制御周期ごとに呼ぶ関数 (nullptr: なし)
+   * @return 非常停止しなければ true
+   */
+  bool wall_sweep_move(const bool rotation, const float x,
+                       const std::function<void()>& sample) {
+    const float sign = x < 0 ? -1 : 1;
+    ctrl::AccelDesigner ad;
+    if (rotation)
+      ad.reset(48 * PI, 4 * PI, PI / 2, 0, 0, std::abs(x));
+    else
+      ad.reset(24'000, 600, 60, 0, 0, std::abs(x));
+    for (float t = 0; t < ad.t_end() + 0.05f; t += sp->sc->Ts) {
+      if (rotation)
+        sp->sc->set_target(0, sign * ad.v(t), 0, sign * ad.a(t));
+      else
+        sp->sc->set_target(sign * ad.v(t), 0, sign * ad.a(t), 0);
+      sp->sc->sampling_wait();
+      if (sample) sample();
+      if (hw->mt->is_emergency()) return false;
     }
+    return true;
   }
   void setGoalPositions() {
     for (int i = 0; i < 2; i++) hw->bz->play(hardware::Buzzer::SHORT7);
@@ -338,7 +483,7 @@ class Machine {
       ad.reset(120'000, 3'000, 720, 0, 30, dist);
       /* start */
       sp->sc->enable();  //< includes position reset
-      for (float t = 0; !hw->mt->is_emergency(); t += 1e-3f) {
+      for (float t = 0; !hw->mt->is_emergency(); t += sp->sc->Ts) {
         sp->sc->set_target(ad.v(t), 0, ad.a(t), 0);
         sp->sc->sampling_wait();
         if (sp->sc->est_p.x > dist) break;
@@ -458,18 +603,42 @@ class Machine {
     // hw->fan->drive(0.5);
     vTaskDelay(pdMS_TO_TICKS(500));
     /* start */
+    const int num_samples = 2000;
+    utils::StepResponseFitter fitter(sp->sc->Ts, num_samples);
     if (dir == 1)
       hw->mt->drive(-gain * 0.05f, gain * 0.05f);  //< 回転
     else
       hw->mt->drive(gain * 0.1f, gain * 0.1f);  //< 並進
-    for (int i = 0; i < 2000; i++) {
+    for (int i = 0; i < num_samples; i++) {
       sp->sc->sampling_wait();
       log_push(log_select);
+      fitter.push(dir == 1 ? hw->imu->get_gyro() : sp->sc->enc_v.tra);
     }
     hw->fan->drive(0);
     hw->mt->drive(0, 0);
     vTaskDelay(pdMS_TO_TICKS(500));
     hw->mt->free();
+    /* モデルの同定 (u.tra = (L + R) / 2, u.rot = R - L) */
+    utils::StepResponseFitter::Result result;
+    if (!fitter.fit(gain * 0.1f, result)) {
+      hw->bz->play(hardware::Buzzer::ERROR);
+      return;
+    }
+    auto model = sp->sc->getFeedbackController().getModel();
+    if (dir == 1)
+      model.K1.rot = result.K1, model.T1.rot = result.T1;
+    else
+      model.K1.tra = result.K1, model.T1.tra = result.T1;
+    APP_LOGI("SysID %s: K1: %f T1: %f", dir == 1 ? "rot" : "tra",
+             (double)result.K1, (double)result.T1);
+    /* 適用して保存するか確認 */
+    hw->bz->play(hardware::Buzzer::CONFIRM);
+    if (!sp->ui->waitForCover()) return;
+    sp->sc->set_model(model);
+    if (sp->sc->backup_model())
+      hw->bz->play(hardware::Buzzer::SUCCESSFUL);
+    else
+      hw->bz->play(hardware::Buzzer::ERROR);
   }
   void encoder_test() {
     int value = sp->ui->waitForSelect(16);
@@ -503,6 +672,30 @@ class Machine {
     }
     hw->mt->free();
   }
+  void encoder_calibration() {
+    int value = sp->ui->waitForSelect(16);
+    if (value < 0) return;
+    const float pwm = 0.01f * (value == 0 ? 8 : value);  //< default is 0.08
+    hw->led->set(15);
+    if (!sp->ui->waitForCover()) return;
+    vTaskDelay(pdMS_TO_TICKS(500));
+    /* 回転数が一定になるまで空転させる */
+    hw->mt->drive(pwm, pwm);
+    vTaskDelay(pdMS_TO_TICKS(1000));
+    const bool result = hw->enc->calibration();
+    hw->mt->free();
+    if (!result) {
+      hw->bz->play(hardware::Buzzer::ERROR);
+      return;
+    }
+    /* 保存するか確認 */
+    hw->bz->play(hardware::Buzzer::CONFIRM);
+    if (!sp->ui->waitForCover()) return;
+    if (hw->enc->backup())
+      hw->bz->play(hardware::Buzzer::SUCCESSFUL);
+    else
+      hw->bz->play(hardware::Buzzer::ERROR);
+  }
   void wall_test() {
     int cells = sp->ui->waitForSelect(16);
     if (cells < 0) return;
@@ -521,7 +714,7 @@ class Machine {
     ad.reset(j_max, a_max, v_max, 0, 0, dist);
     /* start */
     sp->sc->enable();
-    for (float t = 0; t < ad.t_end() + 0.1f; t += 1e-3f) {
+    for (float t = 0; t < ad.t_end() + 0.1f; t += sp->sc->Ts) {
       sp->sc->set_target(ad.v(t), 0, ad.a(t), 0);
       sp->sc->sampling_wait();
       // if ((int)(t * 1000) % 2 == 0)
@@ -560,15 +753,19 @@ class Machine {
       const float dist = 4 * PI;
       ad.reset(j_max, a_max, v_max, 0, 0, dist);
     }
+    /* ログは 2 ms ごと */
+    const int log_decimation =
+        std::max(1, 2000 / SpeedController::control_period_us);
     /* start */
     sp->sc->enable();
-    for (float t = 0; t < ad.t_end() + 0.1f; t += 1e-3f) {
+    int count = 0;
+    for (float t = 0; t < ad.t_end() + 0.1f; t += sp->sc->Ts) {
       if (dir == 0)
         sp->sc->set_target(ad.v(t), 0, ad.a(t), 0);
       else
         sp->sc->set_target(0, ad.v(t), 0, ad.a(t));
       sp->sc->sampling_wait();
-      if ((int)(t * 1000) % 2 == 0)
+      if (count++ % log_decimation == 0)
         log_push(log_select,
                  dir == 0 ? ctrl::Pose(ad.x(t)) : ctrl::Pose(0, 0, ad.x(t)),
                  sp->sc->est_p);
@@ -591,14 +788,14 @@ class Machine {
     const auto& shape = field::shapes[field::ShapeIndex::F180];
     const bool mirror = mode;
     const float velocity = 600;
-    const float Ts = 1e-3f;
+    const float Ts = SpeedController::control_period_us * 1e-6f;
     const float j_max = 240'000;
     const float a_max = 6000;
     const float v_max = velocity;
     const float d_1 = 2 * 45;
     const float d_2 = 2 * 45;
     const float fan_duty = 0.0;
-    ctrl::TrajectoryTracker tt(model::TrajectoryTrackerGain);
+    ctrl::TrajectoryTracker tt(config::parameters().TrajectoryTrackerGain);
     ctrl::Pose offset;
     /* fan */
     if (fan_duty > 0) {  // cppcheck-suppress knownConditionTrueFalse
@@ -692,11 +889,11 @@ class Machine {
         for (int j = 0; j < 2; ++j) {
           // ToDo: 本当に平滑化が必要か確認
           wp[j] = sp->wd->getWallDistanceFrontAveraged(j) *
-                  model::wall_front_attach_gain;
+                  config::parameters().wall_front_attach_gain;
         }
         const ctrl::Polar p = wp.toPolar(model::RotationRadius);
         /* 終了条件 */
-        const float end = model::wall_front_attach_end;
+        const float end = config::parameters().wall_front_attach_end;
         if (math_utils::sum_of_square(wp[0], wp[1]) < end) {
           result = true;  //< 補正成功
           break;
@@ -758,9 +955,17 @@ class Machine {
     bool result = true;
     /* System */
     peripheral::SPIFFS::init() || (result = false);
+    if (!peripheral::record_store().mount()) {
+      APP_LOGE("failed to mount record store");
+      result = false;
+    }
     /* show info */
     APP_LOGI("I'm KERISE v%d.", KERISE_SELECT);
     peripheral::SPIFFS::show_info();
+    /* 実行時パラメータの復元 (無ければ model.h の値) */
+    if (!config::parameter_store().restore(config::PARAMETERS_PATH))
+      APP_LOGW("parameters not restored. filepath: %s",
+               config::PARAMETERS_PATH);
     /* check chip */
     if (!check_chip()) {
       auto* bz = new hardware::Buzzer();
@@ -775,7 +980,7 @@ class Machine {
     sp = new supporters::Supporters(hw);
     sp->init() || (result = false);
     /* Agents */
-    ma = new MoveAction(hw, sp, model::TrajectoryTrackerGain);
+    ma = new MoveAction(hw, sp);
     mr = new MazeRobot(hw, sp, ma);
     /* Others */
     lgr = new Logger();
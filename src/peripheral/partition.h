@@ -0,0 +1,63 @@
+/**
+ * @file partition.h
+ * @brief Raw Flash Partition and Record Store
+ * @author Ryotaro Onuki <kerikun11+github@gmail.com>
+ * @date 2024-02-04
+ * @copyright Copyright 2024 Ryotaro Onuki <kerikun11+github@gmail.com>
+ */
+#pragma once
+
+#include <esp_partition.h>
+
+#include "utils/record_store.hpp"
+
+namespace peripheral {
+
+/**
+ * @brief esp_partition を FlashDevice として使う
+ */
+class Partition : public utils::FlashDevice {
+ public:
+  explicit Partition(const char* label)
+      : partition_(esp_partition_find_first(
+            ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label)) {}
+  size_t size() const override {
+    return partition_ ? partition_->size / kSectorSize * kSectorSize : 0;
+  }
+  bool read(size_t offset, void* data, size_t size) override {
+    return esp_partition_read(partition_, offset, data, size) == ESP_OK;
+  }
+  bool write(size_t offset, const void* data, size_t size) override {
+    return esp_partition_write(partition_, offset, data, size) == ESP_OK;
+  }
+  bool erase_sector(size_t offset) override {
+    return esp_partition_erase_range(partition_, offset, kSectorSize) ==
+           ESP_OK;
+  }
+
+ private:
+  const esp_partition_t* partition_;
+};
+
+/**
+ * @brief 記録の種類 (RecordStore の key)
+ */
+enum RecordKey : uint8_t {
+  RecordKeyMazeWalls = 1,      //< MazeRobot::WallMap
+  RecordKeyMazeState = 2,      //< MazeRobot::State::Record
+  RecordKeyWallReference = 3,  //< WallDetector の壁の基準値
+  RecordKeyRunStrategy = 4,    //< utils::RunStrategy::Record
+};
+
+/**
+ * @brief 迷路や較正値などの小さな記録の保存先 ("records" パーティション)
+ *
+ * 起動時に mount() する．大きなログは SPIFFS に置く．
+ */
+inline utils::RecordStore& record_store() {
+  static Partition partition("records");
+  static utils::RecordStore store(partition);
+  return store;
+}
+
+};  // namespace peripheral
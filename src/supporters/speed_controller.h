@@ -13,14 +13,51 @@
 #include <ctrl/pose.h>
 #include <freertospp/semphr.h>
 
+#include <cmath>    //< for std::pow
+#include <cstddef>  //< for offsetof
+#include <fstream>  //< for std::ifstream, std::ofstream
+
+#include "app_log.h"
+#include "config/parameters.h"
 #include "hardware/hardware.h"
+#include "utils/crc32.hpp"
+#include "utils/odometry.hpp"
+#include "utils/time_profiler.hpp"
 #include "utils/timer_semaphore.h"
 #include "utils/wheel_position.h"
 
 class SpeedController {
  public:
-  static constexpr const int sampling_period_us = 1000;
+  /* 速度制御ループ (センサ取得・推定・PWM更新) の周期 */
+  static constexpr const int sampling_period_us =
+      SPEED_CONTROLLER_SAMPLING_PERIOD_US;
+  /* 軌道生成ループ (sampling_wait() の通知) の周期 */
+  static constexpr const int control_period_us =
+      SPEED_CONTROLLER_CONTROL_PERIOD_US;
+  static constexpr const int kDecimation =
+      control_period_us / sampling_period_us;
+  static_assert(control_period_us % sampling_period_us == 0,
+                "control period must be a multiple of sampling period");
   static constexpr const int kAccumulateSize = 4;
+  /* velocity_filter_alpha を定めた周期 [s] */
+  static constexpr const float kVelocityFilterPeriod = 1e-3f;
+  /* 同定したモデルの保存形式 */
+  struct ModelRecord {
+    static constexpr uint32_t kMagic = 0x4B53434D;  //< "KSCM"
+    static constexpr uint16_t kVersion = 1;
+    uint32_t magic = kMagic;
+    uint16_t version = kVersion;
+    uint16_t size = sizeof(ModelRecord);
+    float K1_tra = 0, K1_rot = 0;
+    float T1_tra = 0, T1_rot = 0;
+    uint32_t crc = 0;  //< crc より前の CRC-32
+
+    uint32_t calc_crc() const {
+      return utils::crc32(this, offsetof(ModelRecord, crc));
+    }
+  };
+  static constexpr auto SPEED_CONTROLLER_MODEL_PATH =
+      "/spiffs/speed_controller_model.bin";
 
  public:  // ToDo: make private
   /* 読み取り専用 */
@@ -33,14 +70,30 @@ class SpeedController {
   ctrl::Accumulator<WheelPosition, kAccumulateSize> wheel_position;
   ctrl::Accumulator<ctrl::Polar, kAccumulateSize> accel;
   uint32_t timestamp_us;
-  float Ts;
+  float Ts = control_period_us * 1e-6f;  //< 軌道生成ループの周期 [s]
+
+ public:
+  /* 設定 (積分方法の比較は tools/sim の kerise_odometry_bench) */
+  /* 実機で比べるまでは従来の ForwardEuler のまま (メニュー 8 で切り替え) */
+  utils::OdometryMethod odometry_method = utils::OdometryMethod::ForwardEuler;
 
  public:
   SpeedController(hardware::Hardware* hw)
-      : hw_(hw), fbc_(model::SpeedControllerModel, model::SpeedControllerGain) {
+      : hw_(hw),
+        fbc_(model::SpeedControllerModel,
+             config::parameters().SpeedControllerGain),
+        velocity_filter_alpha_(calc_velocity_filter_alpha(
+            config::parameters().velocity_filter_alpha)) {
     reset();
   }
   bool init() {
+    restore_model();  //< 同定済みのモデルがあれば適用
+    config::parameter_store().add_listener([this](const auto& p) {
+      std::lock_guard<std::mutex> lock_guard(mutex_);
+      fbc_.setGain(p.SpeedControllerGain);
+      velocity_filter_alpha_ =
+          calc_velocity_filter_alpha(p.velocity_filter_alpha);
+    });
     xTaskCreatePinnedToCore(
         [](void* arg) { static_cast<decltype(this)>(arg)->task(); },
         "SpeedCtrl", 4096, this, TASK_PRIORITY_SPEED_CONTROLLER, NULL,
@@ -59,6 +112,9 @@ class SpeedController {
       wheel_position.clear(hw_->enc->get_wheel_position());
       accel.clear({hw_->imu->get_accel(), hw_->imu->get_angular_accel()});
       fbc_.reset();
+#if SPEED_CONTROLLER_PROFILER_ENABLED
+      profiler_.Reset();  //< 走行開始から計測する
+#endif
     }
     // vTaskDelay(pdMS_TO_TICKS(50));  //< 緊急ループ防止の delay
   }
@@ -75,7 +131,7 @@ class SpeedController {
   void set_target(float v_tra, float v_rot, float a_tra = 0, float a_rot = 0) {
     std::lock_guard<std::mutex> lock_guard(mutex_);
     ref_v.tra = v_tra, ref_v.rot = v_rot, ref_a.tra = a_tra, ref_a.rot = a_rot;
-    drive(0);
+    drive(ref_v, 0);
   }
   void update_pose(const ctrl::Pose& new_pose) {
     std::lock_guard<std::mutex> lock_guard(mutex_);
@@ -96,6 +152,60 @@ class SpeedController {
   const ctrl::FeedbackController<ctrl::Polar>& getFeedbackController() const {
     return fbc_;
   }
+  /**
+   * @brief フィードフォワードのモデルを差し替える
+   */
+  void set_model(const ctrl::FeedbackController<ctrl::Polar>::Model& model) {
+    std::lock_guard<std::mutex> lock_guard(mutex_);
+    fbc_.setModel(model);
+  }
+  bool backup_model(const char* filepath = SPEED_CONTROLLER_MODEL_PATH) {
+    ModelRecord record;
+    {
+      std::lock_guard<std::mutex> lock_guard(mutex_);
+      const auto& model = fbc_.getModel();
+      record.K1_tra = model.K1.tra, record.K1_rot = model.K1.rot;
+      record.T1_tra = model.T1.tra, record.T1_rot = model.T1.rot;
+    }
+    record.crc = record.calc_crc();
+    std::ofstream of(filepath, std::ios::binary);
+    if (of.fail()) {
+      APP_LOGE("Can't open file. filepath: %s", filepath);
+      return false;
+    }
+    of.write((const char*)&record, sizeof(record));
+    return true;
+  }
+  bool restore_model(const char* filepath = SPEED_CONTROLLER_MODEL_PATH) {
+    std::ifstream f(filepath, std::ios::binary);
+    if (f.fail()) {
+      APP_LOGW("Can't open file. filepath: %s", filepath);
+      return false;
+    }
+    ModelRecord record;
+    f.read((char*)&record, sizeof(record));
+    if (f.gcount() != sizeof(record) || record.magic != ModelRecord::kMagic ||
+        record.version != ModelRecord::kVersion ||
+        record.size != sizeof(record) || record.crc != record.calc_crc()) {
+      APP_LOGE("invalid model record. filepath: %s", filepath);
+      return false;
+    }
+    set_model({
+        .K1 = ctrl::Polar(record.K1_tra, record.K1_rot),
+        .T1 = ctrl::Polar(record.T1_tra, record.T1_rot),
+    });
+    APP_LOGI("Speed Controller Model Restored: K1: %f %f T1: %f %f",
+             (double)record.K1_tra, (double)record.K1_rot,
+             (double)record.T1_tra, (double)record.T1_rot);
+    return true;
+  }
+#if SPEED_CONTROLLER_PROFILER_ENABLED
+  void print_profile() {
+    std::lock_guard<std::mutex> lock_guard(mutex_);
+    std::cout << "# sampling_period_us: " << sampling_period_us << std::endl;
+    profiler_.ShowResult(std::cout);
+  }
+#endif
 
  private:
   hardware::Hardware* hw_;
@@ -104,37 +214,72 @@ class SpeedController {
   freertospp::Semaphore data_ready_semaphore_;
   TimerSemaphore sampling_semaphore_;
   mutable std::mutex mutex_;
+#if SPEED_CONTROLLER_PROFILER_ENABLED
+  utils::TimeProfiler<1000, 5> profiler_;
+#endif
+  /* sampling_period_us に換算した velocity_filter_alpha */
+  ctrl::Polar velocity_filter_alpha_;
+
+  /* alpha は 1 ms ごとの値なので，周期が変わっても時定数を保つよう換算 */
+  static ctrl::Polar
+  calc_velocity_filter_alpha(const ctrl::Polar& velocity_filter_alpha) {
+    const float n = sampling_period_us * 1e-6f / kVelocityFilterPeriod;
+    return ctrl::Polar(1 - std::pow(1 - velocity_filter_alpha.tra, n),
+                       1 - std::pow(1 - velocity_filter_alpha.rot, n));
+  }
 
   void task() {
     uint32_t timestamp_us_prev = 0;
-#if 1
+    int decimation_count = 0;
+    float Ts_control = 0;
     sampling_semaphore_.startPeriodic(sampling_period_us);
     while (1) {
       /* wait for sampling trigger */
       sampling_semaphore_.take();
-#else
-    TickType_t xLastWakeTime = xTaskGetTickCount();
-    while (1) {
-      /* wait for sampling trigger */
-      vTaskDelayUntil(&xLastWakeTime, pdMS_TO_TICKS(1));
-#endif
-      timestamp_us = esp_timer_get_time();
+      const uint32_t sampling_us = esp_timer_get_time();
       /* sampling start */
       hw_->sampling_request();
       hw_->sampling_wait();
+#if SPEED_CONTROLLER_PROFILER_ENABLED
+      const uint32_t sampled_us = esp_timer_get_time();
+#endif
       /* lock data */
       std::lock_guard<std::mutex> lock_guard(mutex_);
+#if SPEED_CONTROLLER_PROFILER_ENABLED
+      /* profiler_ は reset() と共有するのでロック後に記録する */
+      profiler_.Start(sampling_us);
+      profiler_.Lap("sampling", sampled_us);
+#endif
       /* update timestamp */
       uint32_t timestamp_diff_us = timestamp_us_prev == 0
                                        ? sampling_period_us
-                                       : (timestamp_us - timestamp_us_prev);
-      timestamp_us_prev = timestamp_us;
-      Ts = timestamp_diff_us * 1e-6f;
+                                       : (sampling_us - timestamp_us_prev);
+      timestamp_us_prev = sampling_us;
+      const float Ts_sampling = timestamp_diff_us * 1e-6f;
       /* update data */
-      update_estimator(Ts);
-      update_odometry(Ts);
+      update_estimator(Ts_sampling);
+#if SPEED_CONTROLLER_PROFILER_ENABLED
+      profiler_.Lap("estimator");
+#endif
+      update_odometry(Ts_sampling);
+#if SPEED_CONTROLLER_PROFILER_ENABLED
+      profiler_.Lap("odometry");
+#endif
+      /* 軌道生成の周期の間は目標速度を目標加速度で補間する */
+      /* (ref_v は set_target() だけが書くので，補間した値は書き戻さない) */
+      const ctrl::Polar ref_v_sampling = ref_v + ref_a * Ts_control;
       /* PID control */
-      drive(Ts);
+      drive(ref_v_sampling, Ts_sampling);
+#if SPEED_CONTROLLER_PROFILER_ENABLED
+      profiler_.Lap("drive");
+#endif
+      /* decimation */
+      Ts_control += Ts_sampling;
+      if (++decimation_count < kDecimation) continue;
+      decimation_count = 0;
+      timestamp_us = sampling_us;
+      Ts = Ts_control;
+      Ts_control = 0;
       /* notify */
       data_ready_semaphore_.give();
     }
@@ -149,24 +294,22 @@ class SpeedController {
     /* calculate estimated velocity value with complementary filter */
     const ctrl::Polar v_low = ctrl::Polar(enc_v.tra, hw_->imu->get_gyro());
     const ctrl::Polar v_high = est_v + accel[0] * float(Ts);
-    const ctrl::Polar alpha = model::velocity_filter_alpha;
+    const ctrl::Polar& alpha = velocity_filter_alpha_;
     est_v = alpha * v_low + (ctrl::Polar(1, 1) - alpha) * v_high;
     /* estimated acceleration */
     est_a = accel[0];
   }
   void update_odometry(const float Ts) {
     /* estimates slip angle */
-    // const float k = 0.01f;
-    const float k = 0.0f;
-    const float slip_angle = k * ref_v.tra * ref_v.rot / 1000;
+    const float slip = utils::slip_angle(config::parameters().slip_angle_gain,
+                                         ref_v.tra, ref_v.rot);
     /* calculate odometry value */
-    est_p.th += hw_->imu->get_gyro() * Ts;
-    est_p.x += enc_v.tra * std::cos(est_p.th + slip_angle) * Ts;
-    est_p.y += enc_v.tra * std::sin(est_p.th + slip_angle) * Ts;
+    utils::integrate_odometry(est_p, enc_v.tra, hw_->imu->get_gyro(), slip, Ts,
+                              odometry_method);
   }
-  void drive(const float Ts) {
+  void drive(const ctrl::Polar& v_ref, const float Ts) {
     /* calculate pwm value */
-    const auto pwm_value = fbc_.update(ref_v, est_v, ref_a, est_a, Ts);
+    const auto pwm_value = fbc_.update(v_ref, est_v, ref_a, est_a, Ts);
     /* drive the motors */
     if (drive_enabled_) {
       const float pwm_value_L = pwm_value.tra - pwm_value.rot / 2;
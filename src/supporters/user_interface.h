@@ -10,6 +10,7 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 
+#include "config/parameters.h"
 #include "hardware/hardware.h"
 
 class UserInterface {
@@ -142,13 +143,13 @@ class UserInterface {
     while (1) {
       vTaskDelay(pdMS_TO_TICKS(1));
       /* CONFIRM */
-      if (!side && hw_->rfl->front(0) > model::ui_thr_ref_front &&
-          hw_->rfl->front(1) > model::ui_thr_ref_front) {
+      if (!side && hw_->rfl->front(0) > config::parameters().ui_thr_ref_front &&
+          hw_->rfl->front(1) > config::parameters().ui_thr_ref_front) {
         hw_->bz->play(hardware::Buzzer::CONFIRM);
         return true;
       }
-      if (side && hw_->rfl->side(0) > model::ui_thr_ref_side &&
-          hw_->rfl->side(1) > model::ui_thr_ref_side) {
+      if (side && hw_->rfl->side(0) > config::parameters().ui_thr_ref_side &&
+          hw_->rfl->side(1) > config::parameters().ui_thr_ref_side) {
         hw_->bz->play(hardware::Buzzer::CONFIRM);
         return true;
       }
@@ -7,20 +7,51 @@
  */
 #pragma once
 
+#include <algorithm>  //< for std::min, std::max
 #include <array>
 #include <cmath>    //< std::log
 #include <fstream>  //< for std::ifstream, std::ofstream
 #include <iomanip>
 #include <iostream>
+#include <vector>
 
+#include "config/parameters.h"
 #include "hardware/hardware.h"
+#include "peripheral/partition.h"
+#include "utils/monotone_curve.hpp"
+#include "utils/wall_classifier.hpp"
+
+/* 設定 */
+/* 前壁の曲線を掃引で当てはめる (0: 従来どおり 1 点の較正の傾き 1 の直線) */
+#define WALL_DETECTOR_FRONT_SWEEP_ENABLED 0
 
 class WallDetector {
  public:
   static constexpr int average_filter_size = 16;
-  static constexpr int wall_threshold_front = 135;  //< ToF [mm]
-  static constexpr int wall_threshold_side = 25;    //< Reflector Dist [mm]
+  static constexpr int wall_threshold_front = 135;    //< ToF [mm]
+  static constexpr int wall_threshold_side = 25;      //< Reflector Dist [mm]
+  static constexpr float wall_confidence_low = 0.9f;  //< 不確かとみなす確率
+  /* 区画の境界の手前で，横壁センサが次の区画の壁を見ている距離 [mm] */
+  static constexpr float side_read_range = 9.0f;
   static constexpr auto WALL_DETECTOR_BACKUP_PATH = "/spiffs/WallDetector.txt";
+  static constexpr uint8_t WALL_REFERENCE_VERSION = 1;
+  /* ref2dist() の表の大きさ (リフレクタの値は 12 bit の ADC の差) */
+  static constexpr int REF2DIST_TABLE_SIZE = 4096;
+  /* 掃引による較正で真の距離をまとめる区間 [mm] */
+  static constexpr float SWEEP_BIN_MIN = -30.0f;
+  static constexpr float SWEEP_BIN_WIDTH = 0.5f;
+  static constexpr int SWEEP_BIN_COUNT = 160;
+  static constexpr int SWEEP_BIN_COUNT_MIN = 4;    //< 使う区間の最小の標本数
+  static constexpr float SWEEP_RANGE_MIN = 10.0f;  //< 必要な真の距離の幅 [mm]
+  /* 掃引する向き (WallValue の添字のビット) */
+  static constexpr uint8_t SWEEP_SIDE = 0b0011;
+  static constexpr uint8_t SWEEP_FRONT = 0b1100;
+#if WALL_DETECTOR_FRONT_SWEEP_ENABLED
+  static constexpr uint8_t SWEEP_ENABLED = SWEEP_SIDE | SWEEP_FRONT;
+#else
+  /* tools/wall/data のログでは前壁の曲線が 1 点の較正より悪かったため */
+  static constexpr uint8_t SWEEP_ENABLED = SWEEP_SIDE;
+#endif
 
   union WallValue {
     // 意味をもったメンバ
@@ -50,6 +81,12 @@ class WallDetector {
       return ret;
     }
   };
+  /**
+   * @brief リフレクタの距離 ref2dist() から壁との距離 [mm] への変換
+   *
+   * WallValue と同じ順に並べる．1 点の較正では傾き 1 の直線になる．
+   */
+  using WallCurves = std::array<utils::MonotoneCurve, 4>;
   struct Walls {
     union {
       struct {
@@ -59,12 +96,26 @@ class WallDetector {
       bool side[2];
     };
     bool front;
+    /* 判定の確からしさ (判定どおりである確率) */
+    std::array<float, 2> side_confidence = {0.5f, 0.5f};
+    float front_confidence = 0.5f;
   };
 
  public:
-  WallDetector(hardware::Hardware* hw) : hw_(hw) {
-    ref2dist_log_gain_ = -model::ref_max_length_mm /
-                         std::log2(float(model::ref_saturation_value));
+  WallDetector(hardware::Hardware* hw)
+      : hw_(hw), classifier_(classifier_parameter()) {
+    curves_.fill(utils::MonotoneCurve::identity());
+    config::parameter_store().add_listener([this](const auto& p) {
+      const float gain =
+          -p.ref_max_length_mm / std::log2(float(p.ref_saturation_value));
+      /* 表を作り直してから差し替える (走行中の update() と排他) */
+      std::vector<float> table(REF2DIST_TABLE_SIZE);
+      for (int i = 0; i < REF2DIST_TABLE_SIZE; ++i)
+        table[i] = gain * std::log2(float(i));
+      std::lock_guard<std::mutex> lock_guard(mutex_);
+      ref2dist_log_gain_ = gain;
+      ref2dist_table_.swap(table);
+    });
   }
   bool init() {
     if (!restore()) return false;
@@ -74,31 +125,32 @@ class WallDetector {
         TASK_CORE_ID_WALL_DETECTOR);
     return true;
   }
-  bool backup(const char* filepath = WALL_DETECTOR_BACKUP_PATH) {
-    std::ofstream of(filepath);
-    if (of.fail()) {
-      APP_LOGE("Can't open file. filepath: %s", filepath);
+  bool backup() {
+    if (!peripheral::record_store().save(
+            peripheral::RecordKeyWallReference, WALL_REFERENCE_VERSION,
+            curves_.data(), sizeof(curves_))) {
+      APP_LOGE("failed to save wall reference");
       return false;
     }
-    for (const auto& value : wall_ref.value) of << value << std::endl;
     return true;
   }
-  bool restore(const char* filepath = WALL_DETECTOR_BACKUP_PATH) {
-    std::ifstream f(filepath);
-    if (f.fail()) {
-      APP_LOGE("Can't open file. filepath: %s", filepath);
-      return false;
-    }
-    for (auto& value : wall_ref.value) {
-      if (f.eof()) {
-        APP_LOGE("invalid file size. filepath: %s", filepath);
-        return false;
-      }
-      f >> value;
+  bool restore() {
+    WallCurves curves;
+    uint8_t version = 0;
+    size_t size = 0;
+    if (peripheral::record_store().load(peripheral::RecordKeyWallReference,
+                                        version, curves.data(), size,
+                                        sizeof(curves)) &&
+        version == WALL_REFERENCE_VERSION && size == sizeof(curves)) {
+      set_curves(curves);
+    } else {
+      /* SPIFFS の旧形式から移行する */
+      WallValue wall_ref;
+      if (!restore_legacy(WALL_DETECTOR_BACKUP_PATH, wall_ref)) return false;
+      set_reference(wall_ref);
+      backup();
     }
-    APP_LOGI("Wall Reference Restored: %10f %10f %10f %10f",
-             (double)wall_ref.side[0], (double)wall_ref.front[0],
-             (double)wall_ref.front[1], (double)wall_ref.side[1]);
+    print_curves();
     return true;
   }
   void calibration_side() {
@@ -108,12 +160,16 @@ class WallDetector {
     const int ave_count = 500;
     TickType_t xLastWakeTime = xTaskGetTickCount();
     for (int j = 0; j < ave_count; j++) {
-      for (int i = 0; i < 2; i++) sum[i] += ref2dist(hw_->rfl->side(i));
+      {
+        std::lock_guard<std::mutex> lock_guard(mutex_);  //< 表の差し替えと排他
+        for (int i = 0; i < 2; i++) sum[i] += ref2dist(hw_->rfl->side(i));
+      }
       vTaskDelayUntil(&xLastWakeTime, pdMS_TO_TICKS(1));
     }
-    for (int i = 0; i < 2; i++) wall_ref.side[i] = sum[i] / ave_count;
-    APP_LOGI("Wall Calibration Side: %10f %10f", (double)wall_ref.side[0],
-             (double)wall_ref.side[1]);
+    /* 今の位置で距離が 0 になるよう曲線をずらす */
+    for (int i = 0; i < 2; i++) shift_curve(i, sum[i] / ave_count);
+    APP_LOGI("Wall Calibration Side: %10f %10f", (double)sum[0] / ave_count,
+             (double)sum[1] / ave_count);
     hw_->tof->enable();
   }
   void calibration_front() {
@@ -123,28 +179,138 @@ class WallDetector {
     const int ave_count = 500;
     TickType_t xLastWakeTime = xTaskGetTickCount();
     for (int j = 0; j < ave_count; j++) {
-      for (int i = 0; i < 2; i++) sum[i] += ref2dist(hw_->rfl->front(i));
+      {
+        std::lock_guard<std::mutex> lock_guard(mutex_);  //< 表の差し替えと排他
+        for (int i = 0; i < 2; i++) sum[i] += ref2dist(hw_->rfl->front(i));
+      }
       vTaskDelayUntil(&xLastWakeTime, pdMS_TO_TICKS(1));
     }
-    for (int i = 0; i < 2; i++) wall_ref.front[i] = sum[i] / ave_count;
-    APP_LOGI("Wall Calibration Front: %10f %10f", (double)wall_ref.front[0],
-             (double)wall_ref.front[1]);
+    for (int i = 0; i < 2; i++) shift_curve(2 + i, sum[i] / ave_count);
+    APP_LOGI("Wall Calibration Front: %10f %10f", (double)sum[0] / ave_count,
+             (double)sum[1] / ave_count);
+    hw_->tof->enable();
+  }
+  /**
+   * @brief 掃引による較正を始める
+   *
+   * 機体を動かしながら，既知の真の距離とともに calibration_sweep_push() を
+   * 1 ms ごとに呼び，calibration_sweep_end() で曲線を当てはめる．
+   * 標本は真の距離の区間ごとの平均にまとめるので，掃引の長さによらない．
+   */
+  void calibration_sweep_begin() {
+    hw_->tof->disable();
+    vTaskDelay(pdMS_TO_TICKS(20));
+    std::lock_guard<std::mutex> lock_guard(mutex_);
+    sweep_bins_.assign(4 * SWEEP_BIN_COUNT, {0, 0});
+  }
+  /**
+   * @param truth 真の壁との距離 [mm] (較正の姿勢で 0，遠ざかると正)
+   * @param channels 標本をとる WallValue の添字のビット
+   */
+  void calibration_sweep_push(const WallValue& truth, const uint8_t channels) {
+    std::lock_guard<std::mutex> lock_guard(mutex_);
+    if (sweep_bins_.empty()) return;
+    for (int i = 0; i < 4; ++i) {
+      if (!(channels & (1 << i))) continue;
+      const float b = (truth.value[i] - SWEEP_BIN_MIN) / SWEEP_BIN_WIDTH;
+      if (!(b >= 0 && b < SWEEP_BIN_COUNT)) continue;
+      const float u = ref2dist(i < 2 ? hw_->rfl->side(i)
+                                     : hw_->rfl->front(i - 2));
+      if (!std::isfinite(u)) continue;
+      auto& bin = sweep_bins_[i * SWEEP_BIN_COUNT + int(b)];
+      bin.sum += u;
+      bin.count++;
+    }
+  }
+  /**
+   * @brief 掃引の標本に曲線を当てはめて差し替える
+   *
+   * SWEEP_ENABLED にないチャンネルは曲線を変えずに失敗とする．
+   * @return 全てのチャンネルで十分な幅の標本が得られ，当てはめられたか
+   */
+  bool calibration_sweep_end(const uint8_t channels) {
+    std::vector<SweepBin> bins;
+    {
+      std::lock_guard<std::mutex> lock_guard(mutex_);
+      bins.swap(sweep_bins_);
+    }
     hw_->tof->enable();
+    if (bins.empty() || (channels & ~SWEEP_ENABLED)) return false;
+    bool result = true;
+    for (int i = 0; i < 4; ++i) {
+      if (!(channels & (1 << i))) continue;
+      std::vector<utils::MonotoneCurve::Point> points;
+      float y_min = SWEEP_BIN_MIN + SWEEP_BIN_COUNT * SWEEP_BIN_WIDTH;
+      float y_max = SWEEP_BIN_MIN;
+      for (int b = 0; b < SWEEP_BIN_COUNT; ++b) {
+        const auto& bin = bins[i * SWEEP_BIN_COUNT + b];
+        if (bin.count < SWEEP_BIN_COUNT_MIN) continue;
+        const float y = SWEEP_BIN_MIN + (b + 0.5f) * SWEEP_BIN_WIDTH;
+        points.push_back({bin.sum / bin.count, y, float(bin.count)});
+        y_min = std::min(y_min, y), y_max = std::max(y_max, y);
+      }
+      utils::MonotoneCurve curve;
+      if (y_max - y_min < SWEEP_RANGE_MIN ||
+          !utils::MonotoneCurve::fit(points, curve)) {
+        APP_LOGE("Wall Calibration Sweep failed: ch %d (%d bins, %.1f mm)", i,
+                 int(points.size()), (double)std::max(0.0f, y_max - y_min));
+        result = false;
+        continue;
+      }
+      std::lock_guard<std::mutex> lock_guard(mutex_);
+      curves_[i] = curve;
+    }
+    print_curves();
+    return result;
+  }
+  WallCurves get_curves() const {
+    std::lock_guard<std::mutex> lock_guard(mutex_);
+    return curves_;
+  }
+  void set_curves(const WallCurves& curves) {
+    std::lock_guard<std::mutex> lock_guard(mutex_);
+    curves_ = curves;
+  }
+  /**
+   * @brief 曲線の節点を表示する (ch: SL SR FL FR)
+   */
+  void print_curves() const {
+    const auto curves = get_curves();
+    for (int i = 0; i < 4; ++i) {
+      const auto& c = curves[i];
+      APP_LOGI("Wall Curve %d: x %7.2f .. %7.2f, y %7.2f .. %7.2f", i,
+               (double)c.x0, (double)c.x_end(), (double)c.y.front(),
+               (double)c.y.back());
+    }
+  }
+  /**
+   * @brief 区画の境界の何 mm 手前までなら次の区画の横壁を読めるか
+   *
+   * 横壁の判定は直前の約 2 時定数の間の標本で決まるので，その間に進む
+   * 距離を side_read_range から引く (tools/sim の kerise_search_prefetch)．
+   * @param v 並進速度 [mm/s]
+   */
+  static float side_read_lead_max(const float v) {
+    const float window = 2 * classifier_parameter().side_tau_ms * 1e-3f * v;
+    return std::max(0.0f, side_read_range - window);
   }
   const char* get_info() const {
     std::lock_guard<std::mutex> lock_guard(mutex_);
-    static char str[128];
+    static char str[160];
     snprintf(str, sizeof(str),
              "R[%4d %4d %4d %4d] "
              "D[%5.1f %5.1f %5.1f %5.1f] "
              "W[%c %c %c] "
+             "P[%.2f %.2f %.2f] "
              "T[%3u mm %3lu ms (%3u mm)]",
              hw_->rfl->side(0), hw_->rfl->front(0),  //
              hw_->rfl->front(1), hw_->rfl->side(1),  //
              (double)distance_.side[0], (double)distance_.front[0],
              (double)distance_.front[1], (double)distance_.side[1],
              walls_.side[0] ? 'X' : '_', walls_.front ? 'X' : '_',
-             walls_.side[1] ? 'X' : '_', hw_->tof->getDistance(),
+             walls_.side[1] ? 'X' : '_', (double)walls_.side_confidence[0],
+             (double)walls_.front_confidence,
+             (double)walls_.side_confidence[1], hw_->tof->getDistance(),
              hw_->tof->passedTimeMs(), hw_->tof->getRangeRaw());
     return str;
   }
@@ -181,15 +347,64 @@ class WallDetector {
   }
 
  private:
+  struct SweepBin {
+    float sum;       //< ref2dist() の和
+    uint32_t count;  //< 標本数
+  };
+
+  bool restore_legacy(const char* filepath, WallValue& wall_ref) {
+    std::ifstream f(filepath);
+    if (f.fail()) {
+      APP_LOGE("Can't open file. filepath: %s", filepath);
+      return false;
+    }
+    for (auto& value : wall_ref.value) {
+      if (f.eof()) {
+        APP_LOGE("invalid file size. filepath: %s", filepath);
+        return false;
+      }
+      f >> value;
+    }
+    return true;
+  }
+  /**
+   * @brief 1 点の基準値 (ref2dist() の値) から曲線を作る
+   */
+  void set_reference(const WallValue& wall_ref) {
+    WallCurves curves;
+    for (int i = 0; i < 4; ++i)
+      curves[i] = utils::MonotoneCurve::identity(-wall_ref.value[i]);
+    set_curves(curves);
+  }
+  /**
+   * @brief ref2dist() の値 u で距離が 0 になるよう曲線 i をずらす
+   */
+  void shift_curve(const int i, const float u) {
+    std::lock_guard<std::mutex> lock_guard(mutex_);
+    curves_[i].shift(-curves_[i](u));
+  }
+  /**
+   * @brief 壁の判定のパラメータ (閾値はこのクラスの定数に合わせる)
+   */
+  static utils::WallClassifier::Parameter classifier_parameter() {
+    utils::WallClassifier::Parameter p;
+    p.side_threshold = wall_threshold_side;
+    p.front_threshold = wall_threshold_front;
+    return p;
+  }
   hardware::Hardware* hw_;
-  WallValue wall_ref;
+  WallCurves curves_;
+  std::vector<SweepBin> sweep_bins_; /*< 掃引による較正の標本 */
   float ref2dist_log_gain_;
+  std::vector<float> ref2dist_table_; /*< ref2dist() の値の表 */
   ctrl::Accumulator<WallValue, average_filter_size> buffer_;
 
   mutable std::mutex mutex_;
   WallValue distance_;
   WallValue distance_average_;
   Walls walls_;
+  utils::WallClassifier classifier_;
+  uint32_t tof_passed_ms_ = 0; /*< 前回の ToF の経過時間 (測距の検出用) */
 
  public:
   void task() {
@@ -205,31 +420,40 @@ class WallDetector {
 
     // リフレクタ値の更新
     for (int i = 0; i < 2; i++) {
-      distance_.side[i] = ref2dist(hw_->rfl->side(i)) - wall_ref.side[i];
-      distance_.front[i] = ref2dist(hw_->rfl->front(i)) - wall_ref.front[i];
+      distance_.side[i] = curves_[i](ref2dist(hw_->rfl->side(i)));
+      distance_.front[i] = curves_[2 + i](ref2dist(hw_->rfl->front(i)));
     }
     buffer_.push(distance_);
     distance_average_ = buffer_.average();
 
-    // 前壁の更新
-    int front_mm = hw_->tof->getDistance();
-    if (!hw_->tof->isValid())
-      walls_.front = false;  //< ToFの測距範囲内に壁がない場合はinvalidになる
-    else if (front_mm < wall_threshold_front * 0.95f)
-      walls_.front = true;
-    else if (front_mm > wall_threshold_front * 1.05f)
-      walls_.front = false;
-
-    // 横壁の更新
+    // 壁の判定 (経過時間が戻ったら新しい測距)
+    const uint32_t tof_passed_ms = hw_->tof->passedTimeMs();
+    utils::WallClassifier::Input in;
+    in.side = distance_.side;
+    in.front = distance_.front;
+    in.tof_mm = hw_->tof->getDistance();
+    in.tof_valid = hw_->tof->isValid();
+    in.tof_updated = tof_passed_ms < tof_passed_ms_;
+    tof_passed_ms_ = tof_passed_ms;
+    classifier_.update(in);
     for (int i = 0; i < 2; i++) {
-      const float value = distance_.side[i];
-      if (value < wall_threshold_side * 0.97f)
-        walls_.side[i] = true;
-      else if (value > wall_threshold_side * 1.03f)
-        walls_.side[i] = false;
+      walls_.side[i] = classifier_.side(i).wall();
+      walls_.side_confidence[i] = classifier_.side(i).confidence();
     }
+    walls_.front = classifier_.front().wall();
+    walls_.front_confidence = classifier_.front().confidence();
   }
+  /**
+   * @brief リフレクタの値を距離 [mm] に変換する
+   *
+   * 1 ms ごとに 4 チャンネル分呼ばれるので，対数は表を引く．
+   * 表は同じ式で作るので，計算した場合と値は一致する．
+   * 表はリスナーが差し替えるので，mutex_ を取った状態で呼ぶこと
+   * (この関数自身は取らない)．
+   */
   float ref2dist(const int16_t value) const {
-    return ref2dist_log_gain_ * std::log2(float(value));
+    if (value < 0 || value >= REF2DIST_TABLE_SIZE)
+      return ref2dist_log_gain_ * std::log2(float(value));  //< 範囲外
+    return ref2dist_table_[value];
   }
 };
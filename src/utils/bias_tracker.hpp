@@ -0,0 +1,114 @@
+/**
+ * @file bias_tracker.hpp
+ * @brief Zero Velocity Update Bias Tracker for IMU
+ * @author Ryotaro Onuki <kerikun11+github@gmail.com>
+ * @date 2024-02-04
+ * @copyright Copyright 2024 Ryotaro Onuki <kerikun11+github@gmail.com>
+ */
+#pragma once
+
+#include <algorithm>  //< for std::max, std::min
+#include <cmath>      //< for std::abs, std::sqrt
+
+#include "utils/motion_parameter.h"
+
+namespace utils {
+
+/**
+ * @brief 静止中の IMU の出力からオフセットを逐次推定するクラス
+ *
+ * 車輪が静止していて，かつ，ジャイロの出力の変動と (オフセット補正後の)
+ * 大きさが小さい状態が一定時間続いたら静止とみなし，ジャイロと加速度の
+ * オフセットを更新する (zero velocity update)．大きさも見るのは，車輪が
+ * 止まったまま一定の角速度で回される場合 (持ち上げて向きを変えるなど) を
+ * 除くため．そのため，オフセットの初期値の誤差は thr_rate より小さいこと．
+ * 静止サンプル数が少ないうちは単純平均，十分に溜まったら指数移動平均になる．
+ * ハードウェアに依存しないのでホスト環境でも実行できる．
+ */
+class BiasTracker {
+ public:
+  struct Parameter {
+    float thr_gyro = 0.02f;          //< 静止判定のジャイロ変動の閾値 [rad/s]
+    float thr_rate = 0.05f;          //< 静止判定の角速度の大きさの閾値 [rad/s]
+    int rest_count_min = 100;        //< 静止とみなすまでの連続サンプル数
+    int average_count_max = 2000;    //< 指数移動平均の時定数 [samples]
+    int confident_count = 400;       //< 信頼度が 1 になる静止サンプル数
+    float confidence_decay = 5e-5f;  //< 移動中の信頼度の減衰率 [1/sample]
+    float fast_alpha = 0.05f;        //< 静止判定用の短期平均のゲイン
+  };
+
+ public:
+  BiasTracker() { reset(); }
+  explicit BiasTracker(const Parameter& param) : param_(param) { reset(); }
+  /**
+   * @brief オフセットの初期値を設定する
+   *
+   * @param confident true: 直前に静止キャリブレーション済み
+   */
+  void reset(const MotionParameter& gyro_bias = MotionParameter(),
+             const MotionParameter& accel_bias = MotionParameter(),
+             const bool confident = false) {
+    gyro_bias_ = gyro_bias;
+    accel_bias_ = accel_bias;
+    gyro_fast_ = gyro_bias;
+    rest_count_ = 0;
+    average_count_ = confident ? param_.confident_count : 0;
+    effective_count_ = confident ? param_.confident_count : 0;
+  }
+  /**
+   * @brief 1 サンプルごとに呼ぶ
+   *
+   * @param gyro オフセット補正前のジャイロの出力 [rad/s]
+   * @param accel オフセット補正前の加速度の出力 [mm/s/s]
+   * @param wheel_stationary エンコーダから見て車輪が静止しているか
+   * @return true 静止中でオフセットを更新した
+   */
+  bool update(const MotionParameter& gyro, const MotionParameter& accel,
+              const bool wheel_stationary) {
+    /* 短期平均からの変動で回転の有無を判定 */
+    const auto d = gyro - gyro_fast_;
+    gyro_fast_ += d * param_.fast_alpha;
+    const auto r = gyro - gyro_bias_;
+    const bool gyro_stationary =
+        std::abs(d.x) < param_.thr_gyro && std::abs(d.y) < param_.thr_gyro &&
+        std::abs(d.z) < param_.thr_gyro &&
+        std::sqrt(r.x * r.x + r.y * r.y + r.z * r.z) < param_.thr_rate;
+    if (!wheel_stationary || !gyro_stationary) {
+      rest_count_ = 0;
+      effective_count_ = std::max(
+          0.0f, effective_count_ - param_.confidence_decay * effective_count_);
+      return false;
+    }
+    if (rest_count_ < param_.rest_count_min) {
+      rest_count_++;
+      return false;
+    }
+    /* 静止中: オフセットを更新 */
+    average_count_ = std::min(average_count_ + 1, param_.average_count_max);
+    const float alpha = 1.0f / average_count_;
+    gyro_bias_ += (gyro - gyro_bias_) * alpha;
+    accel_bias_ += (accel - accel_bias_) * alpha;
+    effective_count_ =
+        std::min(effective_count_ + 1, float(param_.confident_count));
+    return true;
+  }
+  const MotionParameter& get_gyro_bias() const { return gyro_bias_; }
+  const MotionParameter& get_accel_bias() const { return accel_bias_; }
+  /**
+   * @brief オフセットの信頼度 [0, 1]
+   */
+  float get_confidence() const {
+    return effective_count_ / param_.confident_count;
+  }
+  bool is_rest() const { return rest_count_ >= param_.rest_count_min; }
+
+ private:
+  Parameter param_;
+  MotionParameter gyro_bias_, accel_bias_;
+  MotionParameter gyro_fast_;
+  int rest_count_;
+  int average_count_;
+  float effective_count_;
+};
+
+}  // namespace utils
@@ -0,0 +1,31 @@
+/**
+ * @file crc32.hpp
+ * @brief CRC-32 (IEEE 802.3) Checksum
+ * @author Ryotaro Onuki <kerikun11+github@gmail.com>
+ * @date 2024-02-04
+ * @copyright Copyright 2024 Ryotaro Onuki <kerikun11+github@gmail.com>
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace utils {
+
+/**
+ * @brief CRC-32 を計算する (zlib の crc32 と同じ値)
+ *
+ * テーブルを持たないビット単位の実装．保存データの検査用なので速度は求めない．
+ * @param crc 続きから計算する場合は前回の戻り値，最初は 0
+ */
+inline uint32_t crc32(const void* data, const size_t size, uint32_t crc = 0) {
+  const auto* p = static_cast<const uint8_t*>(data);
+  crc = ~crc;
+  for (size_t i = 0; i < size; ++i) {
+    crc ^= p[i];
+    for (int k = 0; k < 8; ++k) crc = (crc >> 1) ^ (0xEDB88320u & -(crc & 1));
+  }
+  return ~crc;
+}
+
+}  // namespace utils
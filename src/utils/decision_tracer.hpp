@@ -0,0 +1,140 @@
+/**
+ * @file decision_tracer.hpp
+ * @brief Search Decision Latency Tracer
+ * @author Ryotaro Onuki <kerikun11+github@gmail.com>
+ * @date 2024-02-04
+ * @copyright Copyright 2024 Ryotaro Onuki <kerikun11+github@gmail.com>
+ */
+#pragma once
+
+#include <algorithm>  //< for std::min, std::sort
+#include <array>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+namespace utils {
+
+/**
+ * @brief 探索の区画ごとに，壁の読み取りから次の行動の取り出しまでの
+ * 時刻を記録するクラス
+ *
+ * 区画は WallCapture で始まり，以降の各点は最初の 1 回のみ記録する．
+ * 複数のタスクから呼ばれるので排他する．時刻は呼び出し側が与える [us]．
+ */
+class DecisionTracer {
+ public:
+  enum Point : uint8_t {
+    WallCapture,   //< MoveAction が壁を読んで待機を通知した
+    PreCallback,   //< calcNextDirectionsPreCallback
+    PostCallback,  //< calcNextDirectionsPostCallback
+    Enqueue,       //< 最初の queueAction
+    Dequeue,       //< MoveAction が次の行動を取り出した
+    PointMax,
+  };
+  static const char* getPointName(const Point p) {
+    static const char* names[] = {
+        "capture", "pre", "post", "enqueue", "dequeue",
+    };
+    return p < PointMax ? names[p] : "unknown";
+  }
+  struct Cell {
+    std::array<uint32_t, PointMax> t_us;  //< 0: 未記録
+    uint32_t latency_us() const {  //< 壁の読み取りから行動の追加まで
+      return t_us[Enqueue] ? t_us[Enqueue] - t_us[WallCapture] : 0;
+    }
+  };
+  static constexpr int kBinWidthUs = 1000;
+  static constexpr int kBinCount = 32;  //< 最後の bin は超過分
+
+ public:
+  explicit DecisionTracer(const int capacity = 1024) {
+    cells_.reserve(capacity);
+  }
+  void reset() {
+    std::lock_guard<std::mutex> lock_guard(mutex_);
+    cells_.clear();
+    dropped_ = 0;
+  }
+  void mark(const Point p, const uint32_t t_us) {
+    std::lock_guard<std::mutex> lock_guard(mutex_);
+    const uint32_t t = t_us | 1;  //< 0 は未記録を表すので避ける
+    if (p == WallCapture) {
+      if (cells_.size() == cells_.capacity()) {
+        dropped_++;
+        return;
+      }
+      cells_.push_back({});
+      cells_.back().t_us[WallCapture] = t;
+      return;
+    }
+    if (cells_.empty()) return;
+    auto& cell = cells_.back();
+    if (!cell.t_us[p]) cell.t_us[p] = t;
+  }
+  /**
+   * @brief 区画ごとの遅延 (壁の読み取りから行動の追加まで) のヒストグラム
+   */
+  std::array<int, kBinCount> histogram() const {
+    std::lock_guard<std::mutex> lock_guard(mutex_);
+    std::array<int, kBinCount> bins{};
+    for (const auto& c : cells_) {
+      if (!c.t_us[Enqueue]) continue;
+      bins[std::min<uint32_t>(c.latency_us() / kBinWidthUs, kBinCount - 1)]++;
+    }
+    return bins;
+  }
+  /**
+   * @brief 遅延の大きい順に区画の番号を返す
+   */
+  std::vector<int> worst(const int count) const {
+    std::lock_guard<std::mutex> lock_guard(mutex_);
+    std::vector<int> indices(cells_.size());
+    for (size_t i = 0; i < indices.size(); ++i) indices[i] = i;
+    std::sort(indices.begin(), indices.end(), [&](int a, int b) {
+      return cells_[a].latency_us() > cells_[b].latency_us();
+    });
+    indices.resize(std::min<size_t>(indices.size(), count));
+    return indices;
+  }
+  /**
+   * @brief ヒストグラムと遅延の大きい区画，全区画の記録 (CSV) を出力する
+   *
+   * 全区画の記録は各点の WallCapture からの経過時間 [us] (未記録は -1)．
+   */
+  void print(std::ostream& os, const int worst_count = 10) const {
+    const auto bins = histogram();
+    const auto indices = worst(worst_count);
+    std::lock_guard<std::mutex> lock_guard(mutex_);
+    os << "# decision latency: cells: " << cells_.size()
+       << " dropped: " << dropped_ << std::endl;
+    os << "# histogram [ms]" << std::endl;
+    for (int i = 0; i < kBinCount; ++i)
+      if (bins[i])
+        os << "#  " << i << (i == kBinCount - 1 ? "+" : "") << "\t" << bins[i]
+           << std::endl;
+    os << "# worst" << std::endl;
+    for (const int i : indices)
+      os << "#  cell " << i << "\t" << cells_[i].latency_us() << " us"
+         << std::endl;
+    os << "cell";
+    for (int p = 0; p < PointMax; ++p)
+      os << "\t" << getPointName(static_cast<Point>(p));
+    os << std::endl;
+    for (size_t i = 0; i < cells_.size(); ++i) {
+      const auto& c = cells_[i];
+      os << i;
+      for (int p = 0; p < PointMax; ++p)
+        os << "\t" << (c.t_us[p] ? int(c.t_us[p] - c.t_us[WallCapture]) : -1);
+      os << std::endl;
+    }
+  }
+
+ private:
+  std::vector<Cell> cells_;
+  int dropped_ = 0;
+  mutable std::mutex mutex_;
+};
+
+}  // namespace utils
@@ -0,0 +1,105 @@
+/**
+ * @file encoder_calibrator.hpp
+ * @brief Encoder Eccentricity Calibrator with Recursive Least Squares
+ * @author Ryotaro Onuki <kerikun11+github@gmail.com>
+ * @date 2024-02-04
+ * @copyright Copyright 2024 Ryotaro Onuki <kerikun11+github@gmail.com>
+ */
+#pragma once
+
+#include <array>
+#include <cmath>
+
+namespace utils {
+
+/**
+ * @brief 空転させたホイールのエンコーダ値から偏心補正値を逐次同定するクラス
+ *
+ * 等速回転中のエンコーダ値 x[k] に対して次のモデルを当てはめる
+ * (tools/encoder/main.py と同じモデル)．
+ *
+ *   x[k] + a sin(2 pi (x[k] / N + b)) = c0 + c1 k
+ *
+ * 右辺の直線と正弦波の cos, sin 成分を未知数とすると線形回帰になるので，
+ * 逐次最小二乗法 (RLS) で 1 サンプルずつ更新する．
+ * ハードウェアに依存しないのでホスト環境でも実行できる．
+ */
+class EncoderCalibrator {
+ public:
+  struct Result {
+    float gain;   //< a [pulses]
+    float phase;  //< b [0, 1)
+  };
+
+ public:
+  explicit EncoderCalibrator(const int pulses_size,
+                             const double forgetting_factor = 1.0)
+      : pulses_size_(pulses_size), lambda_(forgetting_factor) {
+    reset();
+  }
+  void reset() {
+    count_ = 0;
+    pulses_origin_ = 0;
+    theta_.fill(0);
+    for (int i = 0; i < kNumParams; ++i)
+      for (int j = 0; j < kNumParams; ++j) P_[i][j] = i == j ? kInitialP : 0;
+  }
+  /**
+   * @brief 一定周期でサンプルしたエンコーダ値 (オーバーフロー補正済み) を追加
+   */
+  void push(const int pulses) {
+    if (count_ == 0) pulses_origin_ = pulses;
+    const double w = 2 * PI * double(pulses) / pulses_size_;
+    const std::array<double, kNumParams> phi = {
+        1.0, double(count_), std::sin(w), std::cos(w)};
+    const double y = pulses - pulses_origin_;
+    /* P phi */
+    std::array<double, kNumParams> Pphi;
+    for (int i = 0; i < kNumParams; ++i) {
+      Pphi[i] = 0;
+      for (int j = 0; j < kNumParams; ++j) Pphi[i] += P_[i][j] * phi[j];
+    }
+    double denom = lambda_;
+    for (int i = 0; i < kNumParams; ++i) denom += phi[i] * Pphi[i];
+    /* gain and error */
+    double y_hat = 0;
+    for (int i = 0; i < kNumParams; ++i) y_hat += phi[i] * theta_[i];
+    const double e = y - y_hat;
+    for (int i = 0; i < kNumParams; ++i) theta_[i] += Pphi[i] / denom * e;
+    /* covariance update (P is symmetric, so phi^T P == (P phi)^T) */
+    for (int i = 0; i < kNumParams; ++i)
+      for (int j = 0; j < kNumParams; ++j)
+        P_[i][j] = (P_[i][j] - Pphi[i] * Pphi[j] / denom) / lambda_;
+    count_++;
+  }
+  int size() const { return count_; }
+  /**
+   * @brief 同定結果を Encoder::Parameter の ec_gain, ec_phase の形式で取得
+   */
+  Result getResult() const {
+    /* y = c0 + c1 k - p sin(w) - q cos(w) */
+    const double p = -theta_[2];
+    const double q = -theta_[3];
+    double phase = std::atan2(q, p) / (2 * PI);
+    if (phase < 0) phase += 1;
+    return {float(std::hypot(p, q)), float(phase)};
+  }
+  /**
+   * @brief 回転速度の推定値 [pulses/sample]
+   */
+  float getPulsesPerSample() const { return float(theta_[1]); }
+
+ private:
+  static constexpr int kNumParams = 4;
+  static constexpr double kInitialP = 1e6;
+  static constexpr double PI = 3.14159265358979323846;
+
+  int pulses_size_;
+  double lambda_;
+  int count_;
+  int pulses_origin_;
+  std::array<double, kNumParams> theta_;
+  double P_[kNumParams][kNumParams];
+};
+
+}  // namespace utils
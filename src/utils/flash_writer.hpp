@@ -0,0 +1,186 @@
+/**
+ * @file flash_writer.hpp
+ * @brief Background Flash Writer with Request Coalescing
+ * @author Ryotaro Onuki <kerikun11+github@gmail.com>
+ * @date 2024-02-04
+ * @copyright Copyright 2024 Ryotaro Onuki <kerikun11+github@gmail.com>
+ */
+#pragma once
+
+#include <esp_timer.h>
+
+#include <algorithm>  //< for std::max, std::find_if
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <ostream>
+
+namespace utils {
+
+/**
+ * @brief フラッシュへの書き込みを低優先度のタスクで行うクラス
+ *
+ * 書き込みの要求 (Job) は呼び出し時点のスナップショットを値で持つ．
+ * 同じ key の要求が待機中なら新しい方で置き換える (古い内容を書く意味は
+ * ないため)．置き換えた要求は元の順番のまま実行する．
+ * 電源断に備えて書き終えておく必要がある場面では flush() で待つ．
+ *
+ * task() は専用のタスクから呼ぶ．ホスト環境では std::thread で動かせる．
+ */
+class FlashWriter {
+ public:
+  using Job = std::function<bool()>;
+  struct Stats {
+    int requests = 0;             //< post() の回数
+    int coalesced = 0;            //< 待機中の要求を置き換えた回数
+    int rejected = 0;             //< キューが一杯で断った回数
+    int writes = 0;               //< 実行した書き込みの回数
+    int failures = 0;             //< 失敗した書き込みの回数
+    size_t queued_bytes = 0;      //< 待機中の要求のバイト数
+    size_t queued_bytes_max = 0;  //< queued_bytes の最大値
+    uint32_t write_us_max = 0;    //< 書き込み自体の時間の最大値
+    uint32_t latency_us_max = 0;  //< 要求から書き終えるまでの時間の最大値
+    uint64_t latency_us_sum = 0;  //< 要求から書き終えるまでの時間の合計
+  };
+
+ public:
+  explicit FlashWriter(const size_t capacity = 8) : capacity_(capacity) {}
+  /**
+   * @brief 書き込みを要求する
+   *
+   * @param key 要求の種類 (同じ key の待機中の要求は置き換える)
+   * @param bytes 書き込むおよそのバイト数 (統計用)
+   * @return false キューが一杯
+   */
+  bool post(const uint8_t key, const size_t bytes, const Job& job) {
+    std::lock_guard<std::mutex> lock_guard(mutex_);
+    stats_.requests++;
+    const uint32_t seq = ++posted_seq_;
+    const uint32_t now = esp_timer_get_time();
+    auto it = std::find_if(queue_.begin(), queue_.end(),
+                           [&](const Request& r) { return r.key == key; });
+    if (it != queue_.end()) {
+      stats_.coalesced++;
+      stats_.queued_bytes -= it->bytes;
+      /* 番号と受付時刻は最初の要求のまま (flush と遅延は最初の要求から) */
+      it->bytes = bytes, it->job = job;
+    } else {
+      if (queue_.size() >= capacity_) {
+        stats_.rejected++;
+        return false;
+      }
+      queue_.push_back({key, seq, now, bytes, job});
+    }
+    stats_.queued_bytes += bytes;
+    stats_.queued_bytes_max =
+        std::max(stats_.queued_bytes_max, stats_.queued_bytes);
+    cv_.notify_all();
+    return true;
+  }
+  /**
+   * @brief これまでに要求した書き込みが終わるまで待つ
+   *
+   * @return false 前回の flush() 以降に失敗した書き込みがある，
+   * またはタイムアウトした
+   */
+  bool flush(const uint32_t timeout_ms = 10000) {
+    std::unique_lock<std::mutex> unique_lock(mutex_);
+    const uint32_t target = posted_seq_;
+    const bool done =
+        cv_.wait_for(unique_lock, std::chrono::milliseconds(timeout_ms),
+                     [&] { return is_done(target); });
+    const bool result = done && !failed_;
+    failed_ = false;
+    return result;
+  }
+  /**
+   * @brief 要求を 1 つ取り出して書き込む
+   *
+   * @return false stop() された
+   */
+  bool run_once() {
+    Request r;
+    {
+      std::unique_lock<std::mutex> unique_lock(mutex_);
+      cv_.wait(unique_lock, [&] { return stopped_ || !queue_.empty(); });
+      if (stopped_) return false;
+      r = queue_.front();
+      queue_.pop_front();
+      running_seq_ = r.seq;
+    }
+    const uint32_t t_start = esp_timer_get_time();
+    const bool result = r.job();
+    const uint32_t t_end = esp_timer_get_time();
+    {
+      std::lock_guard<std::mutex> lock_guard(mutex_);
+      running_seq_ = 0;
+      stats_.writes++;
+      if (!result) stats_.failures++, failed_ = true;
+      stats_.queued_bytes -= r.bytes;
+      stats_.write_us_max = std::max(stats_.write_us_max, t_end - t_start);
+      stats_.latency_us_max =
+          std::max(stats_.latency_us_max, t_end - r.posted_us);
+      stats_.latency_us_sum += t_end - r.posted_us;
+    }
+    cv_.notify_all();
+    return true;
+  }
+  void task() {
+    while (run_once()) {
+    }
+  }
+  void stop() {
+    std::lock_guard<std::mutex> lock_guard(mutex_);
+    stopped_ = true;
+    cv_.notify_all();
+  }
+  Stats get_stats() const {
+    std::lock_guard<std::mutex> lock_guard(mutex_);
+    return stats_;
+  }
+  void print(std::ostream& os) const {
+    const auto s = get_stats();
+    os << "# flash writer: requests: " << s.requests
+       << " coalesced: " << s.coalesced << " rejected: " << s.rejected
+       << " writes: " << s.writes << " failures: " << s.failures
+       << " queued_bytes_max: " << s.queued_bytes_max
+       << " write_us_max: " << s.write_us_max
+       << " latency_us_max: " << s.latency_us_max << " latency_us_ave: "
+       << (s.writes ? s.latency_us_sum / s.writes : 0) << std::endl;
+  }
+
+ private:
+  struct Request {
+    uint8_t key;
+    uint32_t seq;        //< 最初に要求された番号
+    uint32_t posted_us;  //< 最初に要求された時刻
+    size_t bytes;
+    Job job;
+  };
+  const size_t capacity_;
+  std::deque<Request> queue_;
+  uint32_t posted_seq_ = 0;
+  uint32_t running_seq_ = 0;  //< 実行中の要求の番号 (0: なし)
+  bool failed_ = false;
+  bool stopped_ = false;
+  Stats stats_;
+  mutable std::mutex mutex_;
+  std::condition_variable cv_;
+
+  /**
+   * @brief 番号 target までの要求が全て書き終わったか
+   *
+   * 置き換えた要求は最初の番号を持つので，置き換え後の内容を書き終えるまで
+   * 待つことになる．
+   */
+  bool is_done(const uint32_t target) const {
+    if (running_seq_ && running_seq_ <= target) return false;
+    return std::none_of(queue_.begin(), queue_.end(),
+                        [&](const Request& r) { return r.seq <= target; });
+  }
+};
+
+}  // namespace utils
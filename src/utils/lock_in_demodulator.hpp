@@ -0,0 +1,63 @@
+/**
+ * @file lock_in_demodulator.hpp
+ * @brief Lock-in Demodulator for the Reflectors
+ * @author Ryotaro Onuki <kerikun11+github@gmail.com>
+ * @date 2024-02-04
+ * @copyright Copyright 2024 Ryotaro Onuki <kerikun11+github@gmail.com>
+ */
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+namespace utils {
+
+/**
+ * @brief 点灯と消灯の組を平均する同期検波 (ロックイン) の積算器
+ *
+ * 参照信号を点灯で +1，消灯で -1 として標本に掛けた和を組の数で割る．
+ * 組は 1 周期の中に等間隔に並べるので，外乱光のちらつきのうち周期の
+ * 短い成分と ADC の雑音は平均で小さくなる．
+ * 組ごとではなく平均してから 1 で飽和させるので，弱い信号で雑音が
+ * 正の偏りにならない．組が 1 つなら従来の差分と同じ値になる．
+ * ハードウェアに依存しないのでホスト環境でも実行できる．
+ */
+template <int kNumChannels>
+class LockInDemodulator {
+ public:
+  explicit LockInDemodulator(const int pairs = 1) : pairs_(pairs) {
+    sum_.fill(0);
+    count_.fill(0);
+    value_.fill(1);
+  }
+  int pairs() const { return pairs_; }
+  /**
+   * @brief 1 組の標本を足す
+   *
+   * @param offset 消灯時の ADC の値
+   * @param peak 点灯時の ADC の値
+   * @return true 組がそろって値を更新した
+   */
+  bool push(const int ch, const int offset, const int peak) {
+    sum_[ch] += peak - offset;
+    if (++count_[ch] < pairs_) return false;
+    /* 偶数への丸めで平均する (1 未満は 1 で飽和) */
+    const int32_t sum = sum_[ch];
+    int32_t q = sum / pairs_;
+    const int32_t r2 = 2 * (sum % pairs_);
+    if (r2 > pairs_ || (r2 == pairs_ && (q & 1))) q++;
+    value_[ch] = sum < pairs_ ? 1 : q;
+    sum_[ch] = 0;
+    count_[ch] = 0;
+    return true;
+  }
+  int16_t value(const int ch) const { return value_[ch]; }
+
+ private:
+  int pairs_;                                //< 1 周期の組の数
+  std::array<int32_t, kNumChannels> sum_;    //< 差の和
+  std::array<int, kNumChannels> count_;      //< 足した組の数
+  std::array<int16_t, kNumChannels> value_;  //< 最後の平均
+};
+
+}  // namespace utils
@@ -0,0 +1,109 @@
+/**
+ * @file monotone_curve.hpp
+ * @brief Monotone Piecewise Linear Curve
+ * @author Ryotaro Onuki <kerikun11+github@gmail.com>
+ * @date 2024-02-04
+ * @copyright Copyright 2024 Ryotaro Onuki <kerikun11+github@gmail.com>
+ */
+#pragma once
+
+#include <algorithm>  //< for std::sort, std::max, std::min
+#include <array>
+#include <vector>
+
+namespace utils {
+
+/**
+ * @brief 等間隔の節点をもつ単調非減少な区分線形関数
+ *
+ * 節点の値を表として引くので，評価は O(1) で済む．
+ * 節点の範囲の外は傾き 1 で延ばす (恒等関数に定数を足したものは範囲に
+ * よらず正確に表せる)．そのまま記録できるよう，メンバは数値だけにする．
+ */
+struct MonotoneCurve {
+  static constexpr int kKnotCount = 16;
+  /* 当てはめに使う点 */
+  struct Point {
+    float x;
+    float y;
+    float w;  //< 重み (正)
+  };
+
+  float x0 = 0;                       //< 最初の節点の x
+  float dx = 1;                       //< 節点の間隔 (正)
+  std::array<float, kKnotCount> y{};  //< 節点の値 (単調非減少)
+
+  /**
+   * @brief y = x + offset
+   */
+  static MonotoneCurve identity(const float offset = 0) {
+    MonotoneCurve c;
+    for (int i = 0; i < kKnotCount; ++i) c.y[i] = c.x0 + i * c.dx + offset;
+    return c;
+  }
+  float operator()(const float x) const {
+    const float s = (x - x0) / dx;
+    if (!(s > 0)) return y[0] + (x - x0);  //< NaN もここで返す
+    if (s >= kKnotCount - 1) return y.back() + (x - x_end());
+    const int i = s;
+    return y[i] + (s - i) * (y[i + 1] - y[i]);
+  }
+  float x_end() const { return x0 + (kKnotCount - 1) * dx; }
+  /**
+   * @brief 値を dy だけずらす
+   */
+  void shift(const float dy) {
+    for (auto& v : y) v += dy;
+  }
+  /**
+   * @brief 重み付きの点に単調な曲線を当てはめる
+   *
+   * Pool Adjacent Violators で単調回帰し，区分ごとの重心を結んだ折れ線を
+   * 節点で標本化する．雑音で逆転した点は平均され，曲線は単調になる．
+   *
+   * @return 区分が 2 つ以上できれば true
+   */
+  static bool fit(std::vector<Point> points, MonotoneCurve& curve) {
+    std::sort(points.begin(), points.end(),
+              [](const Point& a, const Point& b) { return a.x < b.x; });
+    /* 区分ごとの重み付きの和 */
+    struct Block {
+      float wx, wy, w;
+      float x() const { return wx / w; }
+      float y() const { return wy / w; }
+    };
+    std::vector<Block> blocks;
+    for (const auto& p : points) {
+      if (!(p.w > 0)) continue;
+      blocks.push_back({p.w * p.x, p.w * p.y, p.w});
+      /* 逆転した区分と x の重なる区分をまとめる */
+      while (blocks.size() >= 2) {
+        const auto& a = blocks[blocks.size() - 2];
+        const auto& b = blocks.back();
+        if (a.y() < b.y() && a.x() < b.x()) break;
+        const Block m = {a.wx + b.wx, a.wy + b.wy, a.w + b.w};
+        blocks.pop_back();
+        blocks.back() = m;
+      }
+    }
+    if (blocks.size() < 2) return false;
+    curve.x0 = blocks.front().x();
+    curve.dx = (blocks.back().x() - curve.x0) / (kKnotCount - 1);
+    if (!(curve.dx > 0)) return false;
+    /* 節点での折れ線の値 */
+    size_t j = 0;
+    for (int i = 0; i < kKnotCount; ++i) {
+      const float x = i + 1 < kKnotCount ? curve.x0 + i * curve.dx
+                                         : blocks.back().x();
+      while (j + 2 < blocks.size() && blocks[j + 1].x() < x) ++j;
+      const auto& a = blocks[j];
+      const auto& b = blocks[j + 1];
+      const float r = std::max(0.0f, std::min((x - a.x()) / (b.x() - a.x()),
+                                              1.0f));
+      curve.y[i] = a.y() + r * (b.y() - a.y());
+    }
+    return true;
+  }
+};
+
+}  // namespace utils
@@ -0,0 +1,77 @@
+/**
+ * @file odometry.hpp
+ * @brief Odometry Integrator
+ * @author Ryotaro Onuki <kerikun11+github@gmail.com>
+ * @date 2024-02-04
+ * @copyright Copyright 2024 Ryotaro Onuki <kerikun11+github@gmail.com>
+ */
+#pragma once
+
+#include <ctrl/pose.h>
+
+#include <cmath>
+
+namespace utils {
+
+/**
+ * @brief 1 周期分の位置の積分方法
+ */
+enum class OdometryMethod {
+  ForwardEuler,  //< 角度更新後の向きで直進 (従来の方法)
+  Midpoint,      //< 周期の中間の向きで直進 (2次精度)
+  ExactArc,      //< 一定の速度・角速度の円弧として積分
+};
+
+/**
+ * @brief 横滑り角の推定値
+ *
+ * 遠心力に比例して進行方向が内側にずれるモデル beta = k v w
+ * @param k 横滑り係数 [s/mm] (0: 横滑りなし)
+ * @param v 並進速度 [mm/s]
+ * @param w 角速度 [rad/s]
+ */
+inline float slip_angle(const float k, const float v, const float w) {
+  return k * v * w;
+}
+
+/**
+ * @brief 並進速度 v と角速度 w で Ts だけ進んだ位置を積分する
+ *
+ * @param p 積分する位置 (更新される)
+ * @param v 並進速度 [mm/s]
+ * @param w 角速度 [rad/s]
+ * @param slip 横滑り角 [rad] (進行方向と機体の向きの差)
+ * @param Ts 積分周期 [s]
+ * @param method 積分方法
+ */
+inline void integrate_odometry(ctrl::Pose& p, const float v, const float w,
+                               const float slip, const float Ts,
+                               const OdometryMethod method) {
+  const float th_0 = p.th + slip;
+  const float dth = w * Ts;
+  p.th += dth;
+  switch (method) {
+    case OdometryMethod::ForwardEuler: {
+      const float th_1 = p.th + slip;
+      p.x += v * std::cos(th_1) * Ts;
+      p.y += v * std::sin(th_1) * Ts;
+    } break;
+    case OdometryMethod::Midpoint: {
+      const float th_m = th_0 + dth / 2;
+      p.x += v * std::cos(th_m) * Ts;
+      p.y += v * std::sin(th_m) * Ts;
+    } break;
+    case OdometryMethod::ExactArc: {
+      const float th_m = th_0 + dth / 2;
+      /* 弦の長さの係数 sin(dth/2) / (dth/2) (dth -> 0 で 1 に収束) */
+      const float half = dth / 2;
+      const float sinc = std::abs(half) < 1e-4f
+                             ? 1 - half * half / 6
+                             : std::sin(half) / half;
+      p.x += v * Ts * sinc * std::cos(th_m);
+      p.y += v * Ts * sinc * std::sin(th_m);
+    } break;
+  }
+}
+
+}  // namespace utils
@@ -0,0 +1,360 @@
+/**
+ * @file parameter_store.hpp
+ * @brief Typed and Persistent Runtime Parameter Store
+ * @author Ryotaro Onuki <kerikun11+github@gmail.com>
+ * @date 2024-02-04
+ * @copyright Copyright 2024 Ryotaro Onuki <kerikun11+github@gmail.com>
+ */
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>  //< for std::chrono::milliseconds
+#include <cmath>   //< for std::isfinite
+#include <cstdint>
+#include <cstdlib>  //< for std::strtof, std::strtol
+#include <cstring>  //< for std::memcpy
+#include <fstream>  //< for std::ifstream, std::ofstream
+#include <functional>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>  //< for std::this_thread::sleep_for
+#include <type_traits>
+#include <vector>
+
+#include "utils/crc32.hpp"
+
+namespace utils {
+
+/**
+ * @brief 名前付きの実行時パラメータを保持し，保存・復元するクラス
+ *
+ * パラメータは構造体 T のメンバ (float または int32_t) として持ち，
+ * 名前と型とオフセットの表 (Entry) で文字列から読み書きできるようにする．
+ *
+ * - 読み出し: get() で構造体のコピーを取得する．ロックを取らず，待たない．
+ *   2 面のバッファの面ごとに読んでいる最中の読み手の数を数えておく．
+ * - 書き込み: 非アクティブな面の読み手がいなくなるのを待ち，その面に
+ *   コピーして変更してから切り替える (書き手は排他)．切り替えの直前に
+ *   読み始めた読み手が古い面を読み終える前に書き換えることはない．
+ *   変更後に登録したリスナを呼び，派生値を持つモジュールに反映させる．
+ * - 保存形式: 名前の CRC-32 をキーとした (key, type, value) の列と CRC-32．
+ *   名前で対応づけるので，パラメータの追加・削除をまたいで復元できる．
+ *   名前を変えた場合は Alias に旧名を登録すれば引き継げる．型が変わった
+ *   場合は値を変換する．
+ *
+ * ハードウェアに依存しないのでホスト環境でも実行できる．
+ */
+template <typename T>
+class ParameterStore {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "parameters must be trivially copyable");
+
+ public:
+  enum class Type : uint8_t {
+    Float = 0,
+    Int = 1,
+  };
+  struct Entry {
+    const char* name;
+    Type type;
+    size_t offset;  //< offsetof(T, member)
+  };
+  struct Alias {
+    const char* old_name;
+    const char* new_name;
+  };
+  using Listener = std::function<void(const T&)>;
+
+  /* 保存形式 */
+  struct Header {
+    static constexpr uint32_t kMagic = 0x4B50524D;  //< "KPRM"
+    static constexpr uint16_t kVersion = 1;
+    uint32_t magic = kMagic;
+    uint16_t version = kVersion;
+    uint16_t count = 0;  //< Record の数
+    uint32_t crc = 0;    //< Record の列の CRC-32
+  };
+  struct Record {
+    uint32_t key;  //< crc32(name)
+    uint8_t type;
+    uint8_t reserved[3];
+    uint32_t value;  //< float または int32_t のビット列
+  };
+
+ public:
+  ParameterStore(const T& defaults, const std::vector<Entry>& entries,
+                 const std::vector<Alias>& aliases = {})
+      : defaults_(defaults), entries_(entries) {
+    buffers_[0] = buffers_[1] = defaults_;
+    for (const auto& e : entries_) keys_.push_back(key_of(e.name));
+    for (const auto& a : aliases) {
+      const int i = find(a.new_name);
+      if (i >= 0) aliases_.push_back({key_of(a.old_name), i});
+    }
+  }
+  /**
+   * @brief 現在のパラメータのコピー (ロックフリー，制御ループから呼んでよい)
+   */
+  T get() const {
+    for (;;) {
+      const int i = active_.load();
+      readers_[i].fetch_add(1);
+      /* 数える前に切り替わっていたら，その面は書き換え中かもしれない */
+      if (active_.load() != i) {
+        readers_[i].fetch_sub(1);
+        continue;
+      }
+      const T p = buffers_[i];
+      readers_[i].fetch_sub(1);
+      return p;
+    }
+  }
+  const T& get_defaults() const { return defaults_; }
+  const std::vector<Entry>& get_entries() const { return entries_; }
+  /**
+   * @brief 変更時に呼ばれる関数を登録する (登録時に現在値で 1 回呼ぶ)
+   */
+  void add_listener(const Listener& listener) {
+    std::lock_guard<std::mutex> lock_guard(mutex_);
+    listeners_.push_back(listener);
+    listener(get());
+  }
+  /**
+   * @brief 関数 f(T&) でパラメータを変更する
+   */
+  template <typename F>
+  void update(F f) {
+    std::lock_guard<std::mutex> lock_guard(mutex_);
+    const int active = active_.load();
+    const int next = 1 - active;
+    /* 前の切り替えの前から next の面を読んでいる読み手を待つ */
+    while (readers_[next].load() != 0)
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    buffers_[next] = buffers_[active];
+    f(buffers_[next]);
+    active_.store(next);
+    const T p = buffers_[next];
+    for (const auto& listener : listeners_) listener(p);
+  }
+  void reset() {
+    update([&](T& p) { p = defaults_; });
+  }
+  /**
+   * @brief 名前で値を文字列として取得する
+   */
+  bool get(const std::string& name, std::string& value) const {
+    const int i = find(name);
+    if (i < 0) return false;
+    value = to_string(entries_[i], get());
+    return true;
+  }
+  /**
+   * @brief 名前で値を文字列から設定する
+   */
+  bool set(const std::string& name, const std::string& value) {
+    const int i = find(name);
+    if (i < 0) return false;
+    const auto& e = entries_[i];
+    char* end = nullptr;
+    uint32_t bits;
+    if (e.type == Type::Float) {
+      const float f = std::strtof(value.c_str(), &end);
+      std::memcpy(&bits, &f, sizeof(bits));
+    } else {
+      const int32_t n = std::strtol(value.c_str(), &end, 0);
+      std::memcpy(&bits, &n, sizeof(bits));
+    }
+    if (end == value.c_str() || *end != '\0') return false;
+    update([&](T& p) { write(e, p, bits); });
+    return true;
+  }
+  /**
+   * @brief 現在値を保存形式に変換する
+   */
+  std::string serialize() const {
+    const T p = get();
+    std::vector<Record> records;
+    for (size_t i = 0; i < entries_.size(); ++i) {
+      Record r = {};
+      r.key = keys_[i];
+      r.type = static_cast<uint8_t>(entries_[i].type);
+      r.value = read(entries_[i], p);
+      records.push_back(r);
+    }
+    Header h;
+    h.count = records.size();
+    h.crc = crc32(records.data(), records.size() * sizeof(Record));
+    std::string data;
+    data.append(reinterpret_cast<const char*>(&h), sizeof(h));
+    data.append(reinterpret_cast<const char*>(records.data()),
+                records.size() * sizeof(Record));
+    return data;
+  }
+  /**
+   * @brief 保存形式から復元する
+   *
+   * 未知のキーは無視し，記録のないパラメータは既定値とする．
+   * @return false 形式・バージョン・CRC の不一致，または未知の型・
+   * 予約領域が 0 でない・同じパラメータが重複・有限でない値の Record
+   * (値は変更しない)
+   */
+  bool deserialize(const std::string& data) {
+    Header h;
+    if (data.size() < sizeof(h)) return false;
+    std::memcpy(&h, data.data(), sizeof(h));
+    if (h.magic != Header::kMagic || h.version != Header::kVersion ||
+        data.size() != sizeof(h) + h.count * sizeof(Record))
+      return false;
+    const char* body = data.data() + sizeof(h);
+    if (crc32(body, h.count * sizeof(Record)) != h.crc) return false;
+    T p = defaults_;
+    std::vector<bool> restored(entries_.size(), false);
+    for (int k = 0; k < h.count; ++k) {
+      Record r;
+      std::memcpy(&r, body + k * sizeof(Record), sizeof(r));
+      if (r.type > static_cast<uint8_t>(Type::Int) || r.reserved[0] != 0 ||
+          r.reserved[1] != 0 || r.reserved[2] != 0)
+        return false;
+      const int i = find(r.key);
+      if (i < 0) continue;
+      if (restored[i]) return false;
+      restored[i] = true;
+      const auto& e = entries_[i];
+      const uint32_t bits = convert(r.value, static_cast<Type>(r.type), e.type);
+      if (e.type == Type::Float) {
+        float f;
+        std::memcpy(&f, &bits, sizeof(f));
+        if (!std::isfinite(f)) return false;
+      }
+      write(e, p, bits);
+    }
+    update([&](T& dst) { dst = p; });
+    return true;
+  }
+  bool backup(const char* filepath) const {
+    std::ofstream of(filepath, std::ios::binary);
+    if (of.fail()) return false;
+    const auto data = serialize();
+    of.write(data.data(), data.size());
+    return of.good();
+  }
+  bool restore(const char* filepath) {
+    std::ifstream f(filepath, std::ios::binary);
+    if (f.fail()) return false;
+    std::stringstream ss;
+    ss << f.rdbuf();
+    return deserialize(ss.str());
+  }
+  /**
+   * @brief シリアルコンソールの 1 行分のコマンドを実行する
+   *
+   * list | get <name> | set <name> <value> | reset | save | load | exit
+   * @return false exit が入力された
+   */
+  bool execute(const std::string& line, std::ostream& os,
+               const char* filepath) {
+    std::istringstream iss(line);
+    std::string cmd, name, value;
+    iss >> cmd >> name >> value;
+    if (cmd.empty()) return true;
+    if (cmd == "exit") return false;
+    if (cmd == "list") {
+      const T p = get();
+      for (const auto& e : entries_)
+        os << e.name << " = " << to_string(e, p) << std::endl;
+    } else if (cmd == "get") {
+      if (get(name, value))
+        os << name << " = " << value << std::endl;
+      else
+        os << "unknown parameter: " << name << std::endl;
+    } else if (cmd == "set") {
+      if (set(name, value))
+        os << name << " = " << value << std::endl;
+      else
+        os << "invalid: " << name << " " << value << std::endl;
+    } else if (cmd == "reset") {
+      reset();
+      os << "reset to defaults" << std::endl;
+    } else if (cmd == "save") {
+      os << (backup(filepath) ? "saved" : "save failed") << std::endl;
+    } else if (cmd == "load") {
+      os << (restore(filepath) ? "loaded" : "load failed") << std::endl;
+    } else {
+      os << "usage: list | get <name> | set <name> <value> | reset | save | "
+            "load | exit"
+         << std::endl;
+    }
+    return true;
+  }
+
+ private:
+  const T defaults_;
+  const std::vector<Entry> entries_;
+  std::vector<uint32_t> keys_;
+  std::vector<std::pair<uint32_t, int>> aliases_;  //< (旧名のキー, index)
+  std::array<T, 2> buffers_;
+  std::atomic<int> active_{0};                         //< 読み手が読む面
+  mutable std::array<std::atomic<int>, 2> readers_{};  //< 面ごとの読み手の数
+  std::mutex mutex_;                                   //< 書き手の排他
+  std::vector<Listener> listeners_;
+
+  static uint32_t key_of(const char* name) {
+    return crc32(name, std::strlen(name));
+  }
+  int find(const std::string& name) const {
+    for (size_t i = 0; i < entries_.size(); ++i)
+      if (name == entries_[i].name) return i;
+    return -1;
+  }
+  int find(const uint32_t key) const {
+    for (size_t i = 0; i < keys_.size(); ++i)
+      if (keys_[i] == key) return i;
+    for (const auto& a : aliases_)
+      if (a.first == key) return a.second;
+    return -1;
+  }
+  static uint32_t read(const Entry& e, const T& p) {
+    uint32_t bits;
+    std::memcpy(&bits, reinterpret_cast<const char*>(&p) + e.offset,
+                sizeof(bits));
+    return bits;
+  }
+  static void write(const Entry& e, T& p, const uint32_t bits) {
+    std::memcpy(reinterpret_cast<char*>(&p) + e.offset, &bits, sizeof(bits));
+  }
+  static uint32_t convert(const uint32_t bits, const Type from,
+                          const Type to) {
+    if (from == to) return bits;
+    uint32_t out;
+    if (from == Type::Int) {
+      int32_t n;
+      std::memcpy(&n, &bits, sizeof(n));
+      const float f = n;
+      std::memcpy(&out, &f, sizeof(out));
+    } else {
+      float f;
+      std::memcpy(&f, &bits, sizeof(f));
+      const int32_t n = f;
+      std::memcpy(&out, &n, sizeof(out));
+    }
+    return out;
+  }
+  static std::string to_string(const Entry& e, const T& p) {
+    const uint32_t bits = read(e, p);
+    std::ostringstream oss;
+    if (e.type == Type::Float) {
+      float f;
+      std::memcpy(&f, &bits, sizeof(f));
+      oss << f;
+    } else {
+      int32_t n;
+      std::memcpy(&n, &bits, sizeof(n));
+      oss << n;
+    }
+    return oss.str();
+  }
+};
+
+}  // namespace utils
@@ -0,0 +1,157 @@
+/**
+ * @file path_candidates.hpp
+ * @brief Candidate Paths for the Fastest Fast Run
+ * @author Ryotaro Onuki <kerikun11+github@gmail.com>
+ * @date 2024-02-04
+ * @copyright Copyright 2024 Ryotaro Onuki <kerikun11+github@gmail.com>
+ */
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <queue>
+#include <utility>  //< for std::pair
+#include <vector>
+
+namespace utils {
+
+/**
+ * @brief 最短走行の経路の候補を作るクラス
+ *
+ * 区画の中心を結ぶグラフの上で，方向転換の重みを変えた Dijkstra 法で
+ * 経路を求め，互いに異なるものを候補とする．
+ * 方向転換が重いほど長い直線の多い経路に，逆向きの方向転換が続くこと
+ * (斜めの区間) が軽いほどジグザグの多い経路になる．
+ * 同じ経路ばかりにならないよう，見つけた経路の区画の移動には
+ * 以降の探索で重み penalty を足す．
+ * どの候補が速いかは機体の加減速とターンの速度で決まるので，
+ * 候補ごとに走行時間を計算して選ぶ．迷路のライブラリには依存しない．
+ */
+class PathCandidates {
+ public:
+  /* 区画の移動の向き */
+  enum Direction : uint8_t {
+    East,
+    North,
+    West,
+    South,
+  };
+  using Directions = std::vector<Direction>;
+  /* 区画 (x, y) から向き d に進めるか */
+  using CanGo = std::function<bool(int x, int y, Direction d)>;
+  /**
+   * @brief 経路の重み (1 区画の移動を 1 とする)
+   */
+  struct Weight {
+    float turn;    //< 方向転換 1 回の追加の重み
+    float zigzag;  //< 直前と逆向きの方向転換 1 回の追加の重み
+  };
+  /* 見つけた経路の区画の移動に足す重み */
+  static constexpr float kPenalty = 0.25f;
+  /* 既定の重みの組 (先頭は区画数の最小) */
+  static const std::vector<Weight>& default_weights() {
+    static const std::vector<Weight> weights = {
+        {0, 0},    {0.5f, 0.5f}, {1, 1},    {2, 2},
+        {4, 4},    {1, 0.2f},    {2, 0.4f}, {4, 0.8f},
+    };
+    return weights;
+  }
+
+ public:
+  PathCandidates(const int size, const CanGo& can_go)
+      : size_(size), can_go_(can_go) {}
+  /**
+   * @brief (0, 0) から北向きに出発し，いずれかのゴール区画に着く経路の候補
+   *
+   * @param goals ゴール区画の座標
+   * @param last 最後の移動の向き (負: 問わない)
+   * @return 互いに異なる経路 (weights の順，到達できなければ空)
+   */
+  std::vector<Directions> search(
+      const std::vector<std::pair<int, int>>& goals, const int last = -1,
+      const std::vector<Weight>& weights = default_weights()) const {
+    std::vector<bool> is_goal(size_ * size_, false);
+    for (const auto& g : goals)
+      if (inside(g.first, g.second)) is_goal[g.second * size_ + g.first] = 1;
+    std::vector<Directions> candidates;
+    std::vector<float> penalty(size_ * size_ * 4, 0);
+    for (const auto& w : weights) {
+      Directions dirs;
+      if (!search(is_goal, last, w, penalty, dirs)) return {};
+      int x = 0, y = 0;
+      for (const auto d : dirs) {
+        penalty[(y * size_ + x) * 4 + d] += kPenalty;
+        x += kDx[d], y += kDy[d];
+      }
+      bool unique = true;
+      for (const auto& c : candidates) unique &= c != dirs;
+      if (unique) candidates.push_back(dirs);
+    }
+    return candidates;
+  }
+
+ private:
+  /* 状態 (区画，向き，直前の方向転換) の番号 */
+  enum Turn : uint8_t {
+    TurnNone,
+    TurnLeft,
+    TurnRight,
+    TurnMax,
+  };
+  static constexpr int kDx[4] = {1, 0, -1, 0};
+  static constexpr int kDy[4] = {0, 1, 0, -1};
+  int size_;
+  CanGo can_go_;
+
+  bool inside(const int x, const int y) const {
+    return x >= 0 && y >= 0 && x < size_ && y < size_;
+  }
+  int index_of(const int x, const int y, const int d, const int t) const {
+    return ((y * size_ + x) * 4 + d) * TurnMax + t;
+  }
+  bool search(const std::vector<bool>& is_goal, const int last,
+              const Weight& w, const std::vector<float>& penalty,
+              Directions& dirs) const {
+    const int n = size_ * size_ * 4 * TurnMax;
+    std::vector<float> cost(n, -1);
+    std::vector<int> parent(n, -1);
+    using Item = std::pair<float, int>;
+    std::priority_queue<Item, std::vector<Item>, std::greater<Item>> queue;
+    /* スタート区画に南から入ったとみなす */
+    const int start = index_of(0, 0, North, TurnNone);
+    cost[start] = 0;
+    queue.push({0, start});
+    while (!queue.empty()) {
+      const auto [c, i] = queue.top();
+      queue.pop();
+      if (c > cost[i]) continue;
+      const int t = i % TurnMax, d = i / TurnMax % 4;
+      const int x = i / TurnMax / 4 % size_, y = i / TurnMax / 4 / size_;
+      if (is_goal[y * size_ + x] && i != start && (last < 0 || d == last)) {
+        /* 経路の復元 */
+        dirs.clear();
+        for (int k = i; k != start; k = parent[k])
+          dirs.push_back(Direction(k / TurnMax % 4));
+        dirs = Directions(dirs.rbegin(), dirs.rend());
+        return true;
+      }
+      for (const int turn : {TurnNone, TurnLeft, TurnRight}) {
+        const int nd = (d + (turn == TurnLeft) + 3 * (turn == TurnRight)) % 4;
+        if (!can_go_(x, y, Direction(nd))) continue;
+        const int nx = x + kDx[nd], ny = y + kDy[nd];
+        if (!inside(nx, ny)) continue;
+        float nc = c + 1 + penalty[(y * size_ + x) * 4 + nd];
+        if (turn != TurnNone)
+          nc += (t != TurnNone && t != turn) ? w.zigzag : w.turn;
+        const int j = index_of(nx, ny, nd, turn);
+        if (cost[j] >= 0 && cost[j] <= nc) continue;
+        cost[j] = nc;
+        parent[j] = i;
+        queue.push({nc, j});
+      }
+    }
+    return false;
+  }
+};
+
+}  // namespace utils
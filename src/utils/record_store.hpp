@@ -0,0 +1,384 @@
+/**
+ * @file record_store.hpp
+ * @brief Wear-Levelled Record Store on Raw Flash Sectors
+ * @author Ryotaro Onuki <kerikun11+github@gmail.com>
+ * @date 2024-02-04
+ * @copyright Copyright 2024 Ryotaro Onuki <kerikun11+github@gmail.com>
+ */
+#pragma once
+
+#include <esp_timer.h>
+
+#include <algorithm>  //< for std::max, std::min
+#include <array>
+#include <cstddef>  //< for offsetof
+#include <cstdint>
+#include <cstring>  //< for std::memcpy
+#include <mutex>
+#include <vector>
+
+#include "utils/crc32.hpp"
+
+namespace utils {
+
+/**
+ * @brief セクタ単位で消去するフラッシュ領域
+ *
+ * 消去すると 0xFF になり，書き込みはビットを 0 にすることしかできない．
+ */
+class FlashDevice {
+ public:
+  static constexpr size_t kSectorSize = 4096;
+
+ public:
+  virtual ~FlashDevice() = default;
+  virtual size_t size() const = 0;  //< kSectorSize の倍数
+  virtual bool read(size_t offset, void* data, size_t size) = 0;
+  virtual bool write(size_t offset, const void* data, size_t size) = 0;
+  virtual bool erase_sector(size_t offset) = 0;
+};
+
+/**
+ * @brief 種類 (key) ごとに最新の 1 件を保持するレコードの保存領域
+ *
+ * セクタを環状に使い，レコードは先頭のセクタ (head) の末尾に追記する．
+ * 同じ key の古いレコードは残るが，読み出しは連番の最も新しいものを採る．
+ *
+ * head が一杯になったら次のセクタを消去して head にする．消去する前に，
+ * そのセクタにある最新のレコードを現在の head に移す．その分の空きは
+ * head の書き込みで常に残しておくので，1 回の書き込みでの消去は通常 1 回で
+ * 済み，書き込みの時間が有界になる．全てのセクタを順に消去するので，
+ * 消去回数は自然に均される．
+ *
+ * この空きを保証するため，全ての key の最新のレコードと書き込むレコードの
+ * 合計を kLiveBytesMax (1 セクタ) 以下に制限する．
+ *
+ * 各セクタとレコードは CRC-32 を持つ．書き込み中に電源が落ちて途中で
+ * 切れたレコードは読み飛ばし，前の版を採る．読み出しのたびにも CRC を
+ * 確かめる．
+ */
+class RecordStore {
+ public:
+  struct SectorHeader {
+    static constexpr uint32_t kMagic = 0x5253534B;  //< "KSSR"
+    uint32_t magic;
+    uint32_t seq;          //< head にするたびに 1 増える
+    uint32_t erase_count;  //< このセクタの消去回数
+    uint32_t crc;          //< crc 以外の CRC-32
+  };
+  struct RecordHeader {
+    static constexpr uint16_t kMagic = 0x524B;  //< "KR"
+    uint16_t magic;
+    uint8_t key;
+    uint8_t version;  //< ペイロードの形式の版数
+    uint16_t size;    //< ペイロードのバイト数
+    uint16_t reserved;
+    uint32_t seq;  //< 全レコードで通しの連番
+    uint32_t crc;  //< crc 以外のヘッダとペイロードの CRC-32
+  };
+  static constexpr size_t kSectorSize = FlashDevice::kSectorSize;
+  /* 全ての key の最新のレコード (ヘッダを含む) の合計の上限 */
+  static constexpr size_t kLiveBytesMax = kSectorSize - sizeof(SectorHeader);
+  static constexpr size_t kPayloadMax = kLiveBytesMax - sizeof(RecordHeader);
+  static constexpr int kKeyMax = 16;
+  /**
+   * @brief ペイロードが size バイトのレコードがセクタで占めるバイト数
+   */
+  static constexpr size_t record_bytes(const size_t size) {
+    return align(sizeof(RecordHeader) + size);
+  }
+  struct Stats {
+    int writes = 0;                //< save() の回数
+    int advances = 0;              //< head を進めた回数
+    int relocations = 0;           //< 消去の前に移したレコードの数
+    int torn = 0;                  //< mount() で見つけた壊れたレコードの数
+    int corrupt = 0;               //< load() で CRC が合わなかった回数
+    int rejected = 0;              //< kLiveBytesMax を超えるので拒否した数
+    uint32_t erase_count_min = 0;  //< セクタの消去回数の最小値
+    uint32_t erase_count_max = 0;  //< セクタの消去回数の最大値
+    uint32_t write_us_max = 0;     //< save() 1 回の最大時間
+  };
+
+ public:
+  explicit RecordStore(FlashDevice& flash)
+      : flash_(flash), sector_count_(flash.size() / kSectorSize) {}
+  /**
+   * @brief フラッシュを走査して各 key の最新のレコードを探す
+   *
+   * 有効なセクタがなければ初期化する．
+   */
+  bool mount() {
+    std::lock_guard<std::mutex> lock_guard(mutex_);
+    mounted_ = false;
+    if (sector_count_ < 3) return false;
+    buffer_.resize(kSectorSize);
+    record_.resize(kSectorSize);
+    index_ = {};
+    stats_ = {};
+    erase_counts_.assign(sector_count_, 0);
+    record_seq_ = 0;
+    /* 最新のセクタを head にする */
+    int head = -1;
+    for (int s = 0; s < sector_count_; ++s) {
+      SectorHeader h;
+      if (!read_sector_header(s, h)) continue;
+      erase_counts_[s] = h.erase_count;
+      if (head < 0 || int32_t(h.seq - sector_seq_) > 0) {
+        head = s;
+        sector_seq_ = h.seq;
+      }
+    }
+    if (head < 0) {
+      /* 初期化 */
+      sector_seq_ = 0;
+      head_ = sector_count_ - 1;
+      if (!start_sector((head_ + 1) % sector_count_)) return false;
+      update_erase_stats();
+      return mounted_ = true;
+    }
+    /* 古い順に走査すると，後から見つかったものほど新しい */
+    for (int i = 1; i <= sector_count_; ++i) {
+      const int s = (head + i) % sector_count_;
+      SectorHeader h;
+      if (!read_sector_header(s, h)) continue;
+      if (!flash_.read(s * kSectorSize, buffer_.data(), kSectorSize))
+        return false;
+      const size_t end = scan_sector(s);
+      if (s == head) write_offset_ = end;
+    }
+    head_ = head;
+    update_erase_stats();
+    return mounted_ = true;
+  }
+  /**
+   * @brief key の最新のレコードを読み出す
+   *
+   * @param data 読み出し先 (capacity バイト)
+   * @return false レコードがない，capacity が足りない，または mount() の後に
+   * 壊れた (CRC が合わない)
+   */
+  bool load(const uint8_t key, uint8_t& version, void* data, size_t& size,
+            const size_t capacity) {
+    std::lock_guard<std::mutex> lock_guard(mutex_);
+    if (!mounted_ || key >= kKeyMax || !index_[key].valid) return false;
+    const auto& e = index_[key];
+    if (e.size > capacity) return false;
+    RecordHeader h;
+    if (!flash_.read(e.offset, &h, sizeof(h))) return false;
+    if (!flash_.read(e.offset + sizeof(h), data, e.size)) return false;
+    if (h.magic != RecordHeader::kMagic || h.key != key || h.size != e.size ||
+        h.seq != e.seq || crc_of(h, data) != h.crc) {
+      stats_.corrupt++;
+      return false;
+    }
+    version = e.version;
+    size = e.size;
+    return true;
+  }
+  /**
+   * @brief key のレコードを書き込む
+   *
+   * @return false 書き込みに失敗した，または全ての key の最新のレコードと
+   * 合わせて kLiveBytesMax を超える
+   */
+  bool save(const uint8_t key, const uint8_t version, const void* data,
+            const size_t size) {
+    std::lock_guard<std::mutex> lock_guard(mutex_);
+    if (!mounted_ || key >= kKeyMax || size > kPayloadMax) return false;
+    const uint32_t total = record_bytes(size);
+    /* 同じ key の古いレコードも，新しいものを書き終えるまでは移す */
+    if (live_bytes() + total > kLiveBytesMax) {
+      stats_.rejected++;
+      return false;
+    }
+    const uint32_t t_start = esp_timer_get_time();
+    stats_.writes++;
+    bool result = false;
+    for (int i = 0; i < sector_count_; ++i) {
+      /* 同じ key の古いレコードは消えてよいので，空きの計算から除く */
+      if (write_offset_ + total + live_bytes(next(head_), key) <= kSectorSize) {
+        result = write_record(key, version, data, size);
+        break;
+      }
+      if (!advance()) break;
+    }
+    const uint32_t t_end = esp_timer_get_time();
+    stats_.write_us_max = std::max(stats_.write_us_max, t_end - t_start);
+    return result;
+  }
+  Stats get_stats() const {
+    std::lock_guard<std::mutex> lock_guard(mutex_);
+    return stats_;
+  }
+
+ private:
+  struct Entry {
+    bool valid = false;
+    uint8_t version = 0;
+    uint16_t size = 0;
+    uint32_t offset = 0;  //< レコードの先頭の位置
+    uint32_t seq = 0;
+  };
+  FlashDevice& flash_;
+  const int sector_count_;
+  std::array<Entry, kKeyMax> index_;
+  std::vector<uint32_t> erase_counts_;
+  std::vector<uint8_t> buffer_;  //< 1 セクタ分の作業領域
+  std::vector<uint8_t> record_;  //< 書き込むレコードを組み立てる領域
+  int head_ = 0;
+  size_t write_offset_ = 0;  //< head の中の次の書き込み位置
+  uint32_t sector_seq_ = 0;
+  uint32_t record_seq_ = 0;
+  bool mounted_ = false;
+  Stats stats_;
+  mutable std::mutex mutex_;
+
+  static constexpr size_t align(const size_t size) {
+    return (size + 3) & ~size_t(3);
+  }
+  int next(const int sector) const { return (sector + 1) % sector_count_; }
+  static uint32_t crc_of(const SectorHeader& h) {
+    return utils::crc32(&h, offsetof(SectorHeader, crc));
+  }
+  static uint32_t crc_of(const RecordHeader& h, const void* data) {
+    const uint32_t crc = utils::crc32(&h, offsetof(RecordHeader, crc));
+    return utils::crc32(data, h.size, crc);
+  }
+  bool read_sector_header(const int sector, SectorHeader& h) {
+    if (!flash_.read(sector * kSectorSize, &h, sizeof(h))) return false;
+    return h.magic == SectorHeader::kMagic && h.crc == crc_of(h);
+  }
+  /**
+   * @brief buffer_ に読んだセクタのレコードを索引に登録する
+   *
+   * 壊れたレコードがあれば 4 バイトずつずらして次のレコードを探す．
+   * @return 追記を始められる位置．最後の有効なレコードの終わりとする
+   * (ペイロードの末尾が 0xFF でも消去済みの領域と区別できる)．
+   * その後ろに壊れたレコードの書きかけのバイトがあれば，それより後ろ．
+   */
+  size_t scan_sector(const int sector) {
+    size_t offset = sizeof(SectorHeader);
+    size_t end = offset;
+    bool in_garbage = false;
+    while (offset + sizeof(RecordHeader) <= kSectorSize) {
+      RecordHeader h;
+      std::memcpy(&h, &buffer_[offset], sizeof(h));
+      const uint8_t* payload = &buffer_[offset + sizeof(h)];
+      if (h.magic != RecordHeader::kMagic || h.key >= kKeyMax ||
+          offset + sizeof(h) + h.size > kSectorSize ||
+          crc_of(h, payload) != h.crc) {
+        /* 消去済みの領域は壊れたレコードとして数えない */
+        if (!in_garbage && h.magic != 0xFFFF) {
+          stats_.torn++;
+          in_garbage = true;
+        }
+        offset += 4;
+        continue;
+      }
+      in_garbage = false;
+      auto& e = index_[h.key];
+      if (!e.valid || int32_t(h.seq - e.seq) > 0) {
+        e.valid = true;
+        e.version = h.version;
+        e.size = h.size;
+        e.offset = sector * kSectorSize + offset;
+        e.seq = h.seq;
+      }
+      if (int32_t(h.seq - record_seq_) > 0) record_seq_ = h.seq;
+      offset += record_bytes(h.size);
+      end = offset;
+    }
+    /* 消去済みでないバイトに重ねて書くと壊れる */
+    size_t dirty = kSectorSize;
+    while (dirty > end && buffer_[dirty - 1] == 0xFF) dirty--;
+    return align(dirty);
+  }
+  /**
+   * @brief sector (負なら全てのセクタ) にある最新のレコードのバイト数
+   * (exclude_key を除く)
+   */
+  size_t live_bytes(const int sector = -1, const int exclude_key = -1) const {
+    size_t sum = 0;
+    for (int k = 0; k < kKeyMax; ++k) {
+      const auto& e = index_[k];
+      if (k == exclude_key || !e.valid) continue;
+      if (sector < 0 || int(e.offset / kSectorSize) == sector)
+        sum += record_bytes(e.size);
+    }
+    return sum;
+  }
+  bool write_record(const uint8_t key, const uint8_t version, const void* data,
+                    const size_t size) {
+    RecordHeader h;
+    h.magic = RecordHeader::kMagic;
+    h.key = key;
+    h.version = version;
+    h.size = size;
+    h.reserved = 0xFFFF;
+    h.seq = record_seq_ + 1;
+    h.crc = crc_of(h, data);
+    /* data は buffer_ (レコードの移動) のこともあるので別の領域で組み立てる */
+    const size_t record_size = sizeof(h) + size;
+    std::memcpy(record_.data(), &h, sizeof(h));
+    std::memcpy(record_.data() + sizeof(h), data, size);
+    const size_t offset = head_ * kSectorSize + write_offset_;
+    /* 失敗した場合も途中まで書かれたかもしれないので位置は進める */
+    write_offset_ += align(record_size);
+    if (!flash_.write(offset, record_.data(), record_size)) return false;
+    record_seq_ = h.seq;
+    auto& e = index_[key];
+    e.valid = true;
+    e.version = version;
+    e.size = size;
+    e.offset = offset;
+    e.seq = h.seq;
+    return true;
+  }
+  /**
+   * @brief 次のセクタの最新のレコードを head に移し，消去して head にする
+   */
+  bool advance() {
+    stats_.advances++;
+    const int victim = next(head_);
+    for (int k = 0; k < kKeyMax; ++k) {
+      const auto e = index_[k];
+      if (!e.valid || int(e.offset / kSectorSize) != victim) continue;
+      if (write_offset_ + record_bytes(e.size) > kSectorSize)
+        return false;  //< 空きを残しているので起こらないはず
+      if (!flash_.read(e.offset + sizeof(RecordHeader), buffer_.data(), e.size))
+        return false;
+      if (!write_record(k, e.version, buffer_.data(), e.size)) return false;
+      stats_.relocations++;
+    }
+    if (!start_sector(victim)) return false;
+    update_erase_stats();
+    return true;
+  }
+  /**
+   * @brief sector を消去して head にする
+   */
+  bool start_sector(const int sector) {
+    SectorHeader h;
+    const uint32_t erase_count =
+        read_sector_header(sector, h) ? h.erase_count : erase_counts_[sector];
+    if (!flash_.erase_sector(sector * kSectorSize)) return false;
+    h.magic = SectorHeader::kMagic;
+    h.seq = sector_seq_ + 1;
+    h.erase_count = erase_count + 1;
+    h.crc = crc_of(h);
+    if (!flash_.write(sector * kSectorSize, &h, sizeof(h))) return false;
+    sector_seq_ = h.seq;
+    erase_counts_[sector] = h.erase_count;
+    head_ = sector;
+    write_offset_ = sizeof(SectorHeader);
+    return true;
+  }
+  void update_erase_stats() {
+    const auto mm = std::minmax_element(erase_counts_.begin(),
+                                        erase_counts_.end());
+    stats_.erase_count_min = *mm.first;
+    stats_.erase_count_max = *mm.second;
+  }
+};
+
+}  // namespace utils
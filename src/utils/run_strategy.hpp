@@ -0,0 +1,280 @@
+/**
+ * @file run_strategy.hpp
+ * @brief Expected-Value Strategy for Fast Run Parameter Selection
+ * @author Ryotaro Onuki <kerikun11+github@gmail.com>
+ * @date 2024-02-04
+ * @copyright Copyright 2024 Ryotaro Onuki <kerikun11+github@gmail.com>
+ */
+#pragma once
+
+#include <algorithm>  //< for std::min, std::max, std::sort
+#include <cmath>
+#include <cstdint>
+#include <cstring>  //< for std::memcpy
+#include <limits>
+#include <ostream>
+#include <vector>
+
+namespace utils {
+
+/**
+ * @brief 最短走行のパラメータの段階と斜めの有無を選ぶクラス
+ *
+ * 段階と斜めの組 (アーム) ごとに試行と成功の回数，成功した走行の平均時間を
+ * 記録し，残りの走行で得られる最短時間の期待値が最小になるアームを選ぶ．
+ *
+ * - 成功確率: 機体の限界の段階 c と斜めによる限界の低下 d を未知数として
+ *   p = 1 / (1 + exp(-(c - d [斜め] - 段階) / scale)) とおく．
+ *   (c, d) の格子の上で，事前分布 Prior と全てのアームの結果から事後分布を
+ *   求めて p を平均する．あるアームの失敗は上の段階の成功確率も下げる．
+ * - 時間: 実測があればその平均．なければ実測のあるアームから
+ *   1 段階あたり kLevelTimeRatio 倍，斜めは kDiagTimeRatio 倍として外挿する．
+ * - 残り k 回，現在の最短時間 b の価値を
+ *   V(k, b) = min_a { p_a V(k-1, min(b, t_a)) + (1 - p_a) V(k-1, b) },
+ *   V(0, b) = b として解く (b は有限個の値しかとらないのでメモ化する)．
+ */
+class RunStrategy {
+ public:
+  static constexpr int kLevelMin = -2;
+  static constexpr int kLevelMax = 9;
+  static constexpr int kLevelCount = kLevelMax - kLevelMin + 1;
+  /* RunParameter::up() で 1 段階上げたときの時間の比 (実測がないとき) */
+  static constexpr float kLevelTimeRatio = 0.93f;
+  /* 斜めありにしたときの時間の比 (実測がないとき) */
+  static constexpr float kDiagTimeRatio = 0.9f;
+  struct Arm {
+    int level;
+    bool diag;
+  };
+  /**
+   * @brief 成功確率の事前分布
+   */
+  struct Prior {
+    float capability = 4.0f;     //< 限界の段階 c の平均
+    float capability_sd = 3.0f;  //< 限界の段階 c の標準偏差
+    float diag = 1.0f;           //< 斜めによる限界の低下 d の平均
+    float diag_sd = 1.5f;        //< 斜めによる限界の低下 d の標準偏差
+    float scale = 1.0f;          //< 成功確率の変化の幅 [段階]
+  };
+  /**
+   * @brief 保存形式
+   *
+   * 項目を変えたら版数を上げ，restore() に旧版からの変換を加える．
+   */
+  struct Record {
+    static constexpr uint8_t kVersion = 1;
+    struct Stat {
+      uint8_t attempts;
+      uint8_t successes;
+      uint16_t time_ms;  //< 成功した走行の平均時間 [ms]
+    };
+    uint16_t best_time_ms;  //< 最短時間 [ms] (0: 成功なし)
+    uint16_t reserved;
+    Stat stats[kLevelCount][2];  //< [段階][斜め]
+  };
+  static_assert(sizeof(Record) == 4 + kLevelCount * 2 * 4,
+                "Record must not have padding");
+
+ public:
+  RunStrategy() { reset(); }
+  explicit RunStrategy(const Prior& prior) : prior_(prior) { reset(); }
+  void reset() { std::memset(&record_, 0, sizeof(record_)); }
+  /**
+   * @brief 走行の結果を記録する
+   *
+   * @param time_s 成功した走行の時間 [s]
+   */
+  void record(const Arm& arm, const bool success, const float time_s = 0) {
+    auto& s = stat(arm);
+    if (s.attempts == UINT8_MAX) return;
+    s.attempts++;
+    if (!success) return;
+    s.successes++;
+    const float t_ms = std::min(time_s * 1000, float(UINT16_MAX));
+    s.time_ms = (s.time_ms * (s.successes - 1) + t_ms) / s.successes;
+    if (!record_.best_time_ms || t_ms < record_.best_time_ms)
+      record_.best_time_ms = t_ms;
+  }
+  /**
+   * @return 最短時間 [s] (成功なしは無限大)
+   */
+  float get_best_time_s() const {
+    return record_.best_time_ms ? record_.best_time_ms / 1000.0f
+                                : std::numeric_limits<float>::infinity();
+  }
+  /**
+   * @brief 成功確率の推定値
+   */
+  float get_success_probability(const Arm& arm) const {
+    return get_success_probability(arm, posterior());
+  }
+  /**
+   * @brief 成功したときの時間の推定値 [s]
+   *
+   * @param base_time_s 実測がひとつもないときの段階 0 で斜めなしの時間
+   */
+  float get_expected_time_s(const Arm& arm, const float base_time_s) const {
+    if (stat(arm).successes) return stat(arm).time_ms / 1000.0f;
+    /* 段階の近い実測から外挿する (同じ斜めの設定を優先) */
+    int best_distance = std::numeric_limits<int>::max();
+    float t = base_time_s * std::pow(kLevelTimeRatio, arm.level) *
+              (arm.diag ? kDiagTimeRatio : 1);
+    for (int j = 0; j < kLevelCount; ++j) {
+      for (int d = 0; d < 2; ++d) {
+        const auto& s = record_.stats[j][d];
+        if (!s.successes) continue;
+        const int level = j + kLevelMin;
+        const int distance = 2 * std::abs(level - arm.level) + (d != arm.diag);
+        if (distance >= best_distance) continue;
+        best_distance = distance;
+        const float diag_ratio = d == arm.diag ? 1
+                                 : arm.diag    ? kDiagTimeRatio
+                                               : 1 / kDiagTimeRatio;
+        t = s.time_ms / 1000.0f *
+            std::pow(kLevelTimeRatio, arm.level - level) * diag_ratio;
+      }
+    }
+    return t;
+  }
+  /**
+   * @brief 次に走るアームを選ぶ
+   *
+   * @param runs 残りの走行回数 (今回を含む)
+   * @param fail_time_s 最後まで成功しなかったときの時間とみなす値 [s]
+   * @param base_time_s 実測がないときの時間の基準 [s]
+   * @param value 選んだアームでの最短時間の期待値 [s] (nullptr: 不要)
+   */
+  Arm choose(const int runs, const float fail_time_s, const float base_time_s,
+             float* value = nullptr) const {
+    /* アームごとの成功確率と時間 */
+    const auto w = posterior();
+    std::vector<Arm> arms;
+    std::vector<float> p, t;
+    for (int level = kLevelMin; level <= kLevelMax; ++level) {
+      for (const bool diag : {false, true}) {
+        arms.push_back({level, diag});
+        p.push_back(get_success_probability(arms.back(), w));
+        t.push_back(get_expected_time_s(arms.back(), base_time_s));
+      }
+    }
+    /* 最短時間のとりうる値 */
+    const float b_now = std::min(get_best_time_s(), fail_time_s);
+    std::vector<float> values = t;
+    values.push_back(b_now);
+    std::sort(values.begin(), values.end());
+    values.erase(std::unique(values.begin(), values.end()), values.end());
+    auto index_of = [&](const float x) {
+      return int(std::lower_bound(values.begin(), values.end(), x) -
+                 values.begin());
+    };
+    std::vector<int> t_index;
+    for (const float x : t) t_index.push_back(index_of(x));
+    /* アーム a を選んだときの期待値 (v は残りの回数での V) */
+    auto q = [&](const std::vector<float>& v, const int a, const int b) {
+      return p[a] * v[std::min(b, t_index[a])] + (1 - p[a]) * v[b];
+    };
+    /* V(k, b) を k = 0 から runs - 1 まで求める */
+    std::vector<float> v = values;
+    for (int k = 1; k < runs; ++k) {
+      std::vector<float> next(values.size());
+      for (int b = 0; b < int(values.size()); ++b) {
+        next[b] = std::numeric_limits<float>::infinity();
+        for (int a = 0; a < int(arms.size()); ++a)
+          next[b] = std::min(next[b], q(v, a, b));
+      }
+      v.swap(next);
+    }
+    /* 今回のアーム (同じ期待値なら段階の低い方) */
+    const int b0 = index_of(b_now);
+    int best = 0;
+    for (int a = 1; a < int(arms.size()); ++a)
+      if (q(v, a, b0) < q(v, best, b0) - 1e-6f) best = a;
+    if (value) *value = q(v, best, b0);
+    return arms[best];
+  }
+  Record to_record() const { return record_; }
+  bool restore(const uint8_t version, const void* data, const size_t size) {
+    if (version != Record::kVersion || size != sizeof(Record)) return false;
+    std::memcpy(&record_, data, sizeof(record_));
+    return true;
+  }
+  void print(std::ostream& os, const float base_time_s) const {
+    os << "level\tdiag\ttry\tsuccess\tp\ttime [s]" << std::endl;
+    for (int level = kLevelMin; level <= kLevelMax; ++level) {
+      for (const bool diag : {false, true}) {
+        const Arm arm{level, diag};
+        os << level << "\t" << diag << "\t" << int(stat(arm).attempts) << "\t"
+           << int(stat(arm).successes) << "\t"
+           << get_success_probability(arm) << "\t"
+           << get_expected_time_s(arm, base_time_s) << std::endl;
+      }
+    }
+  }
+
+ private:
+  /* 事後分布の格子 (c は段階の範囲の外まで，d は 0 以上) */
+  static constexpr float kGridStep = 0.5f;
+  static constexpr int kCapabilityCount = (kLevelCount + 4) * 2 - 1;
+  static constexpr float kCapabilityMin = kLevelMin - 2;
+  static constexpr int kDiagCount = 9;
+  Prior prior_;
+  Record record_;
+
+  float success_probability(const float c, const float d,
+                            const Arm& arm) const {
+    const float x = c - (arm.diag ? d : 0) - arm.level;
+    return 1 / (1 + std::exp(-x / prior_.scale));
+  }
+  /**
+   * @brief (c, d) の格子の事後分布 (和は 1)
+   */
+  std::vector<float> posterior() const {
+    std::vector<float> w(kCapabilityCount * kDiagCount);
+    float log_max = -std::numeric_limits<float>::infinity();
+    for (int i = 0; i < kCapabilityCount; ++i) {
+      for (int j = 0; j < kDiagCount; ++j) {
+        const float c = kCapabilityMin + i * kGridStep, d = j * kGridStep;
+        const float zc = (c - prior_.capability) / prior_.capability_sd;
+        const float zd = (d - prior_.diag) / prior_.diag_sd;
+        float log_w = -(zc * zc + zd * zd) / 2;
+        for (int k = 0; k < kLevelCount; ++k) {
+          for (const bool diag : {false, true}) {
+            const auto& s = record_.stats[k][diag];
+            if (!s.attempts) continue;
+            const float p = success_probability(c, d, {k + kLevelMin, diag});
+            const int failures = s.attempts - s.successes;
+            log_w += s.successes * std::log(std::max(p, 1e-6f)) +
+                     failures * std::log(std::max(1 - p, 1e-6f));
+          }
+        }
+        w[i * kDiagCount + j] = log_w;
+        log_max = std::max(log_max, log_w);
+      }
+    }
+    float sum = 0;
+    for (auto& x : w) sum += x = std::exp(x - log_max);
+    for (auto& x : w) x /= sum;
+    return w;
+  }
+  float get_success_probability(const Arm& arm,
+                                const std::vector<float>& w) const {
+    float p = 0;
+    for (int i = 0; i < kCapabilityCount; ++i)
+      for (int j = 0; j < kDiagCount; ++j)
+        p += w[i * kDiagCount + j] *
+             success_probability(kCapabilityMin + i * kGridStep,
+                                 j * kGridStep, arm);
+    return p;
+  }
+
+  Record::Stat& stat(const Arm& a) {
+    const int level = std::max(kLevelMin, std::min(a.level, kLevelMax));
+    return record_.stats[level - kLevelMin][a.diag];
+  }
+  const Record::Stat& stat(const Arm& a) const {
+    const int level = std::max(kLevelMin, std::min(a.level, kLevelMax));
+    return record_.stats[level - kLevelMin][a.diag];
+  }
+};
+
+}  // namespace utils
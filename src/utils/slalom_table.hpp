@@ -0,0 +1,147 @@
+/**
+ * @file slalom_table.hpp
+ * @brief Precomputed Slalom Reference Table
+ * @author Ryotaro Onuki <kerikun11+github@gmail.com>
+ * @date 2024-02-04
+ * @copyright Copyright 2024 Ryotaro Onuki <kerikun11+github@gmail.com>
+ */
+#pragma once
+
+#include <ctrl/slalom/trajectory.h>
+#include <ctrl/state.h>
+
+#include <algorithm>  //< for std::min, std::max
+#include <cmath>
+#include <vector>
+
+namespace utils {
+
+/**
+ * @brief スラローム軌道を基準速度で標本化しておき，参照するクラス
+ *
+ * スラロームの経路は速度によらず同じ形で，速度 v での軌道は基準速度 v_ref
+ * での軌道を時間方向に r = v / v_ref 倍に縮めたものになる．
+ * そこで，起動時に基準速度での軌道を ctrl::slalom::Trajectory で 1 度だけ
+ * 標本化しておき，走行中は線形補間と r のべき乗によるスケーリングのみで
+ * 目標状態を求める．1 周期あたりの計算量は一定で，三角関数も使わない．
+ */
+class SlalomTable {
+ public:
+  struct Sample {
+    float x, y, th;          //< 開始位置からの相対位置
+    float dth, ddth, dddth;  //< 基準速度での角速度・角加速度・角躍度
+    float cos_th, sin_th;
+  };
+
+ public:
+  /**
+   * @param shape スラロームの形状
+   * @param size 標本点の数
+   * @param substeps 標本点の間の位置の積分の分割数
+   */
+  explicit SlalomTable(const ctrl::slalom::Shape& shape, const int size = 128,
+                       const int substeps = 8)
+      : shape_(shape) {
+    ctrl::slalom::Trajectory st(shape_, false);
+    st.reset(shape_.v_ref);
+    t_curve_ = st.getTimeCurve();
+    dt_ = t_curve_ / (size - 1);
+    const float Ts = dt_ / substeps;
+    float x = 0, y = 0;
+    samples_.resize(size);
+    for (int i = 0; i < size; ++i) {
+      /* 位置を t_i まで積分 (中点則) */
+      if (i > 0) {
+        for (int k = 0; k < substeps; ++k) {
+          ctrl::State sm;
+          st.update(sm, (i - 1) * dt_ + (k + 0.5f) * Ts, 0);
+          x += shape_.v_ref * std::cos(sm.q.th) * Ts;
+          y += shape_.v_ref * std::sin(sm.q.th) * Ts;
+        }
+      }
+      /* t_i での角度系の状態 */
+      ctrl::State si;
+      st.update(si, i * dt_, 0);
+      auto& sample = samples_[i];
+      sample.x = x, sample.y = y, sample.th = si.q.th;
+      sample.dth = si.dq.th, sample.ddth = si.ddq.th;
+      sample.dddth = si.dddq.th;
+      sample.cos_th = std::cos(si.q.th), sample.sin_th = std::sin(si.q.th);
+    }
+  }
+  const ctrl::slalom::Shape& getShape() const { return shape_; }
+  /**
+   * @brief 速度 v でのスラロームの所要時間 [s]
+   */
+  float getTimeCurve(const float v) const {
+    return t_curve_ * shape_.v_ref / v;
+  }
+  /**
+   * @brief 速度 v で開始から時刻 t における目標状態を取得する
+   *
+   * ctrl::slalom::Trajectory::update(s, t, Ts) と同様に，位置は Ts だけ
+   * 積分を進めた値 (時刻 t + Ts での位置) を返す．t + Ts が終点を過ぎた
+   * 分は，終点の向きに直進した位置とする．
+   * @param mirror_x 左右反転 (ctrl::slalom::Trajectory の mirror_x と同じ)
+   * @param x_start 開始時の x 座標 (向きは 0 とする)
+   */
+  void update(ctrl::State& s, const float v, const float t, const float Ts,
+              const bool mirror_x, const float x_start = 0) const {
+    const float r = v / shape_.v_ref;  //< 時間の縮尺
+    const float sg = mirror_x ? -1 : 1;
+    /* 位置 */
+    {
+      int i;
+      float f;
+      const float t_ref = r * (t + Ts);
+      index(t_ref, i, f);
+      const auto& a = samples_[i];
+      const auto& b = samples_[i + 1];
+      const float d = std::max(0.0f, t_ref - t_curve_) * shape_.v_ref;
+      s.q.x = x_start + a.x + (b.x - a.x) * f + d * b.cos_th;
+      s.q.y = sg * (a.y + (b.y - a.y) * f + d * b.sin_th);
+    }
+    /* 角度系 */
+    int i;
+    float f;
+    index(r * t, i, f);
+    const auto& a = samples_[i];
+    const auto& b = samples_[i + 1];
+    const auto lerp = [f](const float p, const float q) {
+      return p + (q - p) * f;
+    };
+    const float dth = sg * r * lerp(a.dth, b.dth);
+    const float ddth = sg * r * r * lerp(a.ddth, b.ddth);
+    const float dddth = sg * r * r * r * lerp(a.dddth, b.dddth);
+    const float c = lerp(a.cos_th, b.cos_th);
+    const float sn = sg * lerp(a.sin_th, b.sin_th);
+    s.q.th = sg * lerp(a.th, b.th);
+    s.dq.x = v * c;
+    s.dq.y = v * sn;
+    s.dq.th = dth;
+    s.ddq.x = -s.dq.y * dth;
+    s.ddq.y = s.dq.x * dth;
+    s.ddq.th = ddth;
+    s.dddq.x = -s.ddq.y * dth - s.dq.y * ddth;
+    s.dddq.y = s.ddq.x * dth + s.dq.x * ddth;
+    s.dddq.th = dddth;
+  }
+
+ private:
+  ctrl::slalom::Shape shape_;
+  float t_curve_;  //< 基準速度での所要時間 [s]
+  float dt_;       //< 基準速度での標本化周期 [s]
+  std::vector<Sample> samples_;
+
+  /**
+   * @brief 基準速度での時刻 t_ref に対応する区間 [i, i+1] と内分比 f
+   */
+  void index(const float t_ref, int& i, float& f) const {
+    const int last = samples_.size() - 1;
+    const float u = std::max(0.0f, std::min(t_ref / dt_, float(last)));
+    i = std::min(int(u), last - 1);
+    f = u - i;
+  }
+};
+
+}  // namespace utils
@@ -0,0 +1,114 @@
+/**
+ * @file step_response_fitter.hpp
+ * @brief First Order System Identification from Step Response
+ * @author Ryotaro Onuki <kerikun11+github@gmail.com>
+ * @date 2024-02-04
+ * @copyright Copyright 2024 Ryotaro Onuki <kerikun11+github@gmail.com>
+ */
+#pragma once
+
+#include <cmath>
+#include <vector>
+
+namespace utils {
+
+/**
+ * @brief ステップ入力に対する応答から 1 次遅れ系のパラメータを同定するクラス
+ *
+ * 静止状態からの大きさ u のステップ応答 v(t) = K1 u (1 - exp(-t / T1)) を，
+ * 記録した速度の列に最小二乗法で当てはめる (出力誤差法)．
+ * T1 を固定すると K1 は閉形式で求まるので，T1 のみを黄金分割探索する．
+ * ハードウェアに依存しないのでホスト環境でも実行できる．
+ */
+class StepResponseFitter {
+ public:
+  struct Result {
+    float K1;  //< 定常ゲイン [速度 / 入力]
+    float T1;  //< 時定数 [s]
+  };
+
+ public:
+  /**
+   * @param Ts サンプリング周期 [s]
+   * @param capacity 記録するサンプル数の上限
+   */
+  StepResponseFitter(const float Ts, const int capacity) : Ts_(Ts) {
+    v_.reserve(capacity);
+  }
+  void reset() { v_.clear(); }
+  /**
+   * @brief ステップ入力の開始から 1 サンプルずつ速度の観測値を追加する
+   *
+   * @param v 並進: [mm/s], 回転: [rad/s]
+   */
+  void push(const float v) {
+    if (v_.size() < v_.capacity()) v_.push_back(v);
+  }
+  int size() const { return v_.size(); }
+  /**
+   * @brief 同定する
+   *
+   * @param u ステップ入力の大きさ
+   * @param T1_min, T1_max 時定数の探索範囲 [s]
+   * @return false サンプル不足または入力が 0 で同定できない
+   */
+  bool fit(const float u, Result& result, const float T1_min = 0.005f,
+           const float T1_max = 1.0f) const {
+    if (v_.size() < 3 || !(std::abs(u) > 0)) return false;
+    /* golden section search for T1 */
+    const float r = (std::sqrt(5.0f) - 1) / 2;
+    float a = T1_min, b = T1_max;
+    float c = b - r * (b - a), d = a + r * (b - a);
+    float fc = cost(u, c), fd = cost(u, d);
+    while (b - a > kTolerance) {
+      if (fc < fd) {
+        b = d, d = c, fd = fc;
+        c = b - r * (b - a), fc = cost(u, c);
+      } else {
+        a = c, c = d, fc = fd;
+        d = a + r * (b - a), fd = cost(u, d);
+      }
+    }
+    const float T1 = (a + b) / 2;
+    const float K1 = gain(u, T1);
+    if (!std::isfinite(K1) || !(K1 > 0)) return false;
+    result = {K1, T1};
+    return true;
+  }
+
+ private:
+  static constexpr float kTolerance = 1e-4f;  //< 時定数の探索精度 [s]
+  float Ts_;
+  std::vector<float> v_;
+
+  /**
+   * @brief T1 を固定したときの最適な K1 (正規方程式の解)
+   */
+  float gain(const float u, const float T1) const {
+    const float A = std::exp(-Ts_ / T1);
+    float e = 1, S_gv = 0, S_gg = 0;  //< e = exp(-k Ts / T1)
+    for (const auto v : v_) {
+      const float g = u * (1 - e);
+      S_gv += g * v;
+      S_gg += g * g;
+      e *= A;
+    }
+    return S_gv / S_gg;
+  }
+  /**
+   * @brief T1 を固定し，K1 を最適化したときの残差二乗和
+   */
+  float cost(const float u, const float T1) const {
+    const float K1 = gain(u, T1);
+    const float A = std::exp(-Ts_ / T1);
+    float e = 1, S_rr = 0;
+    for (const auto v : v_) {
+      const float r = v - K1 * u * (1 - e);
+      S_rr += r * r;
+      e *= A;
+    }
+    return S_rr;
+  }
+};
+
+}  // namespace utils
@@ -5,6 +5,7 @@
 #include <array>
 #include <cmath>
 #include <iostream>
+#include <limits>
 
 namespace utils {
 
@@ -18,19 +19,26 @@ class TimeProfiler {
     frame_index = -1;
     item_index = 0;
   }
-  void Start() {
+  void Start() { Start(GetCurrentTimestamp()); }
+  void Lap(const char *name) { Lap(name, GetCurrentTimestamp()); }
+  /* 先に取得した時刻で記録する (ロックの外で計った区間用) */
+  void Start(const timestamp_t timestamp) {
+    if (IsFull()) return;
     frame_index++;
     item_index = 0;
-    timestamp_table[frame_index][item_index++] = GetCurrentTimestamp();
+    timestamp_table[frame_index][item_index++] = timestamp;
   }
-  void Lap(const char *name) {
-    if (item_index >= static_cast<int>(N_items)) return;
+  void Lap(const char *name, const timestamp_t timestamp) {
+    if (frame_index < 0 || item_index >= static_cast<int>(N_items)) return;
     if (frame_index == 0) names[item_index] = name;
-    timestamp_table[frame_index][item_index++] = GetCurrentTimestamp();
+    timestamp_table[frame_index][item_index++] = timestamp;
   }
+  bool IsFull() const { return frame_index >= static_cast<int>(N_frames) - 1; }
   void ShowResult(std::ostream &csv, const char sep = '\t') {
-    if (frame_index < 1 || item_index < 2) {
-      std::cerr << "[" __FILE__ ":" << __LINE__ << "][" __func__ "()] skipped";
+    const int num_frames = frame_index + 1;
+    if (num_frames < 1 || item_index < 2) {
+      std::cerr << "[" __FILE__ ":" << __LINE__ << "][" << __func__
+                << "()] skipped" << std::endl;
       return;
     }
     std::array<timestamp_t, N_items> min;
@@ -42,7 +50,7 @@ class TimeProfiler {
       min[i] = std::numeric_limits<timestamp_t>::max();
       max[i] = std::numeric_limits<timestamp_t>::min();
       average[i] = 0;
-      for (int f = 0; f < frame_index; ++f) {
+      for (int f = 0; f < num_frames; ++f) {
         auto ts0 = timestamp_table[f][i - 1];
         auto ts1 = timestamp_table[f][i];
         auto diff = ts1 - ts0;
@@ -50,20 +58,18 @@ class TimeProfiler {
         max[i] = std::max(max[i], diff);
         average[i] += diff;
       }
-      average[i] /= N_frames;
+      average[i] /= num_frames;
     }
     /* calc sigma */
     for (int i = 1; i < item_index; ++i) {
-      sigma[i] = 0;
-      for (int f = 0; f < frame_index; ++f) {
+      timestamp_t var = 0;
+      for (int f = 0; f < num_frames; ++f) {
         auto ts0 = timestamp_table[f][i - 1];
         auto ts1 = timestamp_table[f][i];
         auto diff = ts1 - ts0;
-        min[i] = std::min(min[i], diff);
-        max[i] = std::max(max[i], diff);
-        sigma[i] += diff;
+        var += (diff - average[i]) * (diff - average[i]);
       }
-      sigma[i] = std::sqrt(sigma[i] / N_frames);
+      sigma[i] = std::sqrt(var / num_frames);
     }
     /* output result */
     csv << "process"         //
@@ -83,9 +89,9 @@ class TimeProfiler {
 
  private:
   std::array<const char *, N_items> names;
-  std::array<std::array<timestamp_t, N_frames>> timestamp_table;
-  int frame_index;
-  int item_index;
+  std::array<std::array<timestamp_t, N_items>, N_frames> timestamp_table;
+  int frame_index = -1;
+  int item_index = 0;
 
   timestamp_t GetCurrentTimestamp() { return esp_timer_get_time(); }
 };
@@ -0,0 +1,71 @@
+/**
+ * @file turn_speed_solver.hpp
+ * @brief Friction Circle Based Turn Speed Solver
+ * @author Ryotaro Onuki <kerikun11+github@gmail.com>
+ * @date 2024-02-04
+ * @copyright Copyright 2024 Ryotaro Onuki <kerikun11+github@gmail.com>
+ */
+#pragma once
+
+#include <ctrl/slalom/trajectory.h>
+#include <ctrl/state.h>
+
+#include <algorithm>  //< for std::max
+#include <cmath>
+
+namespace utils {
+
+/**
+ * @brief スラロームの形状ごとに，摩擦円に収まる最大の速度を求めるクラス
+ *
+ * 外側の車輪には，旋回の向心加速度 dth (v + dth R) と，角加速度を生む
+ * 前後加速度 ddth R (R: 車輪の回転半径) がかかる．
+ * その合成が摩擦円の半径 a_grip を超えるとタイヤが滑る．
+ *
+ * 速度 v での軌道は基準速度 v_ref での軌道を時間方向に r = v / v_ref 倍に
+ * 縮めたものなので，dth は r 倍，ddth は r^2 倍になり，合成加速度の
+ * ピークは r^2 に比例する．そこで基準速度でのピーク a_ref を 1 度だけ
+ * 標本化しておけば，最大速度は v_ref sqrt(a_grip / a_ref) で求まる．
+ */
+class TurnSpeedSolver {
+ public:
+  /**
+   * @param shape スラロームの形状
+   * @param rotation_radius 車輪の回転半径 (トレッドの半分) [mm]
+   * @param size 標本点の数
+   */
+  TurnSpeedSolver(const ctrl::slalom::Shape& shape,
+                  const float rotation_radius, const int size = 256)
+      : v_ref_(shape.v_ref) {
+    ctrl::slalom::Trajectory st(shape, false);
+    st.reset(v_ref_);
+    const float t_curve = st.getTimeCurve();
+    ctrl::State s;
+    for (int i = 0; i < size; ++i) {
+      st.update(s, t_curve * i / (size - 1), 0);
+      const float dth = std::abs(s.dq.th);
+      const float a_lat = dth * (v_ref_ + rotation_radius * dth);
+      const float a_lon = rotation_radius * s.ddq.th;
+      a_ref_ = std::max(a_ref_, std::sqrt(a_lat * a_lat + a_lon * a_lon));
+    }
+  }
+  /**
+   * @brief 速度 v で走行したときの車輪の合成加速度のピーク [mm/s/s]
+   */
+  float getPeakAcceleration(const float v) const {
+    const float r = v / v_ref_;
+    return a_ref_ * r * r;
+  }
+  /**
+   * @brief 合成加速度のピークが a_grip 以下になる最大の速度 [mm/s]
+   */
+  float getMaxVelocity(const float a_grip) const {
+    return v_ref_ * std::sqrt(a_grip / a_ref_);
+  }
+
+ private:
+  float v_ref_;      //< 基準速度 [mm/s]
+  float a_ref_ = 0;  //< 基準速度での合成加速度のピーク [mm/s/s]
+};
+
+}  // namespace utils
@@ -0,0 +1,261 @@
+/**
+ * @file velocity_planner.hpp
+ * @brief Whole Path Velocity Planner for Fast Run
+ * @author Ryotaro Onuki <kerikun11+github@gmail.com>
+ * @date 2024-02-04
+ * @copyright Copyright 2024 Ryotaro Onuki <kerikun11+github@gmail.com>
+ */
+#pragma once
+
+#include <algorithm>  //< for std::min, std::max
+#include <cmath>
+#include <vector>
+
+namespace utils {
+
+/**
+ * @brief 最短走行の経路全体で速度計画を行うクラス
+ *
+ * 直線とターンの列を受け取り，ターンの速度制約と躍度・加速度の制約を
+ * 満たす最速の速度を，後ろ向き・前向きの 2 回の走査で求める．
+ * ターンは一定速度で通過し，連続するターンの間では速度を変えられない．
+ * 直線の区間では，両端の速度から到達できる最高速度まで加速して減速する．
+ *
+ * 加減速は台形加速度 (躍度制限) で，速度変化 dv にかかる時間は
+ * dv >= a^2 / j で dv / a + a / j，そうでなければ 2 sqrt(dv / j)，
+ * 移動距離は両端の速度の平均と時間の積になる．
+ * ハードウェアに依存しないのでホスト環境でも実行できる．
+ */
+class VelocityPlanner {
+ public:
+  struct Constraint {
+    float j_max;  //< 最大躍度 [mm/s/s/s]
+    float a_max;  //< 最大加速度 [mm/s/s]
+    float v_max;  //< 直線の最高速度 [mm/s]
+  };
+  struct Segment {
+    enum Type {
+      Straight,
+      Turn,
+    };
+    Type type;
+    float distance = 0;     //< Straight: 距離 [mm]
+    int shape = 0;          //< Turn: ターンの種類 (field::ShapeIndex)
+    bool mirror_x = false;  //< Turn: 左右反転
+    float v_limit = 0;      //< Turn: 速度の上限 [mm/s]
+    float k_time = 0;       //< Turn: 所要時間と速度の積 [mm]
+    /* 計画結果 */
+    float v_start = 0;  //< 開始速度 [mm/s]
+    float v_max = 0;    //< 区間内の最高速度 [mm/s]
+    float v_end = 0;    //< 終了速度 [mm/s]
+    float t = 0;        //< 所要時間 [s]
+  };
+
+ public:
+  explicit VelocityPlanner(const Constraint& c) : c_(c) {}
+  void clear() { segments_.clear(); }
+  /**
+   * @brief 直線を追加する (直前も直線なら連結する)
+   */
+  void add_straight(const float distance) {
+    if (!segments_.empty() && segments_.back().type == Segment::Straight)
+      segments_.back().distance += distance;
+    else if (distance > 0)
+      segments_.push_back(make_straight(distance));
+  }
+  /**
+   * @brief ターンを追加する
+   *
+   * @param v_limit ターンの速度 [mm/s]
+   * @param k_time 所要時間 t と速度 v の積 (v によらず一定) [mm]
+   */
+  void add_turn(const int shape, const bool mirror_x, const float v_limit,
+                const float k_time) {
+    Segment s;
+    s.type = Segment::Turn;
+    s.shape = shape;
+    s.mirror_x = mirror_x;
+    s.v_limit = v_limit;
+    s.k_time = k_time;
+    segments_.push_back(s);
+  }
+  /**
+   * @brief 静止から静止までの速度計画を行う
+   *
+   * @param min_distance これより短い直線は無視する [mm]
+   */
+  void plan(const float min_distance = 0.1f) {
+    /* 短い直線を取り除く */
+    segments_.erase(std::remove_if(segments_.begin(), segments_.end(),
+                                   [&](const Segment& s) {
+                                     return s.type == Segment::Straight &&
+                                            s.distance <= min_distance;
+                                   }),
+                    segments_.end());
+    const int n = segments_.size();
+    /* 区間の境界の速度の上限 (境界 k は区間 k の開始) */
+    std::vector<float> v(n + 1, c_.v_max);
+    v[0] = v[n] = 0;
+    for (int k = 0; k < n; ++k) {
+      const auto& s = segments_[k];
+      if (s.type != Segment::Turn) continue;
+      v[k] = std::min(v[k], s.v_limit);
+      v[k + 1] = std::min(v[k + 1], s.v_limit);
+    }
+    /* ターンは等速なので，連続するターンの速度は揃える */
+    const auto propagate_turn = [&](const int k) {
+      if (segments_[k].type != Segment::Turn) return;
+      v[k] = v[k + 1] = std::min(v[k], v[k + 1]);
+    };
+    for (int k = 0; k < n; ++k) propagate_turn(k);
+    for (int k = n - 1; k >= 0; --k) propagate_turn(k);
+    /* 後ろ向き: 減速が間に合う速度に制限 */
+    for (int k = n - 1; k >= 0; --k) {
+      const auto& s = segments_[k];
+      if (s.type == Segment::Straight)
+        v[k] = std::min(v[k], reachable(v[k + 1], s.distance));
+      else
+        propagate_turn(k);
+    }
+    /* 前向き: 加速が間に合う速度に制限 */
+    for (int k = 0; k < n; ++k) {
+      const auto& s = segments_[k];
+      if (s.type == Segment::Straight)
+        v[k + 1] = std::min(v[k + 1], reachable(v[k], s.distance));
+      else
+        propagate_turn(k);
+    }
+    /* 各区間の計画 */
+    for (int k = 0; k < n; ++k) {
+      auto& s = segments_[k];
+      s.v_start = v[k];
+      s.v_end = v[k + 1];
+      if (s.type == Segment::Turn) {
+        s.v_max = s.v_start;
+        s.t = s.k_time / std::max(s.v_start, kVelocityMin);
+      } else {
+        plan_straight(s);
+      }
+    }
+  }
+  const std::vector<Segment>& get_segments() const { return segments_; }
+  float get_total_time() const {
+    float t = 0;
+    for (const auto& s : segments_) t += s.t;
+    return t;
+  }
+  /**
+   * @brief 区間ごとに次のターンの速度のみを見て走る場合の所要時間
+   *
+   * 従来の逐次実行 (直線の終端速度を次のターンの速度とし，
+   * 減速が間に合わなければその速度のままターンに入る) の見積もり．
+   * plan() の後に呼ぶ．
+   * @param overspeed 速度の上限を超えてターンに入る，または最後に停止
+   * できない回数 (nullptr 可)
+   */
+  float estimate_sequential_time(int* overspeed = nullptr) const {
+    float t = 0, v_now = 0;
+    if (overspeed) *overspeed = 0;
+    const int n = segments_.size();
+    for (int k = 0; k < n; ++k) {
+      Segment s = segments_[k];
+      if (s.type == Segment::Turn) {
+        t += s.k_time / std::max(v_now, kVelocityMin);
+        if (overspeed && v_now > s.v_limit + kVelocityMin) ++*overspeed;
+        continue;
+      }
+      /* 次のターンの速度 (最後は停止) */
+      float v_target = 0;
+      if (k + 1 < n && segments_[k + 1].type == Segment::Turn)
+        v_target = segments_[k + 1].v_limit;
+      /* 距離が足りなければ到達できる速度で終える */
+      const float v_reach = reachable(v_now, s.distance);
+      if (v_target < v_now)
+        v_target = std::max(v_target, descend(v_now, s.distance));
+      else
+        v_target = std::min(v_target, v_reach);
+      s.v_start = v_now;
+      s.v_end = v_target;
+      plan_straight(s);
+      t += s.t;
+      v_now = s.v_end;
+    }
+    if (overspeed && v_now > kVelocityMin) ++*overspeed;
+    return t;
+  }
+
+ private:
+  static constexpr float kVelocityMin = 1.0f;  //< ゼロ割り防止 [mm/s]
+  static constexpr int kBisectionCount = 32;
+  Constraint c_;
+  std::vector<Segment> segments_;
+
+  static Segment make_straight(const float distance) {
+    Segment s;
+    s.type = Segment::Straight;
+    s.distance = distance;
+    return s;
+  }
+  /**
+   * @brief 速度変化 dv (>= 0) にかかる時間
+   */
+  float time_of(const float dv) const {
+    const float a = c_.a_max, j = c_.j_max;
+    return dv >= a * a / j ? dv / a + a / j : 2 * std::sqrt(dv / j);
+  }
+  /**
+   * @brief v0 から v1 への速度変化に必要な距離
+   */
+  float distance_of(const float v0, const float v1) const {
+    return (v0 + v1) / 2 * time_of(std::abs(v1 - v0));
+  }
+  /**
+   * @brief v0 から距離 d で到達できる最大の速度 (v_max 以下)
+   */
+  float reachable(const float v0, const float d) const {
+    float lo = v0, hi = std::max(v0, c_.v_max);
+    if (distance_of(v0, hi) <= d) return hi;
+    for (int i = 0; i < kBisectionCount; ++i) {
+      const float mid = (lo + hi) / 2;
+      (distance_of(v0, mid) <= d ? lo : hi) = mid;
+    }
+    return lo;
+  }
+  /**
+   * @brief v0 から距離 d で減速できる最小の速度
+   */
+  float descend(const float v0, const float d) const {
+    float lo = 0, hi = v0;
+    if (distance_of(v0, lo) <= d) return lo;
+    for (int i = 0; i < kBisectionCount; ++i) {
+      const float mid = (lo + hi) / 2;
+      (distance_of(v0, mid) <= d ? hi : lo) = mid;
+    }
+    return hi;
+  }
+  /**
+   * @brief 両端の速度が決まった直線の最高速度と所要時間
+   */
+  void plan_straight(Segment& s) const {
+    const float v0 = s.v_start, v1 = s.v_end, d = s.distance;
+    const auto d_total = [&](const float vp) {
+      return distance_of(v0, vp) + distance_of(vp, v1);
+    };
+    float lo = std::max(v0, v1), hi = std::max(lo, c_.v_max);
+    if (d_total(hi) <= d) {
+      lo = hi;
+    } else {
+      for (int i = 0; i < kBisectionCount; ++i) {
+        const float mid = (lo + hi) / 2;
+        (d_total(mid) <= d ? lo : hi) = mid;
+      }
+    }
+    const float vp = lo;
+    const float d_cruise = std::max(0.0f, d - d_total(vp));
+    s.v_max = vp;
+    s.t = time_of(vp - v0) + time_of(vp - v1) +
+          d_cruise / std::max(vp, kVelocityMin);
+  }
+};
+
+}  // namespace utils
@@ -0,0 +1,156 @@
+/**
+ * @file wall_classifier.hpp
+ * @brief Wall Classifier by Accumulating Log-Odds
+ * @author Ryotaro Onuki <kerikun11+github@gmail.com>
+ * @date 2024-02-04
+ * @copyright Copyright 2024 Ryotaro Onuki <kerikun11+github@gmail.com>
+ */
+#pragma once
+
+#include <algorithm>  //< for std::max, std::min
+#include <array>
+#include <cmath>  //< for std::exp
+
+namespace utils {
+
+/**
+ * @brief 1 枚の壁の有無の対数オッズを積算するクラス
+ *
+ * 標本ごとの対数尤度比を足し，古い標本は忘却係数で減衰させる．
+ * 判定はヒステリシスをもたせ，対数オッズが幅の中にあるうちは変えない．
+ */
+class WallEvidence {
+ public:
+  void reset(const float log_odds = 0) {
+    log_odds_ = log_odds;
+    wall_ = log_odds > 0;
+  }
+  /**
+   * @param llr 標本の対数尤度比 (正: 壁あり)
+   * @param decay 前回までの対数オッズに掛ける忘却係数 (0 以上 1 以下)
+   * @param limit 対数オッズの上限 (飽和させて次の変化に追従させる)
+   * @param hysteresis 判定を変える対数オッズの絶対値
+   */
+  void push(const float llr, const float decay, const float limit,
+            const float hysteresis) {
+    log_odds_ = std::max(-limit, std::min(decay * log_odds_ + llr, limit));
+    if (log_odds_ > hysteresis) wall_ = true;
+    if (log_odds_ < -hysteresis) wall_ = false;
+  }
+  bool wall() const { return wall_; }
+  float log_odds() const { return log_odds_; }
+  /**
+   * @brief 壁がある確率
+   */
+  float probability() const { return 1 / (1 + std::exp(-log_odds_)); }
+  /**
+   * @brief 判定の確からしさ (判定どおりである確率)
+   *
+   * ヒステリシスの幅の中では 0.5 を下回ることがある．
+   */
+  float confidence() const {
+    return wall_ ? probability() : 1 - probability();
+  }
+  /**
+   * @brief 閾値からの距離に比例し，scale で飽和する対数尤度比
+   *
+   * @param x 測定値 (閾値より小さければ壁あり)
+   */
+  static float llr_threshold(const float x, const float threshold,
+                             const float scale, const float gain) {
+    return gain * std::max(-1.0f, std::min((threshold - x) / scale, 1.0f));
+  }
+
+ private:
+  float log_odds_ = 0;
+  bool wall_ = false;
+};
+
+/**
+ * @brief 横壁と前壁の有無を 1 ms ごとの標本から判定するクラス
+ *
+ * - 横壁: 横のリフレクタの距離の対数尤度比を積算する．
+ * - 前壁: ToF は新しい測距ごとに，範囲外 (invalid) の間は 1 ms ごとに
+ *   測距の周期で割った分を積算する．前のリフレクタは近い壁しか見えず，
+ *   遠くでは壁があっても値が出ないので，壁ありの証拠だけを足す．
+ *   近い方のチャンネルを使い，片方が読めなくても判定できるようにする．
+ *
+ * 忘却の時定数は，読み取る位置 (区画の境界) の手前の数 mm
+ * (横壁) から数十 mm (前壁) の標本だけが効くように選ぶ．
+ * ハードウェアに依存しないのでホスト環境でも実行できる．
+ */
+class WallClassifier {
+ public:
+  struct Parameter {
+    float side_threshold = 25;       //< 横壁の距離の閾値 [mm]
+    float side_scale = 5;            //< 対数尤度比が飽和する閾値との差 [mm]
+    float side_llr = 0.5f;           //< 1 標本の対数尤度比の上限
+    float side_tau_ms = 5;           //< 忘却の時定数 [ms]
+    float front_threshold = 135;     //< ToF の距離の閾値 [mm]
+    float front_scale = 15;          //< 対数尤度比が飽和する閾値との差 [mm]
+    float tof_llr = 2;               //< ToF の 1 回の測距の対数尤度比の上限
+    int tof_period_ms = 20;          //< ToF の測距の周期 [ms]
+    float front_ref_threshold = 60;  //< 前のリフレクタの距離の閾値 [mm]
+    float front_ref_scale = 15;      //< 対数尤度比が飽和する閾値との差 [mm]
+    float front_ref_llr = 0.1f;      //< 1 標本の対数尤度比の上限
+    float front_tau_ms = 40;         //< 忘却の時定数 [ms]
+    float limit = 4;                 //< 対数オッズの上限 (確率 0.98)
+    float hysteresis = 0.5f;         //< 判定を変える対数オッズ
+  };
+  /* 1 ms ごとの入力 */
+  struct Input {
+    std::array<float, 2> side;   //< 横壁の距離 [mm] (区画の中央で 0)
+    std::array<float, 2> front;  //< 前壁の距離 [mm] (較正の位置で 0)
+    float tof_mm;                //< ToF の距離 [mm]
+    bool tof_valid;              //< ToF の測距範囲内に壁がある
+    bool tof_updated;            //< 前回から新しい測距があった
+  };
+
+ public:
+  WallClassifier() { reset(); }
+  explicit WallClassifier(const Parameter& param) : param_(param) {
+    reset();
+  }
+  void reset() {
+    for (auto& e : side_) e.reset();
+    front_.reset();
+    side_decay_ = std::exp(-1 / param_.side_tau_ms);
+    front_decay_ = std::exp(-1 / param_.front_tau_ms);
+  }
+  /**
+   * @brief 1 ms ごとに呼ぶ
+   */
+  void update(const Input& in) {
+    const auto& p = param_;
+    /* 横壁 */
+    for (int i = 0; i < 2; ++i)
+      side_[i].push(WallEvidence::llr_threshold(in.side[i], p.side_threshold,
+                                                p.side_scale, p.side_llr),
+                    side_decay_, p.limit, p.hysteresis);
+    /* 前壁: ToF */
+    float llr = 0;
+    if (!in.tof_valid)
+      llr -= p.tof_llr / p.tof_period_ms;
+    else if (in.tof_updated)
+      llr += WallEvidence::llr_threshold(in.tof_mm, p.front_threshold,
+                                         p.front_scale, p.tof_llr);
+    /* 前壁: リフレクタ (近い方) */
+    const float front = std::min(in.front[0], in.front[1]);
+    llr += std::max(0.0f, WallEvidence::llr_threshold(
+                              front, p.front_ref_threshold,
+                              p.front_ref_scale, p.front_ref_llr));
+    front_.push(llr, front_decay_, p.limit, p.hysteresis);
+  }
+  const WallEvidence& side(const int ch) const { return side_[ch]; }
+  const WallEvidence& front() const { return front_; }
+  const Parameter& getParameter() const { return param_; }
+
+ private:
+  Parameter param_;
+  std::array<WallEvidence, 2> side_;
+  WallEvidence front_;
+  float side_decay_;
+  float front_decay_;
+};
+
+}  // namespace utils
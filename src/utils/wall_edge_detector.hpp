@@ -0,0 +1,104 @@
+/**
+ * @file wall_edge_detector.hpp
+ * @brief Wall Edge Detector for Longitudinal Position Correction
+ * @author Ryotaro Onuki <kerikun11+github@gmail.com>
+ * @date 2024-02-04
+ * @copyright Copyright 2024 Ryotaro Onuki <kerikun11+github@gmail.com>
+ */
+#pragma once
+
+#include <cmath>  //< for std::floor
+
+namespace utils {
+
+/**
+ * @brief 横のリフレクタの距離から壁の切れ目 (壁あり → 壁なし) を見つける
+ *
+ * 距離が閾値をまたいだ前後の 2 標本を線形補間し，閾値をまたいだ位置を
+ * 標本の間隔 (1 ms) より細かく求める．壁の切れ目は柱の奥側の端にあり，
+ * 柱だけが見えた場合も同じ位置になる．
+ * 1 標本の読み落としで切れ目としないよう，壁なしが続いてから確定する．
+ * ハードウェアに依存しないのでホスト環境でも実行できる．
+ */
+class WallEdgeDetector {
+ public:
+  struct Parameter {
+    float threshold = 25;       //< 壁ありとみなす距離の閾値 [mm]
+    float wall_length_min = 4;  //< 切れ目の前に壁が続いた長さの下限 [mm]
+    int confirm_count = 3;      //< 確定するまでの壁なしの標本数
+  };
+
+ public:
+  WallEdgeDetector() { reset(); }
+  explicit WallEdgeDetector(const Parameter& param) : param_(param) {
+    reset();
+  }
+  void reset() {
+    state_ = None;
+    prev_distance_ = prev_x_ = NAN;
+  }
+  /**
+   * @brief 1 標本ごとに呼ぶ (位置は進行方向に増えるとする)
+   *
+   * @param distance 横壁の距離 [mm]
+   * @param x 標本をとったときの位置 [mm]
+   * @return true 切れ目を確定した (位置は edge())
+   */
+  bool push(const float distance, const float x) {
+    if (std::isnan(distance)) return false;
+    const float prev_distance = prev_distance_, prev_x = prev_x_;
+    prev_distance_ = distance, prev_x_ = x;
+    if (std::isnan(prev_x)) return false;
+    if (distance < param_.threshold) {
+      /* 壁あり (確定前なら読み落としとみなして続ける) */
+      if (state_ == None) wall_start_ = x;
+      state_ = Wall;
+      return false;
+    }
+    if (state_ == Wall) {
+      /* 閾値をまたいだ位置を補間する */
+      const float r =
+          (param_.threshold - prev_distance) / (distance - prev_distance);
+      edge_ = prev_x + r * (x - prev_x);
+      if (edge_ - wall_start_ < param_.wall_length_min) {
+        state_ = None;
+        return false;
+      }
+      state_ = Candidate;
+      count_ = 0;
+    }
+    if (state_ != Candidate || ++count_ < param_.confirm_count) return false;
+    state_ = None;
+    return true;
+  }
+  /**
+   * @brief 最後に確定した切れ目の位置 [mm]
+   */
+  float edge() const { return edge_; }
+  /**
+   * @brief 切れ目の位置を区画の境界の格子に合わせる補正量
+   *
+   * @param s 切れ目の進行方向の座標 (区画の境界が cell の倍数) [mm]
+   * @param offset 境界から見た切れ目での機体の中心の位置 [mm]
+   * @return 補正量 (s に足す) [mm]
+   */
+  static float cell_error(const float s, const float offset,
+                          const float cell) {
+    const float s_ref =
+        std::floor((s - offset) / cell + 0.5f) * cell + offset;
+    return s_ref - s;
+  }
+
+ private:
+  enum State { None, Wall, Candidate };
+
+  Parameter param_;
+  State state_;
+  int count_ = 0;
+  float wall_start_ = 0;  //< 壁が始まった位置 [mm]
+  float edge_ = 0;        //< 切れ目の位置 [mm]
+  float prev_distance_;   //< 前回の距離 [mm]
+  float prev_x_;          //< 前回の位置 [mm]
+};
+
+}  // namespace utils
@@ -0,0 +1,157 @@
+/**
+ * @file bias_track.cpp
+ * @brief Host Test of the IMU Bias Tracker
+ * @author Ryotaro Onuki <kerikun11+github@gmail.com>
+ * @date 2024-02-04
+ * @copyright Copyright 2024 Ryotaro Onuki <kerikun11+github@gmail.com>
+ */
+/*
+ * 1 kHz の IMU の標本 (真のオフセット + 白色雑音 + 運動) を合成して
+ * utils::BiasTracker に入れ，推定したオフセットの誤差を確かめる．
+ *
+ * - converge: 静止と走行を繰り返す間にオフセットが温度で少しずつ変わる．
+ *   初期値は真値からずらし，最後の静止の後の誤差と信頼度を見る．
+ * - rotate: 車輪は止まったまま一定の角速度で回される (持ち上げて向きを
+ *   変えるなど)．オフセットを更新しないこと．
+ * - moving: 車輪が回っている．オフセットを更新しないこと．
+ *
+ * どれかを満たさなければ失敗で終了する．
+ */
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+#include "utils/bias_tracker.hpp"
+
+namespace {
+
+struct Parameter {
+  float gyro_noise = 2e-3f;     //< ジャイロの雑音の標準偏差 [rad/s]
+  float accel_noise = 20.0f;    //< 加速度の雑音の標準偏差 [mm/s/s]
+  float gyro_bias = 0.02f;      //< ジャイロ z の真のオフセット [rad/s]
+  float accel_bias = 50.0f;     //< 加速度 x の真のオフセット [mm/s/s]
+  float gyro_drift = 5e-3f;     //< 試験の間のオフセットの変化 [rad/s]
+  float initial_error = 0.01f;  //< ジャイロのオフセットの初期値の誤差 [rad/s]
+};
+
+struct Result {
+  float gyro_error;   //< ジャイロ z のオフセットの誤差 [rad/s]
+  float accel_error;  //< 加速度 x のオフセットの誤差 [mm/s/s]
+  float confidence;
+  int updates;  //< オフセットを更新した標本の数
+};
+
+class Imu {
+ public:
+  Imu(const Parameter& p, const int seed) : p_(p), rng_(seed) {}
+  /**
+   * @brief 1 標本を進めて tracker に入れる
+   *
+   * @param rate 真の角速度 z [rad/s]
+   * @param accel 真の加速度 x [mm/s/s]
+   * @param drift オフセットの変化の割合 [0, 1]
+   */
+  bool step(utils::BiasTracker& tracker, const float rate, const float accel,
+            const float drift, const bool wheel_stationary) {
+    const float gb = p_.gyro_bias + p_.gyro_drift * drift;
+    const MotionParameter gyro(noise(p_.gyro_noise), noise(p_.gyro_noise),
+                               gb + rate + noise(p_.gyro_noise));
+    const MotionParameter acc(p_.accel_bias + accel + noise(p_.accel_noise),
+                              noise(p_.accel_noise), noise(p_.accel_noise));
+    return tracker.update(gyro, acc, wheel_stationary);
+  }
+  Result result(const utils::BiasTracker& tracker, const float drift,
+                const int updates) const {
+    return {tracker.get_gyro_bias().z -
+                (p_.gyro_bias + p_.gyro_drift * drift),
+            tracker.get_accel_bias().x - p_.accel_bias,
+            tracker.get_confidence(), updates};
+  }
+
+ private:
+  Parameter p_;
+  std::mt19937 rng_;
+  std::normal_distribution<float> normal_;
+  float noise(const float sigma) { return sigma * normal_(rng_); }
+};
+
+/* 初期値を真値からずらした tracker */
+utils::BiasTracker make_tracker(const Parameter& p) {
+  utils::BiasTracker tracker;
+  tracker.reset(MotionParameter(0, 0, p.gyro_bias + p.initial_error),
+                MotionParameter(p.accel_bias, 0, 0), false);
+  return tracker;
+}
+
+/**
+ * @brief 静止 2 s と走行 8 s を 6 回繰り返し，最後に 2 s 静止する
+ */
+Result converge(const Parameter& p, const int seed) {
+  Imu imu(p, seed);
+  auto tracker = make_tracker(p);
+  const int rest = 2000, run = 8000, laps = 6;
+  const int total = laps * (rest + run) + rest;
+  int updates = 0;
+  for (int i = 0; i < total; ++i) {
+    const float drift = float(i) / total;
+    const bool moving = i % (rest + run) >= rest && i < laps * (rest + run);
+    /* 走行中は 2 Hz で向きを変えながら加減速する */
+    const float t = i * 1e-3f;
+    const float rate = moving ? 6 * std::sin(2 * M_PI * 2 * t) : 0;
+    const float accel = moving ? 3000 * std::cos(2 * M_PI * 1 * t) : 0;
+    updates += imu.step(tracker, rate, accel, drift, !moving);
+  }
+  return imu.result(tracker, 1, updates);
+}
+
+/**
+ * @brief 車輪は止まったまま 0.3 rad/s で 5 s 回される
+ */
+Result rotate(const Parameter& p, const int seed) {
+  Imu imu(p, seed);
+  auto tracker = make_tracker(p);
+  int updates = 0;
+  for (int i = 0; i < 5000; ++i) updates += imu.step(tracker, 0.3f, 0, 0, true);
+  return imu.result(tracker, 0, updates);
+}
+
+/**
+ * @brief 車輪が回ったまま (等速の直進) 5 s
+ */
+Result moving(const Parameter& p, const int seed) {
+  Imu imu(p, seed);
+  auto tracker = make_tracker(p);
+  int updates = 0;
+  for (int i = 0; i < 5000; ++i) updates += imu.step(tracker, 0, 0, 0, false);
+  return imu.result(tracker, 0, updates);
+}
+
+}  // namespace
+
+int main() {
+  const Parameter p;
+  const int seeds = 10;
+  int failures = 0;
+  std::printf("case\tseed\tgyro error [rad/s]\taccel error [mm/s/s]\t"
+              "confidence\tupdates\n");
+  for (int seed = 0; seed < seeds; ++seed) {
+    const Result rs[] = {converge(p, seed), rotate(p, seed), moving(p, seed)};
+    const char* names[] = {"converge", "rotate", "moving"};
+    for (int k = 0; k < 3; ++k) {
+      const auto& r = rs[k];
+      std::printf("%s\t%d\t%.5f\t%.2f\t%.3f\t%d\n", names[k], seed,
+                  r.gyro_error, r.accel_error, r.confidence, r.updates);
+    }
+    /* 雑音とドリフトに対して十分小さく，信頼度が 1 に戻る */
+    const auto& c = rs[0];
+    failures += !(std::abs(c.gyro_error) < 1e-3f &&
+                  std::abs(c.accel_error) < 5.0f && c.confidence > 0.99f);
+    /* 回されている間と走行中は初期値のまま */
+    for (int k = 1; k < 3; ++k)
+      failures += rs[k].updates != 0 ||
+                  std::abs(rs[k].gyro_error - p.initial_error) > 1e-6f;
+  }
+  std::printf("failures: %d\n", failures);
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,401 @@
+/**
+ * @file decision_trace.cpp
+ * @brief Host Harness of the Search Decision Latency Tracer
+ * @author Ryotaro Onuki <kerikun11+github@gmail.com>
+ * @date 2024-02-04
+ * @copyright Copyright 2024 Ryotaro Onuki <kerikun11+github@gmail.com>
+ */
+/*
+ * 探索の区画ごとの受け渡しを 2 つのスレッドで模擬し，ファームウェアと
+ * 同じ点で utils::DecisionTracer::mark() して，探索後の記録を再現する．
+ *
+ * - 走行 (MoveAction::search_run_task()): 区画の境界で壁を読んで探索器に
+ *   通知し (capture)，行動が追加されるまで待って取り出す (dequeue)．
+ *   区画の走行の時間は --cell-us．
+ * - 探索器 (MazeRobot): 通知を受けて壁を読み，
+ *   calcNextDirectionsPreCallback (pre)，足立法の判断 (既知の壁で歩数
+ *   マップを作り次の区画を選ぶ)，calcNextDirectionsPostCallback (post)，
+ *   queueAction (enqueue)．--stall-every 区画ごとに判断を --stall-us だけ
+ *   遅らせる (フラッシュへの保存などの模擬)．
+ *
+ * 32x32 のランダムな迷路 (--mazes 個) をゴールまで探索し，次を確かめる．
+ *
+ * - order: print() の全区画の記録で，全ての点が記録され，capture, pre,
+ *   post, enqueue, dequeue の順であること．
+ * - histogram: histogram() が，スレッドが mark() に与えた時刻から求めた
+ *   遅延のヒストグラムと一致すること．
+ * - worst: worst() が遅延の大きい順で，その遅延が上位と一致すること．
+ *   遅らせた区画の数だけ取ると，どれも --stall-us 以上であること．
+ * - dropped: 容量を超えた区画を記録せずに数えること．
+ *
+ * どれかを満たさなければ失敗で終了する．
+ */
+#include <algorithm>  //< for std::sort, std::min, std::count
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>  //< for UINT32_MAX
+#include <cstdio>
+#include <cstdlib>  //< for std::atoi
+#include <iostream>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>  //< for std::pair
+#include <vector>
+
+#include "utils/decision_tracer.hpp"
+
+namespace {
+
+using Tracer = utils::DecisionTracer;
+
+struct Options {
+  int mazes = 5;
+  int cell_us = 100;     //< 区画の走行の時間
+  int stall_every = 50;  //< 判断を遅らせる区画の間隔
+  int stall_us = 5000;   //< 判断を遅らせる時間
+  bool print = false;    //< 最後の迷路の print() を出力する
+};
+
+/**
+ * @brief esp_timer_get_time() の代わり (実時間)
+ */
+uint32_t now_us() {
+  static const auto t0 = std::chrono::steady_clock::now();
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now() - t0)
+      .count();
+}
+
+/**
+ * @brief 1 回の探索で，スレッドが mark() に与えた時刻
+ */
+struct Run {
+  std::vector<uint32_t> capture, enqueue;
+  std::vector<bool> stalled;
+};
+
+/**
+ * @brief 迷路の壁 (外周と外側は常に壁)
+ */
+class Maze {
+ public:
+  enum Direction { East, North, West, South };
+
+ public:
+  explicit Maze(const int size)
+      : size_(size), east_(size * size), north_(size * size) {}
+  int size() const { return size_; }
+  bool is_wall(int x, int y, int d) const {
+    if (d == West) x--, d = East;
+    if (d == South) y--, d = North;
+    if (d == East && (x < 0 || x >= size_ - 1)) return true;
+    if (d == North && (y < 0 || y >= size_ - 1)) return true;
+    if (x < 0 || y < 0 || x >= size_ || y >= size_) return true;
+    return (d == East ? east_ : north_)[y * size_ + x];
+  }
+  void set_wall(int x, int y, int d, const bool b) {
+    if (d == West) x--, d = East;
+    if (d == South) y--, d = North;
+    if (x < 0 || y < 0 || x >= size_ || y >= size_) return;
+    (d == East ? east_ : north_)[y * size_ + x] = b;
+  }
+  const std::vector<std::pair<int, int>>& goals() const { return goals_; }
+  void add_goal(const int x, const int y) { goals_.push_back({x, y}); }
+
+ private:
+  int size_;
+  std::vector<bool> east_, north_;
+  std::vector<std::pair<int, int>> goals_;
+};
+
+/**
+ * @brief 穴掘り法で作った n x n の迷路 (中央の 4 区画がゴール)
+ */
+Maze make_maze(const int n, const int seed) {
+  Maze maze(n);
+  for (int x = 0; x < n; ++x)
+    for (int y = 0; y < n; ++y)
+      for (int d = 0; d < 4; ++d) maze.set_wall(x, y, d, true);
+  std::mt19937 rng(seed);
+  std::vector<bool> visited(n * n, false);
+  std::vector<std::pair<int, int>> stack = {{0, 0}};
+  visited[0] = true;
+  const int dx[4] = {1, 0, -1, 0}, dy[4] = {0, 1, 0, -1};
+  while (!stack.empty()) {
+    const auto [x, y] = stack.back();
+    std::vector<int> dirs;
+    for (int d = 0; d < 4; ++d) {
+      const int nx = x + dx[d], ny = y + dy[d];
+      if (nx >= 0 && ny >= 0 && nx < n && ny < n && !visited[ny * n + nx])
+        dirs.push_back(d);
+    }
+    if (dirs.empty()) {
+      stack.pop_back();
+      continue;
+    }
+    const int d = dirs[rng() % dirs.size()];
+    maze.set_wall(x, y, d, false);
+    visited[(y + dy[d]) * n + x + dx[d]] = true;
+    stack.push_back({x + dx[d], y + dy[d]});
+  }
+  const int g = n / 2 - 1;
+  for (int x = g; x <= g + 1; ++x) {
+    for (int y = g; y <= g + 1; ++y) maze.add_goal(x, y);
+    maze.set_wall(x, g, Maze::North, false);
+  }
+  maze.set_wall(g, g, Maze::East, false);
+  maze.set_wall(g, g + 1, Maze::East, false);
+  return maze;
+}
+
+/**
+ * @brief 足立法で次の方向を選ぶ (-1: 行き止まり)
+ */
+int decide(const Maze& known, const int x, const int y,
+           const int dir) {
+  const int n = known.size();
+  const int dx[4] = {1, 0, -1, 0}, dy[4] = {0, 1, 0, -1};
+  std::vector<int> step(n * n, n * n);
+  std::queue<std::pair<int, int>> q;
+  for (const auto& g : known.goals()) {
+    step[g.second * n + g.first] = 0;
+    q.push(g);
+  }
+  while (!q.empty()) {
+    const auto [cx, cy] = q.front();
+    q.pop();
+    for (int d = 0; d < 4; ++d) {
+      if (known.is_wall(cx, cy, d)) continue;
+      const int i = (cy + dy[d]) * n + cx + dx[d];
+      if (step[i] <= step[cy * n + cx] + 1) continue;
+      step[i] = step[cy * n + cx] + 1;
+      q.push({cx + dx[d], cy + dy[d]});
+    }
+  }
+  int next = -1;
+  for (int k = 0; k < 4; ++k) {
+    const int d = (dir + k) % 4;
+    if (known.is_wall(x, y, d)) continue;
+    const int i = (y + dy[d]) * n + x + dx[d];
+    if (next < 0 || step[i] < step[(y + dy[next]) * n + x + dx[next]])
+      next = d;
+  }
+  return next;
+}
+
+/**
+ * @brief 走行と探索器のスレッドで迷路をゴールまで探索する
+ */
+Run search(const Maze& maze, const Options& o, Tracer& tracer) {
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool waiting = false;     //< 走行が探索器に通知した
+  std::queue<int> actions;  //< 方向 (-1: 停止)
+  Run run;
+  tracer.reset();
+  /* 探索器 (MazeRobot) */
+  std::thread searcher([&] {
+    const int n = maze.size();
+    const int dx[4] = {1, 0, -1, 0}, dy[4] = {0, 1, 0, -1};
+    Maze known(n);  //< 未知の壁はないものとする
+    for (const auto& g : maze.goals()) known.add_goal(g.first, g.second);
+    int x = 0, y = 0, dir = Maze::North;
+    for (int cell = 0;; ++cell) {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&] { return waiting; });
+        waiting = false;
+      }
+      for (int d = 0; d < 4; ++d)
+        known.set_wall(x, y, d, maze.is_wall(x, y, d));
+      tracer.mark(Tracer::PreCallback, now_us());
+      const bool stall = o.stall_every && cell % o.stall_every == 0;
+      if (stall)
+        std::this_thread::sleep_for(std::chrono::microseconds(o.stall_us));
+      /* ゴールか上限で停止 */
+      bool stop = cell >= 16 * n * n;
+      for (const auto& g : maze.goals()) stop |= g.first == x && g.second == y;
+      const int next = stop ? -1 : decide(known, x, y, dir);
+      tracer.mark(Tracer::PostCallback, now_us());
+      const uint32_t t = now_us();
+      tracer.mark(Tracer::Enqueue, t);
+      {
+        std::lock_guard<std::mutex> lock_guard(mutex);
+        run.enqueue.push_back(t);
+        run.stalled.push_back(stall);
+        actions.push(next);
+      }
+      cv.notify_all();
+      if (next < 0) break;
+      dir = next, x += dx[dir], y += dy[dir];
+    }
+  });
+  /* 走行 (MoveAction) */
+  while (1) {
+    const uint32_t t = now_us();
+    tracer.mark(Tracer::WallCapture, t);
+    int action;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      run.capture.push_back(t);
+      waiting = true;
+      cv.notify_all();
+      cv.wait(lock, [&] { return !actions.empty(); });
+      action = actions.front();
+      actions.pop();
+    }
+    tracer.mark(Tracer::Dequeue, now_us());
+    if (action < 0) break;
+    std::this_thread::sleep_for(std::chrono::microseconds(o.cell_us));
+  }
+  searcher.join();
+  return run;
+}
+
+/**
+ * @brief print() の全区画の記録 (各点の capture からの経過時間) を読む
+ */
+std::vector<std::vector<int>> parse(const std::string& text, int& cells,
+                                    int& dropped) {
+  std::vector<std::vector<int>> rows;
+  std::istringstream iss(text);
+  cells = dropped = -1;
+  for (std::string line; std::getline(iss, line);) {
+    std::sscanf(line.c_str(), "# decision latency: cells: %d dropped: %d",
+                &cells, &dropped);
+    if (line.empty() || line[0] == '#' || line.rfind("cell", 0) == 0)
+      continue;
+    std::istringstream ls(line);
+    std::vector<int> row;
+    for (int v; ls >> v;) row.push_back(v);
+    rows.push_back(std::vector<int>(row.begin() + 1, row.end()));
+  }
+  return rows;
+}
+
+/**
+ * @brief 1 回の探索の記録を確かめる
+ *
+ * @return 満たさなかった項目の数
+ */
+int check(const Run& run, const Tracer& tracer, std::string& text) {
+  std::ostringstream oss;
+  tracer.print(oss);
+  text = oss.str();
+  int cells, dropped;
+  const auto rows = parse(text, cells, dropped);
+  const size_t size = run.capture.size();
+  /* スレッドが与えた時刻からの遅延 (mark() と同じく最下位ビットを立てる) */
+  std::vector<uint32_t> latency(size);
+  for (size_t i = 0; i < size; ++i)
+    latency[i] = (run.enqueue[i] | 1) - (run.capture[i] | 1);
+  /* order */
+  bool order = run.enqueue.size() == size && rows.size() == size &&
+               cells == int(size) && dropped == 0;
+  for (size_t i = 0; order && i < size; ++i) {
+    const auto& r = rows[i];
+    order = r.size() == Tracer::PointMax && r[Tracer::WallCapture] == 0;
+    for (int p = 1; order && p < Tracer::PointMax; ++p)
+      order = r[p] >= r[p - 1];
+    order = order && uint32_t(r[Tracer::Enqueue]) == latency[i];
+  }
+  /* histogram */
+  std::array<int, Tracer::kBinCount> bins{};
+  for (const auto l : latency)
+    bins[std::min<uint32_t>(l / Tracer::kBinWidthUs, Tracer::kBinCount - 1)]++;
+  const bool histogram = tracer.histogram() == bins;
+  /* worst */
+  int stalled = 0;
+  uint32_t stall_min = UINT32_MAX;
+  for (size_t i = 0; i < size; ++i) {
+    if (!run.stalled[i]) continue;
+    stalled++;
+    stall_min = std::min(stall_min, latency[i]);
+  }
+  auto sorted = latency;
+  std::sort(sorted.rbegin(), sorted.rend());
+  const auto indices = tracer.worst(stalled);
+  bool worst = int(indices.size()) == std::min<int>(stalled, size);
+  for (size_t k = 0; worst && k < indices.size(); ++k)
+    worst = indices[k] >= 0 && size_t(indices[k]) < size &&
+            latency[indices[k]] == sorted[k] && sorted[k] >= stall_min;
+  if (!order || !histogram || !worst)
+    std::printf("\torder %s\thistogram %s\tworst %s\n", order ? "ok" : "NG",
+                histogram ? "ok" : "NG", worst ? "ok" : "NG");
+  return !order + !histogram + !worst;
+}
+
+/**
+ * @brief 容量を超えた区画は記録せずに数える
+ */
+int check_dropped(const Maze& maze, const Options& o) {
+  const int capacity = 64;
+  Tracer tracer(capacity);
+  const auto run = search(maze, o, tracer);
+  std::ostringstream oss;
+  tracer.print(oss);
+  int cells, dropped;
+  const auto rows = parse(oss.str(), cells, dropped);
+  const int total = run.capture.size();
+  const bool ok = total > capacity && cells == capacity &&
+                  int(rows.size()) == capacity && dropped == total - capacity;
+  std::printf("dropped\t%s\tcells %d of %d\tdropped %d\n", ok ? "ok" : "NG",
+              cells, total, dropped);
+  return !ok;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  /* 引数 */
+  Options o;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const bool has_value = i + 1 < argc;
+    if (arg == "--mazes" && has_value) {
+      o.mazes = std::atoi(argv[++i]);
+    } else if (arg == "--cell-us" && has_value) {
+      o.cell_us = std::atoi(argv[++i]);
+    } else if (arg == "--stall-every" && has_value) {
+      o.stall_every = std::atoi(argv[++i]);
+    } else if (arg == "--stall-us" && has_value) {
+      o.stall_us = std::atoi(argv[++i]);
+    } else if (arg == "--print") {
+      o.print = true;
+    } else {
+      std::cerr << "usage: " << argv[0]
+                << " [--mazes n --cell-us us --stall-every n --stall-us us"
+                   " --print]"
+                << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  int failures = 0;
+  std::string text;
+  std::printf("maze\tcells\tstalled\tlatency [us] median\tp99\tmax\n");
+  for (int seed = 0; seed < o.mazes; ++seed) {
+    Tracer tracer;
+    const auto run = search(make_maze(32, seed), o, tracer);
+    const int f = check(run, tracer, text);
+    std::vector<uint32_t> latency;
+    for (size_t i = 0; i < run.capture.size(); ++i)
+      latency.push_back(run.enqueue[i] - run.capture[i]);
+    std::sort(latency.begin(), latency.end());
+    const int stalled =
+        std::count(run.stalled.begin(), run.stalled.end(), true);
+    const size_t size = latency.size();
+    std::printf("%d\t%zu\t%d\t%u\t%u\t%u%s\n", seed, size, stalled,
+                latency[size / 2], latency[size * 99 / 100], latency.back(),
+                f ? "\tNG" : "");
+    failures += f;
+  }
+  failures += check_dropped(make_maze(32, 0), o);
+  if (o.print) std::cout << text;
+  std::printf("failures: %d\n", failures);
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,200 @@
+/**
+ * @file encoder_fit.cpp
+ * @brief Host Test of the Encoder Eccentricity Calibrator
+ * @author Ryotaro Onuki <kerikun11+github@gmail.com>
+ * @date 2024-02-04
+ * @copyright Copyright 2024 Ryotaro Onuki <kerikun11+github@gmail.com>
+ */
+/*
+ * tools/encoder/data の空転のログ (Machine::encoder_test() の出力) を
+ * utils::EncoderCalibrator に 1 標本ずつ入れて確かめる．
+ *
+ * - 逐次最小二乗法の結果が，同じ線形モデルを正規方程式で一度に解いた
+ *   結果と一致すること．
+ * - 補正したエンコーダ値の差分 (速度) のばらつきが，tools/encoder/main.py
+ *   が同じログに当てはめた結果 (*_result_ch{0,1}.txt) で補正したときより
+ *   大きくないこと (--margin の比まで許す)．main.py は直線の両端をログの
+ *   最初と最後の値に固定し，EncoderCalibrator は直線も推定するので，
+ *   係数そのものは少し違う．
+ *
+ * どれかのログで満たさなければ失敗で終了する．
+ */
+#include <algorithm>  //< for std::max
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>  //< for std::atof
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "utils/encoder_calibrator.hpp"
+
+namespace {
+
+constexpr int kPulsesSize = 1 << 14;  //< main.py の N
+
+/* main.py の当てはめの結果 */
+struct Reference {
+  double gain = NAN;
+  double phase = NAN;
+};
+
+bool load_reference(const std::string& file, Reference& ref) {
+  std::ifstream ifs(file);
+  if (!ifs) return false;
+  for (std::string line; std::getline(ifs, line);) {
+    if (line.rfind("a = ", 0) == 0) ref.gain = std::stod(line.substr(4));
+    if (line.rfind("b = ", 0) == 0) ref.phase = std::stod(line.substr(4));
+  }
+  return !std::isnan(ref.gain) && !std::isnan(ref.phase);
+}
+
+/**
+ * @brief ログの enc_pulses_{0,1} の列を読む
+ */
+bool load_log(const std::string& file, std::vector<int> (&pulses)[2]) {
+  std::ifstream ifs(file);
+  if (!ifs) return false;
+  std::vector<std::string> names;
+  int columns[2] = {-1, -1};
+  for (std::string line; std::getline(ifs, line);) {
+    if (line.empty() || line[0] == '#') continue;
+    std::istringstream iss(line);
+    std::vector<std::string> cells;
+    for (std::string s; std::getline(iss, s, '\t');) cells.push_back(s);
+    if (names.empty()) {
+      names = cells;
+      for (int ch = 0; ch < 2; ++ch)
+        for (size_t i = 0; i < names.size(); ++i)
+          if (names[i] == "enc_pulses_" + std::to_string(ch)) columns[ch] = i;
+      continue;
+    }
+    if (cells.size() != names.size()) continue;
+    for (int ch = 0; ch < 2; ++ch)
+      pulses[ch].push_back(std::lround(std::stod(cells[columns[ch]])));
+  }
+  return columns[0] >= 0 && columns[1] >= 0 && !pulses[0].empty();
+}
+
+/**
+ * @brief EncoderCalibrator と同じ線形モデルを正規方程式で解く
+ */
+utils::EncoderCalibrator::Result batch_fit(const std::vector<int>& pulses) {
+  constexpr int n = 4;
+  double A[n][n + 1] = {};  //< 拡大係数行列
+  for (size_t k = 0; k < pulses.size(); ++k) {
+    const double w = 2 * M_PI * pulses[k] / kPulsesSize;
+    const double phi[n] = {1, double(k), std::sin(w), std::cos(w)};
+    const double y = pulses[k] - pulses[0];
+    for (int i = 0; i < n; ++i) {
+      for (int j = 0; j < n; ++j) A[i][j] += phi[i] * phi[j];
+      A[i][n] += phi[i] * y;
+    }
+  }
+  /* ガウスの消去法 (部分ピボット選択) */
+  for (int i = 0; i < n; ++i) {
+    int pivot = i;
+    for (int r = i + 1; r < n; ++r)
+      if (std::abs(A[r][i]) > std::abs(A[pivot][i])) pivot = r;
+    for (int c = 0; c <= n; ++c) std::swap(A[i][c], A[pivot][c]);
+    for (int r = 0; r < n; ++r) {
+      if (r == i) continue;
+      const double f = A[r][i] / A[i][i];
+      for (int c = i; c <= n; ++c) A[r][c] -= f * A[i][c];
+    }
+  }
+  const double p = -A[2][n] / A[2][2], q = -A[3][n] / A[3][3];
+  double phase = std::atan2(q, p) / (2 * M_PI);
+  if (phase < 0) phase += 1;
+  return {float(std::hypot(p, q)), float(phase)};
+}
+
+/**
+ * @brief 補正したエンコーダ値の差分の標準偏差 [pulses/sample]
+ */
+double corrected_speed_std(const std::vector<int>& pulses, const double gain,
+                           const double phase) {
+  auto fix = [&](const int x) {
+    return x + gain * std::sin(2 * M_PI * (double(x) / kPulsesSize + phase));
+  };
+  double sum = 0, sum2 = 0;
+  for (size_t k = 1; k < pulses.size(); ++k) {
+    const double d = fix(pulses[k]) - fix(pulses[k - 1]);
+    sum += d, sum2 += d * d;
+  }
+  const double n = pulses.size() - 1;
+  return std::sqrt(std::max(0.0, sum2 / n - (sum / n) * (sum / n)));
+}
+
+/* 位相の差 [-0.5, 0.5) */
+double phase_diff(const double a, const double b) {
+  double d = a - b;
+  return d - std::floor(d + 0.5);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  /* 引数 */
+  double margin = 0.03;  //< main.py に対するばらつきの許容比
+  std::vector<std::string> files;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const bool has_value = i + 1 < argc;
+    if (arg == "--margin" && has_value) {
+      margin = std::atof(argv[++i]);
+    } else if (arg.rfind("--", 0) == 0) {
+      std::cerr << "usage: " << argv[0]
+                << " encoder_log.csv... [--margin ratio]" << std::endl;
+      return EXIT_FAILURE;
+    } else {
+      files.push_back(arg);
+    }
+  }
+  int failures = 0, count = 0;
+  double ratio_sum = 0;
+  std::printf("log\tch\tgain (main.py)\tgain (rls)\tphase (main.py)\t"
+              "phase (rls)\tbatch diff (gain, phase)\tspeed std (raw)\t"
+              "speed std (main.py)\tspeed std (rls)\n");
+  for (const auto& file : files) {
+    std::vector<int> pulses[2];
+    if (!load_log(file, pulses)) {
+      std::cerr << "skipped (not an encoder log): " << file << std::endl;
+      continue;
+    }
+    const auto basename = file.substr(0, file.rfind('.'));
+    const auto name = basename.substr(basename.rfind('/') + 1);
+    for (int ch = 0; ch < 2; ++ch) {
+      Reference ref;
+      const auto ref_file = basename + "_result_ch" + std::to_string(ch);
+      if (!load_reference(ref_file + ".txt", ref)) {
+        std::cerr << "skipped (no main.py result): " << ref_file << std::endl;
+        continue;
+      }
+      utils::EncoderCalibrator calibrator(kPulsesSize);
+      for (const auto p : pulses[ch]) calibrator.push(p);
+      const auto r = calibrator.getResult();
+      const auto b = batch_fit(pulses[ch]);
+      const double dg = std::abs(r.gain - b.gain);
+      const double dp = std::abs(phase_diff(r.phase, b.phase));
+      const double s_raw = corrected_speed_std(pulses[ch], 0, 0);
+      const double s_ref =
+          corrected_speed_std(pulses[ch], ref.gain, ref.phase);
+      const double s_rls = corrected_speed_std(pulses[ch], r.gain, r.phase);
+      std::printf("%s\t%d\t%.2f\t%.2f\t%.4f\t%.4f\t%.3f, %.5f\t%.2f\t%.2f\t"
+                  "%.2f\n",
+                  name.c_str(), ch, ref.gain, r.gain, ref.phase, r.phase, dg,
+                  dp, s_raw, s_ref, s_rls);
+      /* 逐次と一度に解いた結果の差は丸め誤差程度 */
+      failures += dg > 0.1 || dp > 1e-4 || s_rls > s_ref * (1 + margin);
+      ratio_sum += s_rls / s_ref;
+      count++;
+    }
+  }
+  std::printf("fits: %d\tspeed std (rls / main.py) mean: %.3f\t"
+              "failures: %d\n",
+              count, count ? ratio_sum / count : 0, failures);
+  return failures || count == 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,201 @@
+/**
+ * @file flash_writer.cpp
+ * @brief Host Test of the Background Flash Writer
+ * @author Ryotaro Onuki <kerikun11+github@gmail.com>
+ * @date 2024-02-04
+ * @copyright Copyright 2024 Ryotaro Onuki <kerikun11+github@gmail.com>
+ */
+/*
+ * utils::FlashWriter を遅いファイルシステムの代わり (SlowFs: 1 回の書き込みで
+ * 仮想時刻を --write-ms だけ待ってからファイルに書く) の上で確かめる．
+ * 書き込みのタスクはファームウェアと同じく TASK_PRIORITY_FLASH_WRITER の
+ * タスクで動かし，要求はそれより優先度の高いタスクから出す．
+ *
+ * - coalesce: 1 ms ごとに同じ key の要求を 100 回出すと，待機中の要求を
+ *   置き換えて書き込みの回数が減り，flush() の後のファイルは最後の内容．
+ *   要求から書き終えるまでの時間は書き込み 2 回分を超えない．
+ * - order: 置き換えた要求は元の順番のまま書く．
+ * - failure: 書き込みに失敗すると次の flush() が false を返し，
+ *   その次の flush() は true に戻る．
+ * - capacity: 待機中の要求が capacity の数を超える post() は断る．
+ *
+ * どれかを満たさなければ失敗で終了する．
+ */
+#include <freertospp/semphr.h>
+
+#include <cstdio>
+#include <cstdlib>  //< for std::_Exit, std::atoi
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "config/config.h"
+#include "utils/flash_writer.hpp"
+
+namespace {
+
+/**
+ * @brief 遅いファイルシステム (SPIFFS の書き込みの代わり)
+ */
+struct SlowFs {
+  std::string dir;
+  int write_ms;
+  std::vector<std::string> log;  //< 書き込んだファイルの名前の順番
+  freertospp::Semaphore started, release;
+
+  /**
+   * @brief release が与えられるまで終わらない書き込み
+   *
+   * 書き込みのタスクが要求を取り出した後に続きの要求を出すため．
+   */
+  bool write_gated(const std::string& name) {
+    started.give();
+    release.take();
+    return write(name, "-");
+  }
+  bool write(const std::string& name, const std::string& content) {
+    vTaskDelay(pdMS_TO_TICKS(write_ms));
+    std::ofstream of(dir + "/" + name, std::ios::binary | std::ios::trunc);
+    of << content;
+    log.push_back(name);
+    return bool(of);
+  }
+  std::string read(const std::string& name) const {
+    std::ifstream ifs(dir + "/" + name, std::ios::binary);
+    std::stringstream ss;
+    ss << ifs.rdbuf();
+    return ss.str();
+  }
+};
+
+/**
+ * @brief ファームウェアと同じく書き込みのタスクを作る
+ */
+utils::FlashWriter* start_writer(const size_t capacity) {
+  auto* fw = new utils::FlashWriter(capacity);
+  xTaskCreatePinnedToCore(
+      [](void* arg) {
+        static_cast<utils::FlashWriter*>(arg)->task();
+        vTaskDelete(NULL);
+      },
+      "FlashWriter", 4096, fw, TASK_PRIORITY_FLASH_WRITER, NULL,
+      TASK_CORE_ID_FLASH_WRITER);
+  return fw;
+}
+
+int coalesce(SlowFs& fs) {
+  auto* fw = start_writer(8);
+  const int posts = 100;
+  bool ok = true;
+  for (int i = 0; i < posts; ++i) {
+    const std::string content = std::to_string(i);
+    ok = ok && fw->post(1, content.size(),
+                        [&fs, content] { return fs.write("walls", content); });
+    vTaskDelay(pdMS_TO_TICKS(1));
+  }
+  ok = ok && fw->flush();
+  const auto s = fw->get_stats();
+  fw->print(std::cout);
+  fw->stop();
+  const uint32_t write_us = fs.write_ms * 1000;
+  ok = ok && fs.read("walls") == std::to_string(posts - 1);
+  ok = ok && s.writes + s.coalesced == posts && s.writes < posts / 4;
+  ok = ok && s.latency_us_max <= 2 * write_us + 1000;
+  std::printf("coalesce\t%s\twrites %d of %d posts\n", ok ? "ok" : "NG",
+              s.writes, posts);
+  return !ok;
+}
+
+int order(SlowFs& fs) {
+  auto* fw = start_writer(8);
+  fs.log.clear();
+  /* 書き込み中に 1, 2, 1 の順に要求する */
+  bool ok = fw->post(3, 1, [&fs] { return fs.write_gated("busy"); });
+  fs.started.take();
+  ok = ok && fw->post(1, 1, [&fs] { return fs.write("a", "old"); });
+  ok = ok && fw->post(2, 1, [&fs] { return fs.write("b", "b"); });
+  ok = ok && fw->post(1, 1, [&fs] { return fs.write("a", "new"); });
+  fs.release.give();
+  ok = ok && fw->flush();
+  fw->stop();
+  ok = ok && fs.log == std::vector<std::string>{"busy", "a", "b"};
+  ok = ok && fs.read("a") == "new";
+  std::printf("order\t%s\n", ok ? "ok" : "NG");
+  return !ok;
+}
+
+int failure(SlowFs& fs) {
+  auto* fw = start_writer(8);
+  /* 存在しないディレクトリには書けない */
+  bool ok = fw->post(1, 1, [&fs] { return fs.write("missing/a", "a"); });
+  ok = ok && !fw->flush();
+  ok = ok && fw->post(1, 1, [&fs] { return fs.write("a", "a"); });
+  ok = ok && fw->flush();
+  ok = ok && fw->get_stats().failures == 1;
+  fw->stop();
+  std::printf("failure\t%s\n", ok ? "ok" : "NG");
+  return !ok;
+}
+
+int capacity(SlowFs& fs) {
+  auto* fw = start_writer(2);
+  bool ok = fw->post(9, 1, [&fs] { return fs.write_gated("busy"); });
+  fs.started.take();
+  ok = ok && fw->post(1, 1, [&fs] { return fs.write("a", "a"); });
+  ok = ok && fw->post(2, 1, [&fs] { return fs.write("b", "b"); });
+  ok = ok && !fw->post(3, 1, [&fs] { return fs.write("c", "c"); });
+  ok = ok && fw->post(1, 1, [&fs] { return fs.write("a", "a"); });
+  fs.release.give();
+  ok = ok && fw->flush();
+  ok = ok && fw->get_stats().rejected == 1;
+  fw->stop();
+  std::printf("capacity\t%s\n", ok ? "ok" : "NG");
+  return !ok;
+}
+
+struct Test {
+  SlowFs fs;
+  int failures;
+  freertospp::Semaphore done;
+};
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  /* 引数 */
+  std::string dir = ".";
+  int write_ms = 20;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const bool has_value = i + 1 < argc;
+    if (arg == "--dir" && has_value) {
+      dir = argv[++i];
+    } else if (arg == "--write-ms" && has_value) {
+      write_ms = std::atoi(argv[++i]);
+    } else {
+      std::cerr << "usage: " << argv[0] << " [--dir path --write-ms ms]"
+                << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  /* 要求を出す側も仮想時刻の順番を守るタスクで動かす */
+  auto* t = new Test{{dir, write_ms, {}, {}, {}}, 0, {}};
+  xTaskCreatePinnedToCore(
+      [](void* arg) {
+        auto* t = static_cast<Test*>(arg);
+        t->failures += coalesce(t->fs);
+        t->failures += order(t->fs);
+        t->failures += failure(t->fs);
+        t->failures += capacity(t->fs);
+        t->done.give();
+        vTaskDelete(NULL);
+      },
+      "Test", 4096, t, TASK_PRIORITY_MOVE_ACTION, NULL,
+      TASK_CORE_ID_MOVE_ACTION);
+  t->done.take();
+  std::fflush(stdout);
+  /* 書き込みのタスクは後始末をせずに終了する */
+  std::_Exit(t->failures ? EXIT_FAILURE : EXIT_SUCCESS);
+}
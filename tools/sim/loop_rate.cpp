@@ -0,0 +1,187 @@
+/**
+ * @file loop_rate.cpp
+ * @brief Closed-loop Comparison of the Speed Control Loop Rates
+ * @author Ryotaro Onuki <kerikun11+github@gmail.com>
+ * @date 2024-02-04
+ * @copyright Copyright 2024 Ryotaro Onuki <kerikun11+github@gmail.com>
+ */
+/*
+ * SpeedController をシミュレータの上で動かし，Machine::sysid() の加速の
+ * 試験と同じく並進と回転の台形の速度の目標に追従させる．
+ * 速度制御ループの周期 (SPEED_CONTROLLER_SAMPLING_PERIOD_US) はビルドごとに
+ * 変える (kerise_loop_rate_1000, _500, _250)．
+ *
+ * 出力は真の速度と推定速度の目標との誤差の RMS と，仮想時刻 1 s あたりの
+ * 実時間 (ホストでのシミュレータ全体の処理時間)．実機の各段の処理時間は
+ * SPEED_CONTROLLER_PROFILER_ENABLED の計測 (メニュー 15) で見る．
+ *
+ * --reference に 1 kHz の結果の誤差を与えると，それより誤差が
+ * 大きい (--margin の比を超える) とき失敗で終了する．
+ *
+ * 目標を与えるループは実機の MoveAction と同じくタスクとして動かす．
+ * main のスレッドは仮想時刻の順番を待たないので，そこで動かすとホストの
+ * 負荷で結果が変わる．
+ */
+#include <freertospp/semphr.h>
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>  //< for std::_Exit, std::atof
+#include <iostream>
+#include <string>
+
+#include "peripheral/partition.h"
+#include "sim/world.hpp"
+#include "supporters/supporters.h"
+
+namespace {
+
+/**
+ * @brief 台形の速度の目標
+ */
+struct Trapezoid {
+  float a, v, d;  //< 加速度，最高速度，距離
+  float t_acc() const { return std::min(v / a, std::sqrt(d / a)); }
+  float t_end() const {
+    const float ta = t_acc(), v_top = a * ta;
+    return 2 * ta + (d - v_top * ta) / v_top;
+  }
+  float vel(const float t) const {
+    const float ta = t_acc(), v_top = a * ta, te = t_end();
+    if (t < 0 || t > te) return 0;
+    if (t < ta) return a * t;
+    if (t > te - ta) return a * (te - t);
+    return v_top;
+  }
+  float acc(const float t) const {
+    const float ta = t_acc(), te = t_end();
+    if (t < 0 || t > te) return 0;
+    if (t < ta) return a;
+    if (t > te - ta) return -a;
+    return 0;
+  }
+};
+
+struct Result {
+  float rms_true;  //< 真の速度の誤差の RMS
+  float rms_est;   //< 推定速度の誤差の RMS
+};
+
+/**
+ * @brief 並進 (rot = false) または回転の目標に追従させる
+ */
+Result run(SpeedController* sc, const Trapezoid& tr, const bool rot) {
+  auto& world = sim::world();
+  /* 壁のない迷路の区画の中央から北へ */
+  world.set_pose(sim::Field::kCell * 8.5f, sim::Field::kCell * 1.5f, M_PI / 2);
+  sc->enable();
+  double sum2_true = 0, sum2_est = 0;
+  int count = 0;
+  for (float t = 0; t < tr.t_end() + 0.1f; t += sc->Ts) {
+    const float v = tr.vel(t), a = tr.acc(t);
+    if (rot)
+      sc->set_target(0, v, 0, a);
+    else
+      sc->set_target(v, 0, a, 0);
+    sc->sampling_wait();
+    /* 通知の時点の目標 (次の set_target の前) と比べる */
+    const float v_true =
+        rot ? world.get_velocity().rot : world.get_velocity().tra;
+    const float v_est = rot ? sc->est_v.rot : sc->est_v.tra;
+    const float v_ref = tr.vel(t + sc->Ts);
+    sum2_true += (v_true - v_ref) * (v_true - v_ref);
+    sum2_est += (v_est - v_ref) * (v_est - v_ref);
+    count++;
+  }
+  sc->disable();
+  vTaskDelay(pdMS_TO_TICKS(200));
+  return {float(std::sqrt(sum2_true / count)),
+          float(std::sqrt(sum2_est / count))};
+}
+
+struct Measurement {
+  SpeedController* sc;
+  int repeats;
+  Result r[2];
+  freertospp::Semaphore done;
+};
+
+void measure(Measurement* m) {
+  /* Machine::sysid() の加速の試験と同じ程度の目標 */
+  const Trapezoid tra = {9000, 900, 360};
+  const Trapezoid rot = {48 * float(M_PI), 6 * float(M_PI), 4 * float(M_PI)};
+  for (int i = 0; i < m->repeats; ++i) {
+    for (int k = 0; k < 2; ++k) {
+      const auto rr = run(m->sc, k ? rot : tra, k);
+      m->r[k].rms_true += rr.rms_true / m->repeats;
+      m->r[k].rms_est += rr.rms_est / m->repeats;
+    }
+  }
+  m->done.give();
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  /* 引数 */
+  float reference[2] = {NAN, NAN};  //< 1 kHz の真の速度の誤差 (並進，回転)
+  float margin = 0.1f;
+  int repeats = 5;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const bool has_value = i + 2 < argc;
+    if (arg == "--reference" && has_value) {
+      reference[0] = std::atof(argv[++i]);
+      reference[1] = std::atof(argv[++i]);
+    } else if (arg == "--margin" && i + 1 < argc) {
+      margin = std::atof(argv[++i]);
+    } else if (arg == "--repeats" && i + 1 < argc) {
+      repeats = std::atoi(argv[++i]);
+    } else {
+      std::cerr << "usage: " << argv[0]
+                << " [--reference rms_tra rms_rot --margin ratio"
+                << " --repeats n]" << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  /* 機体 (SpeedController のタスクだけを動かす) */
+  auto& world = sim::world();
+  world.set_field(sim::Field(16));
+  peripheral::record_store().mount();
+  auto* hw = new hardware::Hardware();
+  hw->init();
+  auto* sp = new supporters::Supporters(hw);
+  sp->sc->init();
+  vTaskDelay(pdMS_TO_TICKS(500));  //< センサのタスクが落ち着くまで待つ
+  auto* m = new Measurement{sp->sc, repeats, {}, {}};
+  const auto t0 = std::chrono::steady_clock::now();
+  const auto v0 = esp_timer_get_time();
+  xTaskCreatePinnedToCore(
+      [](void* arg) {
+        measure(static_cast<Measurement*>(arg));
+        vTaskDelete(NULL);
+      },
+      "Measure", 4096, m, TASK_PRIORITY_MOVE_ACTION, NULL,
+      TASK_CORE_ID_MOVE_ACTION);
+  m->done.take();
+  const auto& r = m->r;
+  const double real_s =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - t0)
+          .count();
+  const double virtual_s = (esp_timer_get_time() - v0) * 1e-6;
+  std::printf("sampling [us]\tcontrol [us]\ttra rms true [mm/s]\t"
+              "tra rms est [mm/s]\trot rms true [rad/s]\trot rms est [rad/s]\t"
+              "host [ms/s]\n");
+  std::printf("%d\t%d\t%.2f\t%.2f\t%.4f\t%.4f\t%.1f\n",
+              SpeedController::sampling_period_us,
+              SpeedController::control_period_us, r[0].rms_true,
+              r[0].rms_est, r[1].rms_true, r[1].rms_est,
+              1e3 * real_s / virtual_s);
+  std::fflush(stdout);
+  int failures = 0;
+  for (int k = 0; k < 2; ++k)
+    failures += r[k].rms_true > reference[k] * (1 + margin);  //< NaN は合格
+  /* タスクは終わらないので後始末をせずに終了する */
+  std::_Exit(failures ? EXIT_FAILURE : EXIT_SUCCESS);
+}
@@ -0,0 +1,204 @@
+/**
+ * @file main.cpp
+ * @brief Host Simulator of a Fast Run on a Maze File
+ * @author Ryotaro Onuki <kerikun11+github@gmail.com>
+ * @date 2024-02-04
+ * @copyright Copyright 2024 Ryotaro Onuki <kerikun11+github@gmail.com>
+ *
+ * 実機と同じ MoveAction と SpeedController を，シミュレータの
+ * hardware::Hardware の上で動かし，迷路ファイルの最短走行を再現する．
+ */
+#include <MazeLib/RobotBase.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>  //< for std::_Exit, std::atof
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "agents/move_action.h"
+#include "peripheral/partition.h"
+#include "sim/world.hpp"
+#include "supporters/supporters.h"
+
+namespace {
+
+/**
+ * @brief 既知の迷路の最短経路を MazeLib で求める
+ */
+class Planner : public MazeLib::RobotBase {
+ public:
+  bool plan(const sim::Field& field, const bool diag_enabled,
+            std::string& search_path) {
+    using MazeLib::Direction;
+    using MazeLib::Position;
+    if (field.size() > MAZE_SIZE) return false;
+    for (int x = 0; x < field.size(); ++x) {
+      for (int y = 0; y < field.size(); ++y) {
+        const auto p = Position(x, y);
+        maze.updateWall(p, Direction::East,
+                        field.is_wall(x, y, sim::Field::East));
+        maze.updateWall(p, Direction::North,
+                        field.is_wall(x, y, sim::Field::North));
+        if (x == 0) maze.updateWall(p, Direction::West, true);
+        if (y == 0) maze.updateWall(p, Direction::South, true);
+      }
+    }
+    MazeLib::Positions goals;
+    for (const auto& g : field.goals())
+      goals.push_back(Position(g.first, g.second));
+    replaceGoals(goals);
+    if (!calcShortestDirections(diag_enabled)) return false;
+    search_path = convertDirectionsToSearchPath(getShortestDirections());
+    return true;
+  }
+};
+
+/**
+ * @brief 1 区画の箱の中央で壁の基準値を較正する (実機の手順と同じ)
+ */
+void calibrate_wall_reference(supporters::Supporters* sp) {
+  auto& world = sim::world();
+  world.set_field(sim::Field(1));
+  world.set_pose(sim::Field::kCell / 2, sim::Field::kCell / 2, M_PI / 2);
+  sp->wd->calibration_side();
+  sp->wd->calibration_front();
+  sp->wd->backup();
+}
+
+/**
+ * @brief 結果を 1 行で出力して終了する
+ *
+ * タスクは終わらないので後始末をせずに終了する．
+ * 時間切れの監視と同時に呼ばれても 1 回だけ出力する．
+ */
+[[noreturn]] void finish(const char* result, const float t_run,
+                         const bool crashed) {
+  static std::mutex mutex;
+  mutex.lock();  //< 解放しない
+  float x, y, th;
+  sim::world().get_pose(x, y, th);
+  std::printf("result: %s\ttime: %.3f [s]\tpose: %.1f %.1f %.3f\t"
+              "crashed: %d\tspeed: %.1fx\n",
+              result, t_run, x, y, th, crashed,
+              sim::Kernel::get().get_speed_ratio());
+  std::fflush(stdout);
+  std::_Exit(std::string(result) == "success" ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    std::cerr << "usage: " << argv[0] << " <maze.txt> [key=value ...]"
+              << std::endl;
+    std::cerr << "keys: seed battery friction noise gyro_bias time_limit"
+              << std::endl
+              << "      diag v_max a_max j_max v_slalom fan_duty" << std::endl
+              << "      (others: members of config::Parameters)"
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+  /* 迷路 */
+  sim::Field field;
+  std::ifstream ifs(argv[1]);
+  if (!field.parse(ifs) || field.goals().empty()) {
+    std::cerr << "failed to parse maze file: " << argv[1] << std::endl;
+    return EXIT_FAILURE;
+  }
+  /* オプション (key=value) */
+  std::map<std::string, std::string> options;
+  for (int i = 2; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const auto eq = arg.find('=');
+    if (eq == std::string::npos) {
+      std::cerr << "invalid option: " << arg << std::endl;
+      return EXIT_FAILURE;
+    }
+    options[arg.substr(0, eq)] = arg.substr(eq + 1);
+  }
+  const auto option = [&](const char* key, const float value) {
+    const auto it = options.find(key);
+    if (it == options.end()) return value;
+    const float result = std::atof(it->second.c_str());
+    options.erase(it);
+    return result;
+  };
+  /* 機体とセンサ */
+  auto wp = sim::World::Parameter();
+  wp.seed = option("seed", wp.seed);
+  wp.battery_voltage = option("battery", wp.battery_voltage);
+  wp.friction = option("friction", wp.friction);
+  wp.gyro_bias = option("gyro_bias", wp.gyro_bias);
+  const float noise = option("noise", 1);  //< 雑音の標準偏差の倍率
+  wp.gyro_noise *= noise, wp.accel_noise *= noise;
+  wp.angular_accel_noise *= noise;
+  wp.reflector_noise *= noise, wp.tof_noise *= noise;
+  const float time_limit = option("time_limit", 60);  //< [s]
+  /* 走行パラメータ */
+  auto rp = MoveAction::RunParameter();
+  rp.diag_enabled = option("diag", rp.diag_enabled);
+  rp.v_max_ref = option("v_max", rp.v_max_ref);
+  rp.a_max_ref = option("a_max", rp.a_max_ref);
+  rp.j_max = option("j_max", rp.j_max);
+  rp.fan_duty = option("fan_duty", rp.fan_duty);
+  const float v_slalom = option("v_slalom", 0);
+  if (v_slalom > 0)
+    for (auto& vs : rp.v_slalom_ref) vs = v_slalom;
+  rp.set_level(rp.level);  //< 基準の値を v_max などに反映する
+  /* 残りは config::Parameters のメンバとみなす */
+  for (const auto& o : options) {
+    if (!config::parameter_store().set(o.first, o.second)) {
+      std::cerr << "unknown option: " << o.first << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  auto& world = sim::world();
+  world.set_parameter(wp);
+  /* 起動 (machine.h と同じ順) */
+  peripheral::record_store().mount();
+  auto* hw = new hardware::Hardware();
+  hw->init();
+  auto* sp = new supporters::Supporters(hw);
+  calibrate_wall_reference(sp);
+  sp->init();
+  auto* ma = new MoveAction(hw, sp);
+  ma->rp_fast = rp;
+  /* 最短経路 */
+  Planner planner;
+  std::string search_path;
+  if (!planner.plan(field, rp.diag_enabled, search_path)) {
+    std::cerr << "no path to the goal" << std::endl;
+    return EXIT_FAILURE;
+  }
+  /* スタート区画の後ろの壁に付けて置く */
+  world.set_field(field);
+  world.set_pose(sim::Field::kCell / 2,
+                 model::TailLength + sim::Field::kHalfWall, M_PI / 2);
+  /* 時間切れの監視 */
+  const auto t_start = esp_timer_get_time();
+  std::thread([&] {
+    vTaskDelay(pdMS_TO_TICKS(time_limit * 1000));
+    finish("timeout", time_limit, world.is_crashed());
+  }).detach();
+  /* 最短走行 */
+  ma->set_fast_path(search_path);
+  ma->enable(MoveAction::TaskActionFastRun);
+  ma->waitForEndAction();
+  ma->disable();
+  const float t_run = (esp_timer_get_time() - t_start) * 1e-6f;
+  /* 結果 */
+  float x, y, th;
+  world.get_pose(x, y, th);
+  const int cx = std::floor(x / sim::Field::kCell);
+  const int cy = std::floor(y / sim::Field::kCell);
+  bool reached = false;
+  for (const auto& g : field.goals())
+    reached |= g.first == cx && g.second == cy;
+  const bool crashed = world.is_crashed() || hw->mt->is_emergency();
+  finish(reached && !crashed ? "success" : "failure", t_run, crashed);
+}
@@ -0,0 +1,130 @@
+/**
+ * @file odometry_bench.cpp
+ * @brief Comparison of the Odometry Integration Methods
+ * @author Ryotaro Onuki <kerikun11+github@gmail.com>
+ * @date 2024-02-04
+ * @copyright Copyright 2024 Ryotaro Onuki <kerikun11+github@gmail.com>
+ */
+/*
+ * field::shapes の各スラロームを速度 v で走ったときの角度の軌跡を
+ * ctrl::slalom::Trajectory から求め，utils::integrate_odometry の
+ * ForwardEuler, Midpoint, ExactArc で積分したターン終点の位置の誤差を比べる．
+ * 真値は 1 us 刻みの数値積分 (倍精度)．
+ *
+ * ジャイロの値は 2 通り．
+ * - avg: 周期の間の平均の角速度 (積分方法だけの誤差)
+ * - sample: 周期の終わりの瞬時の角速度 (実機の SpeedController と同じ)
+ *
+ * 横滑りはなし (slip = 0)．横滑り係数 model::slip_angle_gain の同定は
+ * 実機のログが必要なので，ここでは扱わない．
+ *
+ * ExactArc の誤差の合計が Midpoint 以下，Midpoint が ForwardEuler 以下で
+ * なければ失敗で終了する．
+ */
+#include <array>  //< for field::shapes
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+#include "config/slalom_shapes.h"
+#include "utils/odometry.hpp"
+
+namespace {
+
+constexpr const char* kShapeNames[field::ShapeIndexMax] = {
+    "S90", "F45", "F90", "F135", "F180", "FV90", "FS90",
+};
+constexpr const char* kMethodNames[] = {"Euler", "Midpoint", "ExactArc"};
+constexpr int kMethods = 3;
+
+/**
+ * @brief 時刻 t における角度と角速度
+ */
+void angle(const ctrl::slalom::Trajectory& st, const double t, double& th,
+           double& w) {
+  ctrl::State s;
+  st.update(s, t, 0);
+  th = s.q.th, w = s.dq.th;
+}
+
+/**
+ * @brief 真のターン終点 (1 us 刻みの中点則)
+ */
+void truth(const ctrl::slalom::Trajectory& st, const float v, double& x,
+           double& y) {
+  const double T = st.getTimeCurve(), dt = 1e-6;
+  const int n = std::ceil(T / dt);
+  x = y = 0;
+  for (int i = 0; i < n; ++i) {
+    double th, w;
+    angle(st, (i + 0.5) * T / n, th, w);
+    x += v * std::cos(th) * T / n;
+    y += v * std::sin(th) * T / n;
+  }
+}
+
+/**
+ * @brief 周期 Ts で積分したターン終点の誤差 [mm]
+ */
+float error(const ctrl::slalom::Trajectory& st, const float v, const float Ts,
+            const bool sample, const utils::OdometryMethod method,
+            const double x_true, const double y_true) {
+  const double T = st.getTimeCurve();
+  const int n = std::round(T / Ts);
+  const double dt = T / n;  //< 周期をターンの時間に合わせる
+  ctrl::Pose p;
+  double th_prev = 0, w_prev;
+  angle(st, 0, th_prev, w_prev);
+  for (int i = 1; i <= n; ++i) {
+    double th, w;
+    angle(st, i * dt, th, w);
+    const float gyro = sample ? w : (th - th_prev) / dt;
+    utils::integrate_odometry(p, v, gyro, 0, dt, method);
+    th_prev = th;
+  }
+  return std::hypot(p.x - x_true, p.y - y_true);
+}
+
+}  // namespace
+
+int main() {
+  const float periods[] = {1e-3f, 5e-4f, 2.5e-4f};
+  const float scales[] = {1.0f, 2.0f};  //< v_ref に対する速度の比
+  double total[2][kMethods] = {};       //< [avg, sample][method]
+  std::printf("shape\tv [mm/s]\tTs [ms]\tgyro");
+  for (const auto name : kMethodNames) std::printf("\t%s [um]", name);
+  std::printf("\n");
+  for (int si = 0; si < field::ShapeIndexMax; ++si) {
+    const auto& shape = field::shapes[si];
+    for (const auto scale : scales) {
+      const float v = shape.v_ref * scale;
+      ctrl::slalom::Trajectory st(shape, false);
+      st.reset(v);
+      double x_true, y_true;
+      truth(st, v, x_true, y_true);
+      for (const auto Ts : periods) {
+        for (int sample = 0; sample < 2; ++sample) {
+          std::printf("%s\t%.0f\t%.2f\t%s", kShapeNames[si], v, Ts * 1e3,
+                      sample ? "sample" : "avg");
+          for (int m = 0; m < kMethods; ++m) {
+            const auto method = static_cast<utils::OdometryMethod>(m);
+            const float e = error(st, v, Ts, sample, method, x_true, y_true);
+            total[sample][m] += e;
+            std::printf("\t%.1f", e * 1e3);
+          }
+          std::printf("\n");
+        }
+      }
+    }
+  }
+  int failures = 0;
+  for (int sample = 0; sample < 2; ++sample) {
+    std::printf("total (%s)", sample ? "sample" : "avg");
+    for (int m = 0; m < kMethods; ++m)
+      std::printf("\t%s: %.1f um", kMethodNames[m], total[sample][m] * 1e3);
+    std::printf("\n");
+    const auto* t = total[sample];
+    failures += !(t[2] <= t[1] && t[1] <= t[0]);
+  }
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
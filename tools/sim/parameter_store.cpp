@@ -0,0 +1,221 @@
+/**
+ * @file parameter_store.cpp
+ * @brief Host Test of the Runtime Parameter Store
+ * @author Ryotaro Onuki <kerikun11+github@gmail.com>
+ * @date 2024-02-04
+ * @copyright Copyright 2024 Ryotaro Onuki <kerikun11+github@gmail.com>
+ */
+/*
+ * utils::ParameterStore を確かめる．
+ *
+ * - roundtrip: serialize() したものを deserialize() すると同じ値に戻る．
+ * - migration: 旧版の構造体 (名前の変更，削除，追加，int から float への
+ *   型の変更) で保存したものを新版で復元すると，名前 (と Alias) で
+ *   対応する値は引き継ぎ，記録のないものは既定値になる．
+ * - corrupt: 1 バイトを書き換えたもの，切り詰めたもの，バージョン違い，
+ *   CRC は正しいが型・予約領域・重複・値が不正な Record は拒否し，
+ *   値を変更しない．
+ * - torn: 書き手が大きな配列の全要素を同じ値にそろえて更新し続ける間に，
+ *   複数の読み手が get() した値の要素がそろっていること．
+ *
+ * どれかを満たさなければ失敗で終了する．
+ */
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>  //< for offsetof
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "utils/parameter_store.hpp"
+
+namespace {
+
+/* 旧版 */
+struct ParametersV1 {
+  float gain = 1.0f;
+  int32_t threshold = 100;
+  float old_offset = 2.0f;  //< 新版では offset に改名
+  float removed = 3.0f;     //< 新版では削除
+  int32_t steps = 7;        //< 新版では float
+};
+using StoreV1 = utils::ParameterStore<ParametersV1>;
+const std::vector<StoreV1::Entry> kEntriesV1 = {
+    {"gain", StoreV1::Type::Float, offsetof(ParametersV1, gain)},
+    {"threshold", StoreV1::Type::Int, offsetof(ParametersV1, threshold)},
+    {"old_offset", StoreV1::Type::Float, offsetof(ParametersV1, old_offset)},
+    {"removed", StoreV1::Type::Float, offsetof(ParametersV1, removed)},
+    {"steps", StoreV1::Type::Int, offsetof(ParametersV1, steps)},
+};
+
+/* 新版 */
+struct Parameters {
+  float gain = 10.0f;
+  int32_t threshold = 1000;
+  float offset = 20.0f;
+  float steps = 70.0f;
+  float added = 40.0f;
+};
+using Store = utils::ParameterStore<Parameters>;
+const std::vector<Store::Entry> kEntries = {
+    {"gain", Store::Type::Float, offsetof(Parameters, gain)},
+    {"threshold", Store::Type::Int, offsetof(Parameters, threshold)},
+    {"offset", Store::Type::Float, offsetof(Parameters, offset)},
+    {"steps", Store::Type::Float, offsetof(Parameters, steps)},
+    {"added", Store::Type::Float, offsetof(Parameters, added)},
+};
+const std::vector<Store::Alias> kAliases = {{"old_offset", "offset"}};
+
+bool equal(const Parameters& a, const Parameters& b) {
+  return std::memcmp(&a, &b, sizeof(a)) == 0;
+}
+
+int roundtrip() {
+  Store a(Parameters(), kEntries, kAliases);
+  a.update([](Parameters& p) {
+    p.gain = 1.5f, p.threshold = -3, p.offset = 0.25f, p.steps = 1e-3f;
+    p.added = -7.0f;
+  });
+  Store b(Parameters(), kEntries, kAliases);
+  const bool ok = b.deserialize(a.serialize()) && equal(a.get(), b.get());
+  std::printf("roundtrip\t%s\n", ok ? "ok" : "NG");
+  return !ok;
+}
+
+int migration() {
+  StoreV1 v1(ParametersV1(), kEntriesV1);
+  v1.update([](ParametersV1& p) {
+    p.gain = 1.5f, p.threshold = 42, p.old_offset = 0.5f, p.removed = 9.0f;
+    p.steps = 12;
+  });
+  Store v2(Parameters(), kEntries, kAliases);
+  const bool restored = v2.deserialize(v1.serialize());
+  const auto p = v2.get();
+  const bool ok = restored && p.gain == 1.5f && p.threshold == 42 &&
+                  p.offset == 0.5f && p.steps == 12.0f &&
+                  p.added == Parameters().added;
+  std::printf("migration\t%s\tgain %g threshold %d offset %g steps %g "
+              "added %g\n",
+              ok ? "ok" : "NG", p.gain, p.threshold, p.offset, p.steps,
+              p.added);
+  return !ok;
+}
+
+/**
+ * @brief Record を書き換えて CRC を付け直す
+ */
+std::string patch(std::string data, const int index,
+                  void (*f)(Store::Record&)) {
+  Store::Header h;
+  std::memcpy(&h, data.data(), sizeof(h));
+  char* body = &data[sizeof(h)];
+  Store::Record r;
+  std::memcpy(&r, body + index * sizeof(r), sizeof(r));
+  f(r);
+  std::memcpy(body + index * sizeof(r), &r, sizeof(r));
+  h.crc = utils::crc32(body, h.count * sizeof(Store::Record));
+  std::memcpy(&data[0], &h, sizeof(h));
+  return data;
+}
+
+int corrupt() {
+  Store src(Parameters(), kEntries, kAliases);
+  src.update([](Parameters& p) { p.gain = 5.0f, p.threshold = 5; });
+  const auto data = src.serialize();
+  std::vector<std::pair<std::string, std::string>> cases;
+  for (size_t i = 0; i < data.size(); ++i) {
+    auto d = data;
+    d[i] ^= 0x10;
+    cases.push_back({"byte " + std::to_string(i), d});
+  }
+  cases.push_back({"truncated", data.substr(0, data.size() - 1)});
+  cases.push_back({"extended", data + '\0'});
+  cases.push_back({"empty", ""});
+  {
+    auto d = data;
+    Store::Header h;
+    std::memcpy(&h, d.data(), sizeof(h));
+    h.version++;
+    std::memcpy(&d[0], &h, sizeof(h));
+    cases.push_back({"version", d});
+  }
+  cases.push_back(
+      {"type", patch(data, 0, [](Store::Record& r) { r.type = 2; })});
+  cases.push_back(
+      {"reserved",
+       patch(data, 1, [](Store::Record& r) { r.reserved[2] = 1; })});
+  cases.push_back({"duplicate", patch(data, 1, [](Store::Record& r) {
+                     r.key = utils::crc32("gain", 4);
+                     r.type = 0;
+                   })});
+  cases.push_back({"nan", patch(data, 0, [](Store::Record& r) {
+                     const float f = NAN;
+                     std::memcpy(&r.value, &f, sizeof(f));
+                   })});
+  int failures = 0;
+  for (const auto& c : cases) {
+    Store dst(Parameters(), kEntries, kAliases);
+    const bool accepted = dst.deserialize(c.second);
+    const bool ok = !accepted && equal(dst.get(), Parameters());
+    if (!ok) std::printf("corrupt\tNG\t%s\n", c.first.c_str());
+    failures += !ok;
+  }
+  std::printf("corrupt\t%s\tcases %d\n", failures ? "NG" : "ok",
+              int(cases.size()));
+  return failures;
+}
+
+/* 読み出しに時間がかかるよう大きくした構造体 */
+struct Wide {
+  float v[256] = {};
+};
+
+int torn() {
+  utils::ParameterStore<Wide> store(Wide(), {});
+  std::atomic<bool> done{false};
+  std::atomic<int> reads{0}, torn_reads{0};
+  std::vector<std::thread> readers;
+  for (int k = 0; k < 3; ++k) {
+    readers.emplace_back([&] {
+      while (!done) {
+        const auto p = store.get();
+        for (const auto v : p.v) {
+          if (v == p.v[0]) continue;
+          torn_reads++;
+          break;
+        }
+        reads++;
+      }
+    });
+  }
+  int updates = 0;
+  const auto end =
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(500);
+  while (std::chrono::steady_clock::now() < end) {
+    const float v = ++updates % 1000;
+    store.update([v](Wide& p) {
+      for (auto& x : p.v) x = v;
+    });
+  }
+  done = true;
+  for (auto& t : readers) t.join();
+  const bool ok = torn_reads == 0 && reads > 0;
+  std::printf("torn\t%s\tupdates %d reads %d torn %d\n", ok ? "ok" : "NG",
+              updates, int(reads), int(torn_reads));
+  return !ok;
+}
+
+}  // namespace
+
+int main() {
+  int failures = 0;
+  failures += roundtrip();
+  failures += migration();
+  failures += corrupt();
+  failures += torn();
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
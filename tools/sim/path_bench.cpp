@@ -0,0 +1,269 @@
+/**
+ * @file path_bench.cpp
+ * @brief Benchmark of the Fastest Fast Run Path Selection
+ * @author Ryotaro Onuki <kerikun11+github@gmail.com>
+ * @date 2024-02-04
+ * @copyright Copyright 2024 Ryotaro Onuki <kerikun11+github@gmail.com>
+ *
+ * 迷路ごとに MazeLib の最短経路と utils::PathCandidates の候補を作り，
+ * MoveAction::estimate_fast_run_time() で見積もった走行時間と，
+ * 候補の生成と評価にかかる計算時間を測る．MazeRobot と同じく，候補は
+ * MazeLib の最短経路と同じ区画に同じ向きで着くものに限る．
+ *
+ * 迷路は機体と同じく Maze::reset() と壁の読み取り (未知の壁の更新) だけで
+ * 作り，候補は MazeRobot::path_can_go() で作る．--check を付けると，
+ * 候補がない迷路や壁を通る候補があれば失敗で終了する．
+ */
+#include <MazeLib/RobotBase.h>
+
+#include <algorithm>  //< for std::find, std::shuffle
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>  //< for std::_Exit, std::atoi
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <utility>  //< for std::pair
+#include <vector>
+
+#include "agents/maze_robot.h"
+#include "agents/move_action.h"
+#include "peripheral/partition.h"
+#include "sim/field.hpp"
+#include "supporters/supporters.h"
+#include "utils/path_candidates.hpp"
+
+namespace {
+
+using PC = utils::PathCandidates;
+const MazeLib::Direction kDirs[] = {
+    MazeLib::Direction::East, MazeLib::Direction::North,
+    MazeLib::Direction::West, MazeLib::Direction::South};
+
+/**
+ * @brief 既知の迷路の最短経路を MazeLib で求める
+ *
+ * スタート区画と外周の壁は Maze::reset() に任せ，残りの壁を
+ * 探索走行で読み取ったものとして更新する．
+ */
+class Planner : public MazeLib::RobotBase {
+ public:
+  explicit Planner(const sim::Field& field) {
+    using MazeLib::Position;
+    maze.reset();
+    for (int x = 0; x < field.size(); ++x) {
+      for (int y = 0; y < field.size(); ++y) {
+        const auto p = Position(x, y);
+        for (int d = 0; d < 4; ++d)
+          if (!maze.isKnown(p, kDirs[d]))
+            maze.updateWall(p, kDirs[d], field.is_wall(x, y, d));
+      }
+    }
+    MazeLib::Positions goals;
+    for (const auto& g : field.goals())
+      goals.push_back(Position(g.first, g.second));
+    replaceGoals(goals);
+  }
+  bool plan(const bool diag_enabled, MazeLib::Directions& dirs) {
+    if (!calcShortestDirections(diag_enabled)) return false;
+    dirs = getShortestDirections();
+    return true;
+  }
+  std::string to_search_path(const MazeLib::Directions& dirs) {
+    return convertDirectionsToSearchPath(dirs);
+  }
+};
+
+/**
+ * @brief 穴掘り法の迷路の壁を一部取り除き，複数の経路がある迷路を作る
+ *
+ * スタートは左下，ゴールは中央の 2x2 区画．
+ */
+sim::Field random_field(const int size, const float loop, std::mt19937& rng) {
+  static constexpr int dx[] = {1, 0, -1, 0};
+  static constexpr int dy[] = {0, 1, 0, -1};
+  sim::Field field(size);
+  for (int x = 0; x < size; ++x) {
+    for (int y = 0; y < size; ++y) {
+      field.set_wall(x, y, sim::Field::East, true);
+      field.set_wall(x, y, sim::Field::North, true);
+    }
+  }
+  std::vector<bool> visited(size * size, false);
+  std::vector<std::pair<int, int>> stack = {{0, 0}};
+  visited[0] = true;
+  while (!stack.empty()) {
+    const auto [x, y] = stack.back();
+    std::vector<int> ds;
+    for (int d = 0; d < 4; ++d) {
+      const int nx = x + dx[d], ny = y + dy[d];
+      if (nx >= 0 && ny >= 0 && nx < size && ny < size &&
+          !visited[ny * size + nx])
+        ds.push_back(d);
+    }
+    if (ds.empty()) {
+      stack.pop_back();
+      continue;
+    }
+    const int d = ds[rng() % ds.size()];
+    field.set_wall(x, y, d, false);
+    visited[(y + dy[d]) * size + x + dx[d]] = true;
+    stack.push_back({x + dx[d], y + dy[d]});
+  }
+  std::uniform_real_distribution<float> uniform(0, 1);
+  for (int x = 0; x < size; ++x)
+    for (int y = 0; y < size; ++y)
+      for (const int d : {sim::Field::East, sim::Field::North})
+        if (uniform(rng) < loop) field.set_wall(x, y, d, false);
+  /* スタート区画は東が壁で北が開いている */
+  field.set_wall(0, 0, sim::Field::East, true);
+  field.set_wall(0, 0, sim::Field::North, false);
+  const int g = size / 2 - 1;
+  for (int x = g; x < g + 2; ++x)
+    for (int y = g; y < g + 2; ++y) field.add_goal(x, y);
+  field.set_wall(g, g, sim::Field::East, false);
+  field.set_wall(g, g + 1, sim::Field::East, false);
+  field.set_wall(g, g, sim::Field::North, false);
+  field.set_wall(g + 1, g, sim::Field::North, false);
+  return field;
+}
+
+uint32_t elapsed_us(const std::chrono::steady_clock::time_point& t) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now() - t)
+      .count();
+}
+
+/**
+ * @brief 候補が壁を通らずに (gx, gy) に着くか
+ */
+bool is_valid(const sim::Field& field, const PC::Directions& dirs,
+              const int gx, const int gy) {
+  static constexpr int dx[] = {1, 0, -1, 0};
+  static constexpr int dy[] = {0, 1, 0, -1};
+  int x = 0, y = 0;
+  for (const auto d : dirs) {
+    if (field.is_wall(x, y, d)) return false;
+    x += dx[d], y += dy[d];
+  }
+  return x == gx && y == gy;
+}
+
+/**
+ * @brief 1 つの迷路と斜めの設定で候補を作って評価する
+ *
+ * @return 候補があり，どれも壁を通らないか
+ */
+bool bench(const std::string& name, const sim::Field& field,
+           const MoveAction& ma, MoveAction::RunParameter rp,
+           const bool diag_enabled) {
+  rp.diag_enabled = diag_enabled;
+  Planner planner(field);
+  MazeLib::Directions shortest;
+  if (!planner.plan(diag_enabled, shortest) || shortest.empty()) {
+    std::printf("%s\t%d\tno path\n", name.c_str(), diag_enabled);
+    return false;
+  }
+  /* MazeLib の最短経路の終点 */
+  static constexpr int dx[] = {1, 0, -1, 0};
+  static constexpr int dy[] = {0, 1, 0, -1};
+  int gx = 0, gy = 0, last = -1;
+  for (const auto d : shortest) {
+    last = std::find(kDirs, kDirs + 4, d) - kDirs;
+    if (last == 4) return true;  //< 区画の境界を通らない向き
+    gx += dx[last], gy += dy[last];
+  }
+  const float t_shortest =
+      ma.estimate_fast_run_time(planner.to_search_path(shortest), rp);
+  /* 候補の生成 */
+  const PC pc(field.size(), MazeRobot::path_can_go(planner.getMaze()));
+  auto t = std::chrono::steady_clock::now();
+  const auto candidates = pc.search({{gx, gy}}, last);
+  const uint32_t search_us = elapsed_us(t);
+  bool valid = !candidates.empty();
+  for (const auto& c : candidates) valid &= is_valid(field, c, gx, gy);
+  /* 候補の評価 (変換を含む) */
+  t = std::chrono::steady_clock::now();
+  float t_best = t_shortest;
+  for (const auto& c : candidates) {
+    MazeLib::Directions ds;
+    for (const auto d : c) ds.push_back(kDirs[d]);
+    const auto path = planner.to_search_path(ds);
+    t_best = std::min(t_best, ma.estimate_fast_run_time(path, rp));
+  }
+  const uint32_t eval_us = elapsed_us(t);
+  std::printf("%s\t%d\t%d\t%d\t%.3f\t%.3f\t%.1f\t%u\t%.1f\t%s\n",
+              name.c_str(), diag_enabled, int(shortest.size()),
+              int(candidates.size()), t_shortest, t_best,
+              100 * (1 - t_best / t_shortest), search_us,
+              float(eval_us) / std::max<size_t>(1, candidates.size()),
+              valid ? "ok" : "NG");
+  return valid;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  /* 引数 */
+  int random = 0;
+  int size = MAZE_SIZE;
+  float loop = 0.1f;
+  uint32_t seed = 0;
+  bool check = false;
+  std::vector<std::string> files;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const bool has_value = i + 1 < argc;
+    if (arg == "--random" && has_value) {
+      random = std::atoi(argv[++i]);
+    } else if (arg == "--size" && has_value) {
+      size = std::atoi(argv[++i]);
+    } else if (arg == "--loop" && has_value) {
+      loop = std::atof(argv[++i]);
+    } else if (arg == "--seed" && has_value) {
+      seed = std::atoi(argv[++i]);
+    } else if (arg == "--check") {
+      check = true;
+    } else {
+      files.push_back(arg);
+    }
+  }
+  if (files.empty() && random <= 0) {
+    std::cerr << "usage: " << argv[0] << " [maze.txt...]"
+              << " [--random N --size N --loop P --seed N --check]"
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+  /* 迷路 */
+  std::vector<std::pair<std::string, sim::Field>> fields;
+  for (const auto& file : files) {
+    sim::Field field;
+    std::ifstream ifs(file);
+    if (!field.parse(ifs) || field.goals().empty()) {
+      std::cerr << "failed to parse maze file: " << file << std::endl;
+      return EXIT_FAILURE;
+    }
+    fields.push_back({file, field});
+  }
+  std::mt19937 rng(seed);
+  for (int i = 0; i < random; ++i)
+    fields.push_back({"random" + std::to_string(i),
+                      random_field(size, loop, rng)});
+  /* 機体 (走行はしないので較正は省く) */
+  peripheral::record_store().mount();
+  auto* hw = new hardware::Hardware();
+  hw->init();
+  auto* sp = new supporters::Supporters(hw);
+  auto* ma = new MoveAction(hw, sp);
+  /* 計測 */
+  std::printf("maze\tdiag\tcells\tcandidates\tshortest [s]\tbest [s]\t"
+              "gain [%%]\tsearch [us]\teval [us/path]\tcandidates\n");
+  int failures = 0;
+  for (const auto& f : fields)
+    for (const bool diag : {false, true})
+      failures += !bench(f.first, f.second, *ma, ma->rp_fast, diag);
+  std::fflush(stdout);
+  /* タスクは終わらないので後始末をせずに終了する */
+  std::_Exit(check && failures ? EXIT_FAILURE : EXIT_SUCCESS);
+}
@@ -0,0 +1,315 @@
+/**
+ * @file record_store.cpp
+ * @brief Power-cut Test and Benchmark of the Record Store
+ * @author Ryotaro Onuki <kerikun11+github@gmail.com>
+ * @date 2024-02-04
+ * @copyright Copyright 2024 Ryotaro Onuki <kerikun11+github@gmail.com>
+ */
+/*
+ * utils::RecordStore を sim::MmapFlash (ファイルを mmap したフラッシュ) の
+ * 上で確かめる．レコードの大きさと頻度はファームウェアの記録に合わせる．
+ *
+ * - remount: ペイロードの末尾が 0xFF のレコードを書いて mount() し直した
+ *   後に追記しても，前のレコードが壊れない．
+ * - power-cut: 一連の save() の途中のあらゆる位置で電源を落とし，
+ *   mount() し直すと，各 key は最後に成功した save() の値 (書きかけの
+ *   key はその新しい値でもよい) を読める．その後の save() も正しく読める．
+ * - corrupt: mount() の後にフラッシュのビットが変わったレコードは
+ *   load() が拒否する．
+ * - budget: 全ての key の最新のレコードの合計が kLiveBytesMax を超える
+ *   save() は拒否し，前の値を保つ．
+ * - bench: save() を続けたときのホストでの時間，1 回の save() での消去の
+ *   回数の最大，セクタの消去回数の偏りを出力する．
+ *
+ * どれかを満たさないか，1 回の save() で 2 回以上消去すれば失敗で終了する．
+ */
+#include <algorithm>  //< for std::max
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>  //< for std::atoi
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "sim/mmap_flash.hpp"
+
+namespace {
+
+using Store = utils::RecordStore;
+using Payload = std::vector<uint8_t>;
+
+/* "records" パーティションと同じ 64 KiB */
+constexpr size_t kFlashSize = 0x10000;
+
+/* ファームウェアの記録の大きさ (peripheral::RecordKey の順) と重み */
+struct Kind {
+  uint8_t key;
+  size_t size;
+  int weight;  //< 探索中の backup() の頻度の目安
+};
+const std::vector<Kind> kKinds = {
+    {1, 642, 10},  //< MazeRobot::WallMap
+    {2, 24, 8},    //< MazeRobot::State::Record
+    {3, 288, 1},   //< WallDetector の壁の基準値
+    {4, 100, 2},   //< utils::RunStrategy::Record
+};
+
+/**
+ * @brief ランダムなペイロード (半分は末尾を 0xFF にする)
+ */
+Payload make_payload(std::mt19937& rng, const size_t size) {
+  Payload p(size);
+  for (auto& b : p) b = rng();
+  if (rng() % 2)
+    for (size_t i = size - std::min<size_t>(size, 1 + rng() % 8); i < size; ++i)
+      p[i] = 0xFF;
+  return p;
+}
+
+const Kind& pick(std::mt19937& rng) {
+  int total = 0;
+  for (const auto& k : kKinds) total += k.weight;
+  int r = rng() % total;
+  for (const auto& k : kKinds)
+    if ((r -= k.weight) < 0) return k;
+  return kKinds.back();
+}
+
+/**
+ * @brief 全ての key が expected のとおりに読めるか
+ *
+ * @param pending 書きかけだった key と値 (その値でもよい)
+ */
+bool verify(Store& store, const std::map<uint8_t, Payload>& expected,
+            const std::pair<int, Payload>& pending = {-1, {}}) {
+  for (const auto& k : kKinds) {
+    uint8_t version;
+    Payload data(Store::kPayloadMax);
+    size_t size;
+    const bool found = store.load(k.key, version, data.data(), size,
+                                  data.size());
+    data.resize(found ? size : 0);
+    const auto it = expected.find(k.key);
+    const bool ok_old = it == expected.end() ? !found
+                                             : found && data == it->second;
+    const bool ok_new = pending.first == k.key && found &&
+                        data == pending.second;
+    if (!ok_old && !ok_new) return false;
+  }
+  return true;
+}
+
+int remount(const std::string& filepath) {
+  sim::MmapFlash flash(filepath, kFlashSize);
+  flash.format();
+  bool ok = true;
+  std::map<uint8_t, Payload> expected;
+  for (int i = 0; i < 20 && ok; ++i) {
+    /* 1 件ずつ mount() し直して追記する */
+    Store store(flash);
+    ok = store.mount() && verify(store, expected);
+    Payload p(24 + i, 0xA5);
+    std::fill(p.end() - 4, p.end(), 0xFF);
+    const uint8_t key = 1 + i % 2;
+    ok = ok && store.save(key, 1, p.data(), p.size());
+    expected[key] = p;
+  }
+  Store store(flash);
+  ok = ok && store.mount() && verify(store, expected);
+  std::printf("remount\t%s\n", ok ? "ok" : "NG");
+  return !ok;
+}
+
+/**
+ * @brief seed の一連の save() を cut バイトで止め，再起動して確かめる
+ *
+ * @return 0: 合格，1: 不合格，-1: 電源が落ちる前に終わった
+ */
+int power_cut_once(sim::MmapFlash& flash, const uint32_t seed,
+                   const int saves, const uint64_t cut) {
+  std::mt19937 rng(seed);
+  std::map<uint8_t, Payload> expected;
+  std::pair<int, Payload> pending = {-1, {}};
+  flash.format();
+  flash.cut_after(cut);
+  {
+    Store store(flash);
+    if (store.mount()) {
+      for (int i = 0; i < saves; ++i) {
+        const auto& k = pick(rng);
+        const auto p = make_payload(rng, k.size);
+        if (!store.save(k.key, 1, p.data(), p.size())) {
+          pending = {k.key, p};
+          break;
+        }
+        expected[k.key] = p;
+      }
+    }
+  }
+  if (!flash.is_cut()) return -1;
+  flash.restore_power();
+  /* 再起動 */
+  Store store(flash);
+  if (!store.mount() || !verify(store, expected, pending)) return 1;
+  /* 読めた値に合わせて続きを書き，もう一度再起動する */
+  uint8_t version;
+  Payload data(Store::kPayloadMax);
+  size_t size;
+  if (pending.first >= 0 && store.load(pending.first, version, data.data(),
+                                       size, data.size()))
+    expected[pending.first] = Payload(data.begin(), data.begin() + size);
+  for (int i = 0; i < 40; ++i) {
+    const auto& k = pick(rng);
+    const auto p = make_payload(rng, k.size);
+    if (!store.save(k.key, 1, p.data(), p.size())) return 1;
+    expected[k.key] = p;
+    if (!verify(store, expected)) return 1;  //< 他の key を壊していないか
+  }
+  Store again(flash);
+  return !again.mount() || !verify(again, expected);
+}
+
+int power_cut(const std::string& filepath, const int cuts) {
+  sim::MmapFlash flash(filepath, kFlashSize);
+  /* 一連の save() 全体のバイト数を測る */
+  const int saves = 200;
+  flash.format();
+  flash.restore_power();
+  const auto used0 = flash.used();
+  {
+    std::mt19937 rng(1);
+    Store store(flash);
+    store.mount();
+    for (int i = 0; i < saves; ++i) {
+      const auto& k = pick(rng);
+      const auto p = make_payload(rng, k.size);
+      store.save(k.key, 1, p.data(), p.size());
+    }
+  }
+  const uint64_t total = flash.used() - used0;
+  /* 先頭は細かく (初期化とセクタの消去)，残りは一様に */
+  std::vector<uint64_t> points;
+  for (uint64_t c = 0; c < 2 * Store::kSectorSize; c += 7) points.push_back(c);
+  std::mt19937_64 rng(2);
+  for (int i = 0; i < cuts; ++i) points.push_back(rng() % total);
+  int failures = 0, done = 0;
+  for (const auto c : points) {
+    const int r = power_cut_once(flash, 1, saves, c);
+    if (r > 0 && failures++ < 5)
+      std::printf("power-cut\tNG\tcut at %llu bytes\n", (unsigned long long)c);
+    done += r >= 0;
+  }
+  std::printf("power-cut\t%s\tcuts %d of %llu bytes\tfailures %d\n",
+              failures ? "NG" : "ok", done, (unsigned long long)total,
+              failures);
+  return failures;
+}
+
+int corrupt(const std::string& filepath) {
+  sim::MmapFlash flash(filepath, kFlashSize);
+  flash.format();
+  Store store(flash);
+  const Payload p(100, 0x5A);
+  bool ok = store.mount() && store.save(1, 1, p.data(), p.size());
+  /* ペイロードの 1 ビットを変える */
+  for (size_t i = 0; i < kFlashSize; ++i) {
+    if (flash.data()[i] != 0x5A) continue;
+    flash.data()[i] ^= 0x01;
+    break;
+  }
+  uint8_t version;
+  Payload data(p.size());
+  size_t size;
+  ok = ok && !store.load(1, version, data.data(), size, data.size()) &&
+       store.get_stats().corrupt == 1;
+  std::printf("corrupt\t%s\n", ok ? "ok" : "NG");
+  return !ok;
+}
+
+int budget(const std::string& filepath) {
+  sim::MmapFlash flash(filepath, kFlashSize);
+  flash.format();
+  Store store(flash);
+  const size_t half = Store::kLiveBytesMax / 2 - sizeof(Store::RecordHeader);
+  const Payload a(half, 0x11), b(half, 0x22), c(64, 0x33);
+  bool ok = store.mount() && store.save(1, 1, a.data(), a.size());
+  /* 1 と 2 の合計は収まるが，どちらかを書き換える余地がない */
+  ok = ok && store.save(2, 1, b.data(), b.size());
+  ok = ok && !store.save(3, 1, c.data(), c.size());
+  ok = ok && !store.save(1, 1, a.data(), a.size());
+  ok = ok && store.get_stats().rejected == 2;
+  ok = ok && verify(store, {{1, a}, {2, b}});
+  std::printf("budget\t%s\n", ok ? "ok" : "NG");
+  return !ok;
+}
+
+int bench(const std::string& filepath, const int saves) {
+  sim::MmapFlash flash(filepath, kFlashSize);
+  flash.format();
+  Store store(flash);
+  if (!store.mount()) return 1;
+  std::mt19937 rng(3);
+  double sum_us = 0, max_us = 0;
+  uint64_t max_erases = 0;
+  const auto c0 = flash.get_counter();
+  for (int i = 0; i < saves; ++i) {
+    const auto& k = pick(rng);
+    const auto p = make_payload(rng, k.size);
+    const auto erases = flash.get_counter().erases;
+    const auto t0 = std::chrono::steady_clock::now();
+    if (!store.save(k.key, 1, p.data(), p.size())) return 1;
+    const auto t1 = std::chrono::steady_clock::now();
+    const double us =
+        std::chrono::duration<double, std::micro>(t1 - t0).count();
+    sum_us += us, max_us = std::max(max_us, us);
+    max_erases = std::max(max_erases, flash.get_counter().erases - erases);
+  }
+  const auto c = flash.get_counter();
+  const auto s = store.get_stats();
+  std::printf("bench\tsaves %d\thost [us/save] mean %.2f max %.1f\t"
+              "bytes/save %.1f\terases/save mean %.4f max %llu\t"
+              "relocations %d\terase count min %u max %u\n",
+              saves, sum_us / saves, max_us,
+              double(c.bytes_written - c0.bytes_written) / saves,
+              double(c.erases - c0.erases) / saves,
+              (unsigned long long)max_erases, s.relocations,
+              s.erase_count_min, s.erase_count_max);
+  return max_erases > 1;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  /* 引数 */
+  std::string filepath = "record_store.bin";
+  int cuts = 2000;
+  int saves = 100000;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const bool has_value = i + 1 < argc;
+    if (arg == "--file" && has_value) {
+      filepath = argv[++i];
+    } else if (arg == "--cuts" && has_value) {
+      cuts = std::atoi(argv[++i]);
+    } else if (arg == "--saves" && has_value) {
+      saves = std::atoi(argv[++i]);
+    } else {
+      std::cerr << "usage: " << argv[0]
+                << " [--file path --cuts n --saves n]" << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  if (!sim::MmapFlash(filepath, kFlashSize).ok()) {
+    std::cerr << "failed to map " << filepath << std::endl;
+    return EXIT_FAILURE;
+  }
+  int failures = 0;
+  failures += remount(filepath);
+  failures += power_cut(filepath, cuts);
+  failures += corrupt(filepath);
+  failures += budget(filepath);
+  failures += bench(filepath, saves);
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,155 @@
+/**
+ * @file reflector_demod.cpp
+ * @brief Host Test of the Reflector Lock-in Demodulation
+ * @author Ryotaro Onuki <kerikun11+github@gmail.com>
+ * @date 2024-02-04
+ * @copyright Copyright 2024 Ryotaro Onuki <kerikun11+github@gmail.com>
+ */
+/*
+ * Reflector::task() と同じ順序とタイミングで合成した ADC の標本を
+ * utils::LockInDemodulator に入れ，1 周期の組の数ごとに出力の偏りと
+ * ばらつきを比べる．
+ *
+ * - 標本 = 外乱光 (直流 + 商用電源のちらつき + 照明の PWM) +
+ *   LED の反射 (点灯中のみ) + ADC の雑音．12 bit に量子化する．
+ * - 区間の始まりからタイマの遅れの後に消灯の値，ADC の変換時間の後に
+ *   点灯の値をとる．2 回の変換が区間に収まらない組の数は試さない．
+ * - LED は点灯の間隔で光量が変わる (コンデンサの充電) ので，誤差は
+ *   その光量に対する値で測る (較正で吸収される)．
+ *
+ * 組が 1 つ (従来) より，既定の組の数で誤差が大きければ失敗で終了する．
+ */
+#include <algorithm>  //< for std::max, std::min
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>  //< for std::atoi, std::atof
+#include <iostream>
+#include <random>
+#include <string>
+
+#include "utils/lock_in_demodulator.hpp"
+
+namespace {
+
+constexpr int kNumChannels = 4;
+constexpr int kPeriodUs = 1000;                     //< 出力の周期 (1 kHz)
+constexpr int kOrder[kNumChannels] = {2, 1, 0, 3};  //< FL SR SL FR
+
+struct Parameter {
+  float adc_us = 20;       //< ADC の 1 回の変換時間 [us]
+  float latency_us = 5;    //< 区間の始まりから消灯の値をとるまで [us]
+  float jitter_us = 5;     //< タイマの遅れのばらつき (一様分布) [us]
+  float noise = 6;         //< ADC の雑音の標準偏差 [LSB]
+  float ambient = 300;     //< 外乱光の直流成分 [LSB]
+  float flicker = 100;     //< 商用電源のちらつきの振幅 [LSB]
+  float flicker_hz = 100;  //< 商用電源のちらつきの周波数 [Hz]
+  float pwm = 30;          //< 照明の PWM の振幅 [LSB]
+  float pwm_hz = 4100;     //< 照明の PWM の周波数 [Hz]
+  float recharge_us = 0;   //< LED のコンデンサの充電の時定数 (0: 理想)
+  int cycles = 20000;      //< 試す周期の数
+};
+
+struct Result {
+  float gain;  //< 点灯の間隔による光量の比
+  float bias;  //< 平均の誤差 [LSB]
+  float rms;   //< 誤差の RMS [LSB]
+};
+
+/**
+ * @brief 1 チャンネルの LED の反射が signal のときの出力の誤差
+ */
+Result run(const Parameter& p, const int pairs, const float signal,
+           std::mt19937& rng) {
+  std::normal_distribution<float> normal(0, 1);
+  std::uniform_real_distribution<float> uniform(0, 1);
+  const float slot_us = float(kPeriodUs) / kNumChannels / pairs;
+  const float gain =
+      p.recharge_us > 0
+          ? 1 - std::exp(-float(kPeriodUs) / pairs / p.recharge_us)
+          : 1;
+  const float phase_flicker = 2 * M_PI * uniform(rng);
+  const float phase_pwm = 2 * M_PI * uniform(rng);
+  auto ambient = [&](const double t_us) {
+    return p.ambient +
+           p.flicker * std::sin(2 * M_PI * p.flicker_hz * t_us * 1e-6 +
+                                phase_flicker) +
+           p.pwm * std::sin(2 * M_PI * p.pwm_hz * t_us * 1e-6 + phase_pwm);
+  };
+  auto adc = [&](const float value) {
+    const float v = std::round(value + p.noise * normal(rng));
+    return int(std::max(0.0f, std::min(v, 4095.0f)));
+  };
+  utils::LockInDemodulator<kNumChannels> demodulator(pairs);
+  double sum = 0, sum2 = 0;
+  int count = 0;
+  for (int c = 0; c < p.cycles; ++c) {
+    for (int s = 0; s < kNumChannels * pairs; ++s) {
+      const int ch = kOrder[s % kNumChannels];
+      const double t0 = double(c) * kPeriodUs + s * slot_us + p.latency_us +
+                        p.jitter_us * uniform(rng);
+      const int offset = adc(ambient(t0));
+      const int peak = adc(ambient(t0 + p.adc_us) + signal * gain);
+      if (!demodulator.push(ch, offset, peak)) continue;
+      const float e = demodulator.value(ch) - signal * gain;
+      sum += e, sum2 += e * e, count++;
+    }
+  }
+  return {gain, float(sum / count), float(std::sqrt(sum2 / count))};
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  /* 引数 */
+  Parameter p;
+  int pairs_default = 5;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const bool has_value = i + 1 < argc;
+    if (arg == "--pairs" && has_value) {
+      pairs_default = std::atoi(argv[++i]);
+    } else if (arg == "--adc-us" && has_value) {
+      p.adc_us = std::atof(argv[++i]);
+    } else if (arg == "--noise" && has_value) {
+      p.noise = std::atof(argv[++i]);
+    } else if (arg == "--flicker" && has_value) {
+      p.flicker = std::atof(argv[++i]);
+    } else if (arg == "--pwm" && has_value) {
+      p.pwm = std::atof(argv[++i]);
+    } else if (arg == "--pwm-hz" && has_value) {
+      p.pwm_hz = std::atof(argv[++i]);
+    } else if (arg == "--recharge-us" && has_value) {
+      p.recharge_us = std::atof(argv[++i]);
+    } else if (arg == "--cycles" && has_value) {
+      p.cycles = std::atoi(argv[++i]);
+    } else {
+      std::cerr << "usage: " << argv[0]
+                << " [--pairs n --adc-us us --noise lsb --flicker lsb"
+                << " --pwm lsb --pwm-hz hz --recharge-us us --cycles n]"
+                << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  /* 組の数は区間 (250 us) の約数 */
+  const int pairs_list[] = {1, 2, 5, 10, 25};
+  const float signals[] = {3, 30, 300};
+  std::mt19937 rng(1);
+  int failures = 0;
+  std::printf("signal [LSB]\tpairs\tslot [us]\tgain\tbias [LSB]\t"
+              "rms [LSB]\n");
+  for (const float signal : signals) {
+    Result single = {}, chosen = {NAN, NAN, NAN};  //< 試せなければ失敗
+    for (const int pairs : pairs_list) {
+      const float slot_us = float(kPeriodUs) / kNumChannels / pairs;
+      if (p.latency_us + p.jitter_us + 2 * p.adc_us > slot_us) continue;
+      const auto r = run(p, pairs, signal, rng);
+      std::printf("%.0f\t%d\t%.1f\t%.3f\t%.3f\t%.3f\n", signal, pairs,
+                  slot_us, r.gain, r.bias, r.rms);
+      if (pairs == 1) single = r;
+      if (pairs == pairs_default) chosen = r;
+    }
+    failures += !(chosen.rms < single.rms);
+  }
+  std::fflush(stdout);
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
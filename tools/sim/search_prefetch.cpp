@@ -0,0 +1,339 @@
+/**
+ * @file search_prefetch.cpp
+ * @brief Benchmark of the Search Prefetch Lead
+ * @author Ryotaro Onuki <kerikun11+github@gmail.com>
+ * @date 2024-02-04
+ * @copyright Copyright 2024 Ryotaro Onuki <kerikun11+github@gmail.com>
+ */
+/*
+ * 探索の先読み (MoveAction::search_prefetch()) の距離を確かめる．
+ *
+ * 1. 読める範囲: シミュレータで区画の中央から境界へ直進し，境界の手前
+ *    d [mm] で WallDetector::getWalls() の横壁を読む．d ごとの誤り率と，
+ *    WallDetector::side_read_lead_max(v) で読んだときの誤り率を出力する．
+ * 2. 32x32 の探索: ランダムな迷路を足立法で探索し，区画ごとの判断
+ *    (既知の壁で歩数マップを作り次の区画を選ぶ) の時間をホストで測る．
+ *    その分布を中央値が --median-ms になるよう縮尺し，境界までに次の
+ *    行動が決まらず減速して待つ (stall) 割合と時間を比べる．
+ *    - none: 先読みなし
+ *    - 5 mm: 制限しない固定の距離 (読める範囲を超えることがある)
+ *    - capped: side_read_lead_max() で制限した現在の距離
+ *
+ * 壁の読み取りはタスクとして動かすので，誤り率はホストの負荷によらない．
+ * 判断の時間はホストの負荷で変わるので，stall は出力するだけとする．
+ * 制限した距離での誤り率が境界で読んだときより 0.5 % 以上大きければ
+ * 失敗で終了する．
+ */
+#include <freertospp/semphr.h>
+
+#include <algorithm>  //< for std::sort, std::min
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>  //< for std::_Exit, std::atoi, std::atof
+#include <iostream>
+#include <queue>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "peripheral/partition.h"
+#include "sim/world.hpp"
+#include "supporters/supporters.h"
+
+namespace {
+
+/* 横壁の誤り率 [%] (雑音を大きくした条件) */
+float side_error(WallDetector* wd, const float v, const float lead,
+                 const int trials) {
+  auto& world = sim::world();
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<float> uniform(0, 1);
+  int errors = 0;
+  for (int i = 0; i < trials; ++i) {
+    /* 北向きに列 1 を進み，区画 (1, 1) の西と東の壁を読む */
+    sim::Field field(3);
+    for (int y = 0; y < 3; ++y) {
+      field.set_wall(1, y, sim::Field::West, uniform(rng) < 0.5f);
+      field.set_wall(1, y, sim::Field::East, uniform(rng) < 0.5f);
+    }
+    field.set_wall(1, 0, sim::Field::North, false);
+    world.set_field(field);
+    /* 横位置と向きのずれ */
+    const float cx = sim::Field::kCell * 3 / 2;
+    const float dx = 6 * (uniform(rng) - 0.5f);
+    const float dth = 0.06f * (uniform(rng) - 0.5f);
+    const float y_end = sim::Field::kCell - lead;
+    for (float y = sim::Field::kCell / 2; y < y_end; y += v * 1e-3f) {
+      world.set_pose(cx + dx, y, M_PI / 2 + dth);
+      vTaskDelay(pdMS_TO_TICKS(1));
+      wd->update();
+    }
+    const auto walls = wd->getWalls();
+    errors += walls.left != field.is_wall(1, 1, sim::Field::West);
+    errors += walls.right != field.is_wall(1, 1, sim::Field::East);
+  }
+  return 100.0f * errors / (2 * trials);
+}
+
+/**
+ * @brief 穴掘り法で作った 32x32 の迷路 (中央の 4 区画がゴール)
+ */
+sim::Field make_maze(const int seed) {
+  constexpr int n = 32;
+  sim::Field field(n);
+  for (int x = 0; x < n; ++x)
+    for (int y = 0; y < n; ++y)
+      for (int d = 0; d < 4; ++d) field.set_wall(x, y, d, true);
+  std::mt19937 rng(seed);
+  std::vector<bool> visited(n * n, false);
+  std::vector<std::pair<int, int>> stack = {{0, 0}};
+  visited[0] = true;
+  const int dx[4] = {1, 0, -1, 0}, dy[4] = {0, 1, 0, -1};
+  while (!stack.empty()) {
+    const auto [x, y] = stack.back();
+    std::vector<int> dirs;
+    for (int d = 0; d < 4; ++d) {
+      const int nx = x + dx[d], ny = y + dy[d];
+      if (nx >= 0 && ny >= 0 && nx < n && ny < n && !visited[ny * n + nx])
+        dirs.push_back(d);
+    }
+    if (dirs.empty()) {
+      stack.pop_back();
+      continue;
+    }
+    const int d = dirs[rng() % dirs.size()];
+    field.set_wall(x, y, d, false);
+    visited[(y + dy[d]) * n + x + dx[d]] = true;
+    stack.push_back({x + dx[d], y + dy[d]});
+  }
+  for (int x = 15; x <= 16; ++x) {
+    for (int y = 15; y <= 16; ++y) field.add_goal(x, y);
+    field.set_wall(x, 15, sim::Field::North, false);
+  }
+  field.set_wall(15, 15, sim::Field::East, false);
+  field.set_wall(15, 16, sim::Field::East, false);
+  return field;
+}
+
+/**
+ * @brief 足立法で探索し，区画ごとの判断の時間 [ns] を返す
+ */
+std::vector<double> search(const sim::Field& maze) {
+  const int n = maze.size();
+  const int dx[4] = {1, 0, -1, 0}, dy[4] = {0, 1, 0, -1};
+  sim::Field known(n);  //< 未知の壁はないものとする
+  std::vector<double> times;
+  std::vector<int> step(n * n);
+  int x = 0, y = 0, dir = sim::Field::North;
+  auto is_goal = [&](const int x, const int y) {
+    for (const auto& g : maze.goals())
+      if (g.first == x && g.second == y) return true;
+    return false;
+  };
+  while (!is_goal(x, y) && times.size() < size_t(16 * n * n)) {
+    /* 壁を読む */
+    for (int d = 0; d < 4; ++d) known.set_wall(x, y, d, maze.is_wall(x, y, d));
+    /* 判断: ゴールからの歩数マップを作り，歩数の少ない隣へ (直進優先) */
+    const auto t0 = std::chrono::steady_clock::now();
+    std::fill(step.begin(), step.end(), n * n);
+    std::queue<std::pair<int, int>> q;
+    for (const auto& g : maze.goals()) {
+      step[g.second * n + g.first] = 0;
+      q.push(g);
+    }
+    while (!q.empty()) {
+      const auto [cx, cy] = q.front();
+      q.pop();
+      for (int d = 0; d < 4; ++d) {
+        if (known.is_wall(cx, cy, d)) continue;
+        const int i = (cy + dy[d]) * n + cx + dx[d];
+        if (step[i] <= step[cy * n + cx] + 1) continue;
+        step[i] = step[cy * n + cx] + 1;
+        q.push({cx + dx[d], cy + dy[d]});
+      }
+    }
+    int next = -1;
+    for (int k = 0; k < 4; ++k) {
+      const int d = (dir + k) % 4;
+      if (known.is_wall(x, y, d)) continue;
+      const int i = (y + dy[d]) * n + x + dx[d];
+      if (next < 0 ||
+          step[i] < step[(y + dy[next]) * n + x + dx[next]])
+        next = d;
+    }
+    const auto t1 = std::chrono::steady_clock::now();
+    times.push_back(std::chrono::duration<double, std::nano>(t1 - t0).count());
+    if (next < 0) break;
+    dir = next, x += dx[dir], y += dy[dir];
+  }
+  return times;
+}
+
+struct Pipeline {
+  int handoffs = 0;
+  int stalls = 0;       //< 境界までに次の行動が決まらなかった数
+  double wait_ms = 0;   //< 境界を過ぎてから待った時間の合計
+  int out_of_range = 0;  //< 読める範囲より手前で読んだ数
+};
+
+/**
+ * @brief 判断の時間の列に対して先読みの距離を試す
+ *
+ * @param lead 先読みの距離 [mm]
+ */
+Pipeline run_pipeline(const std::vector<double>& decision_ms, const float v,
+                      const float read_max, const float lead) {
+  Pipeline p;
+  const double margin_ms = lead / v * 1e3;
+  for (const double t_ms : decision_ms) {
+    p.handoffs++;
+    p.out_of_range += lead > read_max;
+    if (t_ms > margin_ms) p.stalls++, p.wait_ms += t_ms - margin_ms;
+  }
+  return p;
+}
+
+struct Options {
+  int trials = 200;
+  int mazes = 20;
+  float median_ms = 6;  //< 実機の探索器の判断の時間の中央値の仮定
+  std::vector<float> velocities = {330, 600};
+};
+
+struct Measurement {
+  WallDetector* wd;
+  Options options;
+  int failures;
+  freertospp::Semaphore done;
+};
+
+int measure(WallDetector* wd, const Options& o) {
+  auto& world = sim::world();
+  {
+    /* 両側と前に壁のある区画の中央で較正する */
+    sim::Field field(3);
+    for (int y = 0; y < 3; ++y) {
+      field.set_wall(1, y, sim::Field::West, true);
+      field.set_wall(1, y, sim::Field::East, true);
+    }
+    field.set_wall(1, 0, sim::Field::North, true);
+    world.set_field(field);
+    world.set_pose(sim::Field::kCell * 3 / 2, sim::Field::kCell / 2, M_PI / 2);
+    wd->calibration_side();
+    wd->calibration_front();
+  }
+  auto p = world.get_parameter();
+  p.reflector_noise = 0.1f;
+  p.reflector_dropout = 0.02f;
+  world.set_parameter(p);
+  /* 1. 読める範囲 */
+  int failures = 0;
+  std::vector<float> read_max(o.velocities.size());
+  std::printf("v [mm/s]\tlead [mm]\tside error [%%]\n");
+  for (size_t k = 0; k < o.velocities.size(); ++k) {
+    const float v = o.velocities[k];
+    const float e0 = side_error(wd, v, 0, o.trials);
+    for (int d = 0; d <= 12; ++d) {
+      const float e = d ? side_error(wd, v, d, o.trials) : e0;
+      std::printf("%.0f\t%d\t%.2f\n", v, d, e);
+      if (e <= e0 + 0.5f) read_max[k] = d;
+    }
+    const float cap = WallDetector::side_read_lead_max(v);
+    const float e = side_error(wd, v, cap, o.trials);
+    std::printf("%.0f\t%.2f (side_read_lead_max)\t%.2f\n", v, cap, e);
+    failures += e > e0 + 0.5f;
+  }
+  std::fflush(stdout);
+  /* 2. 32x32 の探索 */
+  std::vector<double> host_ns;
+  std::vector<std::vector<double>> runs;
+  for (int seed = 0; seed < o.mazes; ++seed) {
+    runs.push_back(search(make_maze(seed)));
+    host_ns.insert(host_ns.end(), runs.back().begin(), runs.back().end());
+  }
+  std::sort(host_ns.begin(), host_ns.end());
+  const double host_median = host_ns[host_ns.size() / 2];
+  const double scale = o.median_ms / host_median;  //< [ms/ns]
+  std::printf("\nmazes: %d\thandoffs: %d\thost decision [us] median: %.1f"
+              "\tp99: %.1f\tmax: %.1f\n",
+              o.mazes, int(host_ns.size()), host_median * 1e-3,
+              host_ns[host_ns.size() * 99 / 100] * 1e-3,
+              host_ns.back() * 1e-3);
+  std::printf("v [mm/s]\tpolicy\tstalls [%%]\twait [ms/handoff]\t"
+              "out of range [%%]\n");
+  for (size_t k = 0; k < o.velocities.size(); ++k) {
+    const float v = o.velocities[k];
+    /* MoveAction::search_prefetch() と同じ距離 */
+    const float capped = std::min(5.0f, WallDetector::side_read_lead_max(v));
+    Pipeline results[3];
+    for (const auto& run : runs) {
+      std::vector<double> ms(run.size());
+      for (size_t i = 0; i < run.size(); ++i) ms[i] = run[i] * scale;
+      const Pipeline r[3] = {run_pipeline(ms, v, read_max[k], 0),
+                             run_pipeline(ms, v, read_max[k], 5),
+                             run_pipeline(ms, v, read_max[k], capped)};
+      for (int j = 0; j < 3; ++j) {
+        results[j].handoffs += r[j].handoffs;
+        results[j].stalls += r[j].stalls;
+        results[j].wait_ms += r[j].wait_ms;
+        results[j].out_of_range += r[j].out_of_range;
+      }
+    }
+    const char* names[3] = {"none", "5 mm", "capped"};
+    for (int j = 0; j < 3; ++j) {
+      const auto& r = results[j];
+      std::printf("%.0f\t%s\t%.1f\t%.2f\t%.1f\n", v, names[j],
+                  100.0 * r.stalls / r.handoffs, r.wait_ms / r.handoffs,
+                  100.0 * r.out_of_range / r.handoffs);
+    }
+  }
+  std::fflush(stdout);
+  return failures;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  /* 引数 */
+  Options o;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const bool has_value = i + 1 < argc;
+    if (arg == "--trials" && has_value) {
+      o.trials = std::atoi(argv[++i]);
+    } else if (arg == "--mazes" && has_value) {
+      o.mazes = std::atoi(argv[++i]);
+    } else if (arg == "--median-ms" && has_value) {
+      o.median_ms = std::atof(argv[++i]);
+    } else if (arg == "--velocity" && has_value) {
+      o.velocities = {float(std::atof(argv[++i]))};
+    } else {
+      std::cerr << "usage: " << argv[0]
+                << " [--trials n --mazes n --median-ms ms --velocity mm/s]"
+                << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  /* 機体 (シミュレータのリフレクタに合わせ，update() を直接呼ぶ) */
+  config::parameter_store().set("ref_max_length_mm", "90");
+  config::parameter_store().set("ref_saturation_value", "3600");
+  peripheral::record_store().mount();
+  auto* hw = new hardware::Hardware();
+  hw->init();
+  auto* sp = new supporters::Supporters(hw);
+  /* 計測は仮想時刻の順番を守るタスクで動かす */
+  auto* m = new Measurement{sp->wd, o, 0, {}};
+  xTaskCreatePinnedToCore(
+      [](void* arg) {
+        auto* m = static_cast<Measurement*>(arg);
+        m->failures = measure(m->wd, m->options);
+        m->done.give();
+        vTaskDelete(NULL);
+      },
+      "Measure", 8192, m, TASK_PRIORITY_MOVE_ACTION, NULL,
+      TASK_CORE_ID_MOVE_ACTION);
+  m->done.take();
+  /* タスクは終わらないので後始末をせずに終了する */
+  std::_Exit(m->failures ? EXIT_FAILURE : EXIT_SUCCESS);
+}
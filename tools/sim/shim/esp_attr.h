@@ -0,0 +1,10 @@
+/**
+ * @file esp_attr.h
+ * @brief ESP-IDF Attribute Shim for the Host Simulator
+ * @author Ryotaro Onuki <kerikun11+github@gmail.com>
+ * @date 2024-02-04
+ * @copyright Copyright 2024 Ryotaro Onuki <kerikun11+github@gmail.com>
+ */
+#pragma once
+
+#define IRAM_ATTR
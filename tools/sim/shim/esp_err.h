@@ -0,0 +1,29 @@
+/**
+ * @file esp_err.h
+ * @brief ESP-IDF Error Code Shim for the Host Simulator
+ * @author Ryotaro Onuki <kerikun11+github@gmail.com>
+ * @date 2024-02-04
+ * @copyright Copyright 2024 Ryotaro Onuki <kerikun11+github@gmail.com>
+ */
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+
+typedef int esp_err_t;
+
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_INVALID_ARG 0x102
+#define ESP_ERR_INVALID_STATE 0x103
+#define ESP_ERR_INVALID_SIZE 0x104
+
+#define ESP_ERROR_CHECK(x)                                             \
+  do {                                                                 \
+    const esp_err_t err_rc_ = (x);                                     \
+    if (err_rc_ != ESP_OK) {                                           \
+      std::fprintf(stderr, "ESP_ERROR_CHECK failed: 0x%x %s:%d\n",     \
+                   err_rc_, __FILE__, __LINE__);                       \
+      std::abort();                                                    \
+    }                                                                  \
+  } while (0)
@@ -0,0 +1,18 @@
+/**
+ * @file esp_log.h
+ * @brief ESP-IDF Log Shim for the Host Simulator
+ * @author Ryotaro Onuki <kerikun11+github@gmail.com>
+ * @date 2024-02-04
+ * @copyright Copyright 2024 Ryotaro Onuki <kerikun11+github@gmail.com>
+ */
+#pragma once
+
+#include <cstdio>
+
+#define ESP_LOG_BASE(l, tag, fmt, ...) \
+  std::fprintf(stdout, l " (%s) " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGE(tag, fmt, ...) ESP_LOG_BASE("E", tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) ESP_LOG_BASE("W", tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGI(tag, fmt, ...) ESP_LOG_BASE("I", tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGD(tag, fmt, ...)
+#define ESP_LOGV(tag, fmt, ...)
@@ -0,0 +1,79 @@
+/**
+ * @file esp_partition.h
+ * @brief ESP-IDF Partition Shim for the Host Simulator
+ * @author Ryotaro Onuki <kerikun11+github@gmail.com>
+ * @date 2024-02-04
+ * @copyright Copyright 2024 Ryotaro Onuki <kerikun11+github@gmail.com>
+ */
+#pragma once
+
+#include <esp_err.h>
+
+#include <algorithm>  //< for std::fill
+#include <cstdint>
+#include <cstring>  //< for std::strcmp
+#include <mutex>
+#include <vector>
+
+typedef enum {
+  ESP_PARTITION_TYPE_APP = 0x00,
+  ESP_PARTITION_TYPE_DATA = 0x01,
+} esp_partition_type_t;
+typedef enum {
+  ESP_PARTITION_SUBTYPE_ANY = 0xff,
+} esp_partition_subtype_t;
+
+/**
+ * @brief メモリ上のパーティション (NOR フラッシュと同じく書き込みは 1 を 0 に
+ * するだけ)
+ */
+typedef struct {
+  const char* label;
+  uint32_t size;
+  std::vector<uint8_t>* data;
+} esp_partition_t;
+
+namespace sim {
+/* partitions.csv のうち，ファームウェアが生で読み書きするもの */
+inline std::vector<esp_partition_t>& partitions() {
+  static std::vector<esp_partition_t> partitions = {
+      {"records", 0x10000, new std::vector<uint8_t>(0x10000, 0xFF)},
+  };
+  return partitions;
+}
+inline std::mutex& partition_mutex() {
+  static std::mutex mutex;
+  return mutex;
+}
+}  // namespace sim
+
+inline const esp_partition_t* esp_partition_find_first(
+    esp_partition_type_t /* type */, esp_partition_subtype_t /* subtype */,
+    const char* label) {
+  for (const auto& p : sim::partitions())
+    if (label && std::strcmp(p.label, label) == 0) return &p;
+  return nullptr;
+}
+inline esp_err_t esp_partition_read(const esp_partition_t* p, size_t offset,
+                                    void* dst, size_t size) {
+  if (!p || offset + size > p->size) return ESP_ERR_INVALID_SIZE;
+  std::lock_guard<std::mutex> lock_guard(sim::partition_mutex());
+  std::memcpy(dst, p->data->data() + offset, size);
+  return ESP_OK;
+}
+inline esp_err_t esp_partition_write(const esp_partition_t* p, size_t offset,
+                                     const void* src, size_t size) {
+  if (!p || offset + size > p->size) return ESP_ERR_INVALID_SIZE;
+  std::lock_guard<std::mutex> lock_guard(sim::partition_mutex());
+  const auto* bytes = static_cast<const uint8_t*>(src);
+  for (size_t i = 0; i < size; ++i) (*p->data)[offset + i] &= bytes[i];
+  return ESP_OK;
+}
+inline esp_err_t esp_partition_erase_range(const esp_partition_t* p,
+                                           size_t offset, size_t size) {
+  if (!p || offset + size > p->size || offset % 4096 || size % 4096)
+    return ESP_ERR_INVALID_ARG;
+  std::lock_guard<std::mutex> lock_guard(sim::partition_mutex());
+  std::fill(p->data->begin() + offset, p->data->begin() + offset + size, 0xFF);
+  return ESP_OK;
+}
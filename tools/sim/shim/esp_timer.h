@@ -0,0 +1,58 @@
+/**
+ * @file esp_timer.h
+ * @brief ESP-IDF High Resolution Timer Shim for the Host Simulator
+ * @author Ryotaro Onuki <kerikun11+github@gmail.com>
+ * @date 2024-02-04
+ * @copyright Copyright 2024 Ryotaro Onuki <kerikun11+github@gmail.com>
+ */
+#pragma once
+
+#include <esp_err.h>
+
+#include <cstdint>
+
+#include "sim/kernel.hpp"
+
+typedef void (*esp_timer_cb_t)(void* arg);
+typedef sim::Kernel::Timer* esp_timer_handle_t;
+typedef enum {
+  ESP_TIMER_TASK,
+  ESP_TIMER_ISR,
+} esp_timer_dispatch_t;
+typedef struct {
+  esp_timer_cb_t callback;
+  void* arg;
+  esp_timer_dispatch_t dispatch_method;
+  const char* name;
+  bool skip_unhandled_events;
+} esp_timer_create_args_t;
+
+/**
+ * @brief 仮想時刻 [us]
+ */
+inline int64_t esp_timer_get_time() { return sim::Kernel::get().now_us(); }
+inline esp_err_t esp_timer_create(const esp_timer_create_args_t* args,
+                                  esp_timer_handle_t* handle) {
+  const auto callback = args->callback;
+  const auto arg = args->arg;
+  *handle = sim::Kernel::get().create_timer([=] { callback(arg); });
+  return ESP_OK;
+}
+inline esp_err_t esp_timer_start_periodic(esp_timer_handle_t handle,
+                                          uint64_t period_us) {
+  sim::Kernel::get().start_timer(handle, period_us, true);
+  return ESP_OK;
+}
+inline esp_err_t esp_timer_start_once(esp_timer_handle_t handle,
+                                      uint64_t timeout_us) {
+  sim::Kernel::get().start_timer(handle, timeout_us, false);
+  return ESP_OK;
+}
+inline esp_err_t esp_timer_stop(esp_timer_handle_t handle) {
+  sim::Kernel::get().stop_timer(handle);
+  return ESP_OK;
+}
+inline esp_err_t esp_timer_delete(esp_timer_handle_t handle) {
+  sim::Kernel::get().delete_timer(handle);
+  return ESP_OK;
+}
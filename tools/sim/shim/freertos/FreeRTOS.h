@@ -0,0 +1,31 @@
+/**
+ * @file FreeRTOS.h
+ * @brief FreeRTOS Shim for the Host Simulator
+ * @author Ryotaro Onuki <kerikun11+github@gmail.com>
+ * @date 2024-02-04
+ * @copyright Copyright 2024 Ryotaro Onuki <kerikun11+github@gmail.com>
+ */
+#pragma once
+
+#include <esp_attr.h>
+#include <esp_err.h>
+
+#include <cstdint>
+
+#include "sim/kernel.hpp"
+
+/* 1 tick = 1 ms */
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdPASS pdTRUE
+#define pdFAIL pdFALSE
+#define portMAX_DELAY ((TickType_t)0xFFFFFFFF)
+#define portTICK_PERIOD_MS 1
+#define configTICK_RATE_HZ 1000
+#define configMINIMAL_STACK_SIZE 768
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define tskNO_AFFINITY 0x7FFFFFFF
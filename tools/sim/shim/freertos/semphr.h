@@ -0,0 +1,54 @@
+/**
+ * @file semphr.h
+ * @brief FreeRTOS Semaphore Shim for the Host Simulator
+ * @author Ryotaro Onuki <kerikun11+github@gmail.com>
+ * @date 2024-02-04
+ * @copyright Copyright 2024 Ryotaro Onuki <kerikun11+github@gmail.com>
+ */
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+/**
+ * @brief セマフォ (値はカーネルのロックの中で読み書きする)
+ */
+struct SimSemaphore {
+  UBaseType_t count;
+  UBaseType_t max_count;
+};
+typedef SimSemaphore* SemaphoreHandle_t;
+
+inline SemaphoreHandle_t xSemaphoreCreateBinary() {
+  return new SimSemaphore{0, 1};
+}
+inline SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max_count,
+                                                  UBaseType_t initial_count) {
+  return new SimSemaphore{initial_count, max_count};
+}
+inline SemaphoreHandle_t xSemaphoreCreateMutex() {
+  return new SimSemaphore{1, 1};
+}
+inline void vSemaphoreDelete(SemaphoreHandle_t semaphore) { delete semaphore; }
+inline BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore,
+                                 const TickType_t ticks) {
+  const bool taken = sim::Kernel::get().wait(
+      [semaphore] {
+        if (semaphore->count == 0) return false;
+        semaphore->count--;
+        return true;
+      },
+      sim::deadline_of(ticks));
+  return taken ? pdTRUE : pdFALSE;
+}
+inline BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+  bool given = false;
+  sim::Kernel::get().modify([&] {
+    if (semaphore->count < semaphore->max_count)
+      semaphore->count++, given = true;
+  });
+  return given ? pdTRUE : pdFALSE;
+}
+inline BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t semaphore,
+                                        BaseType_t* /* woken */) {
+  return xSemaphoreGive(semaphore);
+}
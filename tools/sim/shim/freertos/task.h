@@ -0,0 +1,96 @@
+/**
+ * @file task.h
+ * @brief FreeRTOS Task Shim for the Host Simulator
+ * @author Ryotaro Onuki <kerikun11+github@gmail.com>
+ * @date 2024-02-04
+ * @copyright Copyright 2024 Ryotaro Onuki <kerikun11+github@gmail.com>
+ */
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+typedef void (*TaskFunction_t)(void*);
+
+/**
+ * @brief タスク (通知の値だけを持つ)
+ */
+struct SimTask {
+  uint32_t notification = 0;
+};
+typedef SimTask* TaskHandle_t;
+
+namespace sim {
+inline TaskHandle_t& current_task() {
+  thread_local TaskHandle_t task = nullptr;
+  return task;
+}
+}  // namespace sim
+
+inline BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function,
+                                          const char* /* name */,
+                                          uint32_t /* stack_depth */,
+                                          void* arg, UBaseType_t priority,
+                                          TaskHandle_t* handle,
+                                          BaseType_t /* core_id */) {
+  auto* task = new SimTask();
+  if (handle) *handle = task;
+  sim::Kernel::get().spawn(
+      [function, arg, task] {
+        sim::current_task() = task;
+        function(arg);
+      },
+      priority);
+  return pdPASS;
+}
+inline BaseType_t xTaskCreate(TaskFunction_t function, const char* name,
+                              uint32_t stack_depth, void* arg,
+                              UBaseType_t priority, TaskHandle_t* handle) {
+  return xTaskCreatePinnedToCore(function, name, stack_depth, arg, priority,
+                                 handle, tskNO_AFFINITY);
+}
+inline TickType_t xTaskGetTickCount() {
+  return sim::Kernel::get().now_us() / 1000;
+}
+inline void vTaskDelay(const TickType_t ticks) {
+  /* FreeRTOS と同じく tick の境界で起きる */
+  const uint64_t deadline_us = (uint64_t(xTaskGetTickCount()) + ticks) * 1000;
+  sim::Kernel::get().wait([] { return false; }, deadline_us);
+}
+inline void vTaskDelayUntil(TickType_t* previous_wake_time,
+                            const TickType_t increment) {
+  *previous_wake_time += increment;
+  sim::Kernel::get().wait([] { return false; },
+                          uint64_t(*previous_wake_time) * 1000);
+}
+/**
+ * @brief 同じ時刻に動けるタスクに順番を譲る
+ */
+inline void taskYIELD() {
+  sim::Kernel::get().wait([] { return true; }, 0);
+}
+/**
+ * @brief 自分自身の削除だけに対応する (以後ずっと待つ)
+ */
+inline void vTaskDelete(TaskHandle_t task) {
+  if (task && task != sim::current_task()) return;
+  while (1)
+    sim::Kernel::get().wait([] { return false; }, sim::Kernel::kForever);
+}
+inline BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+  sim::Kernel::get().modify([task] { task->notification++; });
+  return pdPASS;
+}
+inline uint32_t ulTaskNotifyTake(const BaseType_t clear_on_exit,
+                                 const TickType_t ticks) {
+  auto* task = sim::current_task();
+  uint32_t value = 0;
+  sim::Kernel::get().wait(
+      [&] {
+        if (!task || task->notification == 0) return false;
+        value = task->notification;
+        task->notification = clear_on_exit ? 0 : task->notification - 1;
+        return true;
+      },
+      sim::deadline_of(ticks));
+  return value;
+}
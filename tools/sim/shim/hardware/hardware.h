@@ -0,0 +1,258 @@
+/**
+ * @file hardware.h
+ * @brief Simulated Hardware for the Host Simulator
+ * @author Ryotaro Onuki <kerikun11+github@gmail.com>
+ * @date 2024-02-04
+ * @copyright Copyright 2024 Ryotaro Onuki <kerikun11+github@gmail.com>
+ *
+ * src/hardware/hardware.h の代わりに読み込まれ，同じ名前と使い方のクラスを
+ * sim::World の上に実装する．
+ */
+#pragma once
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <algorithm>  //< for std::max, std::min
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <mutex>
+
+#include "app_log.h"
+#include "config/model.h"
+#include "config/parameters.h"
+#include "sim/world.hpp"
+#include "utils/motion_parameter.h"
+#include "utils/wheel_position.h"
+
+namespace hardware {
+
+class Buzzer {
+ public:
+  enum Music : uint8_t {
+    SELECT,
+    CANCEL,
+    CONFIRM,
+    SUCCESSFUL,
+    ERROR,
+    UP,
+    DOWN,
+    COMPLETE,
+    BOOT,
+    SHUTDOWN,
+    TIMEOUT,
+    EMERGENCY,
+    MAZE_BACKUP,
+    MAZE_RESTORE,
+    CALIBRATION,
+    AEBS,
+    SHORT6,
+    SHORT7,
+    SHORT8,
+    SHORT9,
+  };
+
+ public:
+  /* 鳴らした回数を数えるだけ (走行の判定に使う) */
+  void play(const enum Music music, TickType_t = 0) { counts_[music]++; }
+  int count(const enum Music music) const { return counts_[music]; }
+
+ private:
+  std::atomic<int> counts_[SHORT9 + 1] = {};
+};
+
+class LED {
+ public:
+  uint8_t set(uint8_t new_value) { return value_ = new_value; }
+  uint8_t get() const { return value_; }
+
+ private:
+  std::atomic<uint8_t> value_{0};
+};
+
+class Motor {
+ private:
+  static constexpr float kEmergencyThreshold = 1.3f;
+
+ public:
+  Motor() {
+    /* 壁に衝突したら実機の暴走検知と同じく非常停止にする */
+    sim::world().set_crash_handler([this] { emergency_ = true; });
+  }
+  void drive(float valueL, float valueR) {
+    if (emergency_) return;
+    sim::world().set_duty(valueL, valueR);
+    if (std::abs(valueL) > kEmergencyThreshold ||
+        std::abs(valueR) > kEmergencyThreshold)
+      emergency_stop();
+  }
+  void free() { sim::world().set_duty(0, 0); }
+  void emergency_stop() {
+    emergency_ = true;
+    free();
+  }
+  void emergency_release() {
+    emergency_ = false;
+    free();
+  }
+  bool is_emergency() const { return emergency_; }
+
+ private:
+  std::atomic<bool> emergency_{false};
+};
+
+class Fan {
+ public:
+  void drive(float duty) { sim::world().set_fan_duty(duty); }
+  void free() { drive(0); }
+};
+
+class Button {
+ public:
+  union {
+    uint8_t flags = 0; /**< all flags */
+    struct {
+      uint8_t pressed : 1;         /**< pressed */
+      uint8_t long_pressed_1 : 1;  /**< long-pressed level 1 */
+      uint8_t long_pressed_2 : 1;  /**< long-pressed level 2 */
+      uint8_t long_pressed_3 : 1;  /**< long-pressed level 3 */
+      uint8_t pressing : 1;        /**< pressing */
+      uint8_t long_pressing_1 : 1; /**< long-pressing level 1 */
+      uint8_t long_pressing_2 : 1; /**< long-pressing level 2 */
+      uint8_t long_pressing_3 : 1; /**< long-pressing level 3 */
+    };
+  };
+};
+
+class IMU {
+ public:
+  void calibration() {}
+  float get_bias_confidence() const { return 1.0f; }
+  void set_wheel_stationary(const bool) {}
+  void sampling_request() {}
+  void sampling_wait(TickType_t = portMAX_DELAY) const {}
+  float get_accel() const { return sim::world().get_sample().accel; }
+  float get_gyro() const { return sim::world().get_sample().gyro; }
+  float get_angular_accel() const {
+    return sim::world().get_sample().angular_accel;
+  }
+  const MotionParameter get_gyro3() const { return {0, 0, get_gyro()}; }
+  const MotionParameter get_accel3() const { return {0, get_accel(), 0}; }
+};
+
+class Encoder {
+ public:
+  float get_position(uint8_t ch) {
+    return sim::world().get_sample().wheel_position[ch];
+  }
+  WheelPosition get_wheel_position() {
+    const auto wp = sim::world().get_sample().wheel_position;
+    return {{wp[0], wp[1]}};
+  }
+  void clear_offset() {}
+  void sampling_request() {}
+  void sampling_wait(TickType_t = portMAX_DELAY) const {}
+};
+
+class Reflector {
+ public:
+  static constexpr int kNumChannels = 4;  //< SL SR FL FR
+
+ public:
+  int16_t side(const uint8_t ch) const { return read(ch); }
+  int16_t front(const uint8_t ch) const { return read(ch + 2); }
+  int16_t read(const uint8_t ch) const {
+    return sim::world().get_reflector(ch);
+  }
+  void print() {
+    APP_LOGI("Reflector: %4d %4d %4d %4d", read(0), read(1), read(2), read(3));
+  }
+};
+
+class ToF {
+ public:
+  ToF() {
+    set_reference_range(model::tof_raw_range_90, model::tof_raw_range_180);
+  }
+  void set_reference_range(const float range_90mm, const float range_180mm) {
+    std::lock_guard<std::mutex> lock_guard(mutex_);
+    r90_ = range_90mm, r180_ = range_180mm;
+  }
+  void enable() { sim::world().set_tof_enabled(true); }
+  void disable() { sim::world().set_tof_enabled(false); }
+  uint16_t getDistance() const {
+    /* 生の値から実機と同じ 2 点の直線で換算する */
+    const float range = getRangeRaw();
+    std::lock_guard<std::mutex> lock_guard(mutex_);
+    return (180.0f - 90.0f) / (r180_ - r90_) * (range - r90_) + 90;
+  }
+  uint16_t getRangeRaw() const {
+    float distance;
+    uint32_t passed_ms;
+    sim::world().get_tof(distance, passed_ms);
+    std::lock_guard<std::mutex> lock_guard(mutex_);
+    const float range = r90_ + (distance - 90) * (r180_ - r90_) / 90;
+    return distance >= 255 ? 255 : std::max(0.0f, std::min(range, 254.0f));
+  }
+  uint32_t passedTimeMs() const {
+    float distance;
+    uint32_t passed_ms;
+    sim::world().get_tof(distance, passed_ms);
+    return passed_ms;
+  }
+  bool isValid() const { return passedTimeMs() < 30; }
+  void print() const {
+    APP_LOGI("range_: %3d [mm] D: %3d [mm] Passed: %4u [ms]", getRangeRaw(),
+             getDistance(), passedTimeMs());
+  }
+
+ private:
+  mutable std::mutex mutex_;
+  float r90_, r180_;
+};
+
+class Hardware {
+ public:
+  /* Driver */
+  Buzzer* bz;
+  LED* led;
+  Motor* mt;
+  Fan* fan;
+  /* Sensor */
+  Button* btn;
+  IMU* imu;
+  Encoder* enc;
+  Reflector* rfl;
+  ToF* tof;
+
+ public:
+  Hardware() {}
+  bool init() {
+    bz = new Buzzer();
+    btn = new Button();
+    led = new LED();
+    imu = new IMU();
+    enc = new Encoder();
+    rfl = new Reflector();
+    tof = new ToF();
+    config::parameter_store().add_listener([this](const auto& p) {
+      tof->set_reference_range(p.tof_raw_range_90, p.tof_raw_range_180);
+    });
+    mt = new Motor();
+    fan = new Fan();
+    return true;
+  }
+  void sampling_request() { sim::world().sample(); }
+  void sampling_wait() {}
+  float calibration() { return imu->get_bias_confidence(); }
+  static float getBatteryVoltage() {
+    return sim::world().get_battery_voltage();
+  }
+  void batteryLedIndicate(const float) {}
+  bool batteryCheck() { return true; }
+};
+
+}  // namespace hardware
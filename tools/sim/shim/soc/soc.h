@@ -0,0 +1,11 @@
+/**
+ * @file soc.h
+ * @brief ESP32 SoC Definition Shim for the Host Tools
+ * @author Ryotaro Onuki <kerikun11+github@gmail.com>
+ * @date 2024-02-04
+ * @copyright Copyright 2024 Ryotaro Onuki <kerikun11+github@gmail.com>
+ */
+#pragma once
+
+#define PRO_CPU_NUM 0
+#define APP_CPU_NUM 1
@@ -0,0 +1,190 @@
+/**
+ * @file field.hpp
+ * @brief Maze Field Geometry for the Host Simulator
+ * @author Ryotaro Onuki <kerikun11+github@gmail.com>
+ * @date 2024-02-04
+ * @copyright Copyright 2024 Ryotaro Onuki <kerikun11+github@gmail.com>
+ */
+#pragma once
+
+#include <algorithm>  //< for std::min, std::max, std::min_element
+#include <cmath>
+#include <istream>
+#include <limits>
+#include <string>
+#include <utility>  //< for std::pair
+#include <vector>
+
+#include "config/field.h"
+
+namespace sim {
+
+/**
+ * @brief 迷路の壁の配置と，その幾何 (光線との交差，機体との接触)
+ *
+ * 座標は区画 (0, 0) の左下の柱の中心を原点とし，x を東，y を北にとる [mm]．
+ * 壁と柱は厚さ kWallThickness の長方形で，柱は常にある．
+ */
+class Field {
+ public:
+  enum Direction { East, North, West, South };
+  static constexpr float kCell = field::kCellLengthFull;
+  static constexpr float kHalfWall = field::kWallThickness / 2;
+
+ public:
+  explicit Field(const int size = 0) { resize(size); }
+  void resize(const int size) {
+    size_ = size;
+    east_.assign(size * size, false);
+    north_.assign(size * size, false);
+    goals_.clear();
+  }
+  int size() const { return size_; }
+  /**
+   * @brief 壁があるか (迷路の外周と外側は常に壁)
+   */
+  bool is_wall(int x, int y, int d) const {
+    if (d == West) x--, d = East;
+    if (d == South) y--, d = North;
+    if (d == East && (x < 0 || x >= size_ - 1)) return true;
+    if (d == North && (y < 0 || y >= size_ - 1)) return true;
+    if (x < 0 || y < 0 || x >= size_ || y >= size_) return true;
+    return (d == East ? east_ : north_)[y * size_ + x];
+  }
+  void set_wall(int x, int y, int d, const bool b) {
+    if (d == West) x--, d = East;
+    if (d == South) y--, d = North;
+    if (x < 0 || y < 0 || x >= size_ || y >= size_) return;
+    (d == East ? east_ : north_)[y * size_ + x] = b;
+  }
+  const std::vector<std::pair<int, int>>& goals() const { return goals_; }
+  void add_goal(const int x, const int y) { goals_.push_back({x, y}); }
+  /**
+   * @brief 迷路のテキスト形式を読む
+   *
+   * "+---+" の行が横の壁，"|   |" の行が縦の壁を表す．上の行が北．
+   * 区画の中央の文字が 'G' ならゴール．
+   */
+  bool parse(std::istream& is) {
+    std::vector<std::string> lines;
+    for (std::string line; std::getline(is, line);) {
+      if (!line.empty() && line.back() == '\r') line.pop_back();
+      if (!line.empty()) lines.push_back(line);
+    }
+    if (lines.empty() || lines[0].size() < 5) return false;
+    const int size = (lines[0].size() - 1) / 4;
+    if (int(lines.size()) != 2 * size + 1) return false;
+    resize(size);
+    auto at = [&](const int row, const int col) {
+      return col < int(lines[row].size()) ? lines[row][col] : ' ';
+    };
+    for (int y = 0; y < size; ++y) {
+      const int row_north = 2 * (size - 1 - y);
+      const int row_cell = row_north + 1;
+      for (int x = 0; x < size; ++x) {
+        set_wall(x, y, North, at(row_north, 4 * x + 2) != ' ');
+        set_wall(x, y, East, at(row_cell, 4 * x + 4) != ' ');
+        if (at(row_cell, 4 * x + 2) == 'G') goals_.push_back({x, y});
+      }
+    }
+    return true;
+  }
+  /**
+   * @brief 光線が壁または柱に当たるまでの距離
+   *
+   * @return max_range 範囲内で当たらない
+   */
+  float ray_cast(const float x, const float y, const float th,
+                 const float max_range) const {
+    const float dx = std::cos(th), dy = std::sin(th);
+    float hit = max_range;
+    for_each_box(x, y, x + dx * max_range, y + dy * max_range,
+                 [&](const Box& b) {
+                   const float t = b.intersect(x, y, dx, dy);
+                   if (t >= 0) hit = std::min(hit, t);
+                 });
+    return hit;
+  }
+  /**
+   * @brief 半径 r の円 (機体) が最も深く入り込んだ壁を調べる
+   *
+   * @param nx, ny 壁から円の中心へ向かう単位ベクトル
+   * @return 入り込んだ深さ [mm] (0: 接触なし)
+   */
+  float collide(const float x, const float y, const float r, float& nx,
+                float& ny) const {
+    float depth = 0;
+    for_each_box(x - r, y - r, x + r, y + r, [&](const Box& b) {
+      const float cx = std::max(b.x0, std::min(x, b.x1));
+      const float cy = std::max(b.y0, std::min(y, b.y1));
+      const float d = std::hypot(x - cx, y - cy);
+      if (d >= r || r - d <= depth) return;
+      depth = r - d;
+      if (d > 0) {
+        nx = (x - cx) / d, ny = (y - cy) / d;
+      } else {
+        /* 中心が壁の中にある場合は，近い方の辺から外へ押し出す */
+        const float e[4] = {x - b.x0, b.x1 - x, y - b.y0, b.y1 - y};
+        const int k = std::min_element(e, e + 4) - e;
+        const float n[4][2] = {{-1, 0}, {1, 0}, {0, -1}, {0, 1}};
+        nx = n[k][0], ny = n[k][1];
+        depth = r + e[k];
+      }
+    });
+    return depth;
+  }
+
+ private:
+  struct Box {
+    float x0, y0, x1, y1;
+    /* 光線との交差 (slab 法)．当たらなければ負の値 */
+    float intersect(const float x, const float y, const float dx,
+                    const float dy) const {
+      constexpr float inf = std::numeric_limits<float>::infinity();
+      float t_min = 0, t_max = inf;
+      const float o[2] = {x, y}, d[2] = {dx, dy};
+      const float lo[2] = {x0, y0}, hi[2] = {x1, y1};
+      for (int i = 0; i < 2; ++i) {
+        if (std::abs(d[i]) < 1e-9f) {
+          if (o[i] < lo[i] || o[i] > hi[i]) return -1;
+          continue;
+        }
+        float t0 = (lo[i] - o[i]) / d[i], t1 = (hi[i] - o[i]) / d[i];
+        if (t0 > t1) std::swap(t0, t1);
+        t_min = std::max(t_min, t0), t_max = std::min(t_max, t1);
+        if (t_min > t_max) return -1;
+      }
+      return t_min;
+    }
+  };
+  int size_ = 0;
+  std::vector<bool> east_;   //< 区画の東の壁
+  std::vector<bool> north_;  //< 区画の北の壁
+  std::vector<std::pair<int, int>> goals_;
+
+  /**
+   * @brief 範囲 (x0, y0)-(x1, y1) の近くにある柱と壁を列挙する
+   */
+  template <typename F>
+  void for_each_box(const float x0, const float y0, const float x1,
+                    const float y1, F f) const {
+    const int i0 = std::floor(std::min(x0, x1) / kCell) - 1;
+    const int i1 = std::floor(std::max(x0, x1) / kCell) + 1;
+    const int j0 = std::floor(std::min(y0, y1) / kCell) - 1;
+    const int j1 = std::floor(std::max(y0, y1) / kCell) + 1;
+    const float w = kHalfWall;
+    for (int i = std::max(i0, 0); i <= std::min(i1, size_); ++i) {
+      for (int j = std::max(j0, 0); j <= std::min(j1, size_); ++j) {
+        const float px = i * kCell, py = j * kCell;
+        f(Box{px - w, py - w, px + w, py + w});  //< 柱
+        /* 柱 (i, j) の北と東に伸びる壁 */
+        if (j < size_ && is_wall(i, j, West))
+          f(Box{px - w, py + w, px + w, py + kCell - w});
+        if (i < size_ && is_wall(i, j, South))
+          f(Box{px + w, py - w, px + kCell - w, py + w});
+      }
+    }
+  }
+};
+
+}  // namespace sim
@@ -0,0 +1,252 @@
+/**
+ * @file kernel.hpp
+ * @brief Virtual Time Kernel for the Host Simulator
+ * @author Ryotaro Onuki <kerikun11+github@gmail.com>
+ * @date 2024-02-04
+ * @copyright Copyright 2024 Ryotaro Onuki <kerikun11+github@gmail.com>
+ */
+#pragma once
+
+#include <algorithm>  //< for std::min
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace sim {
+
+/**
+ * @brief 仮想時刻で FreeRTOS のタスクを動かすカーネル
+ *
+ * タスクは std::thread で動かすが，同時に動かすのは 1 つだけで，
+ * 待ち (vTaskDelay やセマフォ) から起こすときは優先度の高い順に選ぶ．
+ * 全てのタスクが待ちに入ったら，時刻を次の起床時刻まで一気に進める．
+ * よって実時間より速く進み，同じ入力なら同じ結果になる．
+ *
+ * std::condition_variable などカーネルの外で待っているタスクは区別できない．
+ * 実時間で grace_us の間なにも起きなければ，そのタスクは止まっているとみなして
+ * 先に進める．
+ * タスクとして登録していないスレッド (main など) は順番を待たずに動く．
+ */
+class Kernel {
+ public:
+  static constexpr uint64_t kForever = std::numeric_limits<uint64_t>::max();
+  /* 時刻を dt_us だけ進める前に呼ぶ関数 (物理モデルの更新) */
+  using Step = std::function<void(uint64_t now_us, uint64_t dt_us)>;
+  struct Timer {
+    std::function<void()> callback;
+    uint64_t next_us = kForever;  //< 次に呼ぶ時刻
+    uint64_t period_us = 0;       //< 0: 1 回だけ
+  };
+
+ public:
+  static Kernel& get() {
+    static Kernel kernel;
+    return kernel;
+  }
+  uint64_t now_us() const { return now_us_; }
+  /**
+   * @brief 物理モデルの更新関数を設定する
+   *
+   * @param max_dt_us 1 回の更新で進める時間の上限
+   */
+  void set_step(const Step& step, const uint64_t max_dt_us) {
+    std::lock_guard<std::mutex> lock_guard(mutex_);
+    step_ = step;
+    max_dt_us_ = max_dt_us;
+  }
+  void set_grace_us(const uint32_t grace_us) { grace_us_ = grace_us; }
+  /**
+   * @brief タスクを作る (最初に選ばれるまで動かない)
+   */
+  void spawn(const std::function<void()>& function, const int priority) {
+    {
+      std::lock_guard<std::mutex> lock_guard(mutex_);
+      running_++;  //< 待ちに入るまでは動いているとみなす
+    }
+    std::thread([this, function, priority] {
+      thread_priority() = priority;
+      wait([] { return true; }, kForever);
+      function();
+      std::lock_guard<std::mutex> lock_guard(mutex_);
+      running_--;
+      cv_.notify_all();
+    }).detach();
+  }
+  /**
+   * @brief try_take() が真を返すか，時刻が deadline_us になるまで待つ
+   *
+   * try_take() はカーネルのロックの中で呼ぶので，条件の判定と消費
+   * (セマフォの減算など) を同時に行える．
+   * @return true try_take() が真を返した
+   * @return false タイムアウトした
+   */
+  bool wait(const std::function<bool()>& try_take, const uint64_t deadline_us) {
+    std::unique_lock<std::mutex> unique_lock(mutex_);
+    const int priority = thread_priority();
+    /* 登録していないスレッドは順番を待たない */
+    if (priority < 0 && try_take()) return true;
+    if (priority < 0 && deadline_us <= now_us_) return false;
+    Waiter w{&try_take, deadline_us, priority, ++sequence_};
+    waiters_.push_back(&w);
+    if (priority >= 0) running_--, stalled_ = std::min(stalled_, running_);
+    cv_.notify_all();
+    cv_.wait(unique_lock, [&] { return w.woken; });
+    waiters_.remove(&w);
+    return w.taken;
+  }
+  /**
+   * @brief 待ちの条件に関わる状態を変える (セマフォの give など)
+   */
+  void modify(const std::function<void()>& f) {
+    std::lock_guard<std::mutex> lock_guard(mutex_);
+    f();
+    wake_unregistered();
+    cv_.notify_all();  //< 時計に知らせる
+  }
+  Timer* create_timer(const std::function<void()>& callback) {
+    std::lock_guard<std::mutex> lock_guard(mutex_);
+    timers_.push_back({callback});
+    return &timers_.back();
+  }
+  void start_timer(Timer* timer, const uint64_t period_us, const bool repeat) {
+    std::lock_guard<std::mutex> lock_guard(mutex_);
+    timer->next_us = now_us_ + period_us;
+    timer->period_us = repeat ? period_us : 0;
+    cv_.notify_all();
+  }
+  void stop_timer(Timer* timer) {
+    std::lock_guard<std::mutex> lock_guard(mutex_);
+    timer->next_us = kForever;
+  }
+  void delete_timer(Timer* timer) {
+    std::lock_guard<std::mutex> lock_guard(mutex_);
+    timers_.remove_if([&](const Timer& t) { return &t == timer; });
+  }
+  /**
+   * @brief 実時間に対する仮想時刻の進み方 (計測用)
+   */
+  double get_speed_ratio() const {
+    const auto real_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                             std::chrono::steady_clock::now() - real_start_)
+                             .count();
+    return real_us ? double(now_us_) / double(real_us) : 0;
+  }
+
+ private:
+  struct Waiter {
+    const std::function<bool()>* try_take;
+    uint64_t deadline_us;
+    int priority;       //< -1: 登録していないスレッド
+    uint64_t sequence;  //< 同じ優先度なら先に待った方から起こす
+    bool woken = false;
+    bool taken = false;
+  };
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::atomic<uint64_t> now_us_{0};
+  std::list<Waiter*> waiters_;
+  std::list<Timer> timers_;
+  Step step_;
+  uint64_t max_dt_us_ = 100;
+  uint64_t sequence_ = 0;
+  int running_ = 0;  //< 待ちに入っていないタスクの数
+  int stalled_ = 0;  //< カーネルの外で止まっているとみなしたタスクの数
+  std::atomic<uint32_t> grace_us_{5000};
+  std::chrono::steady_clock::time_point real_start_ =
+      std::chrono::steady_clock::now();
+
+  Kernel() { std::thread([this] { clock(); }).detach(); }
+  static int& thread_priority() {
+    thread_local int priority = -1;
+    return priority;
+  }
+  void wake(Waiter* w, const bool taken) {
+    w->woken = true, w->taken = taken;
+    if (w->priority >= 0) running_++;
+    cv_.notify_all();
+  }
+  void wake_unregistered() {
+    for (auto* w : waiters_) {
+      if (w->woken || w->priority >= 0) continue;
+      if ((*w->try_take)())
+        wake(w, true);
+      else if (w->deadline_us <= now_us_)
+        wake(w, false);
+    }
+  }
+  /**
+   * @brief 起こせるタスクのうち，優先度の最も高いものを 1 つ起こす
+   */
+  bool wake_one() {
+    std::vector<Waiter*> candidates;
+    for (auto* w : waiters_)
+      if (!w->woken && w->priority >= 0) candidates.push_back(w);
+    std::sort(candidates.begin(), candidates.end(), [](auto* a, auto* b) {
+      return a->priority != b->priority ? a->priority > b->priority
+                                        : a->sequence < b->sequence;
+    });
+    for (auto* w : candidates) {
+      if ((*w->try_take)()) return wake(w, true), true;
+      if (w->deadline_us <= now_us_) return wake(w, false), true;
+    }
+    return false;
+  }
+  void clock() {
+    std::unique_lock<std::mutex> unique_lock(mutex_);
+    while (1) {
+      /* 動いているタスクが待ちに入るまで待つ */
+      const auto grace = std::chrono::microseconds(grace_us_);
+      if (!cv_.wait_for(unique_lock, grace,
+                        [&] { return running_ <= stalled_; }))
+        stalled_ = running_;  //< カーネルの外で止まっているとみなす
+      wake_unregistered();
+      if (wake_one()) continue;
+      /* 次の起床時刻 */
+      uint64_t next_us = kForever;
+      for (const auto* w : waiters_)
+        if (!w->woken) next_us = std::min(next_us, w->deadline_us);
+      for (const auto& t : timers_) next_us = std::min(next_us, t.next_us);
+      if (next_us == kForever) {
+        cv_.wait_for(unique_lock, grace);  //< 外からの操作を待つ
+        continue;
+      }
+      /* 物理モデルを更新して時刻を進める */
+      const auto step = step_;
+      unique_lock.unlock();
+      for (uint64_t t = now_us_; t < next_us;) {
+        const uint64_t dt = std::min(max_dt_us_, next_us - t);
+        if (step) step(t, dt);
+        t += dt;
+        now_us_ = t;
+      }
+      unique_lock.lock();
+      /* 時刻になったタイマーを呼ぶ */
+      std::vector<std::function<void()>> callbacks;
+      for (auto& t : timers_) {
+        if (t.next_us > now_us_) continue;
+        callbacks.push_back(t.callback);
+        t.next_us = t.period_us ? t.next_us + t.period_us : kForever;
+      }
+      unique_lock.unlock();
+      for (const auto& callback : callbacks) callback();
+      unique_lock.lock();
+    }
+  }
+};
+
+/**
+ * @brief 現在から ticks [ms] 後の時刻 (portMAX_DELAY は無期限)
+ */
+inline uint64_t deadline_of(const uint32_t ticks) {
+  if (ticks == 0xFFFFFFFF) return Kernel::kForever;
+  return Kernel::get().now_us() + uint64_t(ticks) * 1000;
+}
+
+}  // namespace sim
@@ -0,0 +1,140 @@
+/**
+ * @file mmap_flash.hpp
+ * @brief Memory-mapped File as a Flash Device for the Host Tools
+ * @author Ryotaro Onuki <kerikun11+github@gmail.com>
+ * @date 2024-02-04
+ * @copyright Copyright 2024 Ryotaro Onuki <kerikun11+github@gmail.com>
+ */
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>  //< for std::fill, std::min
+#include <cstdint>
+#include <cstring>  //< for std::memcpy
+#include <string>
+
+#include "utils/record_store.hpp"
+
+namespace sim {
+
+/**
+ * @brief ファイルを mmap した utils::FlashDevice
+ *
+ * NOR フラッシュと同じく，消去すると 0xFF になり，書き込みはビットを 0 に
+ * することしかできない．ファイルに残るので，プロセスをまたいだ再起動も
+ * 試せる．
+ *
+ * 電源断の試験のため，書き込みと消去のバイト数の予算を与えられる．予算を
+ * 使い切ると，その操作を途中で止めて失敗させ，以後の操作も全て失敗させる．
+ * 消去の途中で止まったセクタは先頭から途中までだけ 0xFF になる．
+ */
+class MmapFlash : public utils::FlashDevice {
+ public:
+  struct Counter {
+    uint64_t bytes_written = 0;  //< 書き込んだバイト数
+    uint64_t erases = 0;         //< 消去したセクタの数
+  };
+
+ public:
+  /**
+   * @param size バイト数 (kSectorSize の倍数)．大きさの違うファイルは
+   * 作り直して消去済みにする．
+   */
+  MmapFlash(const std::string& filepath, const size_t size) : size_(size) {
+    fd_ = open(filepath.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd_ < 0) return;
+    struct stat st;
+    const bool fresh = fstat(fd_, &st) != 0 || size_t(st.st_size) != size;
+    if (fresh && ftruncate(fd_, size) != 0) return;
+    void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (p == MAP_FAILED) return;
+    data_ = static_cast<uint8_t*>(p);
+    if (fresh) format();
+  }
+  ~MmapFlash() {
+    if (data_) munmap(data_, size_);
+    if (fd_ >= 0) close(fd_);
+  }
+  MmapFlash(const MmapFlash&) = delete;
+  MmapFlash& operator=(const MmapFlash&) = delete;
+  bool ok() const { return data_ != nullptr; }
+  size_t size() const override { return ok() ? size_ : 0; }
+  bool read(size_t offset, void* data, size_t size) override {
+    if (!ok() || cut_ || offset + size > size_) return false;
+    std::memcpy(data, data_ + offset, size);
+    return true;
+  }
+  bool write(size_t offset, const void* data, size_t size) override {
+    if (!ok() || cut_ || offset + size > size_) return false;
+    const size_t n = consume(size);
+    const auto* bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < n; ++i) data_[offset + i] &= bytes[i];
+    counter_.bytes_written += n;
+    return n == size;
+  }
+  bool erase_sector(size_t offset) override {
+    if (!ok() || cut_ || offset % kSectorSize || offset >= size_) return false;
+    const size_t n = consume(kSectorSize);
+    std::fill(data_ + offset, data_ + offset + n, 0xFF);
+    counter_.erases += n == kSectorSize;
+    return n == kSectorSize;
+  }
+  /**
+   * @brief 全体を消去済みにする (予算と関係なく)
+   */
+  void format() {
+    if (ok()) std::fill(data_, data_ + size_, 0xFF);
+  }
+  /**
+   * @brief bytes バイトの書き込みと消去の後に電源が落ちる
+   */
+  void cut_after(const uint64_t bytes) {
+    budget_ = bytes;
+    limited_ = true;
+    cut_ = false;
+  }
+  /**
+   * @brief 電源を戻す (予算をなくす)
+   */
+  void restore_power() {
+    limited_ = false;
+    cut_ = false;
+  }
+  bool is_cut() const { return cut_; }
+  /**
+   * @brief 書き込みと消去の合計のバイト数 (cut_after() の単位)
+   */
+  uint64_t used() const { return used_; }
+  const Counter& get_counter() const { return counter_; }
+  uint8_t* data() { return data_; }
+
+ private:
+  const size_t size_;
+  int fd_ = -1;
+  uint8_t* data_ = nullptr;
+  bool limited_ = false;
+  bool cut_ = false;
+  uint64_t budget_ = 0;
+  uint64_t used_ = 0;
+  Counter counter_;
+
+  /**
+   * @brief size バイトの操作のうち，電源が落ちるまでに済むバイト数
+   */
+  size_t consume(const size_t size) {
+    size_t n = size;
+    if (limited_) {
+      n = std::min<uint64_t>(size, budget_);
+      budget_ -= n;
+      cut_ = n < size || budget_ == 0;
+    }
+    used_ += n;
+    return n;
+  }
+};
+
+}  // namespace sim
@@ -0,0 +1,85 @@
+/**
+ * @file work_stealing_pool.hpp
+ * @brief Work-Stealing Thread Pool
+ * @author Ryotaro Onuki <kerikun11+github@gmail.com>
+ * @date 2024-02-04
+ * @copyright Copyright 2024 Ryotaro Onuki <kerikun11+github@gmail.com>
+ */
+#pragma once
+
+#include <algorithm>  //< for std::max
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace sim {
+
+/**
+ * @brief ワークスティーリングのスレッドプール
+ *
+ * ワーカーごとにキューを持ち，自分のキューは後ろから取り出す．
+ * 自分のキューが空になったら，他のワーカーのキューの前から盗む．
+ * 仕事は run() の前に全て push() しておく (仕事の中で push() しない)．
+ */
+class WorkStealingPool {
+ public:
+  using Job = std::function<void()>;
+
+ public:
+  explicit WorkStealingPool(const int num_workers)
+      : queues_(std::max(1, num_workers)) {}
+  int size() const { return queues_.size(); }
+  /**
+   * @brief 仕事を追加する (ワーカーに順番に割り振る)
+   */
+  void push(const Job& job) {
+    auto& q = queues_[next_++ % queues_.size()];
+    std::lock_guard<std::mutex> lock_guard(q.mutex);
+    q.jobs.push_back(job);
+  }
+  /**
+   * @brief 全ての仕事が終わるまで実行する
+   */
+  void run() {
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < queues_.size(); ++i)
+      threads.emplace_back([this, i] { worker(i); });
+    for (auto& t : threads) t.join();
+  }
+
+ private:
+  struct Queue {
+    std::mutex mutex;
+    std::deque<Job> jobs;
+  };
+  std::vector<Queue> queues_;
+  size_t next_ = 0;
+
+  bool pop(const size_t i, Job& job) {
+    auto& q = queues_[i];
+    std::lock_guard<std::mutex> lock_guard(q.mutex);
+    if (q.jobs.empty()) return false;
+    job = std::move(q.jobs.back());
+    q.jobs.pop_back();
+    return true;
+  }
+  bool steal(const size_t i, Job& job) {
+    for (size_t k = 1; k < queues_.size(); ++k) {
+      auto& q = queues_[(i + k) % queues_.size()];
+      std::lock_guard<std::mutex> lock_guard(q.mutex);
+      if (q.jobs.empty()) continue;
+      job = std::move(q.jobs.front());
+      q.jobs.pop_front();
+      return true;
+    }
+    return false;
+  }
+  void worker(const size_t i) {
+    Job job;
+    while (pop(i, job) || steal(i, job)) job();
+  }
+};
+
+}  // namespace sim
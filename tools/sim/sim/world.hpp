@@ -0,0 +1,289 @@
+/**
+ * @file world.hpp
+ * @brief Simulated Machine Dynamics and Sensors on a Maze Field
+ * @author Ryotaro Onuki <kerikun11+github@gmail.com>
+ * @date 2024-02-04
+ * @copyright Copyright 2024 Ryotaro Onuki <kerikun11+github@gmail.com>
+ */
+#pragma once
+
+#include <ctrl/feedback_controller.h>
+#include <ctrl/polar.h>
+
+#include <algorithm>  //< for std::min, std::max
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <random>
+
+#include "config/model.h"
+#include "config/parameters.h"
+#include "sim/field.hpp"
+#include "sim/kernel.hpp"
+
+namespace sim {
+
+/**
+ * @brief 迷路の上を走る機体の真の状態と，センサの読み値を作るクラス
+ *
+ * 並進と回転はそれぞれ SpeedControllerModel と同じ 1 次遅れ
+ * v' = (K1 u - v) / T1 で動く (u は電池電圧で補正したデューティ比)．
+ * 時刻はカーネルが進め，その前に step() を呼ぶ．
+ */
+class World {
+ public:
+  /* センサの取り付け位置 (機体座標: x 前方, y 左方) */
+  struct Mount {
+    float x, y, th;
+  };
+  struct Parameter {
+    uint32_t seed = 0;
+    /* Plant */
+    ctrl::FeedbackController<ctrl::Polar>::Model model =
+        model::SpeedControllerModel;
+    float battery_voltage = 4.0f;  //< [V]
+    float nominal_voltage = 4.0f;  //< モデルを同定したときの電圧 [V]
+    float friction = 0.0f;         //< 並進の動摩擦による減速度 [mm/s/s]
+    /* Body */
+    float body_radius = model::TailLength;  //< 機体を円とみなした半径 [mm]
+    float crash_speed = 150.0f;             //< 衝突とみなす壁への速度 [mm/s]
+    /* Encoder */
+    int encoder_resolution = 16384;  //< 車輪 1 回転あたりのパルス数
+    /* IMU */
+    float gyro_noise = 0.003f;         //< 標準偏差 [rad/s]
+    float gyro_bias = 0.0f;            //< 較正後に残るオフセット [rad/s]
+    float gyro_lsb = 1.0652e-3f;       //< 量子化幅 (2000 dps 設定) [rad/s]
+    float accel_noise = 20.0f;         //< 標準偏差 [mm/s/s]
+    float angular_accel_noise = 5.0f;  //< 標準偏差 [rad/s/s]
+    /* Reflector (SL, SR, FL, FR) */
+    std::array<Mount, 4> reflector_mounts = {{
+        {5, 14, float(M_PI) * 5 / 12},
+        {5, -14, -float(M_PI) * 5 / 12},
+        {20, 8, 0},
+        {20, -8, 0},
+    }};
+    float reflector_range = 90.0f;   //< 値が 1 になる距離 [mm]
+    float reflector_noise = 0.02f;   //< 値に対する標準偏差の比
+    float reflector_dropout = 0.0f;  //< 値が 1 (反射なし) になる確率
+    /* ToF */
+    Mount tof_mount = {15, 0, 0};
+    float tof_noise = 1.0f;    //< 標準偏差 [mm]
+    int tof_period_ms = 20;    //< 測距の周期
+    float tof_dropout = 0.0f;  //< 測距に失敗する (範囲外になる) 確率
+  };
+  /* 1 回のサンプリングで読む値 (Encoder, IMU) */
+  struct Sample {
+    std::array<float, 2> wheel_position = {0, 0};  //< 量子化した値 [mm]
+    float gyro = 0;                                //< [rad/s]
+    float accel = 0;                               //< [mm/s/s]
+    float angular_accel = 0;                       //< [rad/s/s]
+  };
+
+ public:
+  World() {
+    Kernel::get().set_step([this](uint64_t now_us,
+                                  uint64_t dt_us) { step(now_us, dt_us); },
+                           100);
+  }
+  void set_parameter(const Parameter& p) {
+    std::lock_guard<std::mutex> lock_guard(mutex_);
+    p_ = p;
+    rng_.seed(p.seed);
+  }
+  const Parameter& get_parameter() const { return p_; }
+  void set_field(const Field& field) {
+    std::lock_guard<std::mutex> lock_guard(mutex_);
+    field_ = field;
+  }
+  const Field& get_field() const { return field_; }
+  /**
+   * @brief 機体を置く (静止状態にする)
+   */
+  void set_pose(const float x, const float y, const float th) {
+    std::lock_guard<std::mutex> lock_guard(mutex_);
+    x_ = x, y_ = y, th_ = th;
+    v_.clear(), a_.clear();
+  }
+  void get_pose(float& x, float& y, float& th) const {
+    std::lock_guard<std::mutex> lock_guard(mutex_);
+    x = x_, y = y_, th = th_;
+  }
+  ctrl::Polar get_velocity() const {
+    std::lock_guard<std::mutex> lock_guard(mutex_);
+    return v_;
+  }
+  bool is_crashed() const {
+    std::lock_guard<std::mutex> lock_guard(mutex_);
+    return crashed_;
+  }
+  void clear_crash() {
+    std::lock_guard<std::mutex> lock_guard(mutex_);
+    crashed_ = false;
+  }
+  /**
+   * @brief 衝突したときに呼ぶ関数 (World のロックの中で呼ぶ)
+   */
+  void set_crash_handler(const std::function<void()>& handler) {
+    std::lock_guard<std::mutex> lock_guard(mutex_);
+    on_crash_ = handler;
+  }
+  /* Actuator */
+  void set_duty(const float duty_L, const float duty_R) {
+    std::lock_guard<std::mutex> lock_guard(mutex_);
+    duty_ = {std::max(-1.0f, std::min(duty_L, 1.0f)),
+             std::max(-1.0f, std::min(duty_R, 1.0f))};
+  }
+  void set_fan_duty(const float duty) {
+    std::lock_guard<std::mutex> lock_guard(mutex_);
+    fan_duty_ = duty;
+  }
+  float get_battery_voltage() const { return p_.battery_voltage; }
+  /* Sensor */
+  /**
+   * @brief Encoder と IMU の値を取得する (sampling_request に相当)
+   */
+  void sample() {
+    std::lock_guard<std::mutex> lock_guard(mutex_);
+    const float step = float(M_PI) * model::WheelDiameter * model::GearRatio /
+                       p_.encoder_resolution;
+    for (int i = 0; i < 2; ++i)
+      sample_.wheel_position[i] = std::floor(wheel_[i] / step) * step;
+    const float gyro = v_.rot + p_.gyro_bias + p_.gyro_noise * normal();
+    sample_.gyro = std::round(gyro / p_.gyro_lsb) * p_.gyro_lsb;
+    sample_.accel = a_.tra + p_.accel_noise * normal();
+    sample_.angular_accel = a_.rot + p_.angular_accel_noise * normal();
+  }
+  Sample get_sample() const {
+    std::lock_guard<std::mutex> lock_guard(mutex_);
+    return sample_;
+  }
+  int16_t get_reflector(const uint8_t ch) const {
+    std::lock_guard<std::mutex> lock_guard(mutex_);
+    return reflector_[ch];
+  }
+  void set_tof_enabled(const bool enabled) {
+    std::lock_guard<std::mutex> lock_guard(mutex_);
+    tof_enabled_ = enabled;
+  }
+  /**
+   * @brief ToF の最後の測距
+   *
+   * @param distance 機体中心から前壁の中心線までの距離 [mm] (255: 範囲外)
+   * @param passed_ms 最後に有効な測距をしてからの時間 [ms]
+   */
+  void get_tof(float& distance, uint32_t& passed_ms) const {
+    std::lock_guard<std::mutex> lock_guard(mutex_);
+    distance = tof_distance_;
+    passed_ms = tof_passed_ms_;
+  }
+
+ private:
+  mutable std::mutex mutex_;
+  Parameter p_;
+  Field field_;
+  std::mt19937 rng_;
+  std::normal_distribution<float> normal_{0.0f, 1.0f};
+  std::uniform_real_distribution<float> uniform_{0.0f, 1.0f};
+  std::function<void()> on_crash_;
+  /* 真の状態 */
+  float x_ = 0, y_ = 0, th_ = 0;  //< 機体中心の位置と向き
+  ctrl::Polar v_, a_;             //< 速度と加速度
+  std::array<float, 2> wheel_ = {0, 0};
+  std::array<float, 2> duty_ = {0, 0};
+  float fan_duty_ = 0;
+  bool crashed_ = false;
+  /* センサ */
+  Sample sample_;
+  std::array<int16_t, 4> reflector_ = {1, 1, 1, 1};
+  bool tof_enabled_ = true;
+  int tof_count_ = 0;
+  float tof_distance_ = 255;
+  uint32_t tof_passed_ms_ = 0;
+
+  float normal() { return normal_(rng_); }
+  float uniform() { return uniform_(rng_); }
+  void step(const uint64_t now_us, const uint64_t dt_us) {
+    std::lock_guard<std::mutex> lock_guard(mutex_);
+    const float dt = dt_us * 1e-6f;
+    const auto& K1 = p_.model.K1;
+    const auto& T1 = p_.model.T1;
+    /* 1 次遅れの応答 (入力を一定とみなして厳密に離散化) */
+    const float scale = p_.battery_voltage / p_.nominal_voltage;
+    const float u_tra = (duty_[0] + duty_[1]) / 2 * scale;
+    const float u_rot = (duty_[1] - duty_[0]) * scale;
+    const ctrl::Polar v_prev = v_;
+    v_.tra += (K1.tra * u_tra - v_.tra) * (1 - std::exp(-dt / T1.tra));
+    v_.rot += (K1.rot * u_rot - v_.rot) * (1 - std::exp(-dt / T1.rot));
+    const float dv = p_.friction * dt;
+    v_.tra = std::abs(v_.tra) <= dv ? 0 : v_.tra - std::copysign(dv, v_.tra);
+    /* 姿勢と車輪の積分 */
+    const float th_mid = th_ + v_.rot * dt / 2;
+    x_ += v_.tra * std::cos(th_mid) * dt;
+    y_ += v_.tra * std::sin(th_mid) * dt;
+    th_ += v_.rot * dt;
+    wheel_[0] += (v_.tra - v_.rot * model::RotationRadius) * dt;
+    wheel_[1] += (v_.tra + v_.rot * model::RotationRadius) * dt;
+    contact();
+    a_ = (v_ - v_prev) / dt;
+    /* 1 ms ごとのセンサの更新 */
+    if ((now_us + dt_us) / 1000 != now_us / 1000) tick_ms();
+  }
+  /**
+   * @brief 壁にめり込んだら押し戻し，壁に向かう速度を打ち消す
+   */
+  void contact() {
+    float nx = 0, ny = 0;
+    const float depth = field_.collide(x_, y_, p_.body_radius, nx, ny);
+    if (depth <= 0) return;
+    x_ += nx * depth, y_ += ny * depth;
+    const float v_n = v_.tra * (std::cos(th_) * nx + std::sin(th_) * ny);
+    if (v_n >= 0) return;  //< 壁から離れる向き
+    if (-v_n > p_.crash_speed && !crashed_) {
+      crashed_ = true;
+      duty_ = {0, 0};
+      if (on_crash_) on_crash_();
+    }
+    v_.tra = 0;
+  }
+  void tick_ms() {
+    /* Reflector: 値は距離に対して指数的に減衰する (ref2dist の逆) */
+    const float saturation = config::parameters().ref_saturation_value;
+    for (int i = 0; i < 4; ++i) {
+      const float d = ray_cast(p_.reflector_mounts[i], p_.reflector_range);
+      const float value = std::pow(saturation, 1 - d / p_.reflector_range) *
+                          (1 + p_.reflector_noise * normal());
+      reflector_[i] = std::max(1.0f, std::min(value, saturation));
+      if (p_.reflector_dropout > 0 && uniform() < p_.reflector_dropout)
+        reflector_[i] = 1;
+    }
+    /* ToF */
+    tof_passed_ms_++;
+    if (!tof_enabled_ || ++tof_count_ < p_.tof_period_ms) return;
+    tof_count_ = 0;
+    const float max_range = 255;
+    const float d = ray_cast(p_.tof_mount, max_range) + p_.tof_mount.x +
+                    Field::kHalfWall + p_.tof_noise * normal();
+    tof_distance_ = std::min(d, max_range);
+    if (p_.tof_dropout > 0 && uniform() < p_.tof_dropout)
+      tof_distance_ = max_range;
+    if (tof_distance_ < max_range) tof_passed_ms_ = 0;
+  }
+  float ray_cast(const Mount& m, const float max_range) const {
+    const float c = std::cos(th_), s = std::sin(th_);
+    const float x = x_ + c * m.x - s * m.y;
+    const float y = y_ + s * m.x + c * m.y;
+    return field_.ray_cast(x, y, th_ + m.th, max_range);
+  }
+};
+
+/**
+ * @brief シミュレータの世界 (1 つだけ)
+ */
+inline World& world() {
+  static World world;
+  return world;
+}
+
+}  // namespace sim
@@ -0,0 +1,185 @@
+/**
+ * @file slalom_table.cpp
+ * @brief Equivalence Check and Benchmark of the Slalom Reference Table
+ * @author Ryotaro Onuki <kerikun11+github@gmail.com>
+ * @date 2024-02-04
+ * @copyright Copyright 2024 Ryotaro Onuki <kerikun11+github@gmail.com>
+ */
+/*
+ * field::shapes の各スラロームを左右と 4 通りの速度で，MoveAction::trace()
+ * と同じ 1 ms 周期のループで追い，utils::SlalomTable::update() の目標状態を
+ * ctrl::slalom::Trajectory::update() と比べる．
+ *
+ * - 位置 [mm] の誤差の最大．Trajectory の角度を 1/16 周期ごとに中点則で
+ *   積分した値と比べる．1 周期ごとの update() (trace() の従来の方法) との
+ *   差も出力する．
+ * - 角度 [rad] の誤差の最大
+ * - 角速度・角加速度・角躍度の誤差の最大 (それぞれのターン中の最大値に
+ *   対する比)
+ * - ターン終点の位置と Shape::curve の差 (表と 1 周期ごとの積分)
+ * - 1 回の update() のホストでの時間 [ns]
+ *
+ * 位置・角度系の誤差が許容値を超えれば失敗で終了する．
+ */
+#include <algorithm>  //< for std::max
+#include <array>      //< for field::shapes
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+#include "config/slalom_shapes.h"
+#include "utils/slalom_table.hpp"
+
+namespace {
+
+constexpr const char* kShapeNames[field::ShapeIndexMax] = {
+    "S90", "F45", "F90", "F135", "F180", "FV90", "FS90",
+};
+constexpr float Ts = 1e-3f;  //< SpeedController の制御周期 [s]
+
+constexpr int kSubsteps = 16;  //< 位置の基準の 1 周期の分割数
+
+/* 許容値 */
+constexpr float kPositionTolerance = 0.05f;  //< [mm]
+constexpr float kAngleTolerance = 1e-3f;     //< [rad]
+constexpr float kDthTolerance = 2e-3f;       //< 最大の角速度に対する比
+constexpr float kDdthTolerance = 2e-2f;      //< 最大の角加速度に対する比
+constexpr float kDddthTolerance = 1e-1f;     //< 最大の角躍度に対する比
+
+struct Error {
+  float position = 0;       //< 細かく積分した基準との差 [mm]
+  float position_tick = 0;  //< 1 周期ごとの積分との差 [mm] (参考)
+  float angle = 0;
+  float dth = 0, ddth = 0, dddth = 0;  //< 最大値に対する比
+  float end_table = 0, end_tick = 0;   //< 終点と Shape::curve の差 [mm]
+};
+
+/**
+ * @brief 終点の位置と Shape::curve の差
+ */
+float end_error(const ctrl::slalom::Shape& shape, const bool mirror_x,
+                const ctrl::State& s) {
+  const float sg = mirror_x ? -1 : 1;
+  return std::hypot(s.q.x - shape.curve.x, s.q.y - sg * shape.curve.y);
+}
+
+Error compare(const utils::SlalomTable& table, const bool mirror_x,
+              const float v) {
+  const auto& shape = table.getShape();
+  ctrl::slalom::Trajectory st(shape, mirror_x);
+  st.reset(v);
+  ctrl::State s_tr, s_tb, s_fine;
+  Error e;
+  float dth_max = 0, ddth_max = 0, dddth_max = 0;
+  float dth = 0, ddth = 0, dddth = 0;
+  for (float t = 0; t < st.getTimeCurve(); t += Ts) {
+    st.update(s_tr, t, Ts);
+    table.update(s_tb, v, t, Ts, mirror_x);
+    for (int k = 0; k < kSubsteps; ++k) {
+      ctrl::State sm;
+      st.update(sm, t + (k + 0.5f) * Ts / kSubsteps, 0);
+      s_fine.q.x += v * std::cos(sm.q.th) * Ts / kSubsteps;
+      s_fine.q.y += v * std::sin(sm.q.th) * Ts / kSubsteps;
+    }
+    e.position = std::max(e.position, std::hypot(s_tb.q.x - s_fine.q.x,
+                                                 s_tb.q.y - s_fine.q.y));
+    e.position_tick = std::max(
+        e.position_tick, std::hypot(s_tb.q.x - s_tr.q.x, s_tb.q.y - s_tr.q.y));
+    e.angle = std::max(e.angle, std::abs(s_tb.q.th - s_tr.q.th));
+    dth = std::max(dth, std::abs(s_tb.dq.th - s_tr.dq.th));
+    ddth = std::max(ddth, std::abs(s_tb.ddq.th - s_tr.ddq.th));
+    dddth = std::max(dddth, std::abs(s_tb.dddq.th - s_tr.dddq.th));
+    dth_max = std::max(dth_max, std::abs(s_tr.dq.th));
+    ddth_max = std::max(ddth_max, std::abs(s_tr.ddq.th));
+    dddth_max = std::max(dddth_max, std::abs(s_tr.dddq.th));
+  }
+  e.dth = dth / dth_max, e.ddth = ddth / ddth_max, e.dddth = dddth / dddth_max;
+  e.end_table = end_error(shape, mirror_x, s_tb);
+  e.end_tick = end_error(shape, mirror_x, s_tr);
+  return e;
+}
+
+/**
+ * @brief 1 回の update() の時間 [ns] (全ての形状を基準速度で繰り返す)
+ */
+void bench(const std::vector<utils::SlalomTable>& tables, double& ns_table,
+           double& ns_trajectory) {
+  using clock = std::chrono::steady_clock;
+  const int repeats = 200;
+  volatile float sink = 0;
+  long count = 0;
+  auto t0 = clock::now();
+  for (int r = 0; r < repeats; ++r) {
+    for (const auto& table : tables) {
+      const auto& shape = table.getShape();
+      ctrl::slalom::Trajectory st(shape, r & 1);
+      st.reset(shape.v_ref);
+      ctrl::State s;
+      for (float t = 0; t < st.getTimeCurve(); t += Ts, ++count)
+        st.update(s, t, Ts);
+      sink = sink + s.q.x;
+    }
+  }
+  auto t1 = clock::now();
+  ns_trajectory = std::chrono::duration<double, std::nano>(t1 - t0).count() /
+                  count;
+  count = 0;
+  t0 = clock::now();
+  for (int r = 0; r < repeats; ++r) {
+    for (const auto& table : tables) {
+      const float v = table.getShape().v_ref;
+      ctrl::State s;
+      for (float t = 0; t < table.getTimeCurve(v); t += Ts, ++count)
+        table.update(s, v, t, Ts, r & 1);
+      sink = sink + s.q.x;
+    }
+  }
+  t1 = clock::now();
+  ns_table = std::chrono::duration<double, std::nano>(t1 - t0).count() / count;
+}
+
+}  // namespace
+
+int main() {
+  std::vector<utils::SlalomTable> tables;
+  for (const auto& shape : field::shapes) tables.emplace_back(shape);
+  const float scales[] = {0.5f, 1.0f, 1.5f, 2.0f};
+  int failures = 0;
+  Error worst;
+  std::printf("shape\tmirror\tv [mm/s]\tposition [mm]\tposition (tick) [mm]\t"
+              "angle [mrad]\tdth [%%]\tddth [%%]\tdddth [%%]\t"
+              "end (table) [mm]\tend (tick) [mm]\n");
+  for (int si = 0; si < field::ShapeIndexMax; ++si) {
+    for (const bool mirror_x : {false, true}) {
+      for (const auto scale : scales) {
+        const float v = field::shapes[si].v_ref * scale;
+        const auto e = compare(tables[si], mirror_x, v);
+        const bool ok = e.position < kPositionTolerance &&
+                        e.angle < kAngleTolerance && e.dth < kDthTolerance &&
+                        e.ddth < kDdthTolerance && e.dddth < kDddthTolerance;
+        std::printf("%s\t%d\t%.0f\t%.4f\t%.3f\t%.3f\t%.3f\t%.3f\t%.3f\t%.3f\t"
+                    "%.3f%s\n",
+                    kShapeNames[si], mirror_x, v, e.position, e.position_tick,
+                    e.angle * 1e3, e.dth * 1e2, e.ddth * 1e2, e.dddth * 1e2,
+                    e.end_table, e.end_tick, ok ? "" : "\tNG");
+        failures += !ok;
+        worst.position = std::max(worst.position, e.position);
+        worst.angle = std::max(worst.angle, e.angle);
+        worst.dth = std::max(worst.dth, e.dth);
+        worst.ddth = std::max(worst.ddth, e.ddth);
+        worst.dddth = std::max(worst.dddth, e.dddth);
+      }
+    }
+  }
+  double ns_table, ns_trajectory;
+  bench(tables, ns_table, ns_trajectory);
+  std::printf("worst\tposition %.4f mm\tangle %.3f mrad\tdth %.3f %%\t"
+              "ddth %.3f %%\tdddth %.3f %%\n",
+              worst.position, worst.angle * 1e3, worst.dth * 1e2,
+              worst.ddth * 1e2, worst.dddth * 1e2);
+  std::printf("host [ns/update]\ttable %.1f\ttrajectory %.1f\t"
+              "failures: %d\n",
+              ns_table, ns_trajectory, failures);
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,221 @@
+/**
+ * @file step_fit.cpp
+ * @brief Host Test of the Step Response Fitter
+ * @author Ryotaro Onuki <kerikun11+github@gmail.com>
+ * @date 2024-02-04
+ * @copyright Copyright 2024 Ryotaro Onuki <kerikun11+github@gmail.com>
+ */
+/*
+ * utils::StepResponseFitter を tools/sysid/data のステップ応答のログ
+ * (Machine::sysid() の出力) と合成した応答で確かめる．
+ *
+ * - reference: ログごとに，T1 を細かい格子で全探索して double で解いた
+ *   最小二乗解と K1, T1 が一致すること．黄金分割探索が局所解に
+ *   落ちていないかも兼ねる．
+ * - offline: tools/sysid/plot.py に書かれたオフラインの同定結果と
+ *   一致すること．
+ * - synthetic: 既知の K1, T1 の応答に雑音を加えたものから，真値を
+ *   推定できること．
+ *
+ * ログの列は [enc L, enc R, gyro z, accel x, accel y, 電圧, u.tra, u.rot]．
+ * 入力が一定でないログ (スラロームなど) は飛ばす．
+ * どれかを満たさなければ失敗で終了する．
+ */
+#include <algorithm>  //< for std::max
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "utils/step_response_fitter.hpp"
+
+namespace {
+
+constexpr float Ts = 1e-3f;          //< ログの周期 [s]
+constexpr int kCapacity = 2000;      //< Machine::sysid() の標本数
+constexpr double kTolerance = 5e-3;  //< 参照解との相対誤差の上限
+
+/* plot.py のオフラインの同定結果 */
+struct Offline {
+  const char* name;
+  bool rot;
+  double K1, T1;
+};
+const std::vector<Offline> kOffline = {
+    {"20200517-sysid-r0.4", true, 66.72, 0.1499},
+};
+
+struct Step {
+  bool rot;  //< false: 並進，true: 回転
+  float u;   //< ステップ入力の大きさ
+  std::vector<float> v;
+};
+
+/**
+ * @brief ログを読み，入力が一定ならステップ応答として返す
+ */
+bool load_step(const std::string& file, Step& step) {
+  std::ifstream ifs(file);
+  if (!ifs) return false;
+  std::vector<std::vector<float>> rows;
+  for (std::string line; std::getline(ifs, line);) {
+    std::istringstream iss(line);
+    std::vector<float> row;
+    for (float x; iss >> x;) row.push_back(x);
+    if (row.size() == 8) rows.push_back(row);
+  }
+  if (rows.size() < 3) return false;
+  const float u_tra = rows[0][6], u_rot = rows[0][7];
+  if ((u_tra != 0) == (u_rot != 0)) return false;
+  /* 通信の乱れで列がずれた行が少しある (センサの列は正しい) */
+  size_t shifted = 0;
+  for (const auto& r : rows) shifted += r[6] != u_tra || r[7] != u_rot;
+  if (shifted > rows.size() / 100) return false;
+  step.rot = u_rot != 0;
+  step.u = step.rot ? u_rot : u_tra;
+  step.v.clear();
+  for (size_t i = 0; i < rows.size(); ++i) {
+    /* 並進はエンコーダの平均の差分 (最初は静止)，回転はジャイロ */
+    const float enc = (rows[i][0] + rows[i][1]) / 2;
+    const float enc_prev = i ? (rows[i - 1][0] + rows[i - 1][1]) / 2 : enc;
+    step.v.push_back(step.rot ? rows[i][2] : (enc - enc_prev) / Ts);
+  }
+  /* KERISE v4 の古いログはジャイロの符号が逆 (ファームウェアでは正) */
+  float sum = 0;
+  for (const auto v : step.v) sum += v;
+  if (sum * step.u < 0)
+    for (auto& v : step.v) v = -v;
+  return true;
+}
+
+/**
+ * @brief T1 を固定したときの最適な K1 と残差二乗和 (double)
+ */
+double cost(const Step& s, const double T1, double& K1) {
+  const double A = std::exp(-Ts / T1);
+  double e = 1, S_gv = 0, S_gg = 0;
+  for (const auto v : s.v) {
+    const double g = s.u * (1 - e);
+    S_gv += g * v, S_gg += g * g, e *= A;
+  }
+  K1 = S_gv / S_gg;
+  double S_rr = 0;
+  e = 1;
+  for (const auto v : s.v) {
+    const double r = v - K1 * s.u * (1 - e);
+    S_rr += r * r, e *= A;
+  }
+  return S_rr;
+}
+
+/**
+ * @brief 参照解: T1 を 0.1 ms の格子で全探索し，最良の点の前後を細かくする
+ */
+utils::StepResponseFitter::Result reference(const Step& s) {
+  double K1, best_T1 = 0, best = INFINITY;
+  for (double T1 = 0.005; T1 <= 1.0; T1 += 1e-4) {
+    const double c = cost(s, T1, K1);
+    if (c < best) best = c, best_T1 = T1;
+  }
+  const double center = best_T1;
+  for (double T1 = center - 1e-4; T1 <= center + 1e-4; T1 += 1e-6) {
+    const double c = cost(s, T1, K1);
+    if (c < best) best = c, best_T1 = T1;
+  }
+  cost(s, best_T1, K1);
+  return {float(K1), float(best_T1)};
+}
+
+bool fit(const Step& s, utils::StepResponseFitter::Result& r) {
+  utils::StepResponseFitter fitter(Ts, kCapacity);
+  for (const auto v : s.v) fitter.push(v);
+  return fitter.fit(s.u, r);
+}
+
+double rel(const double a, const double b) { return std::abs(a / b - 1); }
+
+/**
+ * @brief 既知の K1, T1 の応答に白色雑音を加えて同定する (10 通り)
+ */
+int synthetic() {
+  struct Case {
+    bool rot;
+    float K1, T1, u, noise;  //< noise: 速度の雑音の標準偏差
+  };
+  const Case cases[] = {
+      {false, 5833, 0.37f, 0.3f, 100},  //< 並進 [mm/s]
+      {true, 66.7f, 0.15f, 0.4f, 1.0f},  //< 回転 [rad/s]
+  };
+  int failures = 0;
+  for (const auto& c : cases) {
+    double err_K1 = 0, err_T1 = 0;
+    for (int seed = 0; seed < 10; ++seed) {
+      std::mt19937 rng(seed);
+      std::normal_distribution<float> normal(0, c.noise);
+      Step s{c.rot, c.u, {}};
+      for (int k = 0; k < kCapacity; ++k)
+        s.v.push_back(c.K1 * c.u * (1 - std::exp(-k * Ts / c.T1)) +
+                      normal(rng));
+      utils::StepResponseFitter::Result r;
+      if (!fit(s, r)) {
+        failures++;
+        continue;
+      }
+      err_K1 = std::max(err_K1, rel(r.K1, c.K1));
+      err_T1 = std::max(err_T1, rel(r.T1, c.T1));
+    }
+    const bool ok = err_K1 < 0.01 && err_T1 < 0.02;
+    std::printf("synthetic\t%s\t%s\tK1 %g T1 %g\tmax error K1 %.4f T1 %.4f\n",
+                c.rot ? "rot" : "tra", ok ? "ok" : "NG", c.K1, c.T1, err_K1,
+                err_T1);
+    failures += !ok;
+  }
+  return failures;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  /* 引数 */
+  if (argc < 2) {
+    std::cerr << "usage: " << argv[0] << " <tools/sysid/data/*.csv>..."
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+  int failures = 0, count = 0;
+  std::printf("log\taxis\tu\tK1 (fitter)\tT1 (fitter)\tK1 (reference)\t"
+              "T1 (reference)\tK1 (offline)\tT1 (offline)\n");
+  for (int i = 1; i < argc; ++i) {
+    const std::string file = argv[i];
+    Step s;
+    if (!load_step(file, s)) {
+      std::cerr << "skipped (not a step response): " << file << std::endl;
+      continue;
+    }
+    const auto basename = file.substr(0, file.rfind('.'));
+    const auto name = basename.substr(basename.rfind('/') + 1);
+    utils::StepResponseFitter::Result r = {NAN, NAN};
+    const auto ref = reference(s);
+    bool ok = fit(s, r) && rel(r.K1, ref.K1) < kTolerance &&
+              rel(r.T1, ref.T1) < kTolerance;
+    double K1_off = NAN, T1_off = NAN;
+    for (const auto& o : kOffline) {
+      if (name != o.name || s.rot != o.rot) continue;
+      K1_off = o.K1, T1_off = o.T1;
+      ok = ok && rel(r.K1, o.K1) < 0.01 && rel(r.T1, o.T1) < 0.01;
+    }
+    std::printf("%s\t%s\t%g\t%.2f\t%.4f\t%.2f\t%.4f\t%.2f\t%.4f%s\n",
+                name.c_str(), s.rot ? "rot" : "tra", s.u, r.K1, r.T1, ref.K1,
+                ref.T1, K1_off, T1_off, ok ? "" : "\tNG");
+    failures += !ok;
+    count++;
+  }
+  failures += synthetic();
+  std::printf("logs: %d\tfailures: %d\n", count, failures);
+  return failures || count == 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,172 @@
+/**
+ * @file strategy.cpp
+ * @brief Competition Simulation of Fast Run Parameter Selection
+ * @author Ryotaro Onuki <kerikun11+github@gmail.com>
+ * @date 2024-02-04
+ * @copyright Copyright 2024 Ryotaro Onuki <kerikun11+github@gmail.com>
+ *
+ * 段階と斜めの有無ごとの成功確率と走行時間のモデルの上で競技を何度も行い，
+ * 従来の規則と utils::RunStrategy の最短時間を比べる．
+ * 走行そのものは模擬せず，成否と時間だけを乱数で決める．
+ */
+#include <algorithm>  //< for std::min
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>  //< for std::atoi, std::atof, EXIT_FAILURE
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "utils/run_strategy.hpp"
+
+namespace {
+
+using Arm = utils::RunStrategy::Arm;
+
+/**
+ * @brief 機体の真の性能 (方策からは見えない)
+ *
+ * 成功確率は段階について logistic で，critical の段階で 1/2 になる．
+ */
+struct Model {
+  const char* name;
+  float critical;   //< 成功確率が 1/2 になる段階 (斜めなし)
+  float diag;       //< 斜めありにしたときの critical の減少 [段階]
+  float scale;      //< logistic の幅 [段階]
+  float diag_time;  //< 斜めありにしたときの時間の比
+
+  float p(const Arm& arm) const {
+    const float x = critical - (arm.diag ? diag : 0) - arm.level;
+    return 1 / (1 + std::exp(-x / scale));
+  }
+  float time(const Arm& arm, const float base_time_s) const {
+    return base_time_s * std::pow(0.93f, arm.level) *
+           (arm.diag ? diag_time : 1);
+  }
+};
+
+/* 方策: 直前の結果から次のアームを返す */
+struct Policy {
+  const char* name;
+  std::function<Arm(int run, int runs, bool last_success, bool any_success,
+                    const Arm& last)>
+      choose;
+  std::function<void(const Arm&, bool, float)> record;
+  std::function<void()> reset;
+};
+
+/**
+ * @brief 従来の MazeRobot::auto_parameter_select() の規則
+ */
+Arm rule_choose(const int run, const bool last_success, const bool any_success,
+                Arm arm) {
+  if (run > 0 && !last_success) {
+    if (any_success) {
+      arm.level -= 1;
+      arm.diag = true;
+    } else {
+      arm.diag = !arm.diag;
+      arm.level = 0;
+    }
+  } else {
+    if (run == 0) arm.level += 3;
+    if (arm.diag)
+      arm.level += 2;
+    else
+      arm.diag = true;
+  }
+  return arm;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  /* 引数 */
+  int trials = 10000;
+  int runs = 4;
+  uint32_t seed = 0;
+  float base_time_s = 20;
+  float limit_s = 150;
+  bool ok = true;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const bool has_value = i + 1 < argc;
+    if (arg == "--trials" && has_value) {
+      trials = std::atoi(argv[++i]);
+    } else if (arg == "--runs" && has_value) {
+      runs = std::atoi(argv[++i]);
+    } else if (arg == "--seed" && has_value) {
+      seed = std::atoi(argv[++i]);
+    } else if (arg == "--time" && has_value) {
+      base_time_s = std::atof(argv[++i]);
+    } else if (arg == "--limit" && has_value) {
+      limit_s = std::atof(argv[++i]);
+    } else {
+      ok = false;
+    }
+  }
+  if (!ok || trials <= 0 || runs <= 0) {
+    std::cerr << "usage: " << argv[0]
+              << " --trials N --runs N --seed N --time T --limit T"
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+  /* 機体のモデル */
+  const std::vector<Model> models = {
+      {"weak", 1.0f, 1.0f, 0.7f, 0.9f},
+      {"nominal", 4.0f, 1.0f, 1.0f, 0.9f},
+      {"strong", 8.0f, 0.5f, 1.0f, 0.85f},
+      {"diag-weak", 5.0f, 4.0f, 0.7f, 0.95f},
+  };
+  /* 方策 */
+  utils::RunStrategy strategy;
+  const std::vector<Policy> policies = {
+      {"rule",
+       [](int run, int, bool last_success, bool any_success, const Arm& last) {
+         return rule_choose(run, last_success, any_success, last);
+       },
+       [](const Arm&, bool, float) {}, [] {}},
+      {"strategy",
+       [&](int run, int total, bool, bool, const Arm&) {
+         return strategy.choose(total - run, limit_s, base_time_s);
+       },
+       [&](const Arm& arm, bool success, float time_s) {
+         strategy.record(arm, success, time_s);
+       },
+       [&] { strategy.reset(); }},
+  };
+  /* 競技 */
+  std::printf("model\tpolicy\tbest [s]\tno_success\n");
+  for (const auto& model : models) {
+    for (const auto& policy : policies) {
+      std::mt19937 rng(seed);
+      std::uniform_real_distribution<float> uniform(0, 1);
+      double sum = 0;
+      int no_success = 0;
+      for (int t = 0; t < trials; ++t) {
+        policy.reset();
+        float best = std::numeric_limits<float>::infinity();
+        Arm arm = {0, true};
+        bool last_success = true, any_success = false;
+        for (int run = 0; run < runs; ++run) {
+          arm = policy.choose(run, runs, last_success, any_success, arm);
+          last_success = uniform(rng) < model.p(arm);
+          const float time_s = model.time(arm, base_time_s);
+          policy.record(arm, last_success, time_s);
+          if (!last_success) continue;
+          any_success = true;
+          best = std::min(best, time_s);
+        }
+        if (!any_success) no_success++;
+        sum += any_success ? best : limit_s;
+      }
+      std::printf("%s\t%s\t%.3f\t%.4f\n", model.name, policy.name,
+                  sum / trials, float(no_success) / trials);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,230 @@
+/**
+ * @file sweep.cpp
+ * @brief Monte-Carlo Sweep of Run Parameters on the Host Simulator
+ * @author Ryotaro Onuki <kerikun11+github@gmail.com>
+ * @date 2024-02-04
+ * @copyright Copyright 2024 Ryotaro Onuki <kerikun11+github@gmail.com>
+ *
+ * パラメータの組ごとに，迷路の集合の上で雑音・摩擦・電池電圧を乱数で変えた
+ * 最短走行を kerise_sim で何度も行い，成功確率と走行時間を集計する．
+ * カーネルと World はプロセスに 1 つなので，1 回の走行を 1 プロセスで行う．
+ */
+#include <algorithm>  //< for std::sort
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>  //< for std::atoi, std::atof, EXIT_FAILURE
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "sim/work_stealing_pool.hpp"
+
+namespace {
+
+/* 乱数で変える範囲 */
+struct Range {
+  float lo, hi;
+};
+
+/* 1 回の走行 */
+struct Job {
+  int set;          //< パラメータの組の番号
+  int maze;         //< 迷路の番号
+  std::string cmd;  //< kerise_sim のコマンド
+};
+struct Result {
+  bool success = false;
+  float time = 0;  //< [s]
+};
+
+/* パラメータの組ごとの集計 */
+struct Summary {
+  int trials = 0;
+  int successes = 0;
+  float p_success = 0;
+  float p_lower = 0;  //< 成功確率の 95% 信頼区間の下限 (Wilson)
+  float time = 0;     //< 迷路ごとの成功時の平均時間の和 [s]
+  bool frontier = false;
+};
+
+std::string quote(const std::string& s) {
+  std::string q = "'";
+  for (const char c : s) {
+    if (c == '\'')
+      q += "'\\''";
+    else
+      q += c;
+  }
+  return q + "'";
+}
+
+bool parse_range(const char* arg, Range& range) {
+  return std::sscanf(arg, "%f:%f", &range.lo, &range.hi) == 2;
+}
+
+/**
+ * @brief kerise_sim を実行して結果の行を読む
+ */
+Result run(const std::string& cmd) {
+  Result result;
+  FILE* fp = popen(cmd.c_str(), "r");
+  if (!fp) return result;
+  char line[256];
+  char status[16];
+  float time;
+  while (std::fgets(line, sizeof(line), fp)) {
+    if (std::sscanf(line, "result: %15s time: %f", status, &time) != 2)
+      continue;
+    result.success = std::string(status) == "success";
+    result.time = time;
+  }
+  pclose(fp);
+  return result;
+}
+
+float wilson_lower(const int successes, const int trials) {
+  if (trials == 0) return 0;
+  const float z = 1.96f;
+  const float n = trials, p = successes / n;
+  const float c = p + z * z / (2 * n);
+  const float d = z * std::sqrt(p * (1 - p) / n + z * z / (4 * n * n));
+  return (c - d) / (1 + z * z / n);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  /* 引数 */
+  std::string sim = argv[0];
+  sim = sim.substr(0, sim.find_last_of('/') + 1) + "kerise_sim";
+  int trials = 10;
+  int jobs = std::thread::hardware_concurrency();
+  uint32_t seed = 0;
+  Range battery = {3.7f, 4.2f};
+  Range friction = {0, 200};
+  Range noise = {0.5f, 2.0f};
+  std::vector<std::string> files;
+  bool ok = true;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const bool has_value = i + 1 < argc;
+    if (arg == "--sim" && has_value) {
+      sim = argv[++i];
+    } else if (arg == "--trials" && has_value) {
+      trials = std::atoi(argv[++i]);
+    } else if (arg == "--jobs" && has_value) {
+      jobs = std::atoi(argv[++i]);
+    } else if (arg == "--seed" && has_value) {
+      seed = std::atoi(argv[++i]);
+    } else if (arg == "--battery" && has_value) {
+      ok &= parse_range(argv[++i], battery);
+    } else if (arg == "--friction" && has_value) {
+      ok &= parse_range(argv[++i], friction);
+    } else if (arg == "--noise" && has_value) {
+      ok &= parse_range(argv[++i], noise);
+    } else {
+      files.push_back(arg);
+    }
+  }
+  if (!ok || files.size() < 2) {
+    std::cerr << "usage: " << argv[0]
+              << " [options] <params.txt> <maze.txt>..." << std::endl
+              << "options: --sim <kerise_sim> --trials N --jobs N --seed N"
+              << std::endl
+              << "         --battery lo:hi --friction lo:hi --noise lo:hi"
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+  /* パラメータの組 (1 行に key=value を空白区切りで並べる) */
+  std::vector<std::string> sets;
+  std::ifstream ifs(files[0]);
+  for (std::string line; std::getline(ifs, line);) {
+    if (line.empty() || line[0] == '#') continue;
+    sets.push_back(line);
+  }
+  const std::vector<std::string> mazes(files.begin() + 1, files.end());
+  if (sets.empty()) {
+    std::cerr << "no parameter set in " << files[0] << std::endl;
+    return EXIT_FAILURE;
+  }
+  /* 走行の一覧 (乱数は走行ごとに固定するので，並列度によらず同じ結果) */
+  std::mt19937 rng(seed);
+  auto uniform = [&](const Range& r) {
+    return std::uniform_real_distribution<float>(r.lo, r.hi)(rng);
+  };
+  std::vector<Job> job_list;
+  for (int s = 0; s < int(sets.size()); ++s) {
+    for (int m = 0; m < int(mazes.size()); ++m) {
+      for (int t = 0; t < trials; ++t) {
+        std::ostringstream oss;
+        oss << quote(sim) << " " << quote(mazes[m]) << " " << sets[s]
+            << " seed=" << rng() << " battery=" << uniform(battery)
+            << " friction=" << uniform(friction)
+            << " noise=" << uniform(noise) << " 2>/dev/null";
+        job_list.push_back({s, m, oss.str()});
+      }
+    }
+  }
+  /* 実行 */
+  std::vector<Result> results(job_list.size());
+  std::atomic<int> done{0};
+  sim::WorkStealingPool pool(jobs);
+  for (size_t i = 0; i < job_list.size(); ++i) {
+    pool.push([&, i] {
+      results[i] = run(job_list[i].cmd);
+      const int n = ++done;
+      if (n % 100 == 0 || n == int(job_list.size()))
+        std::fprintf(stderr, "\r%d / %d", n, int(job_list.size()));
+    });
+  }
+  pool.run();
+  std::fprintf(stderr, "\n");
+  /* 集計 */
+  std::vector<Summary> summaries(sets.size());
+  for (int s = 0; s < int(sets.size()); ++s) {
+    auto& sm = summaries[s];
+    for (int m = 0; m < int(mazes.size()); ++m) {
+      int n = 0;
+      float sum = 0;
+      for (size_t i = 0; i < job_list.size(); ++i) {
+        if (job_list[i].set != s || job_list[i].maze != m) continue;
+        sm.trials++;
+        if (!results[i].success) continue;
+        sm.successes++, n++;
+        sum += results[i].time;
+      }
+      sm.time += n ? sum / n : std::numeric_limits<float>::infinity();
+    }
+    sm.p_success = float(sm.successes) / std::max(1, sm.trials);
+    sm.p_lower = wilson_lower(sm.successes, sm.trials);
+  }
+  /* 成功確率と時間のパレート最適な組 */
+  for (auto& a : summaries) {
+    a.frontier = std::isfinite(a.time);
+    for (const auto& b : summaries) {
+      if (b.p_success >= a.p_success && b.time <= a.time &&
+          (b.p_success > a.p_success || b.time < a.time))
+        a.frontier = false;
+    }
+  }
+  /* 出力 (時間の短い順) */
+  std::vector<int> order(sets.size());
+  for (int i = 0; i < int(order.size()); ++i) order[i] = i;
+  std::sort(order.begin(), order.end(), [&](int a, int b) {
+    return summaries[a].time < summaries[b].time;
+  });
+  std::printf("p_success\tp_lower\ttime\tfrontier\tparams\n");
+  for (const int s : order) {
+    const auto& sm = summaries[s];
+    std::printf("%.3f\t%.3f\t%.3f\t%s\t%s\n", sm.p_success, sm.p_lower,
+                sm.time, sm.frontier ? "*" : "", sets[s].c_str());
+  }
+  return 0;
+}
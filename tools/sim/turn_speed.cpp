@@ -0,0 +1,110 @@
+/**
+ * @file turn_speed.cpp
+ * @brief Host Test of the Friction Circle Based Turn Speed Solver
+ * @author Ryotaro Onuki <kerikun11+github@gmail.com>
+ * @date 2024-02-04
+ * @copyright Copyright 2024 Ryotaro Onuki <kerikun11+github@gmail.com>
+ */
+/*
+ * field::shapes の各スラロームを左右に細かい刻みで追い，両輪の合成加速度
+ * (横: dth v_w，前後: +-R ddth，v_w = v +- R dth) を独立に求めて
+ * utils::TurnSpeedSolver と比べる．R は model::RotationRadius．
+ *
+ * - grip: MoveAction::set_turn_aggression() と同じく，摩擦円の半径
+ *   a_grip = aggression * model::grip_acceleration から求めた速度で走った
+ *   ときの合成加速度のピークが a_grip に一致すること (超えれば滑り，
+ *   下回れば遅い)．
+ * - scale: 基準速度の 0.5..2 倍の速度でのピークが getPeakAcceleration()
+ *   に一致すること (ピークが速度の 2 乗に比例するという前提の確認)．
+ *
+ * 形状ごとに，以前の一律の速度 (Shape::v_ref) で要る合成加速度と，求めた
+ * 速度も出力する．どれかを満たさなければ失敗で終了する．
+ */
+#include <algorithm>  //< for std::max
+#include <array>      //< for field::shapes
+#include <cmath>
+#include <cstdint>  //< for config/model.h
+#include <cstdio>
+#include <cstdlib>
+
+#include "config/model.h"
+#include "config/slalom_shapes.h"
+#include "utils/turn_speed_solver.hpp"
+
+namespace {
+
+constexpr const char* kShapeNames[field::ShapeIndexMax] = {
+    "S90", "F45", "F90", "F135", "F180", "FV90", "FS90",
+};
+constexpr int kSamples = 20000;      //< ターン 1 回の標本点の数
+constexpr float kTolerance = 5e-3f;  //< ピークの相対誤差の上限
+constexpr float kRotationRadius = model::RotationRadius;
+
+/**
+ * @brief 速度 v で走ったときの両輪の合成加速度のピーク [mm/s/s]
+ */
+float simulate(const ctrl::slalom::Shape& shape, const bool mirror_x,
+               const float v) {
+  ctrl::slalom::Trajectory st(shape, mirror_x);
+  st.reset(v);
+  const float t_curve = st.getTimeCurve();
+  float a_peak = 0;
+  for (int i = 0; i <= kSamples; ++i) {
+    ctrl::State s;
+    st.update(s, t_curve * i / kSamples, 0);
+    for (const float sg : {-1.0f, 1.0f}) {
+      const float v_w = v + sg * kRotationRadius * s.dq.th;  //< 車輪の速度
+      const float a_lat = s.dq.th * v_w;
+      const float a_lon = sg * kRotationRadius * s.ddq.th;
+      a_peak = std::max(a_peak, std::hypot(a_lat, a_lon));
+    }
+  }
+  return a_peak;
+}
+
+float rel(const float a, const float b) { return std::abs(a / b - 1); }
+
+}  // namespace
+
+int main() {
+  const float aggressions[] = {0.6f, 0.8f, 1.0f};
+  const float scales[] = {0.5f, 1.0f, 1.5f, 2.0f};
+  const float a_grip_model = model::grip_acceleration;
+  int failures = 0;
+  float worst_grip = 0, worst_scale = 0;
+  std::printf("a_grip %.0f [mm/s/s]\tR %.2f [mm]\n", a_grip_model,
+              kRotationRadius);
+  std::printf("shape\tv_ref [mm/s]\ta at v_ref [mm/s/s]\t"
+              "v (aggression 0.6, 0.8, 1.0) [mm/s]\tgrip error [%%]\t"
+              "scale error [%%]\n");
+  for (int si = 0; si < field::ShapeIndexMax; ++si) {
+    const auto& shape = field::shapes[si];
+    const utils::TurnSpeedSolver solver(shape, kRotationRadius);
+    float grip = 0, scale = 0;
+    float v_solved[3];
+    for (int ai = 0; ai < 3; ++ai) {
+      const float a_grip = aggressions[ai] * a_grip_model;
+      v_solved[ai] = solver.getMaxVelocity(a_grip);
+      for (const bool mirror_x : {false, true})
+        grip = std::max(grip, rel(simulate(shape, mirror_x, v_solved[ai]),
+                                  a_grip));
+    }
+    for (const auto k : scales) {
+      const float v = shape.v_ref * k;
+      for (const bool mirror_x : {false, true})
+        scale = std::max(scale, rel(simulate(shape, mirror_x, v),
+                                    solver.getPeakAcceleration(v)));
+    }
+    const bool ok = grip < kTolerance && scale < kTolerance;
+    std::printf("%s\t%.0f\t%.0f\t%.0f, %.0f, %.0f\t%.3f\t%.3f%s\n",
+                kShapeNames[si], shape.v_ref,
+                simulate(shape, false, shape.v_ref), v_solved[0], v_solved[1],
+                v_solved[2], grip * 1e2, scale * 1e2, ok ? "" : "\tNG");
+    failures += !ok;
+    worst_grip = std::max(worst_grip, grip);
+    worst_scale = std::max(worst_scale, scale);
+  }
+  std::printf("worst\tgrip %.3f %%\tscale %.3f %%\tfailures: %d\n",
+              worst_grip * 1e2, worst_scale * 1e2, failures);
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,314 @@
+/**
+ * @file velocity_planner.cpp
+ * @brief Host Test of the Whole Path Velocity Planner
+ * @author Ryotaro Onuki <kerikun11+github@gmail.com>
+ * @date 2024-02-04
+ * @copyright Copyright 2024 Ryotaro Onuki <kerikun11+github@gmail.com>
+ */
+/*
+ * 16x16 と 32x32 の迷路の最短経路に似せたランダムな経路 (直線と
+ * field::shapes のターンの列．MoveAction::fast_run_plan() と同じく，
+ * ターンの前後の直線を足す) を utils::VelocityPlanner で計画し，次を
+ * 確かめる．
+ *
+ * - limits: 直線ごとに計画 (v_start, v_max, v_end) から躍度一定の区間の列を
+ *   組み立てて (躍度は ±j_max か 0) 厳密に積分し，加速度と速度が制約を
+ *   超えないこと，終端の速度，移動距離，所要時間が計画と一致すること．ターンは等速で
+ *   速度の上限以下，区間の境界で速度が連続し，静止から静止までであること．
+ * - maximal: どの境界の速度も (つながったターンとともに) 1 % 上げると
+ *   どれかの直線で加減速が間に合わなくなること (上限に達した境界を除く)．
+ * - sequential: 計画の所要時間が，次のターンの速度だけを見る従来の逐次
+ *   実行の見積もり (estimate_sequential_time()) 以下であること．逐次実行
+ *   は減速が間に合わないと速度の上限を超えてターンに入り (overspeed)，
+ *   その分だけ速く見えるので，overspeed のない経路のみ比べる．
+ *
+ * どれかを満たさなければ失敗で終了する．
+ */
+#include <algorithm>  //< for std::max, std::min
+#include <array>      //< for field::shapes
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>  //< for std::atoi
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "config/field.h"
+#include "config/slalom_shapes.h"
+#include "utils/slalom_table.hpp"
+#include "utils/velocity_planner.hpp"
+
+namespace {
+
+using Planner = utils::VelocityPlanner;
+using Segment = Planner::Segment;
+
+constexpr double kRelTolerance = 1e-3;  //< 距離と時間の相対誤差の上限
+constexpr double kVelocityTolerance = 1.0;  //< 速度の誤差の上限 [mm/s]
+
+/* 走行パラメータ (RunParameter の段階 0 付近から速い設定まで) */
+struct Setting {
+  Planner::Constraint c;
+  float turn_scale;  //< ターンの速度の Shape::v_ref に対する倍率
+};
+const Setting kSettings[] = {
+    {{240'000, 3600, 720}, 1.0f},
+    {{240'000, 6000, 1200}, 1.2f},
+    {{240'000, 9000, 2000}, 1.4f},
+};
+
+/* ターンの種類 (ShapeIndex) と，区画に沿う走行 (ortho) か斜めか */
+struct Turn {
+  field::ShapeIndex si;
+  bool from_diag, to_diag;
+};
+const Turn kTurns[] = {
+    {field::ShapeIndex::F90, false, false},
+    {field::ShapeIndex::F180, false, false},
+    {field::ShapeIndex::FS90, false, false},
+    {field::ShapeIndex::F45, false, true},
+    {field::ShapeIndex::F135, false, true},
+    {field::ShapeIndex::F45, true, false},
+    {field::ShapeIndex::F135, true, false},
+    {field::ShapeIndex::FV90, true, true},
+};
+
+/**
+ * @brief 迷路の大きさ n に合わせたランダムな経路を計画器に入れる
+ */
+void make_path(std::mt19937& rng, const int n, const Setting& s,
+               const std::vector<float>& k_times, Planner& planner) {
+  planner.clear();
+  const int turns = std::uniform_int_distribution<int>(n / 2, 3 * n)(rng);
+  bool diag = false;
+  /* 最初の直線 (MoveAction::fast_run_task() と同じ) */
+  float straight = field::kCellLengthFull / 2 - 20.0f;
+  for (int i = 0; i < turns; ++i) {
+    /* 直線 (半区画の倍数．長い直線は少ない) */
+    const int max_half = 2 * n - 1;
+    const int half = std::min(
+        max_half, int(std::exponential_distribution<float>(0.4f)(rng)));
+    const float cell = diag ? field::kCellLengthDiag : field::kCellLengthFull;
+    straight += half * cell / 2;
+    /* ターン (今の向きから出られるもの) */
+    std::vector<const Turn*> options;
+    for (const auto& t : kTurns)
+      if (t.from_diag == diag) options.push_back(&t);
+    const auto& t = *options[rng() % options.size()];
+    const bool reverse = t.from_diag && !t.to_diag;
+    const auto& shape = field::shapes[t.si];
+    straight += reverse ? shape.straight_post : shape.straight_prev;
+    planner.add_straight(straight);
+    planner.add_turn(t.si, rng() % 2, shape.v_ref * s.turn_scale,
+                     k_times[t.si]);
+    straight = reverse ? shape.straight_prev : shape.straight_post;
+    diag = t.to_diag;
+  }
+  /* 最後の直線 */
+  straight += (1 + rng() % 4) * field::kCellLengthFull / 2;
+  planner.add_straight(straight);
+  planner.plan();
+}
+
+/**
+ * @brief 速度変化 dv の躍度一定の区間 (躍度, 時間) の列
+ */
+std::vector<std::pair<double, double>> phases(const double dv,
+                                              const Planner::Constraint& c) {
+  const double j = c.j_max, a = c.a_max, sg = dv < 0 ? -1 : 1;
+  const double adv = std::abs(dv);
+  if (adv >= a * a / j)
+    return {{sg * j, a / j}, {0, adv / a - a / j}, {-sg * j, a / j}};
+  const double tau = std::sqrt(adv / j);
+  return {{sg * j, tau}, {-sg * j, tau}};
+}
+
+struct Check {
+  double a_peak = 0, v_peak = 0;
+  double v_error = 0;  //< 終端の速度の誤差 [mm/s]
+  double d_error = 0;  //< 移動距離の相対誤差
+  double t_error = 0;  //< 所要時間の相対誤差
+};
+
+/**
+ * @brief 直線の計画を躍度一定の区間に分けて厳密に積分する
+ */
+void integrate(const Segment& s, const Planner::Constraint& c, Check& k) {
+  std::vector<std::pair<double, double>> ps;
+  for (const auto& p : phases(s.v_max - s.v_start, c)) ps.push_back(p);
+  const auto down = phases(s.v_end - s.v_max, c);
+  const double d_ramps = [&] {
+    /* 巡航の距離は全体から加減速の距離を引いたもの */
+    double x = 0, v = s.v_start, a = 0;
+    for (const auto& list : {ps, down})
+      for (const auto& p : list) {
+        const double J = p.first, t = p.second;
+        x += v * t + a * t * t / 2 + J * t * t * t / 6;
+        v += a * t + J * t * t / 2;
+        a += J * t;
+      }
+    return x;
+  }();
+  const double d_cruise = s.distance - d_ramps;
+  if (d_cruise < -kRelTolerance * s.distance) {
+    k.d_error = std::max(k.d_error, -d_cruise / s.distance);
+  }
+  ps.push_back({0, std::max(0.0, d_cruise) / std::max(1.0f, s.v_max)});
+  for (const auto& p : down) ps.push_back(p);
+  double x = 0, v = s.v_start, a = 0, t_total = 0;
+  for (const auto& p : ps) {
+    const double J = p.first, t = p.second;
+    /* 区間の中の加速度と速度の極値は端点か a = 0 の点 */
+    const double a1 = a + J * t;
+    k.a_peak = std::max({k.a_peak, std::abs(a), std::abs(a1)});
+    double v_ext = std::max(v, v + a * t + J * t * t / 2);
+    if (J != 0) {
+      const double tz = -a / J;
+      if (tz > 0 && tz < t)
+        v_ext = std::max(v_ext, v + a * tz + J * tz * tz / 2);
+    }
+    k.v_peak = std::max(k.v_peak, v_ext);
+    x += v * t + a * t * t / 2 + J * t * t * t / 6;
+    v += a * t + J * t * t / 2;
+    a = a1;
+    t_total += t;
+  }
+  k.v_error = std::max(k.v_error, std::abs(v - s.v_end));
+  k.d_error = std::max(k.d_error, std::abs(x - s.distance) / s.distance);
+  k.t_error =
+      std::max(k.t_error, std::abs(t_total - s.t) / std::max(s.t, 1e-3f));
+}
+
+/**
+ * @brief 速度変化に必要な距離 (計画器と独立に)
+ */
+double required(const double v0, const double v1,
+                const Planner::Constraint& c) {
+  double t = 0;
+  for (const auto& p : phases(v1 - v0, c)) t += p.second;
+  return (v0 + v1) / 2 * t;
+}
+
+/**
+ * @brief 境界の速度の列 v が全ての直線で実現できるか
+ */
+bool feasible(const std::vector<Segment>& segs, const std::vector<double>& v,
+              const Planner::Constraint& c) {
+  for (size_t k = 0; k < segs.size(); ++k)
+    if (segs[k].type == Segment::Straight &&
+        required(v[k], v[k + 1], c) > segs[k].distance * (1 + 1e-4))
+      return false;
+  return true;
+}
+
+/**
+ * @brief 上限に達していない境界の速度を上げられる数 (0 なら最大)
+ */
+int raisable(const std::vector<Segment>& segs, const Planner::Constraint& c) {
+  const int n = segs.size();
+  std::vector<double> v(n + 1);
+  for (int k = 0; k < n; ++k) v[k] = segs[k].v_start;
+  v[n] = segs[n - 1].v_end;
+  int count = 0;
+  for (int k = 1; k < n; ++k) {
+    /* 境界 k とつながったターンの境界を同時に上げる */
+    int lo = k, hi = k;
+    while (lo > 0 && segs[lo - 1].type == Segment::Turn) --lo;
+    while (hi < n && segs[hi].type == Segment::Turn) ++hi;
+    double cap = c.v_max;
+    for (int i = lo; i < hi; ++i)
+      cap = std::min<double>(cap, segs[i].v_limit);
+    if (v[k] >= cap - kVelocityTolerance) continue;
+    auto w = v;
+    const double raised = std::min(cap, v[k] * 1.01 + 1);
+    for (int i = lo; i <= hi; ++i) w[i] = raised;
+    count += feasible(segs, w, c);
+  }
+  return count;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  /* 引数 */
+  int paths = 200;
+  uint32_t seed = 0;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const bool has_value = i + 1 < argc;
+    if (arg == "--paths" && has_value) {
+      paths = std::atoi(argv[++i]);
+    } else if (arg == "--seed" && has_value) {
+      seed = std::atoi(argv[++i]);
+    } else {
+      std::cerr << "usage: " << argv[0] << " [--paths n --seed n]"
+                << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  /* ターンの所要時間と速度の積 (MoveAction::calc_slalom_k_time() と同じ) */
+  std::vector<float> k_times;
+  for (const auto& shape : field::shapes)
+    k_times.push_back(utils::SlalomTable(shape).getTimeCurve(shape.v_ref) *
+                      shape.v_ref);
+  int failures = 0;
+  std::printf("maze\tv_max\ta_max\tturn\tpaths\tplanned [s]\t"
+              "sequential [s]\tsaving [%%]\toverspeed\tcompared\ta peak\t"
+              "v peak\tv error\td error\tt error\traisable\n");
+  for (const int n : {16, 32}) {
+    for (const auto& s : kSettings) {
+      std::mt19937 rng(seed + n);
+      double t_plan = 0, t_seq = 0;
+      int overspeed_sum = 0, raisable_sum = 0, worse = 0, broken = 0;
+      int feasible_sum = 0;  //< 逐次実行が制約を破らない経路の数
+      Check k;
+      for (int p = 0; p < paths; ++p) {
+        Planner planner(s.c);
+        make_path(rng, n, s, k_times, planner);
+        const auto& segs = planner.get_segments();
+        int overspeed = 0;
+        const float tp = planner.get_total_time();
+        const float ts = planner.estimate_sequential_time(&overspeed);
+        overspeed_sum += overspeed;
+        /* 逐次実行が制約を破らない経路のみ比べる */
+        if (!overspeed) {
+          t_plan += tp, t_seq += ts;
+          worse += tp > ts * (1 + kRelTolerance);
+          feasible_sum++;
+        }
+        /* 境界の速度と制約 */
+        for (size_t i = 0; i < segs.size(); ++i) {
+          const auto& g = segs[i];
+          const float v_prev = i ? segs[i - 1].v_end : 0;
+          broken += std::abs(g.v_start - v_prev) > kVelocityTolerance;
+          if (g.type == Segment::Turn)
+            broken += std::abs(g.v_end - g.v_start) > kVelocityTolerance ||
+                      g.v_start > g.v_limit + kVelocityTolerance;
+          else
+            integrate(g, s.c, k);
+        }
+        broken += segs.empty() || segs.back().v_end > kVelocityTolerance;
+        raisable_sum += raisable(segs, s.c);
+      }
+      const bool ok = !worse && !broken && !raisable_sum &&
+                      k.a_peak <= s.c.a_max * (1 + kRelTolerance) &&
+                      k.v_peak <= s.c.v_max + kVelocityTolerance &&
+                      k.v_error < kVelocityTolerance &&
+                      k.d_error < kRelTolerance && k.t_error < kRelTolerance;
+      std::printf("%dx%d\t%.0f\t%.0f\t%.1f\t%d\t%.3f\t%.3f\t%.2f\t%.2f\t"
+                  "%d\t%.0f\t%.0f\t%.3f\t%.1e\t%.1e\t%d%s\n",
+                  n, n, s.c.v_max, s.c.a_max, s.turn_scale, paths,
+                  t_plan / feasible_sum, t_seq / feasible_sum,
+                  100 * (1 - t_plan / t_seq), double(overspeed_sum) / paths,
+                  feasible_sum, k.a_peak, k.v_peak, k.v_error, k.d_error,
+                  k.t_error, raisable_sum, ok ? "" : "\tNG");
+      if (!ok)
+        std::printf("\tworse than sequential %d\tbroken boundaries %d\n",
+                    worse, broken);
+      failures += !ok;
+    }
+  }
+  std::printf("failures: %d\n", failures);
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,97 @@
+/**
+ * @file wall_bench.cpp
+ * @brief Equivalence Check and Benchmark of WallDetector::ref2dist
+ * @author Ryotaro Onuki <kerikun11+github@gmail.com>
+ * @date 2024-02-04
+ * @copyright Copyright 2024 Ryotaro Onuki <kerikun11+github@gmail.com>
+ *
+ * WallDetector::ref2dist() の表が std::log2 で計算した値と一致することを
+ * リフレクタのとりうる全ての値とパラメータの変更の前後で確かめ，
+ * WallDetector::update() の実行時間を測る．
+ */
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>  //< for std::_Exit, std::atoi
+#include <cstring>  //< for std::memcmp
+#include <string>
+
+#include "peripheral/partition.h"
+#include "sim/world.hpp"
+#include "supporters/supporters.h"
+
+namespace {
+
+/**
+ * @brief 表を使わない変換 (WallDetector の以前の実装)
+ */
+float ref2dist_log2(const int16_t value) {
+  const auto& p = config::parameters();
+  const float gain =
+      -p.ref_max_length_mm / std::log2(float(p.ref_saturation_value));
+  return gain * std::log2(float(value));
+}
+
+/**
+ * @return 一致しなかった値の数 (NaN どうしは一致とみなす)
+ */
+int check(const WallDetector& wd) {
+  int mismatch = 0;
+  for (int v = -256; v < WallDetector::REF2DIST_TABLE_SIZE + 256; ++v) {
+    const float a = wd.ref2dist(v), b = ref2dist_log2(v);
+    if (std::isnan(a) && std::isnan(b)) continue;
+    if (std::memcmp(&a, &b, sizeof(a)) == 0) continue;
+    if (mismatch++ < 8)
+      std::printf("mismatch: %d %.9g %.9g\n", v, double(a), double(b));
+  }
+  return mismatch;
+}
+
+template <typename F>
+double measure_ns(const int count, F f) {
+  const auto t = std::chrono::steady_clock::now();
+  for (int i = 0; i < count; ++i) f(i);
+  const auto d = std::chrono::steady_clock::now() - t;
+  return std::chrono::duration<double, std::nano>(d).count() / count;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  const int count = argc > 1 ? std::atoi(argv[1]) : 1000000;
+  if (count <= 0) {
+    std::fprintf(stderr, "usage: %s [count]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  /* 1 区画の箱の中央に置く (リフレクタに壁が見える) */
+  auto& world = sim::world();
+  world.set_field(sim::Field(1));
+  world.set_pose(sim::Field::kCell / 2, sim::Field::kCell / 2, M_PI / 2);
+  peripheral::record_store().mount();
+  auto* hw = new hardware::Hardware();
+  hw->init();
+  auto* sp = new supporters::Supporters(hw);
+  auto* wd = sp->wd;
+  /* 表と計算の一致 (パラメータを変えると表を作り直す) */
+  int mismatch = check(*wd);
+  config::parameter_store().set("ref_max_length_mm", "60");
+  config::parameter_store().set("ref_saturation_value", "2500");
+  mismatch += check(*wd);
+  std::printf("equivalence: %s (%d mismatches)\n", mismatch ? "NG" : "OK",
+              mismatch);
+  /* 変換 1 回と update() 1 回の時間 */
+  volatile float sink = 0;
+  const double table_ns = measure_ns(count, [&](const int i) {
+    sink = sink + wd->ref2dist(i & (WallDetector::REF2DIST_TABLE_SIZE - 1));
+  });
+  const double log2_ns = measure_ns(count, [&](const int i) {
+    sink = sink + ref2dist_log2(i & (WallDetector::REF2DIST_TABLE_SIZE - 1));
+  });
+  const double update_ns = measure_ns(count, [&](int) { wd->update(); });
+  std::printf("ref2dist: table %.1f [ns], log2 %.1f [ns]\n", table_ns,
+              log2_ns);
+  std::printf("update: %.1f [ns]\n", update_ns);
+  std::fflush(stdout);
+  /* タスクは終わらないので後始末をせずに終了する */
+  std::_Exit(mismatch ? EXIT_FAILURE : EXIT_SUCCESS);
+}
@@ -0,0 +1,416 @@
+/**
+ * @file wall_classify.cpp
+ * @brief Host Test of the Wall Classifier
+ * @author Ryotaro Onuki <kerikun11+github@gmail.com>
+ * @date 2024-02-04
+ * @copyright Copyright 2024 Ryotaro Onuki <kerikun11+github@gmail.com>
+ */
+/*
+ * WallDetector の対数オッズによる壁の判定 (utils::WallClassifier) と，
+ * 従来の閾値とヒステリシスによる判定の誤り率を比べる．
+ *
+ * - シミュレータ: 壁をランダムに置いた通路を探索の速さで直進し，
+ *   区画の境界の手前 (探索の先読みの範囲) で壁を読む．
+ *   リフレクタと ToF の雑音と読み落としの大きさを変えて試す．
+ * - ログ: tools/wall/data の LOG_WALL のログを再生し，雑音と読み落としを
+ *   加えて判定する．正解は雑音を加える前の値の前後の中央値で決め，
+ *   正解が前後で変わる (境目の) 標本は数えない．
+ *
+ * 雑音を加えた条件で従来より誤りが多ければ失敗で終了する．
+ */
+#include <algorithm>  //< for std::sort, std::nth_element
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>  //< for std::_Exit, std::atoi
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "peripheral/partition.h"
+#include "sim/world.hpp"
+#include "supporters/supporters.h"
+#include "utils/wall_classifier.hpp"
+
+namespace {
+
+using Classifier = utils::WallClassifier;
+
+/**
+ * @brief 従来の判定 (ToF は ±5 %, 横壁は ±3 % のヒステリシス)
+ */
+struct Legacy {
+  bool side[2] = {false, false};
+  bool front = false;
+
+  void update(const Classifier::Input& in) {
+    const float front_threshold = WallDetector::wall_threshold_front;
+    const float side_threshold = WallDetector::wall_threshold_side;
+    if (!in.tof_valid)
+      front = false;
+    else if (in.tof_mm < front_threshold * 0.95f)
+      front = true;
+    else if (in.tof_mm > front_threshold * 1.05f)
+      front = false;
+    for (int i = 0; i < 2; i++) {
+      if (in.side[i] < side_threshold * 0.97f)
+        side[i] = true;
+      else if (in.side[i] > side_threshold * 1.03f)
+        side[i] = false;
+    }
+  }
+};
+
+/* 誤りの集計 [left, front, right] */
+struct Count {
+  int total[3] = {0, 0, 0};
+  int legacy[3] = {0, 0, 0};
+  int evidence[3] = {0, 0, 0};
+
+  void push(const int i, const bool truth, const bool legacy_wall,
+            const bool evidence_wall) {
+    total[i]++;
+    legacy[i] += legacy_wall != truth;
+    evidence[i] += evidence_wall != truth;
+  }
+  int sum(const int* c) const { return c[0] + c[1] + c[2]; }
+  void print(const char* source, const char* condition) const {
+    static const char* names[3] = {"left", "front", "right"};
+    for (int i = 0; i < 3; ++i)
+      std::printf("%s\t%s\t%s\t%d\t%.3f\t%.3f\n", source, condition, names[i],
+                  total[i], 100.0 * legacy[i] / std::max(total[i], 1),
+                  100.0 * evidence[i] / std::max(total[i], 1));
+  }
+};
+
+/* 雑音の条件 */
+struct Noise {
+  const char* name;
+  float reflector_noise;    //< リフレクタの値に対する標準偏差の比
+  float reflector_dropout;  //< リフレクタの値が 1 になる確率
+  float tof_noise;          //< ToF の標準偏差 [mm]
+  float tof_dropout;        //< ToF の測距に失敗する確率
+};
+
+/**
+ * @brief シミュレータ: 1 区画を直進し，境界の手前で壁を読む
+ *
+ * 北向きに列 1 を進み，区画 (1, 0) の中央から (1, 1) との境界に向かう．
+ * 読む壁は区画 (1, 1) の西 (左)，北 (前)，東 (右)．
+ */
+void simulate(WallDetector* wd, hardware::Hardware* hw, std::mt19937& rng,
+              const float v, Legacy& legacy, Count& count) {
+  auto& world = sim::world();
+  std::uniform_real_distribution<float> uniform(0, 1);
+  sim::Field field(3);
+  for (int y = 0; y < 3; ++y) {
+    field.set_wall(1, y, sim::Field::West, uniform(rng) < 0.5f);
+    field.set_wall(1, y, sim::Field::East, uniform(rng) < 0.5f);
+  }
+  field.set_wall(1, 0, sim::Field::North, false);
+  field.set_wall(1, 1, sim::Field::North, uniform(rng) < 0.5f);
+  world.set_field(field);
+  /* 横位置と向きのずれ，読む位置 (境界の手前 0 から 5 mm) */
+  const float cx = sim::Field::kCell * 3 / 2;
+  const float dx = 6 * (uniform(rng) - 0.5f);
+  const float dth = 0.06f * (uniform(rng) - 0.5f);
+  const float y_end = sim::Field::kCell - 5 * uniform(rng);
+  for (float y = sim::Field::kCell / 2; y < y_end; y += v * 1e-3f) {
+    world.set_pose(cx + dx, y, M_PI / 2 + dth);
+    vTaskDelay(pdMS_TO_TICKS(1));
+    wd->update();
+    Classifier::Input in;
+    in.side = {wd->getWallDistanceSide(0), wd->getWallDistanceSide(1)};
+    in.front = {wd->getWallDistanceFront(0), wd->getWallDistanceFront(1)};
+    in.tof_mm = hw->tof->getDistance();
+    in.tof_valid = hw->tof->isValid();
+    in.tof_updated = false;  //< 従来の判定では使わない
+    legacy.update(in);
+  }
+  const auto walls = wd->getWalls();
+  count.push(0, field.is_wall(1, 1, sim::Field::West), legacy.side[0],
+             walls.left);
+  count.push(1, field.is_wall(1, 1, sim::Field::North), legacy.front,
+             walls.front);
+  count.push(2, field.is_wall(1, 1, sim::Field::East), legacy.side[1],
+             walls.right);
+}
+
+/* ログの 1 回の走行 (WallDetector::update() の入力の列) */
+struct Log {
+  std::string file;
+  std::vector<std::array<bool, 3>> truth;   //< [left, front, right]
+  std::vector<bool> stable;                 //< 正解が前後で変わらない
+  std::vector<std::array<int16_t, 4>> raw;  //< [SL, SR, FL, FR]
+  std::vector<float> tof;                   //< 無効なら NAN
+};
+
+float median(std::vector<float> v) {
+  if (v.empty()) return NAN;
+  std::nth_element(v.begin(), v.begin() + v.size() / 2, v.end());
+  return v[v.size() / 2];
+}
+
+/**
+ * @brief LOG_WALL のログを読む
+ *
+ * 横の距離は走り始めの静止中 (区画の中央) を 0 とし，前の距離は止まった
+ * ときの ToF の値から区画の中央 (ToF が 45 mm) での値を 0 とする．
+ */
+bool load_log(const std::string& file, Log& log) {
+  std::ifstream ifs(file);
+  if (!ifs) return false;
+  std::vector<std::string> names;
+  std::vector<std::vector<float>> rows;
+  for (std::string line; std::getline(ifs, line);) {
+    if (line.empty() || line[0] == '#') continue;
+    std::istringstream iss(line);
+    if (names.empty()) {
+      for (std::string s; std::getline(iss, s, '\t');) names.push_back(s);
+      continue;
+    }
+    std::vector<float> row;
+    for (std::string s; std::getline(iss, s, '\t');)
+      row.push_back(std::stof(s));
+    if (row.size() == names.size()) rows.push_back(row);
+  }
+  auto column = [&](const char* name) {
+    return int(std::find(names.begin(), names.end(), name) - names.begin());
+  };
+  const int n = names.size();
+  const int sl = column("ref_0"), fl = column("ref_1");
+  const int fr = column("ref_2"), sr = column("ref_3");
+  const int tof = column("tof");
+  if (sl >= n || fl >= n || fr >= n || sr >= n || tof >= n) return false;
+  const int rest = 50;
+  if (int(rows.size()) < 4 * rest) return false;
+  /* ToF は読み取りの上限 (250 mm 以上) を範囲外とする */
+  log.file = file;
+  for (const auto& r : rows) {
+    log.raw.push_back({int16_t(r[sl]), int16_t(r[sr]), int16_t(r[fl]),
+                       int16_t(r[fr])});
+    log.tof.push_back(r[tof] < 250 ? r[tof] : NAN);
+  }
+  return true;
+}
+
+/**
+ * @brief 生の値から WallClassifier の入力の列を作る
+ */
+std::vector<Classifier::Input> to_inputs(const WallDetector& wd,
+                                         const Log& log,
+                                         const std::array<float, 4>& u0) {
+  std::vector<Classifier::Input> inputs;
+  float tof_prev = NAN;
+  for (size_t t = 0; t < log.raw.size(); ++t) {
+    Classifier::Input in;
+    for (int i = 0; i < 2; ++i) {
+      in.side[i] = wd.ref2dist(log.raw[t][i]) - u0[i];
+      in.front[i] = wd.ref2dist(log.raw[t][2 + i]) - u0[2 + i];
+    }
+    in.tof_valid = !std::isnan(log.tof[t]);
+    in.tof_mm = in.tof_valid ? log.tof[t] : 255;
+    in.tof_updated = in.tof_valid && log.tof[t] != tof_prev;
+    tof_prev = log.tof[t];
+    inputs.push_back(in);
+  }
+  return inputs;
+}
+
+/**
+ * @brief 較正の基準 (ref2dist() の値) と正解を決める
+ */
+void label_log(const WallDetector& wd, Log& log, std::array<float, 4>& u0) {
+  const int rest = 50, window = 10, margin = 20;
+  const int size = log.raw.size();
+  for (int i = 0; i < 2; ++i) {
+    std::vector<float> u;
+    for (int t = 0; t < rest; ++t) u.push_back(wd.ref2dist(log.raw[t][i]));
+    u0[i] = median(u);
+  }
+  std::vector<float> tofs;
+  for (int t = size - rest; t < size; ++t)
+    if (!std::isnan(log.tof[t])) tofs.push_back(log.tof[t]);
+  const float tof_rest = median(tofs);
+  for (int i = 0; i < 2; ++i) {
+    std::vector<float> u;
+    for (int t = size - rest; t < size; ++t)
+      u.push_back(wd.ref2dist(log.raw[t][2 + i]));
+    u0[2 + i] = median(u) - (tof_rest - sim::Field::kCell / 2);
+  }
+  /* 正解: 前後の中央値 (前壁は ToF の測距を 3 回分) */
+  const auto inputs = to_inputs(wd, log, u0);
+  log.truth.assign(size, {false, false, false});
+  for (int t = 0; t < size; ++t) {
+    std::vector<float> s[2], f;
+    for (int k = std::max(0, t - window); k <= std::min(size - 1, t + window);
+         ++k)
+      for (int i = 0; i < 2; ++i) s[i].push_back(inputs[k].side[i]);
+    for (int k = std::max(0, t - 3 * window);
+         k <= std::min(size - 1, t + 3 * window); ++k)
+      f.push_back(inputs[k].tof_valid ? inputs[k].tof_mm : 255);
+    log.truth[t] = {median(s[0]) < WallDetector::wall_threshold_side,
+                    median(f) < WallDetector::wall_threshold_front,
+                    median(s[1]) < WallDetector::wall_threshold_side};
+  }
+  log.stable.assign(size, false);
+  for (int t = margin; t + margin < size; ++t) {
+    bool stable = true;
+    for (int k = t - margin; k <= t + margin; ++k)
+      stable = stable && log.truth[k] == log.truth[t];
+    log.stable[t] = stable;
+  }
+}
+
+/**
+ * @brief ログを雑音を加えて再生する
+ */
+void replay(const WallDetector& wd, const Log& log,
+            const std::array<float, 4>& u0, const Noise& noise,
+            std::mt19937& rng, Count& count) {
+  std::normal_distribution<float> normal(0, 1);
+  std::uniform_real_distribution<float> uniform(0, 1);
+  Log noisy = log;
+  for (auto& r : noisy.raw) {
+    for (auto& v : r) {
+      const float value = v * (1 + noise.reflector_noise * normal(rng));
+      v = std::max(1.0f, std::min(value, 4095.0f));
+      if (uniform(rng) < noise.reflector_dropout) v = 1;
+    }
+  }
+  /* ToF: 値が変わるところを測距とし，失敗したら次の測距まで範囲外 */
+  float tof_prev = NAN, tof_noisy = NAN;
+  for (auto& t : noisy.tof) {
+    const bool updated = !std::isnan(t) && t != tof_prev;
+    tof_prev = t;
+    if (std::isnan(t)) {
+      tof_noisy = NAN;
+    } else if (updated) {
+      tof_noisy = uniform(rng) < noise.tof_dropout
+                      ? NAN
+                      : std::round(t + noise.tof_noise * normal(rng));
+    }
+    t = tof_noisy;
+  }
+  const auto inputs = to_inputs(wd, noisy, u0);
+  Legacy legacy;
+  Classifier classifier;
+  for (size_t t = 0; t < inputs.size(); ++t) {
+    legacy.update(inputs[t]);
+    classifier.update(inputs[t]);
+    if (!log.stable[t]) continue;
+    count.push(0, log.truth[t][0], legacy.side[0], classifier.side(0).wall());
+    count.push(1, log.truth[t][1], legacy.front, classifier.front().wall());
+    count.push(2, log.truth[t][2], legacy.side[1], classifier.side(1).wall());
+  }
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  /* 引数 */
+  int trials = 1000;
+  int repeats = 20;
+  float v = 330;
+  std::string ref_max_length = "90", ref_saturation = "3600";
+  std::vector<std::string> files;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const bool has_value = i + 1 < argc;
+    if (arg == "--trials" && has_value) {
+      trials = std::atoi(argv[++i]);
+    } else if (arg == "--repeats" && has_value) {
+      repeats = std::atoi(argv[++i]);
+    } else if (arg == "--velocity" && has_value) {
+      v = std::atof(argv[++i]);
+    } else if (arg == "--ref-max-length" && has_value) {
+      ref_max_length = argv[++i];
+    } else if (arg == "--ref-saturation" && has_value) {
+      ref_saturation = argv[++i];
+    } else if (arg.rfind("--", 0) == 0) {
+      std::cerr << "usage: " << argv[0] << " [wall_log.csv...]"
+                << " [--trials n --repeats n --velocity mm/s"
+                << " --ref-max-length mm --ref-saturation value]" << std::endl;
+      return EXIT_FAILURE;
+    } else {
+      files.push_back(arg);
+    }
+  }
+  const Noise noises[] = {
+      {"nominal", 0.02f, 0.0f, 1.0f, 0.0f},
+      {"noisy", 0.1f, 0.02f, 3.0f, 0.1f},
+      {"dropout", 0.02f, 0.05f, 1.0f, 0.3f},
+  };
+  /* 機体 (シミュレータのリフレクタに合わせ，update() を直接呼ぶ) */
+  config::parameter_store().set("ref_max_length_mm", ref_max_length);
+  config::parameter_store().set("ref_saturation_value", ref_saturation);
+  peripheral::record_store().mount();
+  auto* hw = new hardware::Hardware();
+  hw->init();
+  auto* sp = new supporters::Supporters(hw);
+  auto* wd = sp->wd;
+  auto& world = sim::world();
+  {
+    /* 両側と前に壁のある区画の中央で較正する */
+    sim::Field field(3);
+    for (int y = 0; y < 3; ++y) {
+      field.set_wall(1, y, sim::Field::West, true);
+      field.set_wall(1, y, sim::Field::East, true);
+    }
+    field.set_wall(1, 0, sim::Field::North, true);
+    world.set_field(field);
+    world.set_pose(sim::Field::kCell * 3 / 2, sim::Field::kCell / 2, M_PI / 2);
+    wd->calibration_side();
+    wd->calibration_front();
+  }
+  int failures = 0;
+  std::printf("source\tcondition\twall\tsamples\t"
+              "legacy error [%%]\tevidence error [%%]\n");
+  for (const auto& noise : noises) {
+    auto p = world.get_parameter();
+    p.reflector_noise = noise.reflector_noise;
+    p.reflector_dropout = noise.reflector_dropout;
+    p.tof_noise = noise.tof_noise;
+    p.tof_dropout = noise.tof_dropout;
+    world.set_parameter(p);
+    std::mt19937 rng(1);
+    Legacy legacy;
+    Count count;
+    for (int i = 0; i < trials; ++i) simulate(wd, hw, rng, v, legacy, count);
+    count.print("sim", noise.name);
+    if (noise.reflector_dropout > 0 &&
+        count.sum(count.evidence) > count.sum(count.legacy))
+      failures++;
+  }
+  /* ログ (機体のパラメータは引数で合わせる) */
+  std::vector<Log> logs;
+  std::vector<std::array<float, 4>> u0s;
+  for (const auto& file : files) {
+    Log log;
+    std::array<float, 4> u0;
+    if (!load_log(file, log)) {
+      std::cerr << "skipped (not a LOG_WALL log): " << file << std::endl;
+      continue;
+    }
+    label_log(*wd, log, u0);
+    logs.push_back(log);
+    u0s.push_back(u0);
+  }
+  for (const auto& noise : noises) {
+    if (logs.empty()) break;
+    std::mt19937 rng(1);
+    Count count;
+    for (int r = 0; r < repeats; ++r)
+      for (size_t i = 0; i < logs.size(); ++i)
+        replay(*wd, logs[i], u0s[i], noise, rng, count);
+    count.print("log", noise.name);
+    if (noise.reflector_dropout > 0 &&
+        count.sum(count.evidence) > count.sum(count.legacy))
+      failures++;
+  }
+  std::fflush(stdout);
+  /* タスクは終わらないので後始末をせずに終了する */
+  std::_Exit(failures ? EXIT_FAILURE : EXIT_SUCCESS);
+}
@@ -0,0 +1,314 @@
+/**
+ * @file wall_cut.cpp
+ * @brief Host Test of the Wall Edge Position Correction
+ * @author Ryotaro Onuki <kerikun11+github@gmail.com>
+ * @date 2024-02-04
+ * @copyright Copyright 2024 Ryotaro Onuki <kerikun11+github@gmail.com>
+ */
+/*
+ * utils::WallEdgeDetector による壁の切れ目の検出と，MoveAction::side_wall_cut()
+ * と同じ前後方向の位置の補正を確かめる．
+ *
+ * - シミュレータ: 横壁をランダムに置いた 16 区画の直線を一定の速さで進む．
+ *   オドメトリが正確な走行で切れ目の位置 (wall_cut_offset) を較正し，
+ *   オドメトリの距離に倍率の誤差を入れた走行で，終点の前後方向の誤差を
+ *   補正の有無で比べる．
+ * - ログ: tools/wall/data の LOG_WALL のログの横のリフレクタとオドメトリで
+ *   切れ目を探し，走行ごとに柱の格子からのずれのばらつきを測る．
+ *   走り始めの位置は走行ごとに違うので，格子の位相は走行ごとに合わせる．
+ *   柱の間隔は区画に沿う走行と斜めの走行のうち合う方とする．
+ *
+ * シミュレータで補正した方が誤差が大きい条件があれば失敗で終了する．
+ */
+#include <algorithm>  //< for std::sort, std::nth_element
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>  //< for std::_Exit, std::atoi
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "peripheral/partition.h"
+#include "sim/world.hpp"
+#include "supporters/supporters.h"
+#include "utils/wall_edge_detector.hpp"
+
+namespace {
+
+constexpr float kCell = sim::Field::kCell;
+constexpr int kCells = 16;           //< 直線の区画数
+constexpr float kCutAlpha = 0.5f;    //< 補正の割合 (MoveAction と同じ)
+constexpr float kCutTolerance = 15;  //< 補正する誤差の上限 [mm]
+
+float median(std::vector<float> v) {
+  if (v.empty()) return NAN;
+  std::nth_element(v.begin(), v.begin() + v.size() / 2, v.end());
+  return v[v.size() / 2];
+}
+
+/* 結果の集計 */
+struct Stat {
+  std::vector<float> values;
+
+  void push(const float v) { values.push_back(v); }
+  float rms() const {
+    double sum2 = 0;
+    for (const auto v : values) sum2 += v * v;
+    return values.empty() ? 0 : std::sqrt(sum2 / values.size());
+  }
+  float max() const {
+    float m = 0;
+    for (const auto v : values) m = std::max(m, std::abs(v));
+    return m;
+  }
+};
+
+/**
+ * @brief シミュレータ: 列 1 を北へ区画 0 の中央から直進する
+ *
+ * 前後方向の座標 s は区画の境界が kCell の倍数になるようにとる (s = y)．
+ *
+ * @param scale オドメトリの距離の倍率 (1: 正確)
+ * @param cut_offset 補正に使う切れ目の位置 (NAN: 補正しない)
+ * @param residuals 切れ目の格子からのずれ (真の位置) を足していく
+ * @return 終点での推定位置の誤差 [mm]
+ */
+float simulate(WallDetector* wd, std::mt19937& rng, const float v,
+               const float scale, const float cut_offset,
+               std::vector<float>& residuals) {
+  auto& world = sim::world();
+  std::uniform_real_distribution<float> uniform(0, 1);
+  sim::Field field(kCells);
+  for (int y = 0; y < kCells; ++y) {
+    field.set_wall(1, y, sim::Field::West, uniform(rng) < 0.5f);
+    field.set_wall(1, y, sim::Field::East, uniform(rng) < 0.5f);
+  }
+  world.set_field(field);
+  const float cx = kCell * 3 / 2;
+  const float dx = 4 * (uniform(rng) - 0.5f);  //< 横位置のずれ
+  std::array<utils::WallEdgeDetector, 2> detectors;
+  const float s_start = kCell / 2, s_end = kCell * (kCells - 1);
+  float x_est = s_start;
+  for (float y = s_start; y < s_end; y += v * 1e-3f) {
+    world.set_pose(cx + dx, y, M_PI / 2);
+    vTaskDelay(pdMS_TO_TICKS(1));
+    wd->update();
+    for (int i = 0; i < 2; ++i) {
+      if (!detectors[i].push(wd->getWallDistanceSide(i), x_est)) continue;
+      /* 切れ目での真の位置 (推定位置の誤差を除く) */
+      const float x_true = y - (x_est - detectors[i].edge()) / scale;
+      residuals.push_back(
+          -utils::WallEdgeDetector::cell_error(x_true, 0, kCell));
+      if (std::isnan(cut_offset)) continue;
+      const float x_fix = utils::WallEdgeDetector::cell_error(
+          detectors[i].edge(), cut_offset, kCell);
+      if (std::abs(x_fix) < kCutTolerance) x_est += kCutAlpha * x_fix;
+    }
+    x_est += v * 1e-3f * scale;
+  }
+  return x_est - s_end;
+}
+
+/* ログの 1 回の走行 */
+struct Log {
+  std::string robot;
+  std::vector<std::array<int16_t, 2>> raw;  //< [SL, SR]
+  std::vector<float> x;                     //< オドメトリの位置 [mm]
+};
+
+bool load_log(const std::string& file, Log& log) {
+  std::ifstream ifs(file);
+  if (!ifs) return false;
+  std::vector<std::string> names;
+  std::vector<std::vector<float>> rows;
+  for (std::string line; std::getline(ifs, line);) {
+    if (line.empty() || line[0] == '#') continue;
+    std::istringstream iss(line);
+    if (names.empty()) {
+      for (std::string s; std::getline(iss, s, '\t');) names.push_back(s);
+      continue;
+    }
+    std::vector<float> row;
+    for (std::string s; std::getline(iss, s, '\t');)
+      row.push_back(std::stof(s));
+    if (row.size() == names.size()) rows.push_back(row);
+  }
+  auto column = [&](const char* name) {
+    return int(std::find(names.begin(), names.end(), name) - names.begin());
+  };
+  const int n = names.size();
+  const int sl = column("ref_0"), sr = column("ref_3"), x = column("est_q.x");
+  if (sl >= n || sr >= n || x >= n || rows.size() < 100) return false;
+  for (const auto& r : rows) {
+    log.raw.push_back({int16_t(r[sl]), int16_t(r[sr])});
+    log.x.push_back(r[x]);
+  }
+  const auto p = file.rfind('/'), q = file.rfind('/', p - 1);
+  const auto r = q == std::string::npos ? q : file.rfind('/', q - 1);
+  log.robot = file.substr(r == std::string::npos ? 0 : r + 1, q - r - 1);
+  return true;
+}
+
+/**
+ * @brief ログの切れ目の位置 (走り始めからの距離) を集める
+ *
+ * 横の距離は走り始めの静止中を 0 とする．走り始めに壁のない
+ * (反射の小さい) チャンネルは較正できないので使わない．
+ */
+void replay(const WallDetector& wd, const Log& log,
+            std::vector<float>& edges) {
+  const int rest = 50;
+  for (int i = 0; i < 2; ++i) {
+    std::vector<float> u, raw;
+    for (int t = 0; t < rest; ++t) {
+      u.push_back(wd.ref2dist(log.raw[t][i]));
+      raw.push_back(log.raw[t][i]);
+    }
+    if (median(raw) < 100) continue;
+    const float u0 = median(u);
+    utils::WallEdgeDetector detector;
+    for (size_t t = 0; t < log.raw.size(); ++t)
+      if (detector.push(wd.ref2dist(log.raw[t][i]) - u0, log.x[t]))
+        edges.push_back(detector.edge());
+  }
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  /* 引数 */
+  int trials = 50;
+  float scale = 1.02f;
+  std::string ref_max_length = "90", ref_saturation = "3600";
+  std::vector<std::string> files;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const bool has_value = i + 1 < argc;
+    if (arg == "--trials" && has_value) {
+      trials = std::atoi(argv[++i]);
+    } else if (arg == "--scale" && has_value) {
+      scale = std::atof(argv[++i]);
+    } else if (arg == "--ref-max-length" && has_value) {
+      ref_max_length = argv[++i];
+    } else if (arg == "--ref-saturation" && has_value) {
+      ref_saturation = argv[++i];
+    } else if (arg.rfind("--", 0) == 0) {
+      std::cerr << "usage: " << argv[0] << " [wall_log.csv...]"
+                << " [--trials n --scale ratio"
+                << " --ref-max-length mm --ref-saturation value]" << std::endl;
+      return EXIT_FAILURE;
+    } else {
+      files.push_back(arg);
+    }
+  }
+  /* 機体 (シミュレータのリフレクタに合わせ，update() を直接呼ぶ) */
+  config::parameter_store().set("ref_max_length_mm", ref_max_length);
+  config::parameter_store().set("ref_saturation_value", ref_saturation);
+  peripheral::record_store().mount();
+  auto* hw = new hardware::Hardware();
+  hw->init();
+  auto* sp = new supporters::Supporters(hw);
+  auto* wd = sp->wd;
+  auto& world = sim::world();
+  {
+    /* 両側に壁のある区画の中央で較正する */
+    sim::Field field(3);
+    for (int y = 0; y < 3; ++y) {
+      field.set_wall(1, y, sim::Field::West, true);
+      field.set_wall(1, y, sim::Field::East, true);
+    }
+    world.set_field(field);
+    world.set_pose(kCell * 3 / 2, kCell * 3 / 2, M_PI / 2);
+    wd->calibration_side();
+  }
+  int failures = 0;
+  /* シミュレータ: 探索の速さで切れ目の位置を較正する */
+  float cut_offset;
+  {
+    std::mt19937 rng(1);
+    std::vector<float> residuals;
+    for (int i = 0; i < trials; ++i)
+      simulate(wd, rng, 330, 1, NAN, residuals);
+    cut_offset = median(residuals);
+    std::printf("calibration\tsim\tedges: %d\twall_cut_offset: %.2f [mm]\n",
+                int(residuals.size()), cut_offset);
+  }
+  struct Condition {
+    const char* name;
+    float v;
+    float reflector_noise;
+    float reflector_dropout;
+  };
+  const Condition conditions[] = {
+      {"nominal", 330, 0.02f, 0},      {"nominal", 1000, 0.02f, 0},
+      {"nominal", 2000, 0.02f, 0},     {"noisy", 330, 0.1f, 0.02f},
+      {"noisy", 1000, 0.1f, 0.02f},    {"noisy", 2000, 0.1f, 0.02f},
+  };
+  std::printf("source\tcondition\tv [mm/s]\tedges\tedge rms [mm]\t"
+              "edge max [mm]\tend rms (none) [mm]\tend rms (cut) [mm]\t"
+              "end max (cut) [mm]\n");
+  for (const auto& c : conditions) {
+    auto p = world.get_parameter();
+    p.reflector_noise = c.reflector_noise;
+    p.reflector_dropout = c.reflector_dropout;
+    world.set_parameter(p);
+    Stat edge, none, cut;
+    std::vector<float> residuals, dummy;
+    std::mt19937 rng_none(2), rng_cut(2);
+    for (int i = 0; i < trials; ++i) {
+      none.push(simulate(wd, rng_none, c.v, scale, NAN, dummy));
+      cut.push(simulate(wd, rng_cut, c.v, scale, cut_offset, residuals));
+    }
+    for (const auto r : residuals) edge.push(r - cut_offset);
+    std::printf("sim\t%s\t%.0f\t%d\t%.2f\t%.2f\t%.2f\t%.2f\t%.2f\n", c.name,
+                c.v, int(residuals.size()), edge.rms(), edge.max(),
+                none.rms(), cut.rms(), cut.max());
+    failures += cut.rms() >= none.rms();
+  }
+  /* ログ: 走行ごとの切れ目の格子からのずれ (機体ごとにまとめる) */
+  std::map<std::string, std::vector<std::vector<float>>> robots;
+  for (const auto& file : files) {
+    Log log;
+    if (!load_log(file, log)) {
+      std::cerr << "skipped (not a LOG_WALL log): " << file << std::endl;
+      continue;
+    }
+    robots[log.robot].emplace_back();
+    replay(*wd, log, robots[log.robot].back());
+  }
+  for (const auto& robot : robots) {
+    /* 柱の間隔は区画に沿う走行で kCell，斜めの走行で kCell * sqrt(2) */
+    const float pitches[2] = {kCell, kCell * float(M_SQRT2)};
+    Stat stats[2];
+    for (const auto& edges : robot.second) {
+      if (edges.size() < 2) continue;
+      std::vector<float> residuals[2];
+      Stat run[2];
+      for (int k = 0; k < 2; ++k) {
+        for (const auto x : edges)
+          residuals[k].push_back(
+              -utils::WallEdgeDetector::cell_error(x, 0, pitches[k]));
+        const float offset = median(residuals[k]);
+        for (const auto r : residuals[k])
+          run[k].push(
+              utils::WallEdgeDetector::cell_error(r, offset, pitches[k]));
+      }
+      const int k = run[0].rms() <= run[1].rms() ? 0 : 1;
+      for (const auto v : run[k].values) stats[k].push(v);
+    }
+    for (int k = 0; k < 2; ++k)
+      if (!stats[k].values.empty())
+        std::printf("log\t%s\t%s\tedges: %d\tedge rms: %.2f [mm]\t"
+                    "edge max: %.2f [mm]\n",
+                    robot.first.c_str(), k ? "diag" : "along",
+                    int(stats[k].values.size()), stats[k].rms(),
+                    stats[k].max());
+  }
+  std::fflush(stdout);
+  /* タスクは終わらないので後始末をせずに終了する */
+  std::_Exit(failures ? EXIT_FAILURE : EXIT_SUCCESS);
+}
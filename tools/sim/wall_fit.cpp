@@ -0,0 +1,285 @@
+/**
+ * @file wall_fit.cpp
+ * @brief Host Test of the Multi-Point Wall Distance Calibration
+ * @author Ryotaro Onuki <kerikun11+github@gmail.com>
+ * @date 2024-02-04
+ * @copyright Copyright 2024 Ryotaro Onuki <kerikun11+github@gmail.com>
+ *
+ * WallDetector の掃引による較正 (calibration_sweep_*) と
+ * utils::MonotoneCurve の当てはめを，従来の 1 点の較正と比べる．
+ *
+ * - 横壁: シミュレータの通路で Machine::wall_sweep_calibration() と同じ
+ *   横位置で標本をとる (機体は動かさず，姿勢を置いていく)．
+ *   評価は標本をとらなかった横位置も含む．
+ * - 前壁: tools/wall/data の LOG_WALL のログ (前壁に向かって止まる走行) で
+ *   交差検証する．真の距離は止まったあとの ToF にエンコーダの移動量を足した
+ *   値とし，機体ごとに 1 回の走行を除いて当てはめ，除いた走行で誤差を測る．
+ *
+ * 横壁の当てはめに失敗するか，1 点の較正より悪ければ失敗で終了する．
+ */
+#include <algorithm>  //< for std::sort, std::max
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>  //< for std::_Exit, std::atof
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "peripheral/partition.h"
+#include "sim/world.hpp"
+#include "supporters/supporters.h"
+#include "utils/monotone_curve.hpp"
+
+namespace {
+
+using Curve = utils::MonotoneCurve;
+
+/* 誤差の集計 */
+struct Error {
+  double sum2 = 0;
+  float max = 0;
+  int count = 0;
+
+  void push(const float e) {
+    sum2 += e * e;
+    max = std::max(max, std::abs(e));
+    count++;
+  }
+  float rms() const { return count ? std::sqrt(sum2 / count) : 0; }
+};
+
+/**
+ * @brief 横壁: 通路の中央から横位置を y_step ずつ変えて止まり，標本をとる
+ */
+void sweep_side(WallDetector* wd, const float cx, const float cy,
+                const float y_step, const float y_max) {
+  auto& world = sim::world();
+  wd->calibration_sweep_begin();
+  for (float y = -y_max; y <= y_max + y_step / 2; y += y_step) {
+    world.set_pose(cx - y, cy, M_PI / 2);  //< 北向きの機体の左は西
+    for (int i = 0; i < 200; ++i) {
+      vTaskDelay(pdMS_TO_TICKS(1));
+      WallDetector::WallValue truth;
+      truth.side = {-y, y};
+      wd->calibration_sweep_push(truth, WallDetector::SWEEP_SIDE);
+    }
+  }
+}
+
+/**
+ * @brief 横壁: 通路を正面に向けて横位置を変えたときの距離の誤差
+ */
+Error evaluate_side(WallDetector* wd, const float cx, const float cy) {
+  auto& world = sim::world();
+  Error error;
+  for (float y = -15; y <= 15; y += 1) {
+    world.set_pose(cx - y, cy, M_PI / 2);
+    for (int i = 0; i < 20; ++i) {
+      vTaskDelay(pdMS_TO_TICKS(1));
+      wd->update();
+      error.push(wd->getWallDistanceSide(0) - (-y));
+      error.push(wd->getWallDistanceSide(1) - y);
+    }
+  }
+  return error;
+}
+
+/* 前壁: 1 回の走行の標本 (ref2dist() の値と真の距離) */
+struct Run {
+  std::string robot;
+  std::string file;
+  std::vector<Curve::Point> points[2];  //< [FL, FR]
+  float rest_u[2] = {NAN, NAN};         //< 止まったときの ref2dist() の平均
+  float rest_truth = NAN;               //< 止まったときの真の距離
+};
+
+/**
+ * @brief LOG_WALL のログを読む
+ *
+ * @param near 止まった位置から何 mm 手前までを使うか
+ */
+bool load_run(const std::string& file, const WallDetector& wd,
+              const float near, Run& run) {
+  std::ifstream ifs(file);
+  if (!ifs) return false;
+  std::vector<std::string> names;
+  std::vector<std::vector<float>> rows;
+  for (std::string line; std::getline(ifs, line);) {
+    if (line.empty() || line[0] == '#') continue;
+    std::istringstream iss(line);
+    if (names.empty()) {
+      for (std::string s; std::getline(iss, s, '\t');) names.push_back(s);
+      continue;
+    }
+    std::vector<float> row;
+    for (std::string s; std::getline(iss, s, '\t');)
+      row.push_back(std::stof(s));
+    if (row.size() == names.size()) rows.push_back(row);
+  }
+  auto column = [&](const char* name) {
+    return int(std::find(names.begin(), names.end(), name) - names.begin());
+  };
+  const int v = column("est_v.tra"), x = column("est_q.x");
+  const int tof = column("tof"), fl = column("ref_1"), fr = column("ref_2");
+  const int n = names.size();
+  if (v >= n || x >= n || tof >= n || fl >= n || fr >= n) return false;
+  /* 止まったあとの位置と ToF (中央値) */
+  const int rest = 50;
+  if (int(rows.size()) < rest) return false;
+  std::vector<float> xs, tofs;
+  for (int i = rows.size() - rest; i < int(rows.size()); ++i) {
+    if (std::abs(rows[i][v]) > 30) return false;  //< 止まっていない
+    xs.push_back(rows[i][x]), tofs.push_back(rows[i][tof]);
+  }
+  std::sort(xs.begin(), xs.end()), std::sort(tofs.begin(), tofs.end());
+  const float x_rest = xs[rest / 2], tof_rest = tofs[rest / 2];
+  run.rest_truth = tof_rest;
+  for (int c = 0; c < 2; ++c) {
+    float sum = 0;
+    int count = 0;
+    for (int i = rows.size() - rest; i < int(rows.size()); ++i) {
+      const int16_t raw = rows[i][c ? fr : fl];
+      if (raw > 1) sum += wd.ref2dist(raw), count++;
+    }
+    if (count) run.rest_u[c] = sum / count;
+  }
+  /* 真の距離 = 止まったときの ToF + 止まるまでの移動量 */
+  for (const auto& r : rows) {
+    const float truth = tof_rest + x_rest - r[x];
+    if (truth > tof_rest + near) continue;
+    for (int c = 0; c < 2; ++c) {
+      const int16_t raw = r[c ? fr : fl];
+      if (raw <= 1) continue;  //< 反射なし (読み取りの下限)
+      run.points[c].push_back({wd.ref2dist(raw), truth, 1});
+    }
+  }
+  const auto p = file.rfind('/'), q = file.rfind('/', p - 1);
+  const auto r = q == std::string::npos ? q : file.rfind('/', q - 1);
+  run.robot = file.substr(r == std::string::npos ? 0 : r + 1, q - r - 1);
+  run.file = file;
+  return true;
+}
+
+/**
+ * @brief 前壁: 機体ごとに 1 回の走行を除いて当てはめ，除いた走行で評価する
+ *
+ * 実機と同じく，どちらも除いた走行の止まった位置で 1 点の較正をする
+ * (calibration_front())．1 点の較正は傾き 1 の直線，掃引の較正は
+ * 他の走行で当てはめた曲線をその点に合わせてずらしたもの．
+ * 走行ごとの ToF の誤差は真の距離に含まれ，どちらの誤差にも同じく入る．
+ * ログは較正のための掃引ではない (遠くでは柱が見える) ので，結果は表示だけ．
+ */
+void cross_validate(const std::vector<Run>& runs) {
+  std::map<std::string, std::vector<const Run*>> robots;
+  for (const auto& r : runs) robots[r.robot].push_back(&r);
+  for (const auto& robot : robots) {
+    for (int c = 0; c < 2; ++c) {
+      Error e_single, e_curve;
+      int folds = 0;
+      for (const auto* test : robot.second) {
+        if (test->points[c].size() < 10 || std::isnan(test->rest_u[c]))
+          continue;
+        std::vector<Curve::Point> train;
+        for (const auto* r : robot.second)
+          if (r != test)
+            train.insert(train.end(), r->points[c].begin(),
+                         r->points[c].end());
+        Curve curve;
+        if (train.size() < 10 || !Curve::fit(train, curve)) continue;
+        const float offset = test->rest_truth - test->rest_u[c];
+        curve.shift(test->rest_truth - curve(test->rest_u[c]));
+        for (const auto& p : test->points[c]) {
+          e_single.push(p.x + offset - p.y);
+          e_curve.push(curve(p.x) - p.y);
+        }
+        folds++;
+      }
+      if (!folds) continue;
+      std::printf("front\t%s\t%s\t%d\t%d\t%.2f\t%.2f\t%.2f\t%.2f\n",
+                  robot.first.c_str(), c ? "FR" : "FL", folds,
+                  e_curve.count, e_single.rms(), e_single.max, e_curve.rms(),
+                  e_curve.max);
+    }
+  }
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  /* 引数 */
+  float y_step = 2.5f;
+  float y_max = 15;
+  float near = 30;
+  std::string ref_max_length = "90", ref_saturation = "3600";
+  std::vector<std::string> files;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const bool has_value = i + 1 < argc;
+    if (arg == "--y-step" && has_value) {
+      y_step = std::atof(argv[++i]);
+    } else if (arg == "--y-max" && has_value) {
+      y_max = std::atof(argv[++i]);
+    } else if (arg == "--near" && has_value) {
+      near = std::atof(argv[++i]);
+    } else if (arg == "--ref-max-length" && has_value) {
+      ref_max_length = argv[++i];
+    } else if (arg == "--ref-saturation" && has_value) {
+      ref_saturation = argv[++i];
+    } else if (arg.rfind("--", 0) == 0) {
+      std::cerr << "usage: " << argv[0] << " [wall_log.csv...]"
+                << " [--y-step mm --y-max mm --near mm"
+                << " --ref-max-length mm --ref-saturation value]" << std::endl;
+      return EXIT_FAILURE;
+    } else {
+      files.push_back(arg);
+    }
+  }
+  /* 機体 (タスクは動かさず，update() を直接呼ぶ) */
+  peripheral::record_store().mount();
+  auto* hw = new hardware::Hardware();
+  hw->init();
+  auto* sp = new supporters::Supporters(hw);
+  auto* wd = sp->wd;
+  int failures = 0;
+  std::printf("wall\tsource\tch\tfolds\tsamples\t"
+              "single rms [mm]\tsingle max [mm]\t"
+              "curve rms [mm]\tcurve max [mm]\n");
+  /* 横壁: 3 区画の通路の中央 */
+  {
+    auto& world = sim::world();
+    sim::Field field(3);
+    for (int y = 0; y < 3; ++y) field.set_wall(0, y, sim::Field::East, true);
+    world.set_field(field);
+    const float cx = sim::Field::kCell / 2, cy = sim::Field::kCell * 3 / 2;
+    world.set_pose(cx, cy, M_PI / 2);
+    wd->calibration_side();
+    const Error single = evaluate_side(wd, cx, cy);
+    sweep_side(wd, cx, cy, y_step, y_max);
+    if (!wd->calibration_sweep_end(WallDetector::SWEEP_SIDE)) failures++;
+    const Error curve = evaluate_side(wd, cx, cy);
+    std::printf("side\tsim\tSL+SR\t1\t%d\t%.2f\t%.2f\t%.2f\t%.2f\n",
+                curve.count, single.rms(), single.max, curve.rms(),
+                curve.max);
+    failures += curve.rms() > single.rms();
+  }
+  /* 前壁: ログ (機体のパラメータに合わせる) */
+  config::parameter_store().set("ref_max_length_mm", ref_max_length);
+  config::parameter_store().set("ref_saturation_value", ref_saturation);
+  std::vector<Run> runs;
+  for (const auto& file : files) {
+    Run run;
+    if (!load_run(file, *wd, near, run)) {
+      std::cerr << "skipped (not a stopping LOG_WALL log): " << file
+                << std::endl;
+      continue;
+    }
+    runs.push_back(run);
+  }
+  cross_validate(runs);
+  std::fflush(stdout);
+  /* タスクは終わらないので後始末をせずに終了する */
+  std::_Exit(failures ? EXIT_FAILURE : EXIT_SUCCESS);
+}